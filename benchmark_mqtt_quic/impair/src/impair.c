@@ -0,0 +1,584 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "impair.h"
+
+#define IMPAIR_BUF_SIZE     65536
+#define IMPAIR_SOCK_BUF     (4*1024*1024)
+
+struct impair_tcp {
+    struct impair_tcp *next;
+    int fd[2];              /* 0 towards the client, 1 towards the broker. */
+    uint64_t last_due[2];   /* Keeps each direction of the stream in order. */
+    bool closing;           /* A close is queued, stop reading. */
+};
+
+struct impair_udp {
+    struct impair_udp *next;
+    struct sockaddr_storage client;
+    socklen_t client_len;
+    int fd;                 /* Connected to the broker. */
+};
+
+/* A chunk or datagram waiting for its delivery time. */
+struct impair_item {
+    struct impair_item *next;
+    uint64_t due;           /* CLOCK_MONOTONIC, microseconds. */
+    struct impair_tcp *tcp;
+    struct impair_udp *udp;
+    int dir;                /* tcp: fd[dir] is written, udp: 0 is the client. */
+    size_t len;             /* 0 for tcp means close the connection. */
+    uint8_t data[];
+};
+
+struct impair_proxy {
+    struct impair_config cfg;
+    pthread_t thread;
+    pthread_mutex_t lock;   /* Protects stats. */
+    struct impair_stats stats;
+    int tcp_listen;
+    int udp_listen;
+    int wake[2];
+    struct sockaddr_storage upstream_tcp;
+    socklen_t upstream_tcp_len;
+    struct sockaddr_storage upstream_udp;
+    socklen_t upstream_udp_len;
+    struct impair_tcp *tcps;
+    struct impair_udp *udps;
+    struct impair_item *queue;
+    struct impair_item *queue_last;
+    unsigned int rand_state;
+    uint8_t buf[IMPAIR_BUF_SIZE];
+};
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + (uint64_t)ts.tv_nsec/1000;
+}
+
+static double random_unit(struct impair_proxy *proxy)
+{
+    return (double)rand_r(&proxy->rand_state) / ((double)RAND_MAX + 1.0);
+}
+
+static void stats_add(struct impair_proxy *proxy, uint64_t *counter)
+{
+    pthread_mutex_lock(&proxy->lock);
+    (*counter)++;
+    pthread_mutex_unlock(&proxy->lock);
+}
+
+static int resolve(const char *host, int port, int socktype, struct sockaddr_storage *addr, socklen_t *len)
+{
+    struct addrinfo hints, *ai;
+    char service[16];
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    snprintf(service, sizeof(service), "%d", port);
+    rc = getaddrinfo(host, service, &hints, &ai);
+    if (rc) {
+        fprintf(stderr, "impair: unable to resolve %s: %s\n", host, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+    *len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static int listen_socket(const char *host, int port, int socktype)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int fd, opt = 1, size = IMPAIR_SOCK_BUF;
+
+    if (resolve(host, port, socktype, &addr, &len)) {
+        return -1;
+    }
+    fd = socket(addr.ss_family, socktype, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (socktype == SOCK_DGRAM) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    if (bind(fd, (struct sockaddr *)&addr, len)
+            || (socktype == SOCK_STREAM && listen(fd, 64))) {
+        fprintf(stderr, "impair: unable to listen on %s:%d: %s\n", host, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static void queue_insert(struct impair_proxy *proxy, struct impair_item *item)
+{
+    struct impair_item **prev;
+
+    item->next = NULL;
+    /* Nearly everything is due after what is already queued. */
+    if (proxy->queue_last == NULL || proxy->queue_last->due <= item->due) {
+        if (proxy->queue_last) {
+            proxy->queue_last->next = item;
+        } else {
+            proxy->queue = item;
+        }
+        proxy->queue_last = item;
+        return;
+    }
+    for (prev = &proxy->queue; *prev && (*prev)->due <= item->due; prev = &(*prev)->next);
+    item->next = *prev;
+    *prev = item;
+}
+
+/* Base delay plus uniform jitter either side, never negative. */
+static uint64_t link_delay(struct impair_proxy *proxy)
+{
+    int64_t delay = (int64_t)proxy->cfg.delay_ms*1000;
+
+    if (proxy->cfg.jitter_ms > 0) {
+        delay += (int64_t)((random_unit(proxy)*2.0 - 1.0) * proxy->cfg.jitter_ms * 1000.0);
+    }
+    return delay > 0 ? (uint64_t)delay : 0;
+}
+
+static struct impair_item *item_new(const void *data, size_t len)
+{
+    struct impair_item *item;
+
+    item = calloc(1, sizeof(struct impair_item) + len);
+    if (item && len) {
+        memcpy(item->data, data, len);
+        item->len = len;
+    }
+    return item;
+}
+
+static void queue_tcp(struct impair_proxy *proxy, struct impair_tcp *tcp, int dir, const void *data, size_t len)
+{
+    struct impair_item *item;
+    uint64_t due;
+
+    item = item_new(data, len);
+    if (!item) {
+        return;
+    }
+    item->tcp = tcp;
+    item->dir = dir;
+    due = now_us() + link_delay(proxy);
+    if (len && random_unit(proxy) < proxy->cfg.loss) {
+        due += (uint64_t)proxy->cfg.tcp_rto_ms*1000;
+        stats_add(proxy, &proxy->stats.stalled);
+    }
+    /* In order: nothing overtakes a stalled chunk. */
+    if (due < tcp->last_due[dir]) {
+        due = tcp->last_due[dir];
+    }
+    tcp->last_due[dir] = due;
+    item->due = due;
+    queue_insert(proxy, item);
+}
+
+static void queue_udp(struct impair_proxy *proxy, struct impair_udp *udp, int dir, const void *data, size_t len)
+{
+    struct impair_item *item;
+    uint64_t delay;
+
+    if (random_unit(proxy) < proxy->cfg.loss) {
+        stats_add(proxy, &proxy->stats.dropped);
+        return;
+    }
+    item = item_new(data, len);
+    if (!item) {
+        return;
+    }
+    item->udp = udp;
+    item->dir = dir;
+    delay = link_delay(proxy);
+    if (random_unit(proxy) < proxy->cfg.reorder) {
+        delay += (uint64_t)(proxy->cfg.delay_ms > 0 ? proxy->cfg.delay_ms : 1)*1000;
+        stats_add(proxy, &proxy->stats.reordered);
+    }
+    item->due = now_us() + delay;
+    queue_insert(proxy, item);
+}
+
+static void tcp_close(struct impair_proxy *proxy, struct impair_tcp *tcp)
+{
+    struct impair_item **prev, *item;
+    struct impair_tcp **tprev;
+
+    prev = &proxy->queue;
+    proxy->queue_last = NULL;
+    while (*prev) {
+        item = *prev;
+        if (item->tcp == tcp) {
+            *prev = item->next;
+            free(item);
+        } else {
+            proxy->queue_last = item;
+            prev = &item->next;
+        }
+    }
+    for (tprev = &proxy->tcps; *tprev; tprev = &(*tprev)->next) {
+        if (*tprev == tcp) {
+            *tprev = tcp->next;
+            break;
+        }
+    }
+    close(tcp->fd[0]);
+    close(tcp->fd[1]);
+    free(tcp);
+}
+
+static void tcp_accept(struct impair_proxy *proxy)
+{
+    struct impair_tcp *tcp;
+    int fd, up, opt = 1;
+
+    fd = accept(proxy->tcp_listen, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    up = socket(proxy->upstream_tcp.ss_family, SOCK_STREAM, 0);
+    if (up < 0 || connect(up, (struct sockaddr *)&proxy->upstream_tcp, proxy->upstream_tcp_len)) {
+        fprintf(stderr, "impair: unable to connect to broker: %s\n", strerror(errno));
+        if (up >= 0) close(up);
+        close(fd);
+        return;
+    }
+    tcp = calloc(1, sizeof(struct impair_tcp));
+    if (!tcp) {
+        close(up);
+        close(fd);
+        return;
+    }
+    /* The proxy must not add Nagle delays of its own. */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    setsockopt(up, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    tcp->fd[0] = fd;
+    tcp->fd[1] = up;
+    tcp->next = proxy->tcps;
+    proxy->tcps = tcp;
+}
+
+static void tcp_read(struct impair_proxy *proxy, struct impair_tcp *tcp, int from)
+{
+    ssize_t len;
+
+    len = recv(tcp->fd[from], proxy->buf, sizeof(proxy->buf), 0);
+    if (len > 0) {
+        queue_tcp(proxy, tcp, 1-from, proxy->buf, (size_t)len);
+    } else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+        /* Close once what is already on its way has been delivered. */
+        tcp->closing = true;
+        queue_tcp(proxy, tcp, 1-from, NULL, 0);
+    }
+}
+
+static void udp_from_client(struct impair_proxy *proxy)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    struct impair_udp *udp;
+    ssize_t len;
+    int size = IMPAIR_SOCK_BUF;
+
+    while (1) {
+        addr_len = sizeof(addr);
+        len = recvfrom(proxy->udp_listen, proxy->buf, sizeof(proxy->buf), 0, (struct sockaddr *)&addr, &addr_len);
+        if (len < 0) {
+            return;
+        }
+        for (udp = proxy->udps; udp; udp = udp->next) {
+            if (udp->client_len == addr_len && !memcmp(&udp->client, &addr, addr_len)) {
+                break;
+            }
+        }
+        if (!udp) {
+            /* Each client gets its own socket towards the broker, so the
+             * broker sees one address per client, as it would without us. */
+            udp = calloc(1, sizeof(struct impair_udp));
+            if (!udp) {
+                continue;
+            }
+            udp->fd = socket(proxy->upstream_udp.ss_family, SOCK_DGRAM, 0);
+            if (udp->fd < 0 || connect(udp->fd, (struct sockaddr *)&proxy->upstream_udp, proxy->upstream_udp_len)) {
+                if (udp->fd >= 0) close(udp->fd);
+                free(udp);
+                continue;
+            }
+            setsockopt(udp->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            setsockopt(udp->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            fcntl(udp->fd, F_SETFL, fcntl(udp->fd, F_GETFL, 0) | O_NONBLOCK);
+            memcpy(&udp->client, &addr, addr_len);
+            udp->client_len = addr_len;
+            udp->next = proxy->udps;
+            proxy->udps = udp;
+        }
+        queue_udp(proxy, udp, 1, proxy->buf, (size_t)len);
+    }
+}
+
+static void udp_from_broker(struct impair_proxy *proxy, struct impair_udp *udp)
+{
+    ssize_t len;
+
+    while ((len = recv(udp->fd, proxy->buf, sizeof(proxy->buf), 0)) >= 0) {
+        queue_udp(proxy, udp, 0, proxy->buf, (size_t)len);
+    }
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+    struct pollfd pfd;
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void deliver_due(struct impair_proxy *proxy)
+{
+    struct impair_item *item;
+    uint64_t now = now_us();
+
+    while (proxy->queue && proxy->queue->due <= now) {
+        item = proxy->queue;
+        proxy->queue = item->next;
+        if (proxy->queue == NULL) {
+            proxy->queue_last = NULL;
+        }
+        if (item->tcp) {
+            if (item->len == 0 || !write_all(item->tcp->fd[item->dir], item->data, item->len)) {
+                tcp_close(proxy, item->tcp);
+            } else {
+                stats_add(proxy, &proxy->stats.forwarded);
+            }
+        } else {
+            if (item->dir == 0) {
+                sendto(proxy->udp_listen, item->data, item->len, 0,
+                        (struct sockaddr *)&item->udp->client, item->udp->client_len);
+            } else {
+                send(item->udp->fd, item->data, item->len, 0);
+            }
+            stats_add(proxy, &proxy->stats.forwarded);
+        }
+        free(item);
+    }
+}
+
+/* Everything runs on this one thread, so only the stats need locking. */
+static void *proxy_thread(void *arg)
+{
+    struct impair_proxy *proxy = arg;
+    struct pollfd *pfds = NULL;
+    void **owners = NULL;
+    size_t cap = 0, count, i;
+    struct impair_tcp *tcp, *tcp_next;
+    struct impair_udp *udp;
+    int timeout;
+    uint64_t now;
+
+    while (1) {
+        count = 3;
+        for (tcp = proxy->tcps; tcp; tcp = tcp->next) count += 2;
+        for (udp = proxy->udps; udp; udp = udp->next) count++;
+        if (count > cap) {
+            cap = count*2;
+            pfds = realloc(pfds, cap*sizeof(struct pollfd));
+            owners = realloc(owners, cap*sizeof(void *));
+            if (!pfds || !owners) {
+                break;
+            }
+        }
+        pfds[0].fd = proxy->wake[0];
+        pfds[1].fd = proxy->tcp_listen;
+        pfds[2].fd = proxy->udp_listen;
+        count = 3;
+        for (udp = proxy->udps; udp; udp = udp->next) {
+            pfds[count].fd = udp->fd;
+            owners[count++] = udp;
+        }
+        for (tcp = proxy->tcps; tcp; tcp = tcp->next) {
+            /* Closing connections are not read, they only wait for their
+             * queued data. */
+            pfds[count].fd = tcp->closing ? -1 : tcp->fd[0];
+            owners[count++] = tcp;
+            pfds[count].fd = tcp->closing ? -1 : tcp->fd[1];
+            owners[count++] = tcp;
+        }
+        for (i = 0; i < count; i++) {
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+
+        timeout = -1;
+        if (proxy->queue) {
+            now = now_us();
+            timeout = proxy->queue->due > now ? (int)((proxy->queue->due - now + 999)/1000) : 0;
+        }
+        if (poll(pfds, count, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        if (pfds[0].revents) {
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            tcp_accept(proxy);
+        }
+        if (pfds[2].revents & POLLIN) {
+            udp_from_client(proxy);
+        }
+        for (i = 3; i < count; i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            udp = NULL;
+            for (udp = proxy->udps; udp && udp != owners[i]; udp = udp->next);
+            if (udp) {
+                udp_from_broker(proxy, udp);
+                continue;
+            }
+            /* A connection accepted above is not in owners, and one closed
+             * is no longer in the list. */
+            for (tcp = proxy->tcps; tcp && tcp != owners[i]; tcp = tcp->next);
+            if (tcp && !tcp->closing) {
+                tcp_read(proxy, tcp, pfds[i].fd == tcp->fd[0] ? 0 : 1);
+            }
+        }
+        deliver_due(proxy);
+    }
+
+    free(pfds);
+    free(owners);
+    for (tcp = proxy->tcps; tcp; tcp = tcp_next) {
+        tcp_next = tcp->next;
+        tcp_close(proxy, tcp);
+    }
+    return NULL;
+}
+
+void impair_config_init(struct impair_config *cfg)
+{
+    memset(cfg, 0, sizeof(struct impair_config));
+    cfg->listen_host = "127.0.0.1";
+    cfg->listen_port = 18830;
+    cfg->upstream_host = "127.0.0.1";
+    cfg->upstream_tcp_port = 1883;
+    cfg->upstream_udp_port = 1883;
+    cfg->seed = 1;
+}
+
+struct impair_proxy *impair_proxy_start(const struct impair_config *cfg)
+{
+    struct impair_proxy *proxy;
+
+    proxy = calloc(1, sizeof(struct impair_proxy));
+    if (!proxy) {
+        return NULL;
+    }
+    proxy->cfg = *cfg;
+    if (proxy->cfg.tcp_rto_ms <= 0) {
+        /* Linux's minimum RTO, plus the time for the loss to be noticed. */
+        proxy->cfg.tcp_rto_ms = 200 + 2*proxy->cfg.delay_ms;
+    }
+    proxy->rand_state = cfg->seed;
+    proxy->tcp_listen = -1;
+    proxy->udp_listen = -1;
+    proxy->wake[0] = -1;
+    proxy->wake[1] = -1;
+    pthread_mutex_init(&proxy->lock, NULL);
+
+    if (resolve(cfg->upstream_host, cfg->upstream_tcp_port, SOCK_STREAM, &proxy->upstream_tcp, &proxy->upstream_tcp_len)
+            || resolve(cfg->upstream_host, cfg->upstream_udp_port, SOCK_DGRAM, &proxy->upstream_udp, &proxy->upstream_udp_len)
+            || (proxy->tcp_listen = listen_socket(cfg->listen_host, cfg->listen_port, SOCK_STREAM)) < 0
+            || (proxy->udp_listen = listen_socket(cfg->listen_host, cfg->listen_port, SOCK_DGRAM)) < 0
+            || pipe(proxy->wake)
+            || pthread_create(&proxy->thread, NULL, proxy_thread, proxy)) {
+
+        if (proxy->tcp_listen >= 0) close(proxy->tcp_listen);
+        if (proxy->udp_listen >= 0) close(proxy->udp_listen);
+        if (proxy->wake[0] >= 0) close(proxy->wake[0]);
+        if (proxy->wake[1] >= 0) close(proxy->wake[1]);
+        pthread_mutex_destroy(&proxy->lock);
+        free(proxy);
+        return NULL;
+    }
+    return proxy;
+}
+
+void impair_proxy_stats(struct impair_proxy *proxy, struct impair_stats *stats)
+{
+    pthread_mutex_lock(&proxy->lock);
+    *stats = proxy->stats;
+    pthread_mutex_unlock(&proxy->lock);
+}
+
+void impair_proxy_stop(struct impair_proxy *proxy)
+{
+    struct impair_item *item;
+    struct impair_udp *udp;
+
+    if (!proxy) {
+        return;
+    }
+    if (write(proxy->wake[1], "x", 1) != 1) {
+        fprintf(stderr, "impair: unable to stop proxy thread\n");
+    }
+    pthread_join(proxy->thread, NULL);
+
+    while (proxy->queue) {
+        item = proxy->queue;
+        proxy->queue = item->next;
+        free(item);
+    }
+    while (proxy->udps) {
+        udp = proxy->udps;
+        proxy->udps = udp->next;
+        close(udp->fd);
+        free(udp);
+    }
+    close(proxy->tcp_listen);
+    close(proxy->udp_listen);
+    close(proxy->wake[0]);
+    close(proxy->wake[1]);
+    pthread_mutex_destroy(&proxy->lock);
+    free(proxy);
+}
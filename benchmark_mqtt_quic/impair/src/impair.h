@@ -0,0 +1,50 @@
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <stdint.h>
+
+/* Loopback proxy that makes a link look worse than it is, so that TCP and
+ * QUIC can be compared on the same emulated radio link without a radio.
+ *
+ * One port is listened on for both TCP and UDP. TCP connections are relayed
+ * to the broker's TCP port and UDP datagrams (QUIC) to its UDP port, each
+ * chunk or datagram being held back by delay +/- jitter.
+ *
+ * UDP datagrams are dropped with probability loss, and with probability
+ * reorder are held back for one extra delay so that later ones overtake
+ * them.
+ *
+ * A user space proxy cannot drop bytes from a TCP stream, so TCP loss is
+ * modelled by what the receiver would see: with probability loss a chunk,
+ * and everything after it, is stalled for tcp_rto_ms as if it had to be
+ * retransmitted. TCP delivers in order, so reorder does not apply to it. */
+
+struct impair_config {
+    const char *listen_host;
+    int listen_port;
+    const char *upstream_host;
+    int upstream_tcp_port;
+    int upstream_udp_port;
+    int delay_ms;
+    int jitter_ms;
+    double loss;        /* 0 to 1 */
+    double reorder;     /* 0 to 1, UDP only */
+    int tcp_rto_ms;     /* Stall for a "lost" TCP chunk, 0 for 200 + 2*delay. */
+    unsigned int seed;  /* Same seed, same impairments. */
+};
+
+struct impair_stats {
+    uint64_t forwarded;
+    uint64_t dropped;   /* UDP datagrams. */
+    uint64_t reordered; /* UDP datagrams. */
+    uint64_t stalled;   /* TCP chunks. */
+};
+
+struct impair_proxy;
+
+void impair_config_init(struct impair_config *cfg);
+struct impair_proxy *impair_proxy_start(const struct impair_config *cfg);
+void impair_proxy_stats(struct impair_proxy *proxy, struct impair_stats *stats);
+void impair_proxy_stop(struct impair_proxy *proxy);
+
+#endif
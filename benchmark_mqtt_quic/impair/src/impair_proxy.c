@@ -0,0 +1,93 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "impair.h"
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void sig_handle(int signum)
+{
+    (void)signum;
+    g_stop = 1;
+}
+
+static void print_usage(void)
+{
+    printf("mqtt_impair_proxy: relay MQTT over TCP and QUIC through an emulated lossy link.\n\n");
+    printf("Usage: mqtt_impair_proxy [-l port] [-h host] [-p tcp_port] [-P quic_port]\n");
+    printf("                         [--delay ms] [--jitter ms] [--loss ratio] [--reorder ratio]\n");
+    printf("                         [--rto ms] [--seed n]\n\n");
+    printf(" -l : port to listen on for both TCP and UDP, defaults to 18830.\n");
+    printf(" -h : broker host, defaults to 127.0.0.1.\n");
+    printf(" -p : broker TCP port, defaults to 1883.\n");
+    printf(" -P : broker QUIC (UDP) port, defaults to the TCP port.\n");
+    printf(" --delay   : one way delay in milliseconds.\n");
+    printf(" --jitter  : uniform jitter either side of the delay, in milliseconds.\n");
+    printf(" --loss    : loss probability, 0 to 1. TCP chunks are stalled rather than dropped.\n");
+    printf(" --reorder : probability a UDP datagram is held back behind later ones, 0 to 1.\n");
+    printf(" --rto     : stall for a lost TCP chunk, defaults to 200 + 2*delay ms.\n");
+    printf(" --seed    : random seed, the same seed gives the same impairments.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"delay",   required_argument, NULL, 'd'},
+        {"jitter",  required_argument, NULL, 'j'},
+        {"loss",    required_argument, NULL, 'x'},
+        {"reorder", required_argument, NULL, 'o'},
+        {"rto",     required_argument, NULL, 'r'},
+        {"seed",    required_argument, NULL, 's'},
+        {"help",    no_argument,       NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    struct impair_config cfg;
+    struct impair_proxy *proxy;
+    struct impair_stats stats;
+    int opt, udp_port = 0;
+
+    impair_config_init(&cfg);
+    while ((opt = getopt_long(argc, argv, "l:h:p:P:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'l': cfg.listen_port = atoi(optarg); break;
+            case 'h': cfg.upstream_host = optarg; break;
+            case 'p': cfg.upstream_tcp_port = atoi(optarg); break;
+            case 'P': udp_port = atoi(optarg); break;
+            case 'd': cfg.delay_ms = atoi(optarg); break;
+            case 'j': cfg.jitter_ms = atoi(optarg); break;
+            case 'x': cfg.loss = atof(optarg); break;
+            case 'o': cfg.reorder = atof(optarg); break;
+            case 'r': cfg.tcp_rto_ms = atoi(optarg); break;
+            case 's': cfg.seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            default:
+                print_usage();
+                return opt == 'H' ? 0 : 1;
+        }
+    }
+    cfg.upstream_udp_port = udp_port ? udp_port : cfg.upstream_tcp_port;
+
+    signal(SIGINT, sig_handle);
+    signal(SIGTERM, sig_handle);
+
+    proxy = impair_proxy_start(&cfg);
+    if (!proxy) {
+        return 1;
+    }
+    printf("Relaying %s:%d to %s tcp/%d udp/%d, delay %dms jitter %dms loss %.3f reorder %.3f\n",
+            cfg.listen_host, cfg.listen_port, cfg.upstream_host, cfg.upstream_tcp_port,
+            cfg.upstream_udp_port, cfg.delay_ms, cfg.jitter_ms, cfg.loss, cfg.reorder);
+
+    while (!g_stop) {
+        pause();
+    }
+
+    impair_proxy_stats(proxy, &stats);
+    impair_proxy_stop(proxy);
+    printf("forwarded %llu, dropped %llu, reordered %llu, stalled %llu\n",
+            (unsigned long long)stats.forwarded, (unsigned long long)stats.dropped,
+            (unsigned long long)stats.reordered, (unsigned long long)stats.stalled);
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mosquitto.h>
+
+#include "impair.h"
+
+#define BENCH_HEADER_SIZE   16  /* seq and send time, both uint64_t */
+#define BENCH_CONNECT_MS    10000
+
+/* Runs the same publish/subscribe workload over TCP and over QUIC, each
+ * through its own impair proxy, and prints the results side by side. */
+
+struct bench_options {
+    const char *host;
+    int tcp_port;
+    int quic_port;
+    int proxy_port;
+    int count;
+    int rate;           /* Messages per second, 0 for as fast as possible. */
+    int payload_size;
+    int qos;
+    int drain_ms;       /* How long to wait for stragglers after the last publish. */
+    struct impair_config link;
+};
+
+struct bench_result {
+    const char *name;
+    bool ok;
+    int sent;
+    int received;
+    double mean_ms;
+    double p50_ms, p90_ms, p99_ms, p999_ms, max_ms;
+    double msgs_per_s;
+    struct impair_stats link;
+};
+
+struct bench_state {
+    volatile bool connected;
+    volatile bool subscribed;
+    volatile int received;
+    int count;
+    uint64_t *latency_ns;   /* Indexed by seq, 0 until received. */
+    volatile uint64_t last_recv_ns;
+};
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(t / 1000000000);
+    ts.tv_nsec = (long)(t % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static bool wait_for(volatile bool *flag, int timeout_ms)
+{
+    uint64_t end = now_ns() + (uint64_t)timeout_ms*1000000;
+
+    while (!*flag && now_ns() < end) {
+        usleep(1000);
+    }
+    return *flag;
+}
+
+static void on_connect(struct mosquitto *mosq, void *obj, int rc)
+{
+    struct bench_state *state = obj;
+
+    (void)mosq;
+    if (rc == 0) {
+        state->connected = true;
+    }
+}
+
+static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+    struct bench_state *state = obj;
+
+    (void)mosq;
+    (void)mid;
+    (void)qos_count;
+    (void)granted_qos;
+    state->subscribed = true;
+}
+
+static void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+    struct bench_state *state = obj;
+    uint64_t seq, sent, now = now_ns();
+
+    (void)mosq;
+    if (msg->payloadlen < BENCH_HEADER_SIZE) {
+        return;
+    }
+    memcpy(&seq, msg->payload, sizeof(seq));
+    memcpy(&sent, (uint8_t *)msg->payload + sizeof(seq), sizeof(sent));
+    /* QoS 1 can deliver twice, only the first copy counts. */
+    if (seq >= (uint64_t)state->count || state->latency_ns[seq]) {
+        return;
+    }
+    state->latency_ns[seq] = now > sent ? now - sent : 1;
+    state->last_recv_ns = now;
+    state->received++;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const uint64_t *sorted, int n, double p)
+{
+    int i;
+
+    if (n == 0) {
+        return 0.0;
+    }
+    i = (int)(p * (n - 1) + 0.5);
+    return sorted[i] / 1e6;
+}
+
+static struct mosquitto *bench_client(const char *name, int transport, struct bench_state *state, const struct bench_options *opts)
+{
+    struct mosquitto *mosq;
+    char id[64];
+    int rc;
+
+    snprintf(id, sizeof(id), "transport-bench-%s-%d", name, (int)getpid());
+    mosq = mosquitto_new(id, true, state);
+    if (!mosq) {
+        return NULL;
+    }
+    rc = mosquitto_int_option(mosq, MOSQ_OPT_TRANSPORT, transport);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        mosquitto_connect_callback_set(mosq, on_connect);
+        rc = mosquitto_connect(mosq, "127.0.0.1", opts->proxy_port, 60);
+    }
+    if (rc == MOSQ_ERR_SUCCESS) {
+        rc = mosquitto_loop_start(mosq);
+    }
+    if (rc != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", id, mosquitto_strerror(rc));
+        mosquitto_destroy(mosq);
+        return NULL;
+    }
+    return mosq;
+}
+
+static void bench_client_close(struct mosquitto *mosq)
+{
+    if (mosq) {
+        mosquitto_disconnect(mosq);
+        mosquitto_loop_stop(mosq, false);
+        mosquitto_destroy(mosq);
+    }
+}
+
+static void bench_run(const char *name, int transport, const struct bench_options *opts, struct bench_result *result)
+{
+    struct impair_config link = opts->link;
+    struct impair_proxy *proxy;
+    struct mosquitto *sub = NULL, *pub = NULL;
+    struct bench_state sub_state, pub_state;
+    uint8_t *payload;
+    uint64_t *sorted, start, next, interval, last_sent, total;
+    char topic[64];
+    int i, n = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->name = name;
+    memset(&sub_state, 0, sizeof(sub_state));
+    memset(&pub_state, 0, sizeof(pub_state));
+
+    link.listen_port = opts->proxy_port;
+    link.upstream_host = opts->host;
+    link.upstream_tcp_port = opts->tcp_port;
+    link.upstream_udp_port = opts->quic_port;
+    proxy = impair_proxy_start(&link);
+    if (!proxy) {
+        return;
+    }
+
+    payload = calloc(1, (size_t)opts->payload_size);
+    sub_state.count = opts->count;
+    sub_state.latency_ns = calloc((size_t)opts->count, sizeof(uint64_t));
+    if (!payload || !sub_state.latency_ns) {
+        goto cleanup;
+    }
+
+    snprintf(topic, sizeof(topic), "bench/transport/%s/%d", name, (int)getpid());
+    sub = bench_client("sub", transport, &sub_state, opts);
+    if (!sub) {
+        goto cleanup;
+    }
+    mosquitto_subscribe_callback_set(sub, on_subscribe);
+    mosquitto_message_callback_set(sub, on_message);
+    if (!wait_for(&sub_state.connected, BENCH_CONNECT_MS)
+            || mosquitto_subscribe(sub, NULL, topic, opts->qos) != MOSQ_ERR_SUCCESS
+            || !wait_for(&sub_state.subscribed, BENCH_CONNECT_MS)) {
+        fprintf(stderr, "%s: subscriber did not come up\n", name);
+        goto cleanup;
+    }
+    pub = bench_client("pub", transport, &pub_state, opts);
+    if (!pub || !wait_for(&pub_state.connected, BENCH_CONNECT_MS)) {
+        fprintf(stderr, "%s: publisher did not come up\n", name);
+        goto cleanup;
+    }
+
+    interval = opts->rate > 0 ? 1000000000ULL / (uint64_t)opts->rate : 0;
+    start = now_ns();
+    next = start;
+    for (i = 0; i < opts->count; i++) {
+        uint64_t seq = (uint64_t)i, sent;
+
+        if (interval) {
+            sleep_until_ns(next);
+            next += interval;
+        }
+        sent = now_ns();
+        memcpy(payload, &seq, sizeof(seq));
+        memcpy(payload + sizeof(seq), &sent, sizeof(sent));
+        if (mosquitto_publish(pub, NULL, topic, opts->payload_size, payload, opts->qos, false) != MOSQ_ERR_SUCCESS) {
+            break;
+        }
+        result->sent++;
+    }
+    last_sent = now_ns();
+
+    /* Wait until everything arrived, or nothing has arrived for drain_ms. */
+    while (sub_state.received < result->sent) {
+        uint64_t last = sub_state.last_recv_ns > last_sent ? sub_state.last_recv_ns : last_sent;
+
+        if (now_ns() - last > (uint64_t)opts->drain_ms*1000000) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    result->ok = true;
+    result->received = sub_state.received;
+    sorted = malloc((size_t)opts->count * sizeof(uint64_t));
+    if (sorted) {
+        total = 0;
+        for (i = 0, n = 0; i < opts->count; i++) {
+            if (sub_state.latency_ns[i]) {
+                sorted[n++] = sub_state.latency_ns[i];
+                total += sub_state.latency_ns[i];
+            }
+        }
+        qsort(sorted, (size_t)n, sizeof(uint64_t), compare_u64);
+        if (n > 0) {
+            result->mean_ms = (double)total / n / 1e6;
+            result->max_ms = sorted[n-1] / 1e6;
+        }
+        result->p50_ms = percentile_ms(sorted, n, 0.50);
+        result->p90_ms = percentile_ms(sorted, n, 0.90);
+        result->p99_ms = percentile_ms(sorted, n, 0.99);
+        result->p999_ms = percentile_ms(sorted, n, 0.999);
+        free(sorted);
+    }
+    if (n > 0 && sub_state.last_recv_ns > start) {
+        result->msgs_per_s = n / ((sub_state.last_recv_ns - start) / 1e9);
+    }
+
+cleanup:
+    bench_client_close(pub);
+    bench_client_close(sub);
+    impair_proxy_stats(proxy, &result->link);
+    impair_proxy_stop(proxy);
+    free(sub_state.latency_ns);
+    free(payload);
+}
+
+static void print_results(const struct bench_result *results, int count)
+{
+    int i;
+
+#define ROW(label, fmt, field) \
+    do { \
+        printf("%-18s", label); \
+        for (i = 0; i < count; i++) { \
+            if (results[i].ok) printf(fmt, results[i].field); \
+            else printf("%14s", "-"); \
+        } \
+        printf("\n"); \
+    } while (0)
+
+    printf("%-18s", "");
+    for (i = 0; i < count; i++) {
+        printf("%14s", results[i].name);
+    }
+    printf("\n");
+    ROW("sent", "%14d", sent);
+    ROW("received", "%14d", received);
+    ROW("mean (ms)", "%14.3f", mean_ms);
+    ROW("p50 (ms)", "%14.3f", p50_ms);
+    ROW("p90 (ms)", "%14.3f", p90_ms);
+    ROW("p99 (ms)", "%14.3f", p99_ms);
+    ROW("p99.9 (ms)", "%14.3f", p999_ms);
+    ROW("max (ms)", "%14.3f", max_ms);
+    ROW("throughput (msg/s)", "%14.1f", msgs_per_s);
+    ROW("link forwarded", "%14" PRIu64, link.forwarded);
+    ROW("link dropped", "%14" PRIu64, link.dropped);
+    ROW("link reordered", "%14" PRIu64, link.reordered);
+    ROW("link stalled", "%14" PRIu64, link.stalled);
+#undef ROW
+}
+
+static void print_usage(void)
+{
+    printf("mqtt_transport_bench: compare MQTT over TCP and QUIC on an emulated lossy link.\n\n");
+    printf("Usage: mqtt_transport_bench [-h host] [-p tcp_port] [-P quic_port] [-t tcp,quic]\n");
+    printf("                            [-n count] [-r rate] [-s size] [-q qos]\n");
+    printf("                            [--delay ms] [--jitter ms] [--loss ratio] [--reorder ratio]\n");
+    printf("                            [--rto ms] [--seed n] [--proxy-port port] [--drain ms]\n\n");
+    printf(" -h : broker host, defaults to 127.0.0.1.\n");
+    printf(" -p : broker TCP port, defaults to 1883.\n");
+    printf(" -P : broker QUIC port, defaults to the TCP port.\n");
+    printf(" -t : transports to run, comma separated, defaults to tcp,quic.\n");
+    printf(" -n : messages to publish, defaults to 1000.\n");
+    printf(" -r : messages per second, 0 for as fast as possible, defaults to 100.\n");
+    printf(" -s : payload size in bytes, at least %d, defaults to 64.\n", BENCH_HEADER_SIZE);
+    printf(" -q : QoS, defaults to 1.\n");
+    printf(" --delay, --jitter, --loss, --reorder, --rto, --seed : see mqtt_impair_proxy.\n");
+    printf(" --proxy-port : local port used by the proxy, defaults to 18830.\n");
+    printf(" --drain : wait this long for late messages after the last publish, defaults to 5000ms.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"delay",      required_argument, NULL, 'd'},
+        {"jitter",     required_argument, NULL, 'j'},
+        {"loss",       required_argument, NULL, 'x'},
+        {"reorder",    required_argument, NULL, 'o'},
+        {"rto",        required_argument, NULL, 'R'},
+        {"seed",       required_argument, NULL, 'S'},
+        {"proxy-port", required_argument, NULL, 'L'},
+        {"drain",      required_argument, NULL, 'D'},
+        {"help",       no_argument,       NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    struct bench_options opts;
+    struct bench_result results[2];
+    const char *transports = "tcp,quic";
+    int opt, count = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    impair_config_init(&opts.link);
+    opts.host = "127.0.0.1";
+    opts.tcp_port = 1883;
+    opts.proxy_port = 18830;
+    opts.count = 1000;
+    opts.rate = 100;
+    opts.payload_size = 64;
+    opts.qos = 1;
+    opts.drain_ms = 5000;
+
+    while ((opt = getopt_long(argc, argv, "h:p:P:t:n:r:s:q:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'h': opts.host = optarg; break;
+            case 'p': opts.tcp_port = atoi(optarg); break;
+            case 'P': opts.quic_port = atoi(optarg); break;
+            case 't': transports = optarg; break;
+            case 'n': opts.count = atoi(optarg); break;
+            case 'r': opts.rate = atoi(optarg); break;
+            case 's': opts.payload_size = atoi(optarg); break;
+            case 'q': opts.qos = atoi(optarg); break;
+            case 'd': opts.link.delay_ms = atoi(optarg); break;
+            case 'j': opts.link.jitter_ms = atoi(optarg); break;
+            case 'x': opts.link.loss = atof(optarg); break;
+            case 'o': opts.link.reorder = atof(optarg); break;
+            case 'R': opts.link.tcp_rto_ms = atoi(optarg); break;
+            case 'S': opts.link.seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'L': opts.proxy_port = atoi(optarg); break;
+            case 'D': opts.drain_ms = atoi(optarg); break;
+            default:
+                print_usage();
+                return opt == 'H' ? 0 : 1;
+        }
+    }
+    if (opts.quic_port == 0) {
+        opts.quic_port = opts.tcp_port;
+    }
+    if (opts.count <= 0 || opts.payload_size < BENCH_HEADER_SIZE || opts.qos < 0 || opts.qos > 2) {
+        print_usage();
+        return 1;
+    }
+
+    mosquitto_lib_init();
+    printf("delay %dms jitter %dms loss %.3f reorder %.3f, %d x %d bytes at QoS %d\n\n",
+            opts.link.delay_ms, opts.link.jitter_ms, opts.link.loss, opts.link.reorder,
+            opts.count, opts.payload_size, opts.qos);
+
+    /* Same seed for both runs, so both see the same impairment sequence. */
+    if (strstr(transports, "tcp")) {
+        bench_run("tcp", MOSQ_TRANSPORT_TCP, &opts, &results[count++]);
+    }
+    if (strstr(transports, "quic")) {
+        bench_run("quic", MOSQ_TRANSPORT_QUIC, &opts, &results[count++]);
+    }
+    print_results(results, count);
+
+    mosquitto_lib_cleanup();
+    return 0;
+}
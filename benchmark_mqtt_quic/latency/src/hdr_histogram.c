@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr_histogram.h"
+
+static int value_index(uint64_t value)
+{
+    int msb, bucket;
+
+    if (value < HDR_SUB_COUNT) {
+        return (int)value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    bucket = msb - HDR_SUB_BITS + 1;
+    /* value >> bucket is in [HDR_HALF_COUNT, HDR_SUB_COUNT) */
+    return bucket * HDR_HALF_COUNT + (int)(value >> bucket);
+}
+
+/* Largest value that would be counted at index. */
+static uint64_t index_value(int index)
+{
+    int bucket;
+    uint64_t sub;
+
+    if (index < HDR_SUB_COUNT) {
+        return (uint64_t)index;
+    }
+    bucket = index / HDR_HALF_COUNT - 1;
+    sub = (uint64_t)(index - bucket * HDR_HALF_COUNT);
+    return ((sub + 1) << bucket) - 1;
+}
+
+struct hdr_histogram *hdr_new(void)
+{
+    struct hdr_histogram *h;
+
+    h = malloc(sizeof(struct hdr_histogram));
+    if (h) {
+        hdr_reset(h);
+    }
+    return h;
+}
+
+void hdr_reset(struct hdr_histogram *h)
+{
+    memset(h, 0, sizeof(struct hdr_histogram));
+    h->min = UINT64_MAX;
+}
+
+void hdr_record(struct hdr_histogram *h, uint64_t value)
+{
+    if (value > HDR_MAX_VALUE) {
+        value = HDR_MAX_VALUE;
+    }
+    h->counts[value_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+uint64_t hdr_percentile(const struct hdr_histogram *h, double percentile)
+{
+    uint64_t target, seen = 0;
+    int i;
+
+    if (h->total == 0) {
+        return 0;
+    }
+    if (percentile >= 100.0) {
+        return h->max;
+    }
+    target = (uint64_t)(percentile / 100.0 * (double)h->total + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    for (i = 0; i < HDR_COUNTS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            /* Never report more than was actually seen. */
+            return index_value(i) < h->max ? index_value(i) : h->max;
+        }
+    }
+    return h->max;
+}
+
+double hdr_mean(const struct hdr_histogram *h)
+{
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
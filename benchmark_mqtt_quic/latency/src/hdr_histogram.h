@@ -0,0 +1,33 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Log-linear histogram in the style of HdrHistogram: values below 2048 are
+ * counted exactly, above that each power of two is split into 1024 buckets,
+ * so every recorded value is kept to within 0.1%. Values are in nanoseconds
+ * and anything above HDR_MAX_VALUE (about 73 minutes) is clamped. */
+
+#define HDR_SUB_BITS        11
+#define HDR_SUB_COUNT       (1 << HDR_SUB_BITS)
+#define HDR_HALF_COUNT      (HDR_SUB_COUNT / 2)
+#define HDR_BUCKETS         32
+#define HDR_COUNTS          ((HDR_BUCKETS + 1) * HDR_HALF_COUNT)
+#define HDR_MAX_VALUE       ((UINT64_C(1) << (HDR_SUB_BITS + HDR_BUCKETS - 1)) - 1)
+
+struct hdr_histogram {
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t counts[HDR_COUNTS];
+};
+
+struct hdr_histogram *hdr_new(void);
+void hdr_reset(struct hdr_histogram *h);
+void hdr_record(struct hdr_histogram *h, uint64_t value);
+/* Highest value at or below which percentile (0 to 100) of values fall. */
+uint64_t hdr_percentile(const struct hdr_histogram *h, double percentile);
+double hdr_mean(const struct hdr_histogram *h);
+
+#endif
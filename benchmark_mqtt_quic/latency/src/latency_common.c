@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mosquitto.h>
+
+#include "latency_common.h"
+
+uint64_t latency_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void latency_header_write(void *payload, uint64_t seq, uint64_t send_ns)
+{
+    struct latency_header header;
+
+    header.magic = LATENCY_MAGIC;
+    header.reserved = 0;
+    header.seq = seq;
+    header.send_ns = send_ns;
+    memcpy(payload, &header, LATENCY_HEADER_SIZE);
+}
+
+bool latency_header_read(const void *payload, int payloadlen, struct latency_header *header)
+{
+    if (payloadlen < LATENCY_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(header, payload, LATENCY_HEADER_SIZE);
+    return header->magic == LATENCY_MAGIC;
+}
+
+void latency_options_init(struct latency_options *opts)
+{
+    memset(opts, 0, sizeof(struct latency_options));
+    opts->host = "localhost";
+    opts->port = 1883;
+    opts->topic = "test_signal";
+    opts->qos = 1;
+    opts->clock = CLOCK_MONOTONIC;
+}
+
+int latency_option(struct latency_options *opts, int opt, const char *arg)
+{
+    switch (opt) {
+        case 'h':
+            opts->host = arg;
+            return 1;
+        case 'p':
+            opts->port = atoi(arg);
+            return opts->port > 0 && opts->port < 65536 ? 1 : -1;
+        case 't':
+            opts->topic = arg;
+            return 1;
+        case 'q':
+            opts->qos = atoi(arg);
+            return opts->qos >= 0 && opts->qos <= 2 ? 1 : -1;
+        case 'T':
+            if (!strcmp(arg, "tcp")) {
+                opts->transport = MOSQ_TRANSPORT_TCP;
+            } else if (!strcmp(arg, "quic")) {
+                opts->transport = MOSQ_TRANSPORT_QUIC;
+            } else {
+                return -1;
+            }
+            return 1;
+        case 'K':
+            /* Monotonic is only comparable on one host, realtime needs the
+             * hosts' clocks to be synchronised. */
+            if (!strcmp(arg, "monotonic")) {
+                opts->clock = CLOCK_MONOTONIC;
+            } else if (!strcmp(arg, "realtime")) {
+                opts->clock = CLOCK_REALTIME;
+            } else {
+                return -1;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+struct mosquitto *latency_connect(const struct latency_options *opts, void *userdata)
+{
+    struct mosquitto *mosq;
+    int rc = MOSQ_ERR_SUCCESS;
+
+    mosq = mosquitto_new(NULL, true, userdata);
+    if (!mosq) {
+        fprintf(stderr, "Unable to create client.\n");
+        return NULL;
+    }
+    if (opts->transport) {
+        rc = mosquitto_int_option(mosq, MOSQ_OPT_TRANSPORT, opts->transport);
+    }
+    if (rc == MOSQ_ERR_SUCCESS) {
+        rc = mosquitto_connect(mosq, opts->host, opts->port, 60);
+    }
+    if (rc != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "Unable to connect to %s:%d: %s\n", opts->host, opts->port, mosquitto_strerror(rc));
+        mosquitto_destroy(mosq);
+        return NULL;
+    }
+    return mosq;
+}
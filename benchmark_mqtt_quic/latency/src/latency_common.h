@@ -0,0 +1,41 @@
+#ifndef LATENCY_COMMON_H
+#define LATENCY_COMMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Every latency message starts with this header, in host byte order, and is
+ * padded with zeroes to the requested payload size. Both ends must therefore
+ * run on the same architecture. */
+
+#define LATENCY_MAGIC       0x4d514c54u     /* "MQLT" */
+#define LATENCY_HEADER_SIZE 24
+
+struct latency_header {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t seq;       /* From 0, one per message. */
+    uint64_t send_ns;   /* Publisher clock when the message was handed to the library. */
+};
+
+struct latency_options {
+    const char *host;
+    int port;
+    const char *topic;
+    int qos;
+    int transport;      /* MOSQ_TRANSPORT_*, 0 for the library default. */
+    clockid_t clock;
+};
+
+uint64_t latency_now_ns(clockid_t clock);
+void latency_header_write(void *payload, uint64_t seq, uint64_t send_ns);
+bool latency_header_read(const void *payload, int payloadlen, struct latency_header *header);
+
+void latency_options_init(struct latency_options *opts);
+/* Handles the options common to both ends. Returns 1 if opt was one of
+ * them, 0 if it was not, -1 if its argument was invalid. */
+int latency_option(struct latency_options *opts, int opt, const char *arg);
+struct mosquitto *latency_connect(const struct latency_options *opts, void *userdata);
+
+#endif
@@ -1,139 +1,171 @@
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <unistd.h>
-#include <mosquitto.h>
 #include <time.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <dirent.h>
-#include <signal.h>
-#include <ctype.h>
-#include <cjson/cJSON.h>
+#include <unistd.h>
 #include <mosquitto.h>
 
-#define HOST           "localhost"
-#define PORT            1883
-#define KEEP_ALIVE      60
-#define MSG_MAX_SIZE    512
+#include "latency_common.h"
 
-static int  g_stop = 0;
+#define DRAIN_TIMEOUT_MS    10000
 
-void on_connect(struct mosquitto *mosq, void *obj, int rc);
-void sig_handle(int signum);
+static volatile sig_atomic_t g_stop = 0;
+static volatile bool g_connected = false;
+static volatile long g_published = 0;
 
-/* 获取时间 */
-int get_time(char *datetime, int bytes)
+static void sig_handle(int signum)
 {
-    time_t              now;
-    struct tm          *t;
-
-    time(&now);
-    t = localtime(&now);
-
-    snprintf(datetime, bytes, "%04d-%02d-%02d %02d:%02d:%02d", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, (t->tm_hour)+8, t->tm_min, t->tm_sec);
-
-    return 0;
+    (void)signum;
+    g_stop = 1;
 }
 
-/* 安装信号 */
-void sig_handle(int signum)
+static void on_connect(struct mosquitto *mosq, void *obj, int rc)
 {
-    if(SIGUSR1 == signum){
+    (void)mosq;
+    (void)obj;
+    if (rc) {
+        fprintf(stderr, "Connection refused: %s\n", mosquitto_connack_string(rc));
         g_stop = 1;
+    } else {
+        g_connected = true;
     }
 }
 
-// 发布函数
-void publish_loop(struct mosquitto *mosq, const char *topic, int qos, int interval)
+static void on_publish(struct mosquitto *mosq, void *obj, int mid)
 {
-    while (1){
-        time_t now = time(NULL);
-        double timestamp = (double)now;
-
-        // 构建 JSON 消息
-        char payload[256];
-        snprintf(payload, sizeof(payload), "{\"timestamp\": %.3f}", timestamp);
-
-        // 发布消息
-        int ret = mosquitto_publish(mosq, NULL, topic, strlen(payload), payload, qos, false);
-        if (ret != MOSQ_ERR_SUCCESS){
-            fprintf(stderr, "Failed to publish message: %s\n", mosquitto_strerror(ret));
-            break;
-        }
-
-        printf("Published: %s\n", payload);
-
-        // 按间隔等待
-        sleep(interval);
-        mosquitto_loop(mosq, -1, 1);
-    }
+    (void)mosq;
+    (void)obj;
+    (void)mid;
+    g_published++;
 }
 
-void cleanUp(struct mosquitto* mosq)
+static void sleep_until(uint64_t t)
 {
-    mosquitto_destroy(mosq);
-    mosquitto_lib_cleanup();
-    exit(1);
-}
+    struct timespec ts;
 
-/*确认连接回函数*/
-void on_connect(struct mosquitto *mosq, void *obj, int rc)
-{
-    printf("Connection successful cJSON call packaging\n");
+    ts.tv_sec = (time_t)(t / 1000000000);
+    ts.tv_nsec = (long)(t % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_stop);
 }
 
-void on_publish(struct mosquitto *mosq, void *obj, int mid)
+static void print_usage(void)
 {
-    printf("Message with id %d has been published.\n", mid);
+    printf("mosquitto_pub_latency: publish sequence numbered, timestamped messages at a fixed rate.\n\n");
+    printf("Usage: mosquitto_pub_latency [-h host] [-p port] [-t topic] [-q qos] [-r rate]\n");
+    printf("                             [-s size] [-n count] [--transport tcp|quic]\n");
+    printf("                             [--clock monotonic|realtime]\n\n");
+    printf(" -h : broker host, defaults to localhost.\n");
+    printf(" -p : broker port, defaults to 1883.\n");
+    printf(" -t : topic, defaults to test_signal.\n");
+    printf(" -q : QoS, defaults to 1.\n");
+    printf(" -r : messages per second, 0 for as fast as possible, defaults to 100.\n");
+    printf(" -s : payload size in bytes, at least %d, defaults to 64.\n", LATENCY_HEADER_SIZE);
+    printf(" -n : messages to send, 0 to run until interrupted, defaults to 1000.\n");
+    printf(" --transport : tcp or quic, defaults to the library default.\n");
+    printf(" --clock : clock for the timestamps. monotonic, the default, only works with\n");
+    printf("           mosquitto_sub_latency on the same host, realtime needs synchronised clocks.\n");
 }
 
-int main (int argc, char **argv)
+int main(int argc, char *argv[])
 {
-    int                 rv;
-    struct mosquitto    *mosq = NULL;
-
-    /*安装信号*/
-    signal(SIGUSR1,sig_handle);
-    
-    /* MQTT 初始化 */
-    rv = mosquitto_lib_init();
-    if(rv != MOSQ_ERR_SUCCESS){
-        printf("mosquitto lib int failure:%s\n", strerror(errno));
-        cleanUp(mosq);
+    static const struct option options[] = {
+        {"transport", required_argument, NULL, 'T'},
+        {"clock",     required_argument, NULL, 'K'},
+        {"help",      no_argument,       NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    struct latency_options opts;
+    struct mosquitto *mosq;
+    uint8_t *payload;
+    uint64_t interval, next, start, elapsed, end;
+    long count = 1000, sent = 0;
+    int rate = 100, size = 64;
+    int opt, rc;
+
+    latency_options_init(&opts);
+    while ((opt = getopt_long(argc, argv, "h:p:t:q:r:s:n:", options, NULL)) != -1) {
+        rc = latency_option(&opts, opt, optarg);
+        if (rc == 1) {
+            continue;
+        }
+        switch (opt) {
+            case 'r': rate = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'n': count = atol(optarg); break;
+            default:
+                print_usage();
+                return opt == 'H' ? 0 : 1;
+        }
     }
-    
-    /* 创建新的客户端 */
-    mosq = mosquitto_new(NULL,true,NULL);
-    if(!mosq){
-        printf("create client failure:%s\n",strerror(errno));
-        cleanUp(mosq);
+    if (rate < 0 || size < LATENCY_HEADER_SIZE || count < 0) {
+        print_usage();
+        return 1;
+    }
+
+    signal(SIGINT, sig_handle);
+    signal(SIGTERM, sig_handle);
+    signal(SIGUSR1, sig_handle);
+
+    payload = calloc(1, (size_t)size);
+    if (!payload) {
+        return 1;
+    }
+    mosquitto_lib_init();
+    mosq = latency_connect(&opts, NULL);
+    if (!mosq) {
+        free(payload);
+        mosquitto_lib_cleanup();
+        return 1;
     }
-    
-    /* 回调函数 */
     mosquitto_connect_callback_set(mosq, on_connect);
     mosquitto_publish_callback_set(mosq, on_publish);
-    
-    /*  连接MQTT服务器,ip,端口,时间 */ 
-    if(mosquitto_connect(mosq, HOST, PORT, KEEP_ALIVE) != MOSQ_ERR_SUCCESS){
-        printf("mosquitto_connect() failed: %s\n",strerror(errno));
-        cleanUp(mosq);
+    rc = mosquitto_loop_start(mosq);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "Failed to start the loop: %s\n", mosquitto_strerror(rc));
+        g_stop = 1;
+    }
+    while (!g_connected && !g_stop) {
+        usleep(1000);
     }
-    printf("connect successfully\n");
 
-    // 启动事件循环（异步）
-    int ret = mosquitto_loop_start(mosq);
-    if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "Failed to start the loop: %s\n", mosquitto_strerror(ret));
-        cleanUp(mosq);
+    /* Sends are paced on an absolute schedule so that a slow publish does
+     * not shift every later one. */
+    interval = rate > 0 ? 1000000000ULL / (uint64_t)rate : 0;
+    start = latency_now_ns(CLOCK_MONOTONIC);
+    next = start;
+    while (!g_stop && (count == 0 || sent < count)) {
+        if (interval) {
+            sleep_until(next);
+            next += interval;
+            if (g_stop) break;
+        }
+        latency_header_write(payload, (uint64_t)sent, latency_now_ns(opts.clock));
+        rc = mosquitto_publish(mosq, NULL, opts.topic, size, payload, opts.qos, false);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            fprintf(stderr, "Failed to publish message: %s\n", mosquitto_strerror(rc));
+            break;
+        }
+        sent++;
     }
+    elapsed = latency_now_ns(CLOCK_MONOTONIC) - start;
 
-    publish_loop(mosq, "test_signal", 2, 1);
+    /* Let the library finish sending before disconnecting. */
+    end = latency_now_ns(CLOCK_MONOTONIC) + (uint64_t)DRAIN_TIMEOUT_MS*1000000;
+    while (g_published < sent && latency_now_ns(CLOCK_MONOTONIC) < end) {
+        usleep(1000);
+    }
 
-    // 停止事件循环并清理
+    printf("sent %ld messages of %d bytes at QoS %d in %.3fs, %.1f msg/s\n",
+            sent, size, opts.qos, elapsed / 1e9, elapsed ? sent / (elapsed / 1e9) : 0.0);
+
+    mosquitto_disconnect(mosq);
     mosquitto_loop_stop(mosq, false);
-    cleanUp(mosq);
+    mosquitto_destroy(mosq);
+    mosquitto_lib_cleanup();
+    free(payload);
     return 0;
-} 
\ No newline at end of file
+}
@@ -1,179 +1,365 @@
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <mosquitto.h>
-#include <cjson/cJSON.h>
 #include <time.h>
+#include <unistd.h>
+#include <mosquitto.h>
 
-#ifdef _WIN32
-#include <direct.h> 
-#else
-#include <sys/stat.h> 
-#include <unistd.h>   
-#endif
-#include <errno.h>
+#include "hdr_histogram.h"
+#include "latency_common.h"
+
+static const double g_percentiles[] = {50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99};
+#define PERCENTILE_COUNT (sizeof(g_percentiles)/sizeof(g_percentiles[0]))
 
-#define HOST "localhost"
-#define PORT  1883
-#define KEEP_ALIVE 60
-#define MSG_MAX_SIZE  512
+struct sub_state {
+    const struct latency_options *opts;
+    struct hdr_histogram *hist;
+    uint8_t *seen;          /* Bitmap of received sequence numbers. */
+    uint64_t seen_size;     /* In bits. */
+    int64_t highest_seq;    /* -1 until the first message. */
+    uint64_t received;
+    uint64_t duplicates;
+    uint64_t reordered;     /* Arrived after a higher sequence number. */
+    uint64_t invalid;
+    uint64_t skewed;        /* Arrived before it was sent, clocks disagree. */
+    uint64_t first_recv_ns; /* CLOCK_MONOTONIC, for the receive rate. */
+    volatile uint64_t last_recv_ns;
+    FILE *raw;
+};
 
-static int running = 1;
+static volatile sig_atomic_t g_stop = 0;
 
-/* 确认连接回调函数 */
-void on_connect(struct mosquitto *mosq, void *obj, int rc)
+static void sig_handle(int signum)
 {
-    if(rc){
-        printf("on_connect error!\n");
-        exit(1);
-    }
-    else{
-        if(mosquitto_subscribe(mosq, NULL, "test_signal", 2)){
-            printf("Set the topic error!\n");
-            exit(1);
-        }
-        printf("subscribe success");
-    }
+    (void)signum;
+    g_stop = 1;
 }
 
-void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+static void on_connect(struct mosquitto *mosq, void *obj, int rc)
 {
-    bool have_subscription = false;
+    struct sub_state *state = obj;
 
-    /* 在本例中，我们一次只订阅一个主题，但是订阅可以一次包含多个主题，因此这是检查所有主题的一种方法。*/
-    for(int i = 0; i < qos_count; i++){
-        printf("on_subscribe: %d:granted qos = %d\n", i, granted_qos[i]);
-        if(granted_qos[i] <= 2){
-            have_subscription = true;
-        }
+    if (rc) {
+        fprintf(stderr, "Connection refused: %s\n", mosquitto_connack_string(rc));
+        g_stop = 1;
+        return;
     }
-    if(have_subscription == false){
-        /* 代理拒绝了我们所有的订阅，我们知道我们只发送了一个订阅，所以没有保持连接的点。*/
-        fprintf(stderr, "Error: All subscriptions rejected.\n");
+    if (mosquitto_subscribe(mosq, NULL, state->opts->topic, state->opts->qos)) {
+        fprintf(stderr, "Unable to subscribe to %s\n", state->opts->topic);
+        g_stop = 1;
+    }
+}
+
+static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+    (void)obj;
+    (void)mid;
+    /* Only one topic is ever subscribed to. */
+    if (qos_count < 1 || granted_qos[0] > 2) {
+        fprintf(stderr, "Error: subscription rejected.\n");
         mosquitto_disconnect(mosq);
+        g_stop = 1;
     }
 }
 
-/*获取到订阅的内容*/
-void on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg)
+static bool seen_test_and_set(struct sub_state *state, uint64_t seq)
 {
-    char *payload = (char *)msg->payload;
-    payload[msg->payloadlen] = '\0'; // 确保消息是以空字符结尾的字符串
+    uint64_t size;
+    uint8_t *seen;
+    bool was_set;
+
+    if (seq >= state->seen_size) {
+        size = state->seen_size ? state->seen_size : 65536;
+        while (size <= seq) size *= 2;
+        seen = realloc(state->seen, (size_t)(size / 8));
+        if (!seen) {
+            return false;
+        }
+        memset(seen + state->seen_size / 8, 0, (size_t)((size - state->seen_size) / 8));
+        state->seen = seen;
+        state->seen_size = size;
+    }
+    was_set = state->seen[seq / 8] & (1 << (seq % 8));
+    state->seen[seq / 8] |= (uint8_t)(1 << (seq % 8));
+    return was_set;
+}
 
-    // 接收时间戳
-    double received_time = (double)time(NULL);
+static void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+    struct sub_state *state = obj;
+    struct latency_header header;
+    uint64_t now = latency_now_ns(state->opts->clock);
+    uint64_t latency;
 
-    // 解析 JSON 数据
-    cJSON *json = cJSON_Parse(payload);
-    if (!json){
-        fprintf(stderr, "Error parsing JSON: %s\n", cJSON_GetErrorPtr());
+    (void)mosq;
+    if (!latency_header_read(msg->payload, msg->payloadlen, &header)) {
+        state->invalid++;
         return;
     }
-
-    // 获取 "timestamp" 字段
-    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-    if (!cJSON_IsNumber(timestamp)){
-        fprintf(stderr, "Invalid payload: 'timestamp' is missing or not a number.\n");
-        cJSON_Delete(json);
+    if (seen_test_and_set(state, header.seq)) {
+        state->duplicates++;
         return;
     }
+    if ((int64_t)header.seq < state->highest_seq) {
+        state->reordered++;
+    } else {
+        state->highest_seq = (int64_t)header.seq;
+    }
+    if (now >= header.send_ns) {
+        latency = now - header.send_ns;
+    } else {
+        latency = 0;
+        state->skewed++;
+    }
+    hdr_record(state->hist, latency);
+    state->received++;
+    if (state->raw) {
+        fprintf(state->raw, "%llu,%llu\n", (unsigned long long)header.seq, (unsigned long long)latency);
+    }
 
-    // 添加 "received_timestamp" 字段
-    cJSON *received_timestamp = cJSON_CreateNumber(received_time);
-    cJSON_AddItemToObject(json, "received_timestamp", received_timestamp);
+    now = latency_now_ns(CLOCK_MONOTONIC);
+    if (state->first_recv_ns == 0) {
+        state->first_recv_ns = now;
+    }
+    state->last_recv_ns = now;
+}
 
-    // 将更新后的 JSON 数据写入日志文件
-    FILE *log_file = fopen("mqtt_logs.json", "a");
-    if (log_file){
-        char *updated_json = cJSON_PrintUnformatted(json); // 生成紧凑的 JSON 字符串
-        fprintf(log_file, "%s\n", updated_json);
-        fclose(log_file);
+static uint64_t lost_count(const struct sub_state *state, long expected)
+{
+    uint64_t total = expected > 0 ? (uint64_t)expected : (uint64_t)(state->highest_seq + 1);
 
-        printf("Logged message: %s\n", updated_json);
+    return total > state->received ? total - state->received : 0;
+}
 
-        free(updated_json); // 释放生成的 JSON 字符串内存
-    }
-    else{
-        fprintf(stderr, "Failed to open log file for writing.\n");
-    }
+static double recv_rate(const struct sub_state *state)
+{
+    uint64_t span = state->last_recv_ns - state->first_recv_ns;
 
-    // 清理 JSON 对象
-    cJSON_Delete(json);
+    return span ? (state->received - 1) / (span / 1e9) : 0.0;
 }
 
-void cleanUp(struct mosquitto* mosq)
+static void print_summary(const struct sub_state *state, long expected)
 {
-    printf("clean up");
-    mosquitto_destroy(mosq);
-    mosquitto_lib_cleanup();
-    exit(1);
+    size_t i;
+
+    printf("received %llu, lost %llu, duplicates %llu, reordered %llu, invalid %llu",
+            (unsigned long long)state->received, (unsigned long long)lost_count(state, expected),
+            (unsigned long long)state->duplicates, (unsigned long long)state->reordered,
+            (unsigned long long)state->invalid);
+    if (state->skewed) {
+        printf(", clock skewed %llu", (unsigned long long)state->skewed);
+    }
+    printf("\n%.1f msg/s received\n", recv_rate(state));
+    printf("latency (us): min %.3f mean %.3f", state->hist->total ? state->hist->min / 1e3 : 0.0,
+            hdr_mean(state->hist) / 1e3);
+    for (i = 0; i < PERCENTILE_COUNT; i++) {
+        printf(" p%g %.3f", g_percentiles[i], hdr_percentile(state->hist, g_percentiles[i]) / 1e3);
+    }
+    printf(" max %.3f\n", state->hist->max / 1e3);
 }
 
-int main(int argc, char *argv[])
+/* One row per run, so repeated runs with different labels can be compared. */
+static int write_csv(const char *path, const char *label, const struct sub_state *state, long expected)
 {
-    int                 ret;
-    struct mosquitto    *mosq;
+    FILE *fp;
+    size_t i;
+    bool header;
 
-        // 检查命令行参数：日志文件保存路径
-    const char *log_dir = "logs"; // 默认路径
-    if (argc > 1) {
-        log_dir = argv[1];
+    fp = fopen(path, "a");
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return 1;
     }
-
-    // 检查或创建日志目录
-#ifdef _WIN32
-    if (_mkdir(log_dir) != 0 && errno != EEXIST) {
-        fprintf(stderr, "Failed to create or access directory: %s\n", log_dir);
-        return EXIT_FAILURE;
+    header = ftell(fp) == 0;
+    if (header) {
+        fprintf(fp, "label,received,lost,duplicates,reordered,msg_per_s,min_us,mean_us");
+        for (i = 0; i < PERCENTILE_COUNT; i++) {
+            fprintf(fp, ",p%g_us", g_percentiles[i]);
+        }
+        fprintf(fp, ",max_us\n");
     }
-#else
-    if (mkdir(log_dir, 0777) != 0 && errno != EEXIST) {
-        fprintf(stderr, "Failed to create or access directory: %s\n", log_dir);
-        return EXIT_FAILURE;
+    fprintf(fp, "%s,%llu,%llu,%llu,%llu,%.1f,%.3f,%.3f", label,
+            (unsigned long long)state->received, (unsigned long long)lost_count(state, expected),
+            (unsigned long long)state->duplicates, (unsigned long long)state->reordered,
+            recv_rate(state), state->hist->total ? state->hist->min / 1e3 : 0.0,
+            hdr_mean(state->hist) / 1e3);
+    for (i = 0; i < PERCENTILE_COUNT; i++) {
+        fprintf(fp, ",%.3f", hdr_percentile(state->hist, g_percentiles[i]) / 1e3);
     }
-#endif
+    fprintf(fp, ",%.3f\n", state->hist->max / 1e3);
+    fclose(fp);
+    return 0;
+}
 
-    time_t now = time(NULL);
-    struct tm *local_time = localtime(&now);
-    char log_filename[256];
-    strftime(log_filename, sizeof(log_filename), "logs/mqtt_logs_%Y%m%d_%H%M%S.json", local_time);
+static int write_json(const char *path, const char *label, const struct sub_state *state, long expected)
+{
+    FILE *fp;
+    size_t i;
 
-    FILE *log_file = fopen(log_filename, "a");
-    if (!log_file) {
-        fprintf(stderr, "Failed to open log file: %s\n", log_filename);
-        return EXIT_FAILURE;
+    fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(fp, "{\n  \"label\": \"%s\",\n", label);
+    fprintf(fp, "  \"topic\": \"%s\",\n  \"qos\": %d,\n", state->opts->topic, state->opts->qos);
+    fprintf(fp, "  \"received\": %llu,\n  \"lost\": %llu,\n  \"duplicates\": %llu,\n"
+            "  \"reordered\": %llu,\n  \"invalid\": %llu,\n  \"clock_skewed\": %llu,\n",
+            (unsigned long long)state->received, (unsigned long long)lost_count(state, expected),
+            (unsigned long long)state->duplicates, (unsigned long long)state->reordered,
+            (unsigned long long)state->invalid, (unsigned long long)state->skewed);
+    fprintf(fp, "  \"msg_per_s\": %.1f,\n  \"latency_us\": {\n", recv_rate(state));
+    fprintf(fp, "    \"min\": %.3f,\n    \"mean\": %.3f,\n",
+            state->hist->total ? state->hist->min / 1e3 : 0.0, hdr_mean(state->hist) / 1e3);
+    for (i = 0; i < PERCENTILE_COUNT; i++) {
+        fprintf(fp, "    \"p%g\": %.3f,\n", g_percentiles[i], hdr_percentile(state->hist, g_percentiles[i]) / 1e3);
     }
+    fprintf(fp, "    \"max\": %.3f\n  }\n}\n", state->hist->max / 1e3);
+    fclose(fp);
+    return 0;
+}
 
-    /* MQTT 初始化 */
-    ret = mosquitto_lib_init();
-    if(ret){
-        printf("Init lib error!\n");
-        cleanUp(mosq);
+static void print_usage(void)
+{
+    printf("mosquitto_sub_latency: measure latency, loss and reordering of mosquitto_pub_latency messages.\n\n");
+    printf("Usage: mosquitto_sub_latency [-h host] [-p port] [-t topic] [-q qos] [-n count]\n");
+    printf("                             [--idle seconds] [--transport tcp|quic]\n");
+    printf("                             [--clock monotonic|realtime] [--label text]\n");
+    printf("                             [--csv file] [--json file] [--raw file]\n\n");
+    printf(" -h : broker host, defaults to localhost.\n");
+    printf(" -p : broker port, defaults to 1883.\n");
+    printf(" -t : topic, defaults to test_signal.\n");
+    printf(" -q : QoS, defaults to 1.\n");
+    printf(" -n : messages the publisher sends. Stop once they are all in, and count the\n");
+    printf("      missing ones as lost. Without it loss is counted up to the highest seen.\n");
+    printf(" --idle : stop this many seconds after the last message, 0 to wait for a\n");
+    printf("          signal, defaults to 5.\n");
+    printf(" --transport : tcp or quic, defaults to the library default.\n");
+    printf(" --clock : must match the publisher, defaults to monotonic.\n");
+    printf(" --label : name for this run in the CSV and JSON output, defaults to the topic.\n");
+    printf(" --csv : append a summary row to this file, with a header row if it is new.\n");
+    printf(" --json : write a summary object to this file.\n");
+    printf(" --raw : write seq,latency_ns for every message to this file.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"transport", required_argument, NULL, 'T'},
+        {"clock",     required_argument, NULL, 'K'},
+        {"idle",      required_argument, NULL, 'I'},
+        {"label",     required_argument, NULL, 'L'},
+        {"csv",       required_argument, NULL, 'C'},
+        {"json",      required_argument, NULL, 'J'},
+        {"raw",       required_argument, NULL, 'R'},
+        {"help",      no_argument,       NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    struct latency_options opts;
+    struct sub_state state;
+    struct mosquitto *mosq;
+    const char *label = NULL, *csv = NULL, *json = NULL, *raw = NULL;
+    long expected = 0;
+    int idle = 5;
+    int opt, rc, ret = 0;
+
+    latency_options_init(&opts);
+    while ((opt = getopt_long(argc, argv, "h:p:t:q:n:", options, NULL)) != -1) {
+        rc = latency_option(&opts, opt, optarg);
+        if (rc == 1) {
+            continue;
+        }
+        switch (opt) {
+            case 'n': expected = atol(optarg); break;
+            case 'I': idle = atoi(optarg); break;
+            case 'L': label = optarg; break;
+            case 'C': csv = optarg; break;
+            case 'J': json = optarg; break;
+            case 'R': raw = optarg; break;
+            default:
+                print_usage();
+                return opt == 'H' ? 0 : 1;
+        }
+    }
+    if (expected < 0 || idle < 0) {
+        print_usage();
+        return 1;
+    }
+    if (!label) {
+        label = opts.topic;
     }
 
-    /* 创建新的客户端 */
-    mosq = mosquitto_new(NULL,true,log_file);
-    if(mosq == NULL){
-        printf("Create a new client failure\n");
-        cleanUp(mosq);
+    memset(&state, 0, sizeof(state));
+    state.opts = &opts;
+    state.highest_seq = -1;
+    state.hist = hdr_new();
+    if (!state.hist) {
+        return 1;
+    }
+    if (raw) {
+        state.raw = fopen(raw, "w");
+        if (!state.raw) {
+            fprintf(stderr, "Unable to open %s: %s\n", raw, strerror(errno));
+            free(state.hist);
+            return 1;
+        }
+        fprintf(state.raw, "seq,latency_ns\n");
     }
 
-    /* 回调函数 */
+    signal(SIGINT, sig_handle);
+    signal(SIGTERM, sig_handle);
+    signal(SIGUSR1, sig_handle);
+
+    mosquitto_lib_init();
+    mosq = latency_connect(&opts, &state);
+    if (!mosq) {
+        ret = 1;
+        goto cleanup;
+    }
     mosquitto_connect_callback_set(mosq, on_connect);
     mosquitto_subscribe_callback_set(mosq, on_subscribe);
     mosquitto_message_callback_set(mosq, on_message);
+    rc = mosquitto_loop_start(mosq);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "Failed to start the loop: %s\n", mosquitto_strerror(rc));
+        mosquitto_destroy(mosq);
+        ret = 1;
+        goto cleanup;
+    }
 
-    /* 连接代理 */
-    ret = mosquitto_connect(mosq, HOST, PORT, KEEP_ALIVE);
-    if(ret){
-        printf("Connect server error!\n");
-        cleanUp(mosq);
+    while (!g_stop) {
+        if (expected > 0 && state.received >= (uint64_t)expected) {
+            break;
+        }
+        if (idle > 0 && state.last_recv_ns
+                && latency_now_ns(CLOCK_MONOTONIC) - state.last_recv_ns > (uint64_t)idle*1000000000) {
+            break;
+        }
+        usleep(10000);
     }
-    printf("connection client is ok\n");
 
-    mosquitto_loop_forever(mosq, -1, 1);
+    mosquitto_disconnect(mosq);
+    mosquitto_loop_stop(mosq, false);
+    mosquitto_destroy(mosq);
 
-    cleanUp(mosq);
+    print_summary(&state, expected);
+    if (csv) {
+        ret |= write_csv(csv, label, &state, expected);
+    }
+    if (json) {
+        ret |= write_json(json, label, &state, expected);
+    }
 
-    return 0;
-} 
+cleanup:
+    mosquitto_lib_cleanup();
+    if (state.raw) {
+        fclose(state.raw);
+    }
+    free(state.seen);
+    free(state.hist);
+    return ret;
+}
@@ -0,0 +1,890 @@
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mosquitto.h>
+
+#include "hdr_histogram.h"
+#include "latency_common.h"
+
+/* Opens many publishers and subscribers and drives them from a handful of
+ * worker threads, to find out how much a broker can take.
+ *
+ * TCP clients are run from an external poll() loop in their worker, using
+ * mosquitto_loop_read/write/misc(), so the connection count is not limited
+ * by select()'s FD_SETSIZE. QUIC clients have no socket to poll, their I/O
+ * happens on msquic's threads, so they use mosquitto_loop_start() and the
+ * worker only paces their publishes.
+ *
+ * Latency is measured end to end with the header from latency_common.h. In
+ * the retained scenario it is measured from the SUBSCRIBE instead, as the
+ * messages were stored long before. */
+
+#define LG_MAX_WORKERS      256
+#define LG_CONNECT_TIMEOUT  30
+#define LG_MISC_INTERVAL_NS 100000000ULL
+#define LG_READS_PER_WAKE   16
+
+enum lg_scenario {
+    lg_fanin,       /* Many publishers, each on its own topic, few subscribers on all of them. */
+    lg_fanout,      /* Few publishers on one topic, many subscribers. */
+    lg_shared,      /* Publishers to a shared subscription, each message is delivered once. */
+    lg_retained,    /* Publishers store retained messages, subscribers then fetch them all. */
+};
+
+enum lg_phase {
+    lg_phase_connect,
+    lg_phase_run,
+    lg_phase_subscribe,
+    lg_phase_clear,
+    lg_phase_stop,
+};
+
+struct loadgen;
+struct lg_worker;
+
+struct lg_client {
+    struct mosquitto *mosq;
+    struct lg_worker *worker;
+    int index;
+    bool is_pub;
+    volatile bool connected;
+    volatile bool subscribed;
+    volatile bool failed;
+    bool subscribe_sent;
+    uint64_t connect_start_ns;
+    uint64_t subscribe_ns;
+    /* Publishers */
+    uint64_t next_ns;
+    uint64_t seq;
+    uint64_t sent;
+    volatile uint64_t completed;
+    bool clearing;
+};
+
+struct lg_worker {
+    pthread_t thread;
+    struct loadgen *lg;
+    struct lg_client **clients;
+    int client_count;
+    pthread_mutex_t lock;       /* Everything below. */
+    struct hdr_histogram *latency;
+    struct hdr_histogram *connect;
+    uint64_t sent;
+    uint64_t sent_bytes;
+    uint64_t received;
+    uint64_t received_bytes;
+    uint64_t first_recv_ns;
+    uint64_t last_recv_ns;
+    uint64_t errors;
+};
+
+struct loadgen {
+    struct latency_options opts;
+    enum lg_scenario scenario;
+    int pubs;
+    int subs;
+    int workers;
+    int rate;               /* Per publisher, 0 for as fast as the window allows. */
+    long count;             /* Per publisher, 0 to run for duration. */
+    int duration;
+    int size;
+    int window;             /* Most messages a publisher has with the library at once. */
+    int drain_ms;
+    bool keep_retained;
+    const char *label;
+    const char *csv;
+    char base[64];
+    char filter[160];
+    volatile enum lg_phase phase;
+    volatile bool publishing;
+    struct lg_client *clients;
+    struct lg_worker *worker;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static const double g_percentiles[] = {50.0, 90.0, 99.0, 99.9, 99.99};
+#define PERCENTILE_COUNT (sizeof(g_percentiles)/sizeof(g_percentiles[0]))
+
+static const char *g_scenarios[] = {"fanin", "fanout", "shared", "retained"};
+
+
+static void sig_handle(int signum)
+{
+    (void)signum;
+    g_stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    return latency_now_ns(CLOCK_MONOTONIC);
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000);
+    ts.tv_nsec = (long)(ns % 1000000000);
+    nanosleep(&ts, NULL);
+}
+
+static void client_topic(const struct loadgen *lg, const struct lg_client *client, char *topic, size_t len)
+{
+    switch (lg->scenario) {
+        case lg_fanin:
+            snprintf(topic, len, "%s/in/%d", lg->base, client->index);
+            break;
+        case lg_fanout:
+            snprintf(topic, len, "%s/out", lg->base);
+            break;
+        case lg_shared:
+            snprintf(topic, len, "%s/shared/%d", lg->base, client->index);
+            break;
+        case lg_retained:
+            snprintf(topic, len, "%s/retained/%d/%" PRIu64, lg->base, client->index, client->seq);
+            break;
+    }
+}
+
+static void client_subscribe(struct lg_client *client)
+{
+    struct loadgen *lg = client->worker->lg;
+
+    client->subscribe_sent = true;
+    client->subscribe_ns = now_ns();
+    if (mosquitto_subscribe(client->mosq, NULL, lg->filter, lg->opts.qos) != MOSQ_ERR_SUCCESS) {
+        client->failed = true;
+    }
+}
+
+static void on_connect(struct mosquitto *mosq, void *obj, int rc)
+{
+    struct lg_client *client = obj;
+    struct lg_worker *worker = client->worker;
+    uint64_t now = now_ns();
+
+    (void)mosq;
+    if (rc) {
+        client->failed = true;
+        return;
+    }
+    pthread_mutex_lock(&worker->lock);
+    hdr_record(worker->connect, now - client->connect_start_ns);
+    pthread_mutex_unlock(&worker->lock);
+    client->connected = true;
+    if (!client->is_pub && worker->lg->scenario != lg_retained) {
+        client_subscribe(client);
+    }
+}
+
+static void on_disconnect(struct mosquitto *mosq, void *obj, int rc)
+{
+    struct lg_client *client = obj;
+
+    (void)mosq;
+    if (rc && client->worker->lg->phase != lg_phase_stop) {
+        client->failed = true;
+    }
+}
+
+static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+    struct lg_client *client = obj;
+
+    (void)mosq;
+    (void)mid;
+    if (qos_count < 1 || granted_qos[0] > 2) {
+        client->failed = true;
+    } else {
+        client->subscribed = true;
+    }
+}
+
+static void on_publish(struct mosquitto *mosq, void *obj, int mid)
+{
+    struct lg_client *client = obj;
+
+    (void)mosq;
+    (void)mid;
+    client->completed++;
+}
+
+static void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+    struct lg_client *client = obj;
+    struct lg_worker *worker = client->worker;
+    struct latency_header header;
+    uint64_t now = now_ns(), since;
+
+    (void)mosq;
+    /* Skips the empty messages that clear retained topics. */
+    if (!latency_header_read(msg->payload, msg->payloadlen, &header)) {
+        return;
+    }
+    since = worker->lg->scenario == lg_retained ? client->subscribe_ns : header.send_ns;
+
+    pthread_mutex_lock(&worker->lock);
+    hdr_record(worker->latency, now > since ? now - since : 0);
+    worker->received++;
+    worker->received_bytes += (uint64_t)msg->payloadlen;
+    if (worker->first_recv_ns == 0) {
+        worker->first_recv_ns = now;
+    }
+    worker->last_recv_ns = now;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/* Publishes everything that is due, returns when the next one is. */
+static uint64_t publish_due(struct lg_client *client, uint8_t *payload, uint64_t now)
+{
+    struct lg_worker *worker = client->worker;
+    struct loadgen *lg = worker->lg;
+    uint64_t interval = lg->rate > 0 ? 1000000000ULL / (uint64_t)lg->rate : 0;
+    char topic[160];
+    int len, rc;
+
+    if (!client->connected || client->failed) {
+        return UINT64_MAX;
+    }
+    while (client->next_ns <= now && client->sent - client->completed < (uint64_t)lg->window) {
+        if (lg->count && client->seq >= (uint64_t)lg->count) {
+            return UINT64_MAX;
+        }
+        client_topic(lg, client, topic, sizeof(topic));
+        if (client->clearing) {
+            len = 0;
+        } else {
+            len = lg->size;
+            latency_header_write(payload, client->seq, now_ns());
+        }
+        rc = mosquitto_publish(client->mosq, NULL, topic, len, len ? payload : NULL, lg->opts.qos,
+                lg->scenario == lg_retained);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            pthread_mutex_lock(&worker->lock);
+            worker->errors++;
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        client->seq++;
+        client->sent++;
+        if (!client->clearing) {
+            pthread_mutex_lock(&worker->lock);
+            worker->sent++;
+            worker->sent_bytes += (uint64_t)len;
+            pthread_mutex_unlock(&worker->lock);
+        }
+        client->next_ns = interval ? client->next_ns + interval : now;
+    }
+    if (client->next_ns <= now) {
+        /* Window full, wait for the library to make room. */
+        return UINT64_MAX;
+    }
+    return client->next_ns;
+}
+
+static void worker_connect(struct lg_worker *worker)
+{
+    struct loadgen *lg = worker->lg;
+    struct lg_client *client;
+    int i, rc;
+
+    for (i = 0; i < worker->client_count && !g_stop; i++) {
+        client = worker->clients[i];
+        client->connect_start_ns = now_ns();
+        rc = mosquitto_connect(client->mosq, lg->opts.host, lg->opts.port, 60);
+        if (rc == MOSQ_ERR_SUCCESS && lg->opts.transport == MOSQ_TRANSPORT_QUIC) {
+            rc = mosquitto_loop_start(client->mosq);
+        }
+        if (rc != MOSQ_ERR_SUCCESS) {
+            client->failed = true;
+            pthread_mutex_lock(&worker->lock);
+            worker->errors++;
+            pthread_mutex_unlock(&worker->lock);
+        }
+    }
+}
+
+static void *worker_run(void *arg)
+{
+    struct lg_worker *worker = arg;
+    struct loadgen *lg = worker->lg;
+    struct lg_client *client;
+    struct pollfd *pfds;
+    struct lg_client **polled;
+    uint8_t *payload;
+    uint64_t now, next, due, last_misc = 0;
+    enum lg_phase phase;
+    bool tcp = lg->opts.transport != MOSQ_TRANSPORT_QUIC;
+    int i, j, count, timeout, rc;
+
+    pfds = calloc((size_t)worker->client_count + 1, sizeof(struct pollfd));
+    polled = calloc((size_t)worker->client_count + 1, sizeof(struct lg_client *));
+    payload = calloc(1, (size_t)lg->size);
+    if (!pfds || !polled || !payload) {
+        free(pfds);
+        free(polled);
+        free(payload);
+        return NULL;
+    }
+
+    worker_connect(worker);
+
+    while ((phase = lg->phase) != lg_phase_stop) {
+        now = now_ns();
+        next = now + 10000000;
+        for (i = 0; i < worker->client_count; i++) {
+            client = worker->clients[i];
+            if (client->failed || !client->connected) {
+                continue;
+            }
+            if (client->is_pub) {
+                if (phase == lg_phase_clear && !client->clearing) {
+                    client->clearing = true;
+                    client->seq = 0;
+                    client->next_ns = now;
+                }
+                if (lg->publishing || client->clearing) {
+                    due = publish_due(client, payload, now);
+                    if (due < next) next = due;
+                }
+            } else if (phase == lg_phase_subscribe && !client->subscribe_sent) {
+                client_subscribe(client);
+            }
+        }
+
+        timeout = next > now ? (int)((next - now) / 1000000) : 0;
+        if (!tcp) {
+            /* Nothing tells us when a QUIC client's window opens, so check
+             * often while publishing. */
+            if (lg->publishing && next > now + 1000000) {
+                next = now + 1000000;
+            }
+            sleep_ns(next > now ? next - now : 0);
+            continue;
+        }
+
+        count = 0;
+        for (i = 0; i < worker->client_count; i++) {
+            client = worker->clients[i];
+            if (client->failed || mosquitto_socket(client->mosq) < 0) {
+                continue;
+            }
+            pfds[count].fd = mosquitto_socket(client->mosq);
+            pfds[count].events = POLLIN | (mosquitto_want_write(client->mosq) ? POLLOUT : 0);
+            pfds[count].revents = 0;
+            polled[count++] = client;
+        }
+        if (count == 0) {
+            sleep_ns(next > now ? next - now : 0);
+            continue;
+        }
+        if (poll(pfds, (nfds_t)count, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            client = polled[i];
+            rc = MOSQ_ERR_SUCCESS;
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                for (j = 0; j < LG_READS_PER_WAKE && rc == MOSQ_ERR_SUCCESS; j++) {
+                    rc = mosquitto_loop_read(client->mosq, 1);
+                }
+            }
+            if (rc == MOSQ_ERR_SUCCESS && (pfds[i].revents & POLLOUT)) {
+                rc = mosquitto_loop_write(client->mosq, 1);
+            }
+            if (rc != MOSQ_ERR_SUCCESS && lg->phase != lg_phase_stop) {
+                client->failed = true;
+            }
+        }
+        now = now_ns();
+        if (now - last_misc > LG_MISC_INTERVAL_NS) {
+            last_misc = now;
+            for (i = 0; i < worker->client_count; i++) {
+                if (!worker->clients[i]->failed) {
+                    mosquitto_loop_misc(worker->clients[i]->mosq);
+                }
+            }
+        }
+    }
+
+    /* Disconnect here, where the TCP clients' I/O happens. */
+    for (i = 0; i < worker->client_count; i++) {
+        client = worker->clients[i];
+        mosquitto_disconnect(client->mosq);
+        if (tcp && mosquitto_socket(client->mosq) >= 0) {
+            mosquitto_loop_write(client->mosq, 1);
+        }
+    }
+
+    free(pfds);
+    free(polled);
+    free(payload);
+    return NULL;
+}
+
+struct lg_totals {
+    uint64_t sent, sent_bytes;
+    uint64_t received, received_bytes;
+    uint64_t first_recv_ns, last_recv_ns;
+    uint64_t errors;
+    int connected, subscribed, failed, pubs_done;
+};
+
+static void totals_get(struct loadgen *lg, struct lg_totals *t)
+{
+    struct lg_worker *worker;
+    struct lg_client *client;
+    int i;
+
+    memset(t, 0, sizeof(*t));
+    for (i = 0; i < lg->workers; i++) {
+        worker = &lg->worker[i];
+        pthread_mutex_lock(&worker->lock);
+        t->sent += worker->sent;
+        t->sent_bytes += worker->sent_bytes;
+        t->received += worker->received;
+        t->received_bytes += worker->received_bytes;
+        t->errors += worker->errors;
+        if (worker->first_recv_ns && (t->first_recv_ns == 0 || worker->first_recv_ns < t->first_recv_ns)) {
+            t->first_recv_ns = worker->first_recv_ns;
+        }
+        if (worker->last_recv_ns > t->last_recv_ns) {
+            t->last_recv_ns = worker->last_recv_ns;
+        }
+        pthread_mutex_unlock(&worker->lock);
+    }
+    for (i = 0; i < lg->pubs + lg->subs; i++) {
+        client = &lg->clients[i];
+        if (client->failed) {
+            t->failed++;
+        } else if (client->connected) {
+            t->connected++;
+        }
+        if (client->subscribed) {
+            t->subscribed++;
+        }
+        /* Clearing restarts seq, so wait until the worker has noticed. */
+        if (client->is_pub && client->sent == client->completed
+                && (lg->phase != lg_phase_clear || client->clearing)
+                && (client->failed || (lg->count && client->seq >= (uint64_t)lg->count))) {
+            t->pubs_done++;
+        }
+    }
+}
+
+/* Waits for deliveries to stop, either all expected arrived or none for
+ * drain_ms. */
+static void wait_drain(struct loadgen *lg, uint64_t (*expected)(struct loadgen *, const struct lg_totals *))
+{
+    struct lg_totals t;
+    uint64_t last_count = UINT64_MAX, last_change = now_ns();
+
+    while (!g_stop) {
+        totals_get(lg, &t);
+        if (t.received >= expected(lg, &t)) {
+            return;
+        }
+        if (t.received != last_count) {
+            last_count = t.received;
+            last_change = now_ns();
+        } else if (now_ns() - last_change > (uint64_t)lg->drain_ms*1000000) {
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+static uint64_t expected_deliveries(struct loadgen *lg, const struct lg_totals *t)
+{
+    if (lg->scenario == lg_shared) {
+        return t->sent;
+    }
+    return t->sent * (uint64_t)lg->subs;
+}
+
+static void merge_histograms(struct loadgen *lg, struct hdr_histogram *latency, struct hdr_histogram *connect)
+{
+    struct lg_worker *worker;
+    int i, j;
+
+    for (i = 0; i < lg->workers; i++) {
+        worker = &lg->worker[i];
+        pthread_mutex_lock(&worker->lock);
+        for (j = 0; j < HDR_COUNTS; j++) {
+            latency->counts[j] += worker->latency->counts[j];
+            connect->counts[j] += worker->connect->counts[j];
+        }
+        latency->total += worker->latency->total;
+        latency->sum += worker->latency->sum;
+        if (worker->latency->min < latency->min) latency->min = worker->latency->min;
+        if (worker->latency->max > latency->max) latency->max = worker->latency->max;
+        connect->total += worker->connect->total;
+        connect->sum += worker->connect->sum;
+        if (worker->connect->min < connect->min) connect->min = worker->connect->min;
+        if (worker->connect->max > connect->max) connect->max = worker->connect->max;
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+static void print_histogram(const char *name, const struct hdr_histogram *h)
+{
+    size_t i;
+
+    printf("%s (us): min %.1f mean %.1f", name, h->total ? h->min / 1e3 : 0.0, hdr_mean(h) / 1e3);
+    for (i = 0; i < PERCENTILE_COUNT; i++) {
+        printf(" p%g %.1f", g_percentiles[i], hdr_percentile(h, g_percentiles[i]) / 1e3);
+    }
+    printf(" max %.1f\n", h->max / 1e3);
+}
+
+static int write_csv(struct loadgen *lg, const struct lg_totals *t, double connect_rate,
+        double publish_s, double deliver_s, const struct hdr_histogram *latency)
+{
+    FILE *fp;
+    size_t i;
+
+    fp = fopen(lg->csv, "a");
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s: %s\n", lg->csv, strerror(errno));
+        return 1;
+    }
+    if (ftell(fp) == 0) {
+        fprintf(fp, "label,scenario,transport,pubs,subs,qos,size,connect_per_s,sent,sent_msg_per_s,"
+                "sent_bytes_per_s,received,received_msg_per_s,received_bytes_per_s,lost,errors,mean_us");
+        for (i = 0; i < PERCENTILE_COUNT; i++) {
+            fprintf(fp, ",p%g_us", g_percentiles[i]);
+        }
+        fprintf(fp, ",max_us\n");
+    }
+    fprintf(fp, "%s,%s,%s,%d,%d,%d,%d,%.1f,%" PRIu64 ",%.1f,%.1f,%" PRIu64 ",%.1f,%.1f,%" PRIu64 ",%" PRIu64 ",%.1f",
+            lg->label ? lg->label : "", g_scenarios[lg->scenario],
+            lg->opts.transport == MOSQ_TRANSPORT_QUIC ? "quic" : "tcp",
+            lg->pubs, lg->subs, lg->opts.qos, lg->size, connect_rate,
+            t->sent, publish_s > 0 ? t->sent / publish_s : 0.0, publish_s > 0 ? t->sent_bytes / publish_s : 0.0,
+            t->received, deliver_s > 0 ? t->received / deliver_s : 0.0,
+            deliver_s > 0 ? t->received_bytes / deliver_s : 0.0,
+            expected_deliveries(lg, t) > t->received ? expected_deliveries(lg, t) - t->received : 0,
+            t->errors, hdr_mean(latency) / 1e3);
+    for (i = 0; i < PERCENTILE_COUNT; i++) {
+        fprintf(fp, ",%.1f", hdr_percentile(latency, g_percentiles[i]) / 1e3);
+    }
+    fprintf(fp, ",%.1f\n", latency->max / 1e3);
+    fclose(fp);
+    return 0;
+}
+
+static uint64_t retained_expected(struct loadgen *lg, const struct lg_totals *t)
+{
+    (void)t;
+    return (uint64_t)lg->pubs * (uint64_t)lg->count * (uint64_t)lg->subs;
+}
+
+static void print_usage(void)
+{
+    printf("mqtt_loadgen: load a broker with many publishers and subscribers.\n\n");
+    printf("Usage: mqtt_loadgen [-h host] [-p port] [--transport tcp|quic] [--scenario name]\n");
+    printf("                    [--pubs n] [--subs n] [--threads n] [-q qos] [-s size]\n");
+    printf("                    [-r rate] [-n count] [-d seconds] [--window n] [--drain ms]\n");
+    printf("                    [--keep-retained] [--label text] [--csv file]\n\n");
+    printf(" --scenario : fanin    - each publisher on its own topic, subscribers to all of them.\n");
+    printf("                         Defaults to 100 publishers and 1 subscriber.\n");
+    printf("              fanout   - publishers on one topic, every subscriber gets every message.\n");
+    printf("                         Defaults to 1 publisher and 100 subscribers.\n");
+    printf("              shared   - subscribers share one $share subscription.\n");
+    printf("                         Defaults to 10 publishers and 10 subscribers.\n");
+    printf("              retained - publishers store -n retained messages each on their own\n");
+    printf("                         topics, then subscribers fetch them all with a wildcard.\n");
+    printf("                         Latency is from the SUBSCRIBE. Defaults to 10 and 10.\n");
+    printf("                         At QoS 1 and 2 the broker only queues max_queued_messages\n");
+    printf("                         per subscriber, raise it to fetch more than that.\n");
+    printf(" --pubs, --subs : number of publishing and subscribing connections.\n");
+    printf(" --threads : worker threads, defaults to the number of CPUs.\n");
+    printf(" -q : QoS, defaults to 0.\n");
+    printf(" -s : payload size in bytes, at least %d, defaults to 64.\n", LATENCY_HEADER_SIZE);
+    printf(" -r : messages per second per publisher, 0 for as fast as possible, defaults to 0.\n");
+    printf(" -n : messages per publisher, defaults to 1000 for retained, otherwise run for -d.\n");
+    printf(" -d : seconds to publish for, defaults to 10.\n");
+    printf(" --window : most messages a publisher hands the library before they are sent or\n");
+    printf("            acknowledged, defaults to 100.\n");
+    printf(" --drain : stop waiting for deliveries once none arrived for this long, defaults\n");
+    printf("           to 5000ms.\n");
+    printf(" --keep-retained : leave the retained messages on the broker.\n");
+    printf(" --csv : append a summary row to this file, with a header row if it is new.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"transport",     required_argument, NULL, 'T'},
+        {"scenario",      required_argument, NULL, 'S'},
+        {"pubs",          required_argument, NULL, 'P'},
+        {"subs",          required_argument, NULL, 'M'},
+        {"threads",       required_argument, NULL, 'W'},
+        {"window",        required_argument, NULL, 'w'},
+        {"drain",         required_argument, NULL, 'D'},
+        {"keep-retained", no_argument,       NULL, 'k'},
+        {"label",         required_argument, NULL, 'L'},
+        {"csv",           required_argument, NULL, 'C'},
+        {"help",          no_argument,       NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    struct loadgen lg;
+    struct lg_client *client;
+    struct lg_worker *worker;
+    struct lg_totals t;
+    struct hdr_histogram *latency, *connect;
+    uint64_t start, connected_ns, run_start, run_end, deliver_start;
+    double connect_s, publish_s, deliver_s, connect_rate;
+    int opt, rc, i, ret = 0;
+
+    memset(&lg, 0, sizeof(lg));
+    latency_options_init(&lg.opts);
+    lg.opts.qos = 0;
+    lg.scenario = lg_fanin;
+    lg.pubs = -1;
+    lg.subs = -1;
+    lg.count = -1;
+    lg.duration = 10;
+    lg.size = 64;
+    lg.window = 100;
+    lg.drain_ms = 5000;
+    lg.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt_long(argc, argv, "h:p:q:s:r:n:d:", options, NULL)) != -1) {
+        rc = latency_option(&lg.opts, opt, optarg);
+        if (rc == 1) {
+            continue;
+        }
+        switch (opt) {
+            case 'S':
+                for (i = 0; i < (int)(sizeof(g_scenarios)/sizeof(g_scenarios[0])); i++) {
+                    if (!strcmp(optarg, g_scenarios[i])) break;
+                }
+                if (i == (int)(sizeof(g_scenarios)/sizeof(g_scenarios[0]))) {
+                    print_usage();
+                    return 1;
+                }
+                lg.scenario = (enum lg_scenario)i;
+                break;
+            case 'P': lg.pubs = atoi(optarg); break;
+            case 'M': lg.subs = atoi(optarg); break;
+            case 'W': lg.workers = atoi(optarg); break;
+            case 's': lg.size = atoi(optarg); break;
+            case 'r': lg.rate = atoi(optarg); break;
+            case 'n': lg.count = atol(optarg); break;
+            case 'd': lg.duration = atoi(optarg); break;
+            case 'w': lg.window = atoi(optarg); break;
+            case 'D': lg.drain_ms = atoi(optarg); break;
+            case 'k': lg.keep_retained = true; break;
+            case 'L': lg.label = optarg; break;
+            case 'C': lg.csv = optarg; break;
+            default:
+                print_usage();
+                return opt == 'H' ? 0 : 1;
+        }
+    }
+    if (lg.pubs < 0) {
+        lg.pubs = lg.scenario == lg_fanin ? 100 : lg.scenario == lg_fanout ? 1 : 10;
+    }
+    if (lg.subs < 0) {
+        lg.subs = lg.scenario == lg_fanin ? 1 : lg.scenario == lg_fanout ? 100 : 10;
+    }
+    if (lg.count < 0) {
+        lg.count = lg.scenario == lg_retained ? 1000 : 0;
+    }
+    if (lg.workers < 1) lg.workers = 1;
+    if (lg.workers > LG_MAX_WORKERS) lg.workers = LG_MAX_WORKERS;
+    if (lg.workers > lg.pubs + lg.subs) lg.workers = lg.pubs + lg.subs;
+    if (lg.pubs < 1 || lg.subs < 0 || lg.size < LATENCY_HEADER_SIZE || lg.rate < 0
+            || lg.duration < 1 || lg.window < 1 || lg.drain_ms < 0
+            || (lg.scenario == lg_retained && lg.count < 1)) {
+        print_usage();
+        return 1;
+    }
+    if (lg.opts.transport == 0) {
+        lg.opts.transport = MOSQ_TRANSPORT_TCP;
+    }
+
+    snprintf(lg.base, sizeof(lg.base), "loadgen/%d", (int)getpid());
+    switch (lg.scenario) {
+        case lg_fanin: snprintf(lg.filter, sizeof(lg.filter), "%s/in/+", lg.base); break;
+        case lg_fanout: snprintf(lg.filter, sizeof(lg.filter), "%s/out", lg.base); break;
+        case lg_shared: snprintf(lg.filter, sizeof(lg.filter), "$share/loadgen/%s/shared/+", lg.base); break;
+        case lg_retained: snprintf(lg.filter, sizeof(lg.filter), "%s/retained/#", lg.base); break;
+    }
+
+    signal(SIGINT, sig_handle);
+    signal(SIGTERM, sig_handle);
+    mosquitto_lib_init();
+
+    latency = hdr_new();
+    connect = hdr_new();
+    lg.clients = calloc((size_t)(lg.pubs + lg.subs), sizeof(struct lg_client));
+    lg.worker = calloc((size_t)lg.workers, sizeof(struct lg_worker));
+    if (!latency || !connect || !lg.clients || !lg.worker) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (i = 0; i < lg.workers; i++) {
+        worker = &lg.worker[i];
+        worker->lg = &lg;
+        worker->clients = calloc((size_t)((lg.pubs + lg.subs) / lg.workers + 1), sizeof(struct lg_client *));
+        worker->latency = hdr_new();
+        worker->connect = hdr_new();
+        if (!worker->clients || !worker->latency || !worker->connect) {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for (i = 0; i < lg.pubs + lg.subs; i++) {
+        client = &lg.clients[i];
+        client->is_pub = i < lg.pubs;
+        client->index = client->is_pub ? i : i - lg.pubs;
+        client->worker = &lg.worker[i % lg.workers];
+        client->worker->clients[client->worker->client_count++] = client;
+
+        client->mosq = mosquitto_new(NULL, true, client);
+        if (!client->mosq) {
+            fprintf(stderr, "Unable to create client.\n");
+            return 1;
+        }
+        rc = mosquitto_int_option(client->mosq, MOSQ_OPT_TRANSPORT, lg.opts.transport);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            fprintf(stderr, "Unable to use that transport: %s\n", mosquitto_strerror(rc));
+            return 1;
+        }
+        mosquitto_connect_callback_set(client->mosq, on_connect);
+        mosquitto_disconnect_callback_set(client->mosq, on_disconnect);
+        mosquitto_subscribe_callback_set(client->mosq, on_subscribe);
+        mosquitto_publish_callback_set(client->mosq, on_publish);
+        mosquitto_message_callback_set(client->mosq, on_message);
+    }
+
+    printf("%s over %s: %d publishers, %d subscribers, %d threads, QoS %d, %d byte payloads\n",
+            g_scenarios[lg.scenario], lg.opts.transport == MOSQ_TRANSPORT_QUIC ? "quic" : "tcp",
+            lg.pubs, lg.subs, lg.workers, lg.opts.qos, lg.size);
+
+    /* Connect */
+    start = now_ns();
+    for (i = 0; i < lg.workers; i++) {
+        if (pthread_create(&lg.worker[i].thread, NULL, worker_run, &lg.worker[i])) {
+            fprintf(stderr, "Unable to start worker.\n");
+            return 1;
+        }
+    }
+    do {
+        usleep(1000);
+        totals_get(&lg, &t);
+    } while (!g_stop && t.connected + t.failed < lg.pubs + lg.subs
+            && now_ns() - start < LG_CONNECT_TIMEOUT*1000000000ULL);
+    connected_ns = now_ns();
+    connect_s = (connected_ns - start) / 1e9;
+    connect_rate = connect_s > 0 ? t.connected / connect_s : 0.0;
+    printf("connect: %d of %d in %.3fs, %.1f conn/s\n", t.connected, lg.pubs + lg.subs, connect_s, connect_rate);
+    if (lg.scenario != lg_retained) {
+        while (!g_stop && t.subscribed + t.failed < lg.subs) {
+            usleep(1000);
+            totals_get(&lg, &t);
+        }
+    }
+
+    /* Publish */
+    run_start = now_ns();
+    for (i = 0; i < lg.pubs; i++) {
+        lg.clients[i].next_ns = run_start;
+    }
+    lg.phase = lg_phase_run;
+    lg.publishing = true;
+    if (lg.count) {
+        do {
+            usleep(1000);
+            totals_get(&lg, &t);
+        } while (!g_stop && t.pubs_done < lg.pubs);
+    } else {
+        while (!g_stop && now_ns() - run_start < (uint64_t)lg.duration*1000000000ULL) {
+            usleep(10000);
+        }
+    }
+    lg.publishing = false;
+    run_end = now_ns();
+    publish_s = (run_end - run_start) / 1e9;
+
+    /* Deliver */
+    deliver_start = run_start;
+    if (lg.scenario == lg_retained) {
+        deliver_start = now_ns();
+        lg.phase = lg_phase_subscribe;
+        wait_drain(&lg, retained_expected);
+    } else {
+        wait_drain(&lg, expected_deliveries);
+    }
+    totals_get(&lg, &t);
+    deliver_s = t.last_recv_ns > deliver_start ? (t.last_recv_ns - deliver_start) / 1e9 : 0.0;
+
+    if (lg.scenario == lg_retained && !lg.keep_retained) {
+        lg.phase = lg_phase_clear;
+        do {
+            usleep(1000);
+            totals_get(&lg, &t);
+        } while (!g_stop && t.pubs_done < lg.pubs);
+        totals_get(&lg, &t);
+    }
+
+    lg.phase = lg_phase_stop;
+    for (i = 0; i < lg.workers; i++) {
+        pthread_join(lg.worker[i].thread, NULL);
+    }
+
+    merge_histograms(&lg, latency, connect);
+    print_histogram("connect latency", connect);
+    printf("publish: %" PRIu64 " messages in %.3fs, %.1f msg/s, %.1f bytes/s\n",
+            t.sent, publish_s, publish_s > 0 ? t.sent / publish_s : 0.0,
+            publish_s > 0 ? t.sent_bytes / publish_s : 0.0);
+    if (lg.scenario == lg_retained) {
+        printf("deliver: %" PRIu64 " of %" PRIu64 " in %.3fs, %.1f msg/s, %.1f bytes/s\n",
+                t.received, retained_expected(&lg, &t), deliver_s,
+                deliver_s > 0 ? t.received / deliver_s : 0.0, deliver_s > 0 ? t.received_bytes / deliver_s : 0.0);
+    } else {
+        printf("deliver: %" PRIu64 " of %" PRIu64 " in %.3fs, %.1f msg/s, %.1f bytes/s\n",
+                t.received, expected_deliveries(&lg, &t), deliver_s,
+                deliver_s > 0 ? t.received / deliver_s : 0.0, deliver_s > 0 ? t.received_bytes / deliver_s : 0.0);
+    }
+    print_histogram(lg.scenario == lg_retained ? "subscribe to message" : "end to end latency", latency);
+    if (t.failed || t.errors) {
+        printf("failed connections %d, publish errors %" PRIu64 "\n", t.failed, t.errors);
+    }
+    if (lg.csv) {
+        ret = write_csv(&lg, &t, connect_rate, publish_s, deliver_s, latency);
+    }
+
+    for (i = 0; i < lg.pubs + lg.subs; i++) {
+        client = &lg.clients[i];
+        if (lg.opts.transport == MOSQ_TRANSPORT_QUIC) {
+            mosquitto_loop_stop(client->mosq, false);
+        }
+        mosquitto_destroy(client->mosq);
+    }
+    for (i = 0; i < lg.workers; i++) {
+        free(lg.worker[i].clients);
+        free(lg.worker[i].latency);
+        free(lg.worker[i].connect);
+        pthread_mutex_destroy(&lg.worker[i].lock);
+    }
+    free(lg.worker);
+    free(lg.clients);
+    free(latency);
+    free(connect);
+    mosquitto_lib_cleanup();
+    return ret;
+}
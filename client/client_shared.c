@@ -195,6 +195,12 @@ static void init_config(struct mosq_config *cfg, int pub_or_sub)
 	cfg->repeat_delay.tv_sec = 0;
 	cfg->repeat_delay.tv_usec = 0;
 	cfg->random_filter = 10000;
+#ifdef WITH_QUIC
+	cfg->quic_initial_rtt = -1;
+	cfg->quic_stream_window = -1;
+	cfg->quic_conn_window = -1;
+	cfg->quic_keepalive = -1;
+#endif
 	if(pub_or_sub == CLIENT_RR){
 		cfg->protocol_version = MQTT_PROTOCOL_V5;
 		cfg->msg_count = 1;
@@ -220,6 +226,9 @@ void client_config_cleanup(struct mosq_config *cfg)
 	free(cfg->will_payload);
 	free(cfg->format);
 	free(cfg->response_topic);
+#ifdef WITH_QUIC
+	free(cfg->quic_cc);
+#endif
 #ifdef WITH_TLS
 	free(cfg->cafile);
 	free(cfg->capath);
@@ -731,14 +740,27 @@ int client_config_line_proc(struct mosq_config *cfg, int pub_or_sub, int argc, c
 				if(!strncasecmp(url, "mqtt://", 7)) {
 					url += 7;
 					cfg->port = 1883;
+#ifdef WITH_TCP
+					cfg->transport = MOSQ_TRANSPORT_TCP;
+#endif
 				} else if(!strncasecmp(url, "mqtts://", 8)) {
 #ifdef WITH_TLS
 					url += 8;
 					cfg->port = 8883;
 					cfg->tls_use_os_certs = true;
+					cfg->transport = MOSQ_TRANSPORT_TCP;
 #else
 					fprintf(stderr, "Error: TLS support not available.\n\n");
 					return 1;
+#endif
+				} else if(!strncasecmp(url, "mqtt+quic://", 12)) {
+#ifdef WITH_QUIC
+					url += 12;
+					cfg->port = 1883;
+					cfg->transport = MOSQ_TRANSPORT_QUIC;
+#else
+					fprintf(stderr, "Error: QUIC support not available.\n\n");
+					return 1;
 #endif
 				} else {
 					fprintf(stderr, "Error: unsupported URL scheme.\n\n");
@@ -911,6 +933,75 @@ int client_config_line_proc(struct mosq_config *cfg, int pub_or_sub, int argc, c
 			i++;
 		}else if(!strcmp(argv[i], "--quiet")){
 			cfg->quiet = true;
+#ifdef WITH_QUIC
+		}else if(!strcmp(argv[i], "--quic-cc")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --quic-cc argument given but no algorithm specified.\n\n");
+				return 1;
+			}else{
+				if(strcasecmp(argv[i+1], "cubic") && strcasecmp(argv[i+1], "bbr")){
+					fprintf(stderr, "Error: Invalid --quic-cc value, it must be cubic or bbr.\n\n");
+					return 1;
+				}
+				free(cfg->quic_cc);
+				cfg->quic_cc = strdup(argv[i+1]);
+			}
+			i++;
+		}else if(!strcmp(argv[i], "--quic-conn-window")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --quic-conn-window argument given but no size specified.\n\n");
+				return 1;
+			}else{
+				cfg->quic_conn_window = atoi(argv[i+1]);
+				if(cfg->quic_conn_window < 1){
+					fprintf(stderr, "Error: Invalid --quic-conn-window value, it must be greater than 0.\n\n");
+					return 1;
+				}
+			}
+			i++;
+		}else if(!strcmp(argv[i], "--quic-ecn")){
+			cfg->quic_ecn = true;
+		}else if(!strcmp(argv[i], "--quic-initial-rtt")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --quic-initial-rtt argument given but no time specified.\n\n");
+				return 1;
+			}else{
+				cfg->quic_initial_rtt = atoi(argv[i+1]);
+				if(cfg->quic_initial_rtt < 1){
+					fprintf(stderr, "Error: Invalid --quic-initial-rtt value, it must be greater than 0.\n\n");
+					return 1;
+				}
+			}
+			i++;
+		}else if(!strcmp(argv[i], "--quic-keepalive")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --quic-keepalive argument given but no interval specified.\n\n");
+				return 1;
+			}else{
+				cfg->quic_keepalive = atoi(argv[i+1]);
+				if(cfg->quic_keepalive < 0){
+					fprintf(stderr, "Error: Invalid --quic-keepalive value, it must be 0 or greater.\n\n");
+					return 1;
+				}
+			}
+			i++;
+		}else if(!strcmp(argv[i], "--quic-no-pacing")){
+			cfg->quic_no_pacing = true;
+		}else if(!strcmp(argv[i], "--quic-no-send-buffering")){
+			cfg->quic_no_send_buffering = true;
+		}else if(!strcmp(argv[i], "--quic-stream-window")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --quic-stream-window argument given but no size specified.\n\n");
+				return 1;
+			}else{
+				cfg->quic_stream_window = atoi(argv[i+1]);
+				if(cfg->quic_stream_window < 1 || (cfg->quic_stream_window & (cfg->quic_stream_window - 1))){
+					fprintf(stderr, "Error: Invalid --quic-stream-window value, it must be a power of two.\n\n");
+					return 1;
+				}
+			}
+			i++;
+#endif
 		}else if(!strcmp(argv[i], "-r") || !strcmp(argv[i], "--retain")){
 			if(pub_or_sub != CLIENT_PUB){
 				goto unknown_option;
@@ -1094,6 +1185,21 @@ int client_config_line_proc(struct mosq_config *cfg, int pub_or_sub, int argc, c
 				cfg->unsub_topics[cfg->unsub_topic_count-1] = strdup(argv[i+1]);
 			}
 			i++;
+		}else if(!strcmp(argv[i], "--transport")){
+			if(i==argc-1){
+				fprintf(stderr, "Error: --transport argument given but no transport specified.\n\n");
+				return 1;
+			}else{
+				if(!strcasecmp(argv[i+1], "tcp")){
+					cfg->transport = MOSQ_TRANSPORT_TCP;
+				}else if(!strcasecmp(argv[i+1], "quic")){
+					cfg->transport = MOSQ_TRANSPORT_QUIC;
+				}else{
+					fprintf(stderr, "Error: Invalid --transport value, it must be tcp or quic.\n\n");
+					return 1;
+				}
+			}
+			i++;
 		}else if(!strcmp(argv[i], "-u") || !strcmp(argv[i], "--username")){
 			if(i==argc-1){
 				fprintf(stderr, "Error: -u argument given but no username specified.\n\n");
@@ -1109,6 +1215,9 @@ int client_config_line_proc(struct mosq_config *cfg, int pub_or_sub, int argc, c
 			}else{
 				cfg->host = strdup(argv[i+1]);
 				cfg->port = 0;
+#ifdef WITH_TCP
+				cfg->transport = MOSQ_TRANSPORT_TCP;
+#endif
 			}
 			i++;
 		}else if(!strcmp(argv[i], "-V") || !strcmp(argv[i], "--protocol-version")){
@@ -1252,6 +1361,11 @@ int client_opts_set(struct mosquitto *mosq, struct mosq_config *cfg)
 		mosquitto_lib_cleanup();
 		return 1;
 	}
+	if(cfg->transport && mosquitto_int_option(mosq, MOSQ_OPT_TRANSPORT, cfg->transport)){
+		err_printf(cfg, "Error: Problem setting transport, this build may not support it.\n");
+		mosquitto_lib_cleanup();
+		return 1;
+	}
 #ifdef WITH_TCP
 #ifdef WITH_TLS
 	if(cfg->keyform && mosquitto_string_option(mosq, MOSQ_OPT_TLS_KEYFORM, cfg->keyform)){
@@ -1326,6 +1440,23 @@ int client_opts_set(struct mosquitto *mosq, struct mosq_config *cfg)
 	}
 #endif
 #ifdef WITH_QUIC
+	if(cfg->quic_cc && mosquitto_string_option(mosq, MOSQ_OPT_QUIC_CONGESTION_CONTROL, cfg->quic_cc)){
+		err_printf(cfg, "Error: Problem setting QUIC congestion control.\n");
+		mosquitto_lib_cleanup();
+		return 1;
+	}
+	if((cfg->quic_initial_rtt > 0 && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_INITIAL_RTT, cfg->quic_initial_rtt))
+			|| (cfg->quic_stream_window > 0 && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_STREAM_WINDOW, cfg->quic_stream_window))
+			|| (cfg->quic_conn_window > 0 && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_CONN_WINDOW, cfg->quic_conn_window))
+			|| (cfg->quic_keepalive >= 0 && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_KEEPALIVE_INTERVAL, cfg->quic_keepalive))
+			|| (cfg->quic_no_pacing && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_PACING, 0))
+			|| (cfg->quic_no_send_buffering && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_SEND_BUFFERING, 0))
+			|| (cfg->quic_ecn && mosquitto_int_option(mosq, MOSQ_OPT_QUIC_ECN, 1))){
+
+		err_printf(cfg, "Error: Problem setting QUIC options, check the options are valid.\n");
+		mosquitto_lib_cleanup();
+		return 1;
+	}
 	if(mosquitto_quic_set(mosq))
 	{
 		err_printf(cfg, "Error: Problem setting QUIC.\n");
@@ -130,6 +130,17 @@ struct mosq_config {
 	bool have_topic_alias; /* pub */
 	char *response_topic; /* rr */
 	bool tcp_nodelay;
+	int transport; /* MOSQ_TRANSPORT_*, or 0 for the library default. */
+#ifdef WITH_QUIC
+	char *quic_cc;
+	int quic_initial_rtt; /* Negative to use the msquic default. */
+	int quic_stream_window;
+	int quic_conn_window;
+	int quic_keepalive;
+	bool quic_no_pacing;
+	bool quic_no_send_buffering;
+	bool quic_ecn;
+#endif
 };
 
 int client_config_load(struct mosq_config *config, int pub_or_sub, int argc, char *argv[]);
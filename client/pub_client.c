@@ -409,6 +409,7 @@ static void print_usage(void)
 #else
 	printf("                     [-A bind_address] [--nodelay]\n");
 #endif
+	printf("                     [--transport {tcp|quic}]\n");
 	printf("                     [-i id] [-I id_prefix]\n");
 	printf("                     [-d] [--quiet]\n");
 	printf("                     [-M max_inflight]\n");
@@ -426,6 +427,11 @@ static void print_usage(void)
 #endif
 #ifdef WITH_SOCKS
 	printf("                     [--proxy socks-url]\n");
+#endif
+#ifdef WITH_QUIC
+	printf("                     [--quic-cc {cubic|bbr}] [--quic-initial-rtt ms] [--quic-keepalive ms]\n");
+	printf("                     [--quic-stream-window bytes] [--quic-conn-window bytes]\n");
+	printf("                     [--quic-no-pacing] [--quic-no-send-buffering] [--quic-ecn]\n");
 #endif
 	printf("                     [--property command identifier value]\n");
 	printf("                     [-D command identifier value]\n");
@@ -447,6 +453,9 @@ static void print_usage(void)
 	printf(" -k : keep alive in seconds for this client. Defaults to 60.\n");
 	printf(" -L : specify user, password, hostname, port and topic as a URL in the form:\n");
 	printf("      mqtt(s)://[username[:password]@]host[:port]/topic\n");
+#ifdef WITH_QUIC
+	printf("      Use mqtt+quic:// to connect over QUIC.\n");
+#endif
 	printf(" -l : read messages from stdin, sending a separate message for each line.\n");
 	printf(" -m : message payload to send.\n");
 	printf(" -M : the maximum inflight messages for QoS 1/2..\n");
@@ -473,6 +482,7 @@ static void print_usage(void)
 	printf(" --quiet : don't print error messages.\n");
 	printf(" --repeat : if publish mode is -f, -m, or -s, then repeat the publish N times.\n");
 	printf(" --repeat-delay : if using --repeat, wait time seconds between publishes. Defaults to 0.\n");
+	printf(" --transport : connect over tcp or quic. Defaults to quic if supported, otherwise tcp.\n");
 	printf(" --unix : connect to a broker through a unix domain socket instead of a TCP socket,\n");
 	printf("          e.g. /tmp/mosquitto.sock\n");
 	printf(" --will-payload : payload for the client Will, which is sent by the broker in case of\n");
@@ -508,6 +518,16 @@ static void print_usage(void)
 	printf(" --proxy : SOCKS5 proxy URL of the form:\n");
 	printf("           socks5h://[username[:password]@]hostname[:port]\n");
 	printf("           Only \"none\" and \"username\" authentication is supported.\n");
+#endif
+#ifdef WITH_QUIC
+	printf(" --quic-cc : QUIC congestion control algorithm, cubic or bbr.\n");
+	printf(" --quic-conn-window : QUIC connection flow control window in bytes.\n");
+	printf(" --quic-ecn : use Explicit Congestion Notification where the network supports it.\n");
+	printf(" --quic-initial-rtt : round trip time in ms to assume before it has been measured.\n");
+	printf(" --quic-keepalive : send a QUIC PING after this many ms without traffic, 0 to disable.\n");
+	printf(" --quic-no-pacing : send as soon as the congestion window allows, without pacing.\n");
+	printf(" --quic-no-send-buffering : don't buffer data ahead of the congestion window.\n");
+	printf(" --quic-stream-window : QUIC stream flow control window in bytes, a power of two.\n");
 #endif
 	printf("\nSee https://mosquitto.org/ for more information.\n\n");
 }
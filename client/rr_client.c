@@ -181,6 +181,7 @@ static void print_usage(void)
 #else
 	printf("                    [-A bind_address] [--nodelay]\n");
 #endif
+	printf("                    [--transport {tcp|quic}]\n");
 	printf("                    [-i id] [-I id_prefix]\n");
 	printf("                    [-d] [-N] [--quiet] [-v]\n");
 	printf("                    [--will-topic [--will-payload payload] [--will-qos qos] [--will-retain]]\n");
@@ -215,6 +216,9 @@ static void print_usage(void)
 	printf(" -k : keep alive in seconds for this client. Defaults to 60.\n");
 	printf(" -L : specify user, password, hostname, port and topic as a URL in the form:\n");
 	printf("      mqtt(s)://[username[:password]@]host[:port]/topic\n");
+#ifdef WITH_QUIC
+	printf("      Use mqtt+quic:// to connect over QUIC.\n");
+#endif
 	printf(" -N : do not add an end of line character when printing the payload.\n");
 	printf(" -p : network port to connect to. Defaults to 1883 for plain MQTT and 8883 for MQTT over TLS.\n");
 	printf(" -P : provide a password\n");
@@ -241,6 +245,7 @@ static void print_usage(void)
 	printf(" --pretty : print formatted output rather than minimised output when using the\n");
 	printf("            JSON output format option.\n");
 	printf(" --quiet : don't print error messages.\n");
+	printf(" --transport : connect over tcp or quic. Defaults to quic if supported, otherwise tcp.\n");
 	printf(" --unix : connect to a broker through a unix domain socket instead of a TCP socket,\n");
 	printf("          e.g. /tmp/mosquitto.sock\n");
 	printf(" --will-payload : payload for the client Will, which is sent by the broker in case of\n");
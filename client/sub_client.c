@@ -203,6 +203,7 @@ static void print_usage(void)
 #else
 	printf("                     [-A bind_address] [--nodelay]\n");
 #endif
+	printf("                     [--transport {tcp|quic}]\n");
 	printf("                     [-i id] [-I id_prefix]\n");
 	printf("                     [-d] [-N] [--quiet] [-v]\n");
 	printf("                     [--will-topic [--will-payload payload] [--will-qos qos] [--will-retain]]\n");
@@ -218,6 +219,11 @@ static void print_usage(void)
 #endif
 #ifdef WITH_SOCKS
 	printf("                     [--proxy socks-url]\n");
+#endif
+#ifdef WITH_QUIC
+	printf("                     [--quic-cc {cubic|bbr}] [--quic-initial-rtt ms] [--quic-keepalive ms]\n");
+	printf("                     [--quic-stream-window bytes] [--quic-conn-window bytes]\n");
+	printf("                     [--quic-no-pacing] [--quic-no-send-buffering] [--quic-ecn]\n");
 #endif
 	printf("                     [-D command identifier value]\n");
 	printf("       mosquitto_sub --help\n\n");
@@ -240,6 +246,9 @@ static void print_usage(void)
 	printf(" -k : keep alive in seconds for this client. Defaults to 60.\n");
 	printf(" -L : specify user, password, hostname, port and topic as a URL in the form:\n");
 	printf("      mqtt(s)://[username[:password]@]host[:port]/topic\n");
+#ifdef WITH_QUIC
+	printf("      Use mqtt+quic:// to connect over QUIC.\n");
+#endif
 	printf(" -N : do not add an end of line character when printing the payload.\n");
 	printf(" -p : network port to connect to. Defaults to 1883 for plain MQTT and 8883 for MQTT over TLS.\n");
 	printf(" -P : provide a password\n");
@@ -275,6 +284,7 @@ static void print_usage(void)
 	printf("                   first non-retained message is received.\n");
 	printf(" --remove-retained : send a message to the server to clear any received retained messages\n");
 	printf("                     Use -T to filter out messages you do not want to be cleared.\n");
+	printf(" --transport : connect over tcp or quic. Defaults to quic if supported, otherwise tcp.\n");
 	printf(" --unix : connect to a broker through a unix domain socket instead of a TCP socket,\n");
 	printf("          e.g. /tmp/mosquitto.sock\n");
 	printf(" --will-payload : payload for the client Will, which is sent by the broker in case of\n");
@@ -310,6 +320,16 @@ static void print_usage(void)
 	printf(" --proxy : SOCKS5 proxy URL of the form:\n");
 	printf("           socks5h://[username[:password]@]hostname[:port]\n");
 	printf("           Only \"none\" and \"username\" authentication is supported.\n");
+#endif
+#ifdef WITH_QUIC
+	printf(" --quic-cc : QUIC congestion control algorithm, cubic or bbr.\n");
+	printf(" --quic-conn-window : QUIC connection flow control window in bytes.\n");
+	printf(" --quic-ecn : use Explicit Congestion Notification where the network supports it.\n");
+	printf(" --quic-initial-rtt : round trip time in ms to assume before it has been measured.\n");
+	printf(" --quic-keepalive : send a QUIC PING after this many ms without traffic, 0 to disable.\n");
+	printf(" --quic-no-pacing : send as soon as the congestion window allows, without pacing.\n");
+	printf(" --quic-no-send-buffering : don't buffer data ahead of the congestion window.\n");
+	printf(" --quic-stream-window : QUIC stream flow control window in bytes, a power of two.\n");
 #endif
 	printf("\nSee https://mosquitto.org/ for more information.\n\n");
 }
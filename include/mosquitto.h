@@ -146,6 +146,21 @@ enum mosq_opt_t {
 	MOSQ_OPT_TCP_NODELAY = 11,
 	MOSQ_OPT_BIND_ADDRESS = 12,
 	MOSQ_OPT_TLS_USE_OS_CERTS = 13,
+	MOSQ_OPT_QUIC_RESUMPTION_FILE = 14,
+	MOSQ_OPT_QUIC_ZERO_RTT = 15,
+	MOSQ_OPT_QUIC_LANES = 16,
+	MOSQ_OPT_QUIC_LANE_MODE = 17,
+	MOSQ_OPT_QUIC_LANE = 18,
+	MOSQ_OPT_QUIC_DATAGRAM = 19,
+	MOSQ_OPT_QUIC_CONGESTION_CONTROL = 20,
+	MOSQ_OPT_QUIC_PACING = 21,
+	MOSQ_OPT_QUIC_INITIAL_RTT = 22,
+	MOSQ_OPT_QUIC_STREAM_WINDOW = 23,
+	MOSQ_OPT_QUIC_CONN_WINDOW = 24,
+	MOSQ_OPT_QUIC_KEEPALIVE_INTERVAL = 25,
+	MOSQ_OPT_QUIC_SEND_BUFFERING = 26,
+	MOSQ_OPT_QUIC_ECN = 27,
+	MOSQ_OPT_TRANSPORT = 28,
 };
 
 
@@ -156,6 +171,18 @@ enum mosq_opt_t {
 #define MQTT_PROTOCOL_V311 4
 #define MQTT_PROTOCOL_V5 5
 
+/* Values for MOSQ_OPT_TRANSPORT */
+#define MOSQ_TRANSPORT_TCP 1
+#define MOSQ_TRANSPORT_QUIC 4
+
+/* Values for MOSQ_OPT_QUIC_LANE_MODE */
+#define MOSQ_QUIC_LANE_BY_TOPIC 0
+#define MOSQ_QUIC_LANE_BY_QOS 1
+#define MOSQ_QUIC_LANE_BY_APP 2
+
+/* Priority a QUIC lane starts with, see mosquitto_quic_lane_priority_set() */
+#define MOSQ_QUIC_PRIORITY_DEFAULT 0x7FFF
+
 /* Struct: mosquitto_message
  *
  * Contains details of a PUBLISH message.
@@ -183,6 +210,51 @@ struct mosquitto_message{
 	bool retain;
 };
 
+/* Struct: mosquitto_quic_stats
+ *
+ * Transport statistics for a QUIC connection, taken from msquic's
+ * QUIC_STATISTICS_V2. Counters are totals since the connection started.
+ *
+ * uint32_t rtt, min_rtt, max_rtt, rtt_variance - round trip time in
+ *           microseconds.
+ * uint32_t congestion_window - the congestion window in bytes.
+ * uint16_t path_mtu - the path MTU in bytes.
+ * uint64_t send_packets, send_bytes - packets and bytes sent.
+ * uint64_t send_lost_packets - packets suspected lost and retransmitted.
+ * uint64_t send_spurious_lost_packets - of those, packets that later turned
+ *           out not to be lost.
+ * uint32_t congestion_events - times the congestion window was reduced.
+ * uint32_t persistent_congestion_events - times persistent congestion was
+ *           detected.
+ * uint32_t ecn_congestion_events - congestion events signalled by ECN.
+ * uint64_t recv_packets, recv_bytes - packets and bytes received.
+ * uint64_t recv_reordered_packets, recv_dropped_packets,
+ * uint64_t recv_duplicate_packets - received packets that were out of order,
+ *           dropped or duplicates.
+ * bool resumed - the connection resumed an earlier session.
+ */
+struct mosquitto_quic_stats{
+	uint32_t rtt;
+	uint32_t min_rtt;
+	uint32_t max_rtt;
+	uint32_t rtt_variance;
+	uint32_t congestion_window;
+	uint16_t path_mtu;
+	uint64_t send_packets;
+	uint64_t send_bytes;
+	uint64_t send_lost_packets;
+	uint64_t send_spurious_lost_packets;
+	uint32_t congestion_events;
+	uint32_t persistent_congestion_events;
+	uint32_t ecn_congestion_events;
+	uint64_t recv_packets;
+	uint64_t recv_bytes;
+	uint64_t recv_reordered_packets;
+	uint64_t recv_dropped_packets;
+	uint64_t recv_duplicate_packets;
+	bool resumed;
+};
+
 struct mosquitto;
 typedef struct mqtt5__property mosquitto_property;
 
@@ -1439,9 +1511,11 @@ libmosq_EXPORT int mosquitto_loop_misc(struct mosquitto *mosq);
  *	mosq - a valid mosquitto instance.
  *
  * Returns:
- *	The socket for the mosquitto client or -1 on failure.
+ *	The socket for the mosquitto client or -1 on failure. QUIC connections
+ *	have no socket of their own, so this is also -1 when the transport is
+ *	MOSQ_TRANSPORT_QUIC; use <mosquitto_loop_start> for those.
  */
-// libmosq_EXPORT int mosquitto_socket(struct mosquitto *mosq);
+libmosq_EXPORT int mosquitto_socket(struct mosquitto *mosq);
 
 /*
  * Function: mosquitto_want_write
@@ -1574,6 +1648,79 @@ libmosq_EXPORT int mosquitto_opts_set(struct mosquitto *mosq, enum mosq_opt_t op
  *	MOSQ_OPT_TLS_USE_OS_CERTS - Set to 1 to instruct the client to load and
  *	          trust OS provided CA certificates for use with TLS connections.
  *	          Set to 0 (the default) to only use manually specified CA certs.
+ *
+ *	MOSQ_OPT_QUIC_ZERO_RTT - QUIC only. When a resumption ticket for the
+ *	          broker is available, send CONNECT as 0-RTT early data without
+ *	          waiting for the handshake to complete. Early data can be replayed
+ *	          by an attacker on the network, set to 0 to always wait for the
+ *	          handshake. Tickets are still used to shorten the handshake.
+ *	          Defaults to 1.
+ *
+ *	MOSQ_OPT_QUIC_LANES - QUIC only. The number of QUIC streams, or lanes,
+ *	          to use, between 1 and 8 inclusive. Lane 0 carries CONNECT,
+ *	          subscriptions, acknowledgements and pings. When more than one
+ *	          lane is used, PUBLISH packets are spread over the other lanes
+ *	          so that a packet lost on one lane does not hold up the others.
+ *	          Packets on the same lane are delivered in order, packets on
+ *	          different lanes are not ordered relative to each other. The
+ *	          broker delivers messages on a lane chosen by topic. Must be set
+ *	          before <mosquitto_connect>. Defaults to 1.
+ *
+ *	MOSQ_OPT_QUIC_LANE_MODE - QUIC only. How outgoing PUBLISH packets are
+ *	          assigned to lanes. MOSQ_QUIC_LANE_BY_TOPIC (the default) hashes
+ *	          the topic, so all messages on a topic stay in order.
+ *	          MOSQ_QUIC_LANE_BY_QOS uses one lane per QoS level.
+ *	          MOSQ_QUIC_LANE_BY_APP uses the lane set with MOSQ_OPT_QUIC_LANE.
+ *	          Topics added with <mosquitto_quic_lane_topic_add> go to their
+ *	          own lane whatever the mode, and the first two modes then only
+ *	          use the remaining lanes.
+ *
+ *	MOSQ_OPT_QUIC_LANE - QUIC only. The lane used for subsequent publishes
+ *	          when the lane mode is MOSQ_QUIC_LANE_BY_APP, between 0 and one
+ *	          less than MOSQ_OPT_QUIC_LANES.
+ *
+ *	MOSQ_OPT_QUIC_DATAGRAM - QUIC only. Set to 1 to send QoS 0 PUBLISH
+ *	          packets as unreliable QUIC DATAGRAM frames, and to let the
+ *	          broker do the same for QoS 0 messages it delivers. Lost
+ *	          datagrams are not retransmitted, so stale values are dropped
+ *	          rather than delaying newer ones. Messages too large for a
+ *	          datagram, or using a topic alias, are sent on a stream as
+ *	          usual. Must be set before <mosquitto_connect>. Defaults to 0.
+ *
+ *	The following QUIC only options tune the transport. They apply from the
+ *	next <mosquitto_connect> or <mosquitto_reconnect>, and unless set the
+ *	msquic defaults are used.
+ *
+ *	MOSQ_OPT_QUIC_PACING - Set to 0 to send packets as soon as the congestion
+ *	          window allows rather than spreading them out over the RTT.
+ *
+ *	MOSQ_OPT_QUIC_INITIAL_RTT - The RTT in milliseconds assumed before it
+ *	          has been measured. Must be greater than 0.
+ *
+ *	MOSQ_OPT_QUIC_STREAM_WINDOW - The flow control window of each stream
+ *	          in bytes. Must be a power of two.
+ *
+ *	MOSQ_OPT_QUIC_CONN_WINDOW - The flow control window of the connection
+ *	          as a whole in bytes. Must be greater than 0.
+ *
+ *	MOSQ_OPT_QUIC_KEEPALIVE_INTERVAL - Send a QUIC PING after this many
+ *	          milliseconds without other traffic, to keep NAT bindings open
+ *	          between MQTT keepalives. 0 disables QUIC keepalives.
+ *
+ *	MOSQ_OPT_QUIC_SEND_BUFFERING - Set to 0 to stop msquic buffering data
+ *	          sent ahead of the congestion window.
+ *
+ *	MOSQ_OPT_QUIC_ECN - Set to 1 to use Explicit Congestion Notification
+ *	          where the network supports it.
+ *
+ *	MOSQ_OPT_TRANSPORT - The transport to use for the next connection, either
+ *	          MOSQ_TRANSPORT_TCP or MOSQ_TRANSPORT_QUIC. Returns
+ *	          MOSQ_ERR_NOT_SUPPORTED if the library was built without that
+ *	          transport. Takes effect on the next <mosquitto_connect> or
+ *	          <mosquitto_reconnect>, so a client that fails to connect over
+ *	          QUIC can set MOSQ_TRANSPORT_TCP and try again on the same
+ *	          instance. Defaults to MOSQ_TRANSPORT_QUIC if the library was
+ *	          built with QUIC support, otherwise MOSQ_TRANSPORT_TCP.
  */
 libmosq_EXPORT int mosquitto_int_option(struct mosquitto *mosq, enum mosq_opt_t option, int value);
 
@@ -1615,6 +1762,17 @@ libmosq_EXPORT int mosquitto_int_option(struct mosquitto *mosq, enum mosq_opt_t
  *
  *	MOSQ_OPT_BIND_ADDRESS - Set the hostname or ip address of the local network
  *	          interface to bind to when connecting.
+ *
+ *	MOSQ_OPT_QUIC_RESUMPTION_FILE - QUIC only. Path of a file used to keep
+ *	          session resumption tickets across process restarts. Tickets
+ *	          are always cached in memory per broker host and port, this
+ *	          option additionally loads them from and saves them to the file.
+ *	          The file is created readable by the current user only.
+ *	          Must be set before <mosquitto_connect>.
+ *
+ *	MOSQ_OPT_QUIC_CONGESTION_CONTROL - QUIC only. The congestion control
+ *	          algorithm, either "cubic" (the default) or "bbr". Applies from
+ *	          the next <mosquitto_connect> or <mosquitto_reconnect>.
  */
 libmosq_EXPORT int mosquitto_string_option(struct mosquitto *mosq, enum mosq_opt_t option, const char *value);
 
@@ -1742,7 +1900,144 @@ libmosq_EXPORT void mosquitto_user_data_set(struct mosquitto *mosq, void *obj);
 libmosq_EXPORT void *mosquitto_userdata(struct mosquitto *mosq);
 
 
+/*
+ * Function: mosquitto_quic_set
+ *
+ * Prepare a client for connecting over QUIC with its current QUIC options.
+ * The msquic registration and configuration are shared with every other
+ * client in the process that uses the same settings, so many clients can be
+ * run from one process cheaply. <mosquitto_connect> and
+ * <mosquitto_reconnect> also do this, so options changed afterwards still
+ * apply to the next connection.
+ *
+ * Parameters:
+ * 	mosq - a valid mosquitto instance.
+ *
+ * Returns:
+ *	MOSQ_ERR_SUCCESS - on success.
+ * 	MOSQ_ERR_INVAL -   if the input parameters were invalid.
+ * 	MOSQ_ERR_QUIC -    if msquic could not be set up.
+ * 	MOSQ_ERR_NOT_SUPPORTED - if QUIC support is not available.
+ */
 int mosquitto_quic_set(struct mosquitto *mosq);
+
+/*
+ * Function: mosquitto_quic_stats
+ *
+ * Retrieve transport statistics for the current QUIC connection.
+ *
+ * Parameters:
+ * 	mosq -  a valid mosquitto instance.
+ * 	stats - a pointer to a struct mosquitto_quic_stats, which is filled in.
+ *
+ * Returns:
+ *	MOSQ_ERR_SUCCESS - on success.
+ * 	MOSQ_ERR_INVAL -   if the input parameters were invalid.
+ * 	MOSQ_ERR_NO_CONN - if the client isn't connected.
+ * 	MOSQ_ERR_QUIC -    if msquic could not provide the statistics.
+ * 	MOSQ_ERR_NOT_SUPPORTED - if QUIC support is not available.
+ *
+ * See Also:
+ * 	<mosquitto_quic_stats_callback_set>
+ */
+libmosq_EXPORT int mosquitto_quic_stats(struct mosquitto *mosq, struct mosquitto_quic_stats *stats);
+
+/*
+ * Function: mosquitto_quic_lane_priority_set
+ *
+ * Set the send priority of a QUIC lane. When the connection is congested,
+ * msquic sends queued data from higher priority lanes first, so a lane
+ * carrying time critical messages is not held up behind bulk transfers on
+ * the others. Lanes of equal priority share the connection in turn.
+ *
+ * Use with MOSQ_OPT_QUIC_LANES and either MOSQ_OPT_QUIC_LANE_MODE or
+ * <mosquitto_quic_lane_topic_add> to choose what is sent on each lane. Lane
+ * 0 carries CONNECT, acknowledgements and pings. This only affects packets
+ * sent by the client, not those delivered by the broker.
+ *
+ * May be called before connecting, or while connected to change the
+ * priority of the current connection.
+ *
+ * Parameters:
+ * 	mosq -     a valid mosquitto instance.
+ * 	lane -     the lane, from 0 to 7.
+ * 	priority - from 0 to 65535, higher values are sent first. Lanes start
+ * 	           at MOSQ_QUIC_PRIORITY_DEFAULT.
+ *
+ * Returns:
+ *	MOSQ_ERR_SUCCESS - on success.
+ * 	MOSQ_ERR_INVAL -   if the input parameters were invalid.
+ * 	MOSQ_ERR_NOT_SUPPORTED - if QUIC support is not available.
+ *
+ * Example:
+ * (start code)
+ *	mosquitto_int_option(mosq, MOSQ_OPT_QUIC_LANES, 3);
+ *	mosquitto_quic_lane_topic_add(mosq, "v2x/safety/#", 1);
+ *	mosquitto_quic_lane_priority_set(mosq, 1, 0xFFFF);
+ *	mosquitto_quic_lane_priority_set(mosq, 2, 0x1000);
+ * (end)
+ */
+libmosq_EXPORT int mosquitto_quic_lane_priority_set(struct mosquitto *mosq, int lane, int priority);
+
+/*
+ * Function: mosquitto_quic_lane_topic_add
+ *
+ * Send PUBLISH packets whose topic matches a topic filter on a given QUIC
+ * lane, whatever MOSQ_OPT_QUIC_LANE_MODE is set to. Filters are checked in
+ * the order they were added and the first match wins. Lanes used by a filter
+ * are kept for matching topics only, other topics are spread over the
+ * remaining lanes. A filter for a lane at or above MOSQ_OPT_QUIC_LANES is
+ * ignored.
+ *
+ * Should be called before connecting, from the thread that will run the
+ * network loop.
+ *
+ * Parameters:
+ * 	mosq -    a valid mosquitto instance.
+ * 	pattern - a topic filter, which may contain + and # wildcards, or NULL
+ * 	          to remove all filters.
+ * 	lane -    the lane, from 0 to 7.
+ *
+ * Returns:
+ *	MOSQ_ERR_SUCCESS - on success.
+ * 	MOSQ_ERR_INVAL -   if the input parameters were invalid.
+ * 	MOSQ_ERR_NOMEM -   if an out of memory condition occurred.
+ * 	MOSQ_ERR_NOT_SUPPORTED - if QUIC support is not available.
+ *
+ * See Also:
+ * 	<mosquitto_quic_lane_priority_set>
+ */
+libmosq_EXPORT int mosquitto_quic_lane_topic_add(struct mosquitto *mosq, const char *pattern, int lane);
+
+/*
+ * Function: mosquitto_quic_migrate
+ *
+ * Move the current QUIC connection to a new local address, for example after
+ * a mobile client switches from one network interface to another. The QUIC
+ * connection itself is kept, so there is no reconnect and the MQTT session,
+ * subscriptions and messages in flight are unaffected. The new path is
+ * validated by msquic in the background, sending carries on meanwhile.
+ *
+ * A change of address made by a NAT on the way to the broker needs no call
+ * to this function, the broker follows it on its own.
+ *
+ * Later reconnections still use the bind address given to
+ * <mosquitto_connect_bind>, if any.
+ *
+ * Parameters:
+ * 	mosq -          a valid mosquitto instance.
+ * 	local_address - the IPv4 or IPv6 address of the local interface to
+ * 	                use, as a string.
+ *
+ * Returns:
+ *	MOSQ_ERR_SUCCESS - if the migration was started.
+ * 	MOSQ_ERR_INVAL -   if the input parameters were invalid, or the address
+ * 	                   could not be parsed.
+ * 	MOSQ_ERR_NO_CONN - if the client isn't connected.
+ * 	MOSQ_ERR_QUIC -    if msquic refused the new address.
+ * 	MOSQ_ERR_NOT_SUPPORTED - if the client isn't using QUIC.
+ */
+libmosq_EXPORT int mosquitto_quic_migrate(struct mosquitto *mosq, const char *local_address);
 /* ======================================================================
  *
  * Section: TLS support
@@ -2229,6 +2524,50 @@ libmosq_EXPORT void mosquitto_unsubscribe_callback_set(struct mosquitto *mosq, v
  */
 libmosq_EXPORT void mosquitto_unsubscribe_v5_callback_set(struct mosquitto *mosq, void (*on_unsubscribe)(struct mosquitto *, void *, int, const mosquitto_property *props));
 
+/*
+ * Function: mosquitto_quic_stats_callback_set
+ *
+ * Set a callback that is given the QUIC transport statistics every interval
+ * seconds while the client is connected over QUIC. It is called from
+ * <mosquitto_loop>, so is only as regular as the loop is run.
+ *
+ * Parameters:
+ *  mosq -         a valid mosquitto instance.
+ *  on_quic_stats - a callback function in the following form:
+ *                 void callback(struct mosquitto *mosq, void *obj, const struct mosquitto_quic_stats *stats)
+ *                 or NULL to stop the callbacks.
+ *  interval -     seconds between callbacks, must be greater than 0.
+ *
+ * Callback Parameters:
+ *  mosq -  the mosquitto instance making the callback.
+ *  obj -   the user data provided in <mosquitto_new>
+ *  stats - the statistics. Only valid during the callback.
+ */
+libmosq_EXPORT void mosquitto_quic_stats_callback_set(struct mosquitto *mosq, void (*on_quic_stats)(struct mosquitto *, void *, const struct mosquitto_quic_stats *), int interval);
+
+/*
+ * Function: mosquitto_quic_backpressure_callback_set
+ *
+ * Set a callback for when QUIC flow control starts or stops holding back
+ * outgoing packets. The library only hands msquic as much data as it needs to
+ * keep the link busy. Anything beyond that stays in the library's own queue,
+ * which grows for as long as the application keeps publishing. An application
+ * that publishes faster than the link can carry should pause while blocked is
+ * true and resume once it is called again with false.
+ *
+ * Parameters:
+ *  mosq -                 a valid mosquitto instance.
+ *  on_quic_backpressure - a callback function in the following form:
+ *                         void callback(struct mosquitto *mosq, void *obj, bool blocked)
+ *
+ * Callback Parameters:
+ *  mosq -    the mosquitto instance making the callback.
+ *  obj -     the user data provided in <mosquitto_new>
+ *  blocked - true when packets start being held back, false once they are
+ *            being sent again.
+ */
+libmosq_EXPORT void mosquitto_quic_backpressure_callback_set(struct mosquitto *mosq, void (*on_quic_backpressure)(struct mosquitto *, void *, bool));
+
 /*
  * Function: mosquitto_log_callback_set
  *
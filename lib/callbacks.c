@@ -20,6 +20,7 @@ Contributors:
 
 #include "mosquitto.h"
 #include "mosquitto_internal.h"
+#include "time_mosq.h"
 
 
 void mosquitto_connect_callback_set(struct mosquitto *mosq, void (*on_connect)(struct mosquitto *, void *, int))
@@ -113,6 +114,22 @@ void mosquitto_unsubscribe_v5_callback_set(struct mosquitto *mosq, void (*on_uns
 	pthread_mutex_unlock(&mosq->callback_mutex);
 }
 
+void mosquitto_quic_stats_callback_set(struct mosquitto *mosq, void (*on_quic_stats)(struct mosquitto *, void *, const struct mosquitto_quic_stats *), int interval)
+{
+	pthread_mutex_lock(&mosq->callback_mutex);
+	mosq->on_quic_stats = on_quic_stats;
+	mosq->quic_stats_interval = interval > 0 ? interval : 1;
+	mosq->quic_stats_next = mosquitto_time() + mosq->quic_stats_interval;
+	pthread_mutex_unlock(&mosq->callback_mutex);
+}
+
+void mosquitto_quic_backpressure_callback_set(struct mosquitto *mosq, void (*on_quic_backpressure)(struct mosquitto *, void *, bool))
+{
+	pthread_mutex_lock(&mosq->callback_mutex);
+	mosq->on_quic_backpressure = on_quic_backpressure;
+	pthread_mutex_unlock(&mosq->callback_mutex);
+}
+
 void mosquitto_log_callback_set(struct mosquitto *mosq, void (*on_log)(struct mosquitto *, void *, int, const char *))
 {
 	pthread_mutex_lock(&mosq->log_callback_mutex);
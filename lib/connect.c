@@ -192,28 +192,17 @@ static int mosquitto__reconnect(struct mosquitto *mosq, bool blocking)
 
 	message__reconnect_reset(mosq, false);
 
-#ifdef WITH_QUIC
-	if (mosq->connection.handle != NULL)
-	{
-		net__quic_close(mosq);
+	if(net__transport_is_open(mosq)){
+		net__transport_close(mosq);
 	}
-	UNUSED(blocking);
-	rc = net__quic_connect(mosq, mosq->host, mosq->port, mosq->bind_address);
-#endif
-
-#ifdef WITH_TCP
-	if(mosq->sock != INVALID_SOCKET){
-        net__socket_close(mosq);
-    }
 #ifdef WITH_SOCKS
-	if(mosq->socks5_host){rc = net__socket_connect(mosq, mosq->host, mosq->port, mosq->bind_address, blocking);
+	if(mosq->socks5_host && mosq->transport == mosq_t_tcp){
 		rc = net__socket_connect(mosq, mosq->socks5_host, mosq->socks5_port, mosq->bind_address, blocking);
 	}else
 #endif
-	{	
-		rc = net__socket_connect(mosq, mosq->host, mosq->port, mosq->bind_address, blocking);
+	{
+		rc = net__transport_connect(mosq, mosq->host, mosq->port, mosq->bind_address, blocking);
 	}
-#endif
 
 	if(rc>0){
 		mosquitto__set_state(mosq, mosq_cs_connect_pending);
@@ -221,7 +210,7 @@ static int mosquitto__reconnect(struct mosquitto *mosq, bool blocking)
 	}
 
 #ifdef WITH_SOCKS
-	if(mosq->socks5_host){
+	if(mosq->socks5_host && mosq->transport == mosq_t_tcp){
 		mosquitto__set_state(mosq, mosq_cs_socks5_new);
 		return socks5__send(mosq);
 	}else
@@ -231,12 +220,7 @@ static int mosquitto__reconnect(struct mosquitto *mosq, bool blocking)
 		rc = send__connect(mosq, mosq->keepalive, mosq->clean_start, outgoing_properties);
 		if(rc){
 			packet__cleanup_all(mosq);
-#ifdef WITH_QUIC
-			net__quic_close(mosq);
-#endif
-#ifdef WITH_TCP
-			net__socket_close(mosq);
-#endif
+			net__transport_close(mosq);
 			mosquitto__set_state(mosq, mosq_cs_new);
 		}
 		return rc;
@@ -273,12 +257,7 @@ int mosquitto_disconnect_v5(struct mosquitto *mosq, int reason_code, const mosqu
 
 	mosquitto__set_state(mosq, mosq_cs_disconnected);
 	mosquitto__set_request_disconnect(mosq, true);
-#ifdef WITH_QUIC
-	if(mosq->connection.handle == NULL){
-#endif
-#ifdef WITH_TCP
-	if(mosq->sock == INVALID_SOCKET){
-#endif
+	if(!net__transport_is_open(mosq)){
 		return MOSQ_ERR_NO_CONN;
 	}else{
 		return send__disconnect(mosq, (uint8_t)reason_code, outgoing_properties);
@@ -290,12 +269,7 @@ void do_client_disconnect(struct mosquitto *mosq, int reason_code, const mosquit
 {
 	mosquitto__set_state(mosq, mosq_cs_disconnected);
 
-#ifdef WITH_QUIC
-	net__quic_close(mosq);
-#endif
-#ifdef WITH_TCP
-	net__socket_close(mosq);
-#endif
+	net__transport_close(mosq);
 
 	/* Free data and reset values */
 	pthread_mutex_lock(&mosq->out_packet_mutex);
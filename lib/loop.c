@@ -32,13 +32,38 @@ Contributors:
 #include "tls_mosq.h"
 #include "util_mosq.h"
 
+#ifdef WITH_QUIC
+#include "quic_mosq.h"
+#endif
+
 #if !defined(WIN32) && !defined(__SYMBIAN32__) && !defined(__QNX__)
 #define HAVE_PSELECT
 #endif
 
-int mosquitto_loop(struct mosquitto *mosq, int timeout, int max_packets)
+static int mosquitto__loop_rc_handle(struct mosquitto *mosq, int rc);
+
+#ifdef WITH_QUIC
+static void loop__quic_stats(struct mosquitto *mosq)
 {
+	struct mosquitto_quic_stats stats;
+	time_t now = mosquitto_time();
+
+	pthread_mutex_lock(&mosq->callback_mutex);
+	if(mosq->on_quic_stats && now >= mosq->quic_stats_next){
+		mosq->quic_stats_next = now + mosq->quic_stats_interval;
+		if(msquic_stats(mosq, &stats) == MOSQ_ERR_SUCCESS){
+			mosq->in_callback = true;
+			mosq->on_quic_stats(mosq, mosq->userdata, &stats);
+			mosq->in_callback = false;
+		}
+	}
+	pthread_mutex_unlock(&mosq->callback_mutex);
+}
+#endif
+
 #ifdef WITH_TCP
+static int loop__tcp(struct mosquitto *mosq, int timeout, int max_packets)
+{
 #ifdef HAVE_PSELECT
 	struct timespec local_timeout;
 #else
@@ -52,7 +77,6 @@ int mosquitto_loop(struct mosquitto *mosq, int timeout, int max_packets)
 	time_t now;
 	time_t timeout_ms;
 
-	if(!mosq || max_packets < 1) return MOSQ_ERR_INVAL;
 #ifndef WIN32
 	if(mosq->sock >= FD_SETSIZE || mosq->sockpairR >= FD_SETSIZE){
 		return MOSQ_ERR_INVAL;
@@ -179,45 +203,149 @@ int mosquitto_loop(struct mosquitto *mosq, int timeout, int max_packets)
 #endif
 	}
 	return mosquitto_loop_misc(mosq);
+}
 #endif
+
+
 #ifdef WITH_QUIC
-	UNUSED(timeout);
-    int rc;
-
-    if(!mosq || max_packets < 1){
-        return MOSQ_ERR_INVAL;
-    }
-    if(mosq->connection.handle == NULL){
-        return MOSQ_ERR_NO_CONN;
-    }
-
-    bool need_write = mosq->want_write;
-
-    if(!need_write) {
-        pthread_mutex_lock(&mosq->current_out_packet_mutex);
-        pthread_mutex_lock(&mosq->out_packet_mutex);
-        if(mosq->out_packet || mosq->current_out_packet){
-            need_write = true;
-        }
-        pthread_mutex_unlock(&mosq->out_packet_mutex);
-        pthread_mutex_unlock(&mosq->current_out_packet_mutex);
-    }
-
-    if(need_write){
-        rc = mosquitto_loop_write(mosq, max_packets);
-        if(rc || mosq->connection.handle == NULL){
-            return rc;
-        }
-    }
+static int loop__quic(struct mosquitto *mosq, int timeout, int max_packets)
+{
+#ifdef HAVE_PSELECT
+	struct timespec local_timeout;
+#else
+	struct timeval local_timeout;
+#endif
+	fd_set readfds;
+	int fdcount;
+	int rc;
+	char pairbuf;
+	time_t now;
+	time_t timeout_ms;
+	bool need_write;
+
+	if(mosq->connection.handle == NULL){
+		return MOSQ_ERR_NO_CONN;
+	}
+#ifndef WIN32
+	if(mosq->sockpairR >= FD_SETSIZE){
+		return MOSQ_ERR_INVAL;
+	}
+#endif
+
+	/* msquic reads and sends on its own threads, so all that is left to
+	 * wait for here is something to send, a closed connection or the
+	 * keepalive. packet__queue() and the msquic callbacks wake us through
+	 * sockpairR. */
+	need_write = mosq->want_write;
+	if(!need_write){
+		pthread_mutex_lock(&mosq->current_out_packet_mutex);
+		pthread_mutex_lock(&mosq->out_packet_mutex);
+		if(mosq->out_packet || mosq->current_out_packet){
+			need_write = true;
+		}
+		pthread_mutex_unlock(&mosq->out_packet_mutex);
+		pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+	}
+
+	timeout_ms = timeout;
+	if(timeout_ms < 0){
+		timeout_ms = 1000;
+	}
+
+	now = mosquitto_time();
+	pthread_mutex_lock(&mosq->msgtime_mutex);
+	if(mosq->next_msg_out && now + timeout_ms/1000 > mosq->next_msg_out){
+		timeout_ms = (mosq->next_msg_out - now)*1000;
+	}
+	pthread_mutex_unlock(&mosq->msgtime_mutex);
+	pthread_mutex_lock(&mosq->callback_mutex);
+	if(mosq->on_quic_stats && now + timeout_ms/1000 > mosq->quic_stats_next){
+		timeout_ms = (mosq->quic_stats_next - now)*1000;
+	}
+	pthread_mutex_unlock(&mosq->callback_mutex);
+
+	/* A send held back by a full stream is retried once msquic wakes us. */
+	if(need_write && !mosq->want_write && msquic_send_blocked(&mosq->connection)){
+		need_write = false;
+	}
+	if(timeout_ms < 0 || need_write || msquic_connection_closed(&mosq->connection)){
+		timeout_ms = 0;
+	}
+
+	local_timeout.tv_sec = timeout_ms/1000;
+#ifdef HAVE_PSELECT
+	local_timeout.tv_nsec = (timeout_ms-local_timeout.tv_sec*1000)*1000000;
+#else
+	local_timeout.tv_usec = (timeout_ms-local_timeout.tv_sec*1000)*1000;
+#endif
+
+	FD_ZERO(&readfds);
+	if(mosq->sockpairR != INVALID_SOCKET){
+		FD_SET(mosq->sockpairR, &readfds);
+	}
+#ifdef HAVE_PSELECT
+	fdcount = pselect(mosq->sockpairR+1, &readfds, NULL, NULL, &local_timeout, NULL);
+#else
+	fdcount = select(mosq->sockpairR+1, &readfds, NULL, NULL, &local_timeout);
+#endif
+	if(fdcount == -1){
+#ifdef WIN32
+		errno = WSAGetLastError();
+#endif
+		if(errno == EINTR){
+			return MOSQ_ERR_SUCCESS;
+		}else{
+			return MOSQ_ERR_ERRNO;
+		}
+	}
+	if(fdcount > 0 && mosq->sockpairR != INVALID_SOCKET && FD_ISSET(mosq->sockpairR, &readfds)){
+		/* Several wakeups may have been queued while we were busy. */
+#ifndef WIN32
+		while(read(mosq->sockpairR, &pairbuf, 1) > 0);
+#else
+		while(recv(mosq->sockpairR, &pairbuf, 1, 0) > 0);
+#endif
+		need_write = true;
+	}
+
+	if(msquic_connection_closed(&mosq->connection)){
+		return mosquitto__loop_rc_handle(mosq, MOSQ_ERR_CONN_LOST);
+	}
+
+	if(need_write){
+		rc = mosquitto_loop_write(mosq, max_packets);
+		if(rc || mosq->connection.handle == NULL){
+			return rc;
+		}
+	}
+	loop__quic_stats(mosq);
+	msquic_tickets_save(mosq);
 
 	return mosquitto_loop_misc(mosq);
+}
 #endif
+
+
+int mosquitto_loop(struct mosquitto *mosq, int timeout, int max_packets)
+{
+	if(!mosq || max_packets < 1) return MOSQ_ERR_INVAL;
+
+#ifdef WITH_QUIC
+	if(mosq->transport == mosq_t_quic){
+		return loop__quic(mosq, timeout, max_packets);
+	}
+#endif
+#ifdef WITH_TCP
+	if(mosq->transport == mosq_t_tcp){
+		return loop__tcp(mosq, timeout, max_packets);
+	}
+#endif
+	return MOSQ_ERR_NOT_SUPPORTED;
 }
 
 
 static int interruptible_sleep(struct mosquitto *mosq, time_t reconnect_delay)
 {
-#ifdef WITH_TCP
 #ifdef HAVE_PSELECT
 	struct timespec local_timeout;
 #else
@@ -271,18 +399,11 @@ static int interruptible_sleep(struct mosquitto *mosq, time_t reconnect_delay)
 #endif
 	}
 	return MOSQ_ERR_SUCCESS;
-#endif
-#ifdef WITH_QUIC
-	UNUSED(mosq);
-	UNUSED(reconnect_delay);
-	return MOSQ_ERR_SUCCESS;
-#endif
 }
 
 
 int mosquitto_loop_forever(struct mosquitto *mosq, int timeout, int max_packets)
 {
-#ifdef WITH_TCP
 	int run = 1;
 	int rc = MOSQ_ERR_SUCCESS;
 	unsigned long reconnect_delay;
@@ -355,29 +476,14 @@ int mosquitto_loop_forever(struct mosquitto *mosq, int timeout, int max_packets)
 		}while(run && rc != MOSQ_ERR_SUCCESS);
 	}
 	return rc;
-#endif
-#ifdef WITH_QUIC
-	UNUSED(timeout);
-	UNUSED(max_packets);
-	unsigned long reconnect_delay = 1;
-	interruptible_sleep(mosq, (time_t)reconnect_delay);
-	while(1){
-		// do nothing
-	}
-	return MOSQ_ERR_SUCCESS;
-#endif
 }
 
 
 int mosquitto_loop_misc(struct mosquitto *mosq)
 {
 	if(!mosq) return MOSQ_ERR_INVAL;
-#ifdef WITH_TCP
-	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
-#endif
-#ifdef WITH_QUIC
-	if(mosq->connection.handle == NULL) return MOSQ_ERR_NO_CONN;
-#endif
+	if(!net__transport_is_open(mosq)) return MOSQ_ERR_NO_CONN;
+
 	return mosquitto__check_keepalive(mosq);
 }
 
@@ -386,12 +492,7 @@ static int mosquitto__loop_rc_handle(struct mosquitto *mosq, int rc)
 	enum mosquitto_client_state state;
 
 	if(rc){
-#ifdef WITH_QUIC
-		net__quic_close(mosq);
-#endif
-#ifdef WITH_TCP
-		net__socket_close(mosq);
-#endif
+		net__transport_close(mosq);
 		state = mosquitto__get_state(mosq);
 		if(state == mosq_cs_disconnecting || state == mosq_cs_disconnected){
 			rc = MOSQ_ERR_SUCCESS;
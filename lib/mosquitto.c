@@ -120,7 +120,6 @@ struct mosquitto *mosquitto_new(const char *id, bool clean_start, void *userdata
 	if(mosq){
 #ifdef WITH_QUIC
 		mosq->connection.handle = NULL;
-		mosq->stream.handle = NULL;
 #endif
 #ifdef WITH_TCP
 		mosq->sock = INVALID_SOCKET;
@@ -148,6 +147,10 @@ struct mosquitto *mosquitto_new(const char *id, bool clean_start, void *userdata
 
 int mosquitto_reinitialise(struct mosquitto *mosq, const char *id, bool clean_start, void *userdata)
 {
+#ifdef WITH_QUIC
+	int i;
+#endif
+
 	if(!mosq) return MOSQ_ERR_INVAL;
 
 	if(clean_start == false && id == NULL){
@@ -165,18 +168,36 @@ int mosquitto_reinitialise(struct mosquitto *mosq, const char *id, bool clean_st
 	mosq->protocol = mosq_p_mqtt311;
 #ifdef WITH_QUIC
 	mosq->quic_execution_profile = QUIC_EXECUTION_PROFILE_LOW_LATENCY;
+	mosq->quic_config = NULL;
+	/* Zeroed so that equal settings compare equal, see msquic_config(). */
+	memset(&mosq->quic_settings, 0, sizeof(QUIC_SETTINGS));
+	mosq->quic_settings.IdleTimeoutMs = 0;
+	mosq->quic_settings.IsSet.IdleTimeoutMs = 1;
 	mosq->connection.handle = NULL;
 	mosq->connection.state = mosq_qs_new;
-	mosq->stream.handle = NULL;
-	mosq->stream.packet_reader.buffers = NULL;
-    mosq->stream.packet_reader.buffer_count = 0;
-    mosq->stream.packet_reader.current_buffer = 0;
-    mosq->stream.packet_reader.buffer_pos = 0;
-    mosq->stream.packet_reader.buffer_count = 0;
-    mosq->stream.packet_reader.consumed_length = 0;
+	mosq->connection.early_data = false;
+	mosq->connection.datagram_max = 0;
+	mosq->quic_zero_rtt = true;
+	mosq->quic_datagram = false;
+	for(i=0; i<MOSQ_QUIC_MAX_LANES; i++){
+		memset(&mosq->streams[i], 0, sizeof(struct mosq_quic_stream));
+		mosq->streams[i].mosq = mosq;
+		mosq->streams[i].lane = (uint8_t)i;
+		mosq->streams[i].priority = MOSQ_QUIC_PRIORITY_DEFAULT;
+		packet__cleanup(&mosq->streams[i].in_packet);
+	}
+	mosq->quic_lanes = 1;
+	mosq->quic_lane_mode = MOSQ_QUIC_LANE_BY_TOPIC;
+	mosq->quic_lane = 0;
 #endif
 #ifdef WITH_TCP
 	mosq->sock = INVALID_SOCKET;
+#endif
+	/* QUIC is preferred when built in, see MOSQ_OPT_TRANSPORT. */
+#ifdef WITH_QUIC
+	mosq->transport = mosq_t_quic;
+#else
+	mosq->transport = mosq_t_tcp;
 #endif
 	mosq->sockpairR = INVALID_SOCKET;
 	mosq->sockpairW = INVALID_SOCKET;
@@ -260,6 +281,10 @@ int mosquitto_reinitialise(struct mosquitto *mosq, const char *id, bool clean_st
 
 void mosquitto__destroy(struct mosquitto *mosq)
 {
+#ifdef WITH_QUIC
+	int i;
+#endif
+
 	if(!mosq) return;
 
 #ifdef WITH_QUIC
@@ -311,6 +336,8 @@ void mosquitto__destroy(struct mosquitto *mosq)
 	if(mosq->ssl_ctx){
 		SSL_CTX_free(mosq->ssl_ctx);
 	}
+	mosquitto__free(mosq->tls_batch);
+	mosq->tls_batch = NULL;
 	mosquitto__free(mosq->tls_cafile);
 	mosquitto__free(mosq->tls_capath);
 	mosquitto__free(mosq->tls_certfile);
@@ -340,12 +367,23 @@ void mosquitto__destroy(struct mosquitto *mosq)
 
 	mosquitto__free(mosq->bind_address);
 	mosq->bind_address = NULL;
+#ifdef WITH_QUIC
+	mosquitto__free(mosq->quic_resumption_file);
+	mosq->quic_resumption_file = NULL;
+	msquic_config_release(mosq);
+	msquic_lane_topics_clear(mosq);
+#endif
 
 	mosquitto_property_free_all(&mosq->connect_properties);
 
 	packet__cleanup_all_no_locks(mosq);
 
 	packet__cleanup(&mosq->in_packet);
+#ifdef WITH_QUIC
+	for(i=0; i<MOSQ_QUIC_MAX_LANES; i++){
+		packet__cleanup(&mosq->streams[i].in_packet);
+	}
+#endif
 	if(mosq->sockpairR != INVALID_SOCKET){
 		COMPAT_CLOSE(mosq->sockpairR);
 		mosq->sockpairR = INVALID_SOCKET;
@@ -364,13 +402,16 @@ void mosquitto_destroy(struct mosquitto *mosq)
 	mosquitto__free(mosq);
 }
 
-#ifdef WITH_TCP
 int mosquitto_socket(struct mosquitto *mosq)
 {
 	if(!mosq) return INVALID_SOCKET;
-	return mosq->sock;
-}
+#ifdef WITH_TCP
+	if(mosq->transport == mosq_t_tcp){
+		return mosq->sock;
+	}
 #endif
+	return INVALID_SOCKET;
+}
 
 
 bool mosquitto_want_write(struct mosquitto *mosq)
@@ -136,7 +136,8 @@ enum mosquitto__transport {
 	mosq_t_invalid = 0,
 	mosq_t_tcp = 1,
 	mosq_t_ws = 2,
-	mosq_t_sctp = 3
+	mosq_t_sctp = 3,
+	mosq_t_quic = 4
 };
 
 
@@ -151,6 +152,24 @@ struct session_expiry_list {
 	struct session_expiry_list *next;
 };
 
+#ifdef WITH_BROKER
+/* A PUBLISH encoded once and sent unchanged to many clients, cached on the
+ * mosquitto_msg_store. Outgoing packets point their payload at it rather
+ * than having their own copy. */
+struct mosquitto__shared_packet{
+	struct mosquitto__shared_packet *next;
+	uint8_t *payload;
+	uint32_t packet_length;
+	uint32_t remaining_length;
+	uint32_t mid_pos; /* Offset of the message id, 0 for QoS 0. */
+	uint32_t expiry_interval;
+	int ref_count;
+	uint8_t command;
+	int8_t remaining_count;
+	bool mqtt5;
+};
+#endif
+
 struct mosquitto__packet{
 	uint8_t *payload;
 	struct mosquitto__packet *next;
@@ -162,6 +181,20 @@ struct mosquitto__packet{
 	uint16_t mid;
 	uint8_t command;
 	int8_t remaining_count;
+#ifdef WITH_QUIC
+	uint8_t lane; /* QUIC stream the packet is sent on, 0 for the control stream. */
+	bool datagram; /* May be sent as an unreliable QUIC DATAGRAM instead. */
+#endif
+#ifdef WITH_BROKER
+	struct mosquitto__shared_packet *shared; /* Owns payload if set. */
+	uint8_t mid_bytes[2]; /* Message id sent in place of the shared one. */
+#endif
+#ifdef WITH_QUIC
+	QUIC_BUFFER quic_buffer; /* Describes payload while msquic owns the packet. */
+#endif
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+	QUIC_BUFFER *quic_buffers; /* Buffers of a batched send, on its first packet. */
+#endif
 };
 
 struct mosquitto_message_all{
@@ -211,18 +244,31 @@ struct mosquitto_msg_data{
 	uint16_t inflight_maximum;
 };
 #ifdef WITH_QUIC
-struct mosq_quic_packet_reader {
-    const QUIC_BUFFER *buffers;     // QUIC缓冲区数组
-    uint32_t buffer_count;          // 总缓冲区数量
-    uint32_t current_buffer;        // 当前处理的缓冲区索引
-    uint32_t buffer_pos;            // 当前缓冲区读取位置
-    uint64_t total_length;          // 总数据长度
-    uint64_t consumed_length;       // 已处理的数据长度
-};
+/* MQTT packets may be spread over several bidirectional streams, or lanes.
+ * Lane n is always the n-th stream opened by the client, so it has stream ID
+ * 4*n. Lane 0 carries CONNECT and all other control packets. */
+#define MOSQ_QUIC_MAX_LANES 8
+/* Send buffer a stream starts with, until msquic says otherwise. This is
+ * msquic's own default. */
+#define MOSQ_QUIC_IDEAL_SEND_BUFFER 0x20000
+/* Most packets handed to msquic in one StreamSend. */
+#define MOSQ_QUIC_SEND_BATCH 16
 
 struct mosq_quic_stream {
     HQUIC handle;
-    struct mosq_quic_packet_reader packet_reader;
+    struct mosquitto *mosq;
+    struct mosquitto__packet in_packet; /* Partial packet while other lanes are read. */
+    uint64_t ideal_send_buffer; /* Bytes msquic wants queued, see msquic_send_packet(). */
+    uint64_t send_outstanding; /* Bytes handed to msquic and not yet completed. */
+    uint16_t priority; /* QUIC_PARAM_STREAM_PRIORITY, higher is sent first. */
+    uint8_t lane;
+};
+
+/* Topic filter pinned to a lane, see mosquitto_quic_lane_topic_add(). */
+struct mosq_quic_lane_topic {
+    struct mosq_quic_lane_topic *next;
+    char *pattern;
+    uint8_t lane;
 };
 
 enum mosquitto_quic_connection_state {
@@ -238,7 +284,16 @@ struct mosq_quic_connection {
 	enum mosquitto_quic_connection_state state;
 	pthread_mutex_t state_mutex;
     pthread_cond_t state_cond;
+	bool early_data; /* Sends may go out as 0-RTT until the handshake completes. */
+	bool send_blocked; /* A send was refused because its stream was full. */
+	uint16_t datagram_max; /* Largest DATAGRAM the peer accepts, 0 if none. */
 };
+
+#ifdef WITH_BROKER
+struct mosquitto__quic_conn;
+#else
+struct mosq_quic_config;
+#endif
 #endif
 
 struct mosquitto {
@@ -247,14 +302,36 @@ struct mosquitto {
 	int ident;
 #endif
 
+#if defined(WITH_BROKER) && defined(WITH_IO_THREADS)
+	struct mosquitto__io_conn *io; /* Served by an I/O thread, see net_io.c. */
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_URING)
+	struct mosquitto__uring_conn *uring; /* See mux_uring.c. */
+	bool uring_direct; /* Reads and writes go through the ring. */
+#endif
 #ifdef WITH_QUIC
+#  ifdef WITH_BROKER
+	struct mosquitto__quic_conn *quic;
+#  else
 	QUIC_EXECUTION_PROFILE quic_execution_profile;
+	struct mosq_quic_config *quic_config; /* Shared, see msquic_config(). */
+	QUIC_SETTINGS quic_settings; /* From the MOSQ_OPT_QUIC_* tuning options. */
 	struct mosq_quic_connection connection;
-	struct mosq_quic_stream stream;
+	struct mosq_quic_stream streams[MOSQ_QUIC_MAX_LANES];
+	char *quic_resumption_file;
+	bool quic_ticket_dirty; /* Ticket not yet written to quic_resumption_file. */
+	bool quic_zero_rtt;
+	bool quic_datagram;
+	uint8_t quic_lanes;
+	uint8_t quic_lane_mode;
+	uint8_t quic_lane;
+	struct mosq_quic_lane_topic *quic_lane_topics;
+#  endif
 #endif
 #ifdef WITH_TCP
 	mosq_sock_t sock;
 #endif
+	enum mosquitto__transport transport;
 #ifndef WITH_BROKER
 	mosq_sock_t sockpairR, sockpairW;
 #endif
@@ -288,6 +365,7 @@ struct mosquitto {
 	SSL_CTX *ssl_ctx;
 #ifndef WITH_BROKER
 	SSL_CTX *user_ssl_ctx;
+	uint8_t *tls_batch; /* Scratch record for net__writev(). */
 #endif
 	char *tls_cafile;
 	char *tls_capath;
@@ -368,6 +446,11 @@ struct mosquitto {
 	void (*on_unsubscribe)(struct mosquitto *, void *userdata, int mid);
 	void (*on_unsubscribe_v5)(struct mosquitto *, void *userdata, int mid, const mosquitto_property *props);
 	void (*on_log)(struct mosquitto *, void *userdata, int level, const char *str);
+	void (*on_quic_stats)(struct mosquitto *, void *userdata, const struct mosquitto_quic_stats *stats);
+	time_t quic_stats_interval;
+	time_t quic_stats_next;
+	void (*on_quic_backpressure)(struct mosquitto *, void *userdata, bool blocked);
+	bool quic_backpressure;
 	/*void (*on_error)();*/
 	char *host;
 	uint16_t port;
@@ -81,6 +81,7 @@ Contributors:
 #include "memory_mosq.h"
 #include "mqtt_protocol.h"
 #include "net_mosq.h"
+#include "packet_mosq.h"
 #include "time_mosq.h"
 #include "util_mosq.h"
 
@@ -182,6 +183,9 @@ void net__cleanup(void)
 #endif
 
 #ifdef WITH_QUIC
+#  ifndef WITH_BROKER
+	msquic_tickets_cleanup();
+#  endif
 	msquic_cleanup();
 #endif
 
@@ -377,6 +381,23 @@ int net__socket_close(struct mosquitto *mosq)
 	}
 #endif
 
+#if defined(WITH_BROKER) && defined(WITH_QUIC)
+	if(mosq->quic){
+		net__quic_close(mosq);
+	}
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_THREADS)
+	if(mosq->io){
+		/* The descriptor belongs to an I/O thread, which closes it. */
+		net__io_close(mosq);
+	}
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_URING)
+	if(mosq->uring){
+		mux_uring__close(mosq);
+	}
+#endif
+
 #ifdef WITH_WEBSOCKETS
 	if(mosq->wsi)
 	{
@@ -894,6 +915,8 @@ int net__socket_connect_step3(struct mosquitto *mosq, const char *host)
 			net__print_ssl_error(mosq);
 			return MOSQ_ERR_TLS;
 		}
+		/* net__writev() retries with a freshly gathered buffer. */
+		SSL_set_mode(mosq->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 		SSL_set_ex_data(mosq->ssl, tls_ex_index_mosq, mosq);
 		bio = BIO_new_socket(mosq->sock, BIO_NOCLOSE);
@@ -1016,10 +1039,11 @@ int net__socket_nonblock(mosq_sock_t *sock)
 	return MOSQ_ERR_SUCCESS;
 }
 
-#ifdef WITH_QUIC
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
 int net__quic_close(struct mosquitto *mosq)
 {
 	int rc = 0;
+	int i;
     assert(mosq);
 	struct mosq_quic_connection* connection = &mosq->connection;
 	if(connection->handle)
@@ -1027,14 +1051,69 @@ int net__quic_close(struct mosquitto *mosq)
 		rc = msquic_try_close(connection);
 		connection->handle = NULL;
 	}
+	msquic_tickets_save(mosq);
+	/* Drop anything half read on the other lanes. */
+	for(i=1; i<MOSQ_QUIC_MAX_LANES; i++){
+		packet__cleanup(&mosq->streams[i].in_packet);
+	}
 	return rc;
 }
 
-int net__quic_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address)
+int net__quic_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking)
 {
 	if(!mosq || !host || !port) return MOSQ_ERR_INVAL;
 
-	return msquic_try_connect(mosq, host, port, bind_address);
+	return msquic_try_connect(mosq, host, port, bind_address, blocking);
+}
+#endif
+
+#ifndef WITH_BROKER
+/* Connect using the transport chosen with MOSQ_OPT_TRANSPORT. */
+int net__transport_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking)
+{
+#ifdef WITH_QUIC
+	if(mosq->transport == mosq_t_quic){
+		return net__quic_connect(mosq, host, port, bind_address, blocking);
+	}
+#endif
+#ifdef WITH_TCP
+	if(mosq->transport == mosq_t_tcp){
+		return net__socket_connect(mosq, host, port, bind_address, blocking);
+	}
+#endif
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+/* Close the connection, whichever transport it was made with. The transport
+ * may have been changed since connecting, so all of them are closed. */
+int net__transport_close(struct mosquitto *mosq)
+{
+	int rc = MOSQ_ERR_SUCCESS;
+
+#ifdef WITH_QUIC
+	rc = net__quic_close(mosq);
+#endif
+#ifdef WITH_TCP
+	rc = net__socket_close(mosq);
+#endif
+	return rc;
+}
+
+
+bool net__transport_is_open(struct mosquitto *mosq)
+{
+#ifdef WITH_QUIC
+	if(mosq->connection.handle){
+		return true;
+	}
+#endif
+#ifdef WITH_TCP
+	if(mosq->sock != INVALID_SOCKET){
+		return true;
+	}
+#endif
+	return false;
 }
 #endif
 
@@ -1043,11 +1122,21 @@ ssize_t net__read(
 	void *buf, 
 	size_t count)
 {
-#ifdef TCP
 #ifdef WITH_TLS
 	int ret;
 #endif
 	assert(mosq);
+#ifdef WITH_QUIC
+	if(mosq->transport == mosq_t_quic){
+		/* Incoming QUIC data is parsed in place as it arrives, by
+		 * net__quic_read_packets() in the broker and the stream callback in
+		 * the library, so there is never anything to read here. */
+		errno = EINVAL;
+		return -1;
+	}
+#endif
+
+#ifdef WITH_TCP
 	errno = 0;
 #ifdef WITH_TLS
 	if(mosq->ssl){
@@ -1071,21 +1160,41 @@ ssize_t net__read(
 #ifdef WITH_TLS
 	}
 #endif
-#endif /* TCP */
-
-#ifdef WITH_QUIC
-	return msquic_recv(&mosq->stream.packet_reader, buf, count);
-#endif /* QUIC */
+#else
+	errno = ENOTCONN;
+	return -1;
+#endif /* WITH_TCP */
 }
 
 ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
 {
-assert(mosq);
-
-#ifdef TCP
 #ifdef WITH_TLS
 	int ret;
 #endif
+	assert(mosq);
+#ifdef WITH_QUIC
+	if(mosq->transport == mosq_t_quic){
+#  ifdef WITH_BROKER
+		/* Packets are handed to msquic whole, see packet__write(). */
+		errno = EINVAL;
+		return -1;
+#  else
+		return msquic_send_buffer(mosq, buf, count);
+#  endif
+	}
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_THREADS)
+	if(mosq->io){
+		return net__io_write(mosq, buf, count);
+	}
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_URING)
+	if(mosq->uring_direct){
+		return mux_uring__write(mosq, buf, count);
+	}
+#endif
+
+#ifdef WITH_TCP
 	errno = 0;
 #ifdef WITH_TLS
 	if(mosq->ssl){
@@ -1105,12 +1214,106 @@ assert(mosq);
 #ifdef WITH_TLS
 	}
 #endif
-#endif /* TCP */
+#else
+	errno = ENOTCONN;
+	return -1;
+#endif /* WITH_TCP */
+}
 
-#ifdef WITH_QUIC
-	return msquic_send(mosq->stream.handle, buf, count);
-#endif /* QUIC */
+#ifndef WIN32
+#ifdef WITH_TLS
+/* One full TLS record. */
+#  define NET_TLS_BATCH_SIZE 16384
+#  ifdef WITH_BROKER
+/* Every TLS write in the broker happens on the main loop, so one buffer
+ * serves all connections. Clients may write from several threads and keep
+ * one each in mosq->tls_batch. */
+static uint8_t net__tls_batch[NET_TLS_BATCH_SIZE];
+#  endif
+#endif
+
+/* Write a list of buffers in one call where the transport allows it. As with
+ * net__write(), a short write is possible and may end part way through any
+ * of the buffers. */
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+#ifdef WITH_TCP
+	struct msghdr msg;
+#endif
+	ssize_t total = 0, rc;
+	int i;
+#ifdef WITH_TLS
+	uint8_t *buf;
+	size_t len, n;
+#endif
+
+	assert(mosq);
+	assert(iov);
+	assert(iovcnt > 0);
+
+#ifdef WITH_TLS
+	if(mosq->ssl && iov[0].iov_len < NET_TLS_BATCH_SIZE){
+		/* There is no SSL_writev(), so copy small packets into a single
+		 * record instead. If this returns WANT_WRITE the caller gathers the
+		 * same packets again, so the retry starts with identical data. */
+#ifdef WITH_BROKER
+		buf = net__tls_batch;
+#else
+		if(!mosq->tls_batch){
+			mosq->tls_batch = mosquitto__malloc(NET_TLS_BATCH_SIZE);
+			if(!mosq->tls_batch){
+				return net__write(mosq, iov[0].iov_base, iov[0].iov_len);
+			}
+		}
+		buf = mosq->tls_batch;
+#endif
+		len = 0;
+		for(i=0; i<iovcnt && len < NET_TLS_BATCH_SIZE; i++){
+			n = iov[i].iov_len;
+			if(n > NET_TLS_BATCH_SIZE - len){
+				n = NET_TLS_BATCH_SIZE - len;
+			}
+			memcpy(&buf[len], iov[i].iov_base, n);
+			len += n;
+		}
+		return net__write(mosq, buf, len);
+	}
+#endif
+
+#ifdef WITH_TCP
+	if(mosq->transport == mosq_t_tcp
+#ifdef WITH_TLS
+			&& mosq->ssl == NULL
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_THREADS)
+			&& mosq->io == NULL
+#endif
+#if defined(WITH_BROKER) && defined(WITH_IO_URING)
+			&& mosq->uring_direct == false
+#endif
+			){
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec *)iov;
+		msg.msg_iovlen = (size_t)iovcnt;
+		return sendmsg(mosq->sock, &msg, MSG_NOSIGNAL);
+	}
+#endif
+
+	/* Transports that buffer internally take the buffers one at a time. */
+	for(i=0; i<iovcnt; i++){
+		rc = net__write(mosq, iov[i].iov_base, iov[i].iov_len);
+		if(rc < 0){
+			return total > 0 ? total : rc;
+		}
+		total += rc;
+		if((size_t)rc < iov[i].iov_len){
+			break;
+		}
+	}
+	return total;
 }
+#endif
 
 #ifndef WITH_BROKER
 int net__socketpair(mosq_sock_t *pairR, mosq_sock_t *pairW)
@@ -20,6 +20,7 @@ Contributors:
 
 #ifndef WIN32
 #  include <sys/socket.h>
+#  include <sys/uio.h>
 #  include <unistd.h>
 #else
 #  include <winsock2.h>
@@ -79,14 +80,23 @@ int net__socket_connect_step3(struct mosquitto *mosq, const char *host);
 
 int net__socket_nonblock(mosq_sock_t *sock);
 
-#ifdef WITH_QUIC
-int net__quic_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address);
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+int net__quic_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking);
 int net__quic_close(struct mosquitto *mosq);
 #endif
 
+#ifndef WITH_BROKER
+int net__transport_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking);
+int net__transport_close(struct mosquitto *mosq);
+bool net__transport_is_open(struct mosquitto *mosq);
+#endif
+
 int net__socketpair(mosq_sock_t *sp1, mosq_sock_t *sp2);
 ssize_t net__read(struct mosquitto *mosq, void *buf, size_t count);
 ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count);
+#ifndef WIN32
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt);
+#endif
 
 #ifdef WITH_TLS
 void net__print_ssl_error(struct mosquitto *mosq);
@@ -139,6 +139,73 @@ int mosquitto_quic_set(struct mosquitto *mosq)
 }
 
 
+int mosquitto_quic_stats(struct mosquitto *mosq, struct mosquitto_quic_stats *stats)
+{
+#ifdef WITH_QUIC
+	if(!mosq || !stats) return MOSQ_ERR_INVAL;
+
+	return msquic_stats(mosq, stats);
+#else
+	UNUSED(mosq);
+	UNUSED(stats);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+int mosquitto_quic_lane_priority_set(struct mosquitto *mosq, int lane, int priority)
+{
+#ifdef WITH_QUIC
+	if(!mosq) return MOSQ_ERR_INVAL;
+	if(lane < 0 || lane >= MOSQ_QUIC_MAX_LANES) return MOSQ_ERR_INVAL;
+	if(priority < 0 || priority > UINT16_MAX) return MOSQ_ERR_INVAL;
+
+	return msquic_lane_priority(mosq, (uint8_t)lane, (uint16_t)priority);
+#else
+	UNUSED(mosq);
+	UNUSED(lane);
+	UNUSED(priority);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+int mosquitto_quic_lane_topic_add(struct mosquitto *mosq, const char *pattern, int lane)
+{
+#ifdef WITH_QUIC
+	if(!mosq) return MOSQ_ERR_INVAL;
+	if(pattern == NULL){
+		msquic_lane_topics_clear(mosq);
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(lane < 0 || lane >= MOSQ_QUIC_MAX_LANES) return MOSQ_ERR_INVAL;
+	if(mosquitto_sub_topic_check(pattern)) return MOSQ_ERR_INVAL;
+
+	return msquic_lane_topic_add(mosq, pattern, (uint8_t)lane);
+#else
+	UNUSED(mosq);
+	UNUSED(pattern);
+	UNUSED(lane);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+int mosquitto_quic_migrate(struct mosquitto *mosq, const char *local_address)
+{
+#ifdef WITH_QUIC
+	if(!mosq || !local_address) return MOSQ_ERR_INVAL;
+	if(mosq->transport != mosq_t_quic) return MOSQ_ERR_NOT_SUPPORTED;
+
+	return msquic_migrate(mosq, local_address);
+#else
+	UNUSED(mosq);
+	UNUSED(local_address);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
 int mosquitto_tls_set(struct mosquitto *mosq, const char *cafile, const char *capath, const char *certfile, const char *keyfile, int (*pw_callback)(char *buf, int size, int rwflag, void *userdata))
 {
 #ifdef WITH_TLS
@@ -382,6 +449,37 @@ int mosquitto_string_option(struct mosquitto *mosq, enum mosq_opt_t option, cons
 				return MOSQ_ERR_SUCCESS;
 			}
 
+		case MOSQ_OPT_QUIC_RESUMPTION_FILE:
+#ifdef WITH_QUIC
+			mosquitto__free(mosq->quic_resumption_file);
+			mosq->quic_resumption_file = NULL;
+			if(value){
+				mosq->quic_resumption_file = mosquitto__strdup(value);
+				if(!mosq->quic_resumption_file){
+					return MOSQ_ERR_NOMEM;
+				}
+			}
+			return MOSQ_ERR_SUCCESS;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+
+		case MOSQ_OPT_QUIC_CONGESTION_CONTROL:
+#ifdef WITH_QUIC
+			if(value == NULL){
+				return MOSQ_ERR_INVAL;
+			}else if(!strcasecmp(value, "cubic")){
+				mosq->quic_settings.CongestionControlAlgorithm = QUIC_CONGESTION_CONTROL_ALGORITHM_CUBIC;
+			}else if(!strcasecmp(value, "bbr")){
+				mosq->quic_settings.CongestionControlAlgorithm = QUIC_CONGESTION_CONTROL_ALGORITHM_BBR;
+			}else{
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_settings.IsSet.CongestionControlAlgorithm = 1;
+			return MOSQ_ERR_SUCCESS;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
 
 		default:
 			return MOSQ_ERR_INVAL;
@@ -526,6 +624,151 @@ int mosquitto_int_option(struct mosquitto *mosq, enum mosq_opt_t option, int val
 #endif
 			break;
 
+		case MOSQ_OPT_QUIC_ZERO_RTT:
+#ifdef WITH_QUIC
+			mosq->quic_zero_rtt = (bool)value;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_LANES:
+#ifdef WITH_QUIC
+			if(value < 1 || value > MOSQ_QUIC_MAX_LANES){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_lanes = (uint8_t)value;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_LANE_MODE:
+#ifdef WITH_QUIC
+			if(value != MOSQ_QUIC_LANE_BY_TOPIC
+					&& value != MOSQ_QUIC_LANE_BY_QOS
+					&& value != MOSQ_QUIC_LANE_BY_APP){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_lane_mode = (uint8_t)value;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_LANE:
+#ifdef WITH_QUIC
+			if(value < 0 || value >= MOSQ_QUIC_MAX_LANES){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_lane = (uint8_t)value;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_DATAGRAM:
+#ifdef WITH_QUIC
+			mosq->quic_datagram = (bool)value;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_PACING:
+#ifdef WITH_QUIC
+			mosq->quic_settings.PacingEnabled = (value != 0);
+			mosq->quic_settings.IsSet.PacingEnabled = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_INITIAL_RTT:
+#ifdef WITH_QUIC
+			if(value < 1){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_settings.InitialRttMs = (uint32_t)value;
+			mosq->quic_settings.IsSet.InitialRttMs = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_STREAM_WINDOW:
+#ifdef WITH_QUIC
+			/* msquic requires a power of two. */
+			if(value < 1 || (value & (value - 1))){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_settings.StreamRecvWindowDefault = (uint32_t)value;
+			mosq->quic_settings.IsSet.StreamRecvWindowDefault = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_CONN_WINDOW:
+#ifdef WITH_QUIC
+			if(value < 1){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_settings.ConnFlowControlWindow = (uint32_t)value;
+			mosq->quic_settings.IsSet.ConnFlowControlWindow = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_KEEPALIVE_INTERVAL:
+#ifdef WITH_QUIC
+			if(value < 0){
+				return MOSQ_ERR_INVAL;
+			}
+			mosq->quic_settings.KeepAliveIntervalMs = (uint32_t)value;
+			mosq->quic_settings.IsSet.KeepAliveIntervalMs = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_SEND_BUFFERING:
+#ifdef WITH_QUIC
+			mosq->quic_settings.SendBufferingEnabled = (value != 0);
+			mosq->quic_settings.IsSet.SendBufferingEnabled = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_QUIC_ECN:
+#ifdef WITH_QUIC
+			mosq->quic_settings.EcnEnabled = (value != 0);
+			mosq->quic_settings.IsSet.EcnEnabled = 1;
+#else
+			return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			break;
+
+		case MOSQ_OPT_TRANSPORT:
+			if(value == MOSQ_TRANSPORT_TCP){
+#ifdef WITH_TCP
+				mosq->transport = mosq_t_tcp;
+#else
+				return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			}else if(value == MOSQ_TRANSPORT_QUIC){
+#ifdef WITH_QUIC
+				mosq->transport = mosq_t_quic;
+#else
+				return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+			}else{
+				return MOSQ_ERR_INVAL;
+			}
+			break;
+
 		default:
 			return MOSQ_ERR_INVAL;
 	}
@@ -35,6 +35,9 @@ Contributors:
 #include "mqtt_protocol.h"
 #include "net_mosq.h"
 #include "packet_mosq.h"
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+#  include "quic_mosq.h"
+#endif
 #include "read_handle.h"
 #include "util_mosq.h"
 #ifdef WITH_BROKER
@@ -47,6 +50,13 @@ Contributors:
 #  define G_PUB_MSGS_SENT_INC(A)
 #endif
 
+/* Most bytes a single packet__read() takes from the network. */
+#define PACKET_READ_SIZE 4096
+/* Most buffers handed to the socket in a single write call. */
+#define PACKET_WRITE_IOV_MAX 64
+
+static int packet__read_buffer_real(struct mosquitto *mosq, uint8_t *buf, uint32_t len);
+
 int packet__alloc(struct mosquitto__packet *packet)
 {
 	uint8_t remaining_bytes[5], byte;
@@ -95,12 +105,33 @@ void packet__cleanup(struct mosquitto__packet *packet)
 	packet->remaining_count = 0;
 	packet->remaining_mult = 1;
 	packet->remaining_length = 0;
-	mosquitto__free(packet->payload);
+#ifdef WITH_BROKER
+	if(packet->shared){
+		packet__shared_release(packet->shared);
+		packet->shared = NULL;
+	}else
+#endif
+	{
+		mosquitto__free(packet->payload);
+	}
 	packet->payload = NULL;
 	packet->to_process = 0;
 	packet->pos = 0;
 }
 
+#ifdef WITH_BROKER
+void packet__shared_release(struct mosquitto__shared_packet *shared)
+{
+	if(!shared) return;
+
+	shared->ref_count--;
+	if(shared->ref_count == 0){
+		mosquitto__free(shared->payload);
+		mosquitto__free(shared);
+	}
+}
+#endif
+
 
 void packet__cleanup_all_no_locks(struct mosquitto *mosq)
 {
@@ -155,6 +186,8 @@ int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet)
 
 #ifdef WITH_BROKER
 	if(db.config->max_queued_messages > 0 && mosq->out_packet_count >= db.config->max_queued_messages){
+		COMPAT_pthread_mutex_unlock(&mosq->out_packet_mutex);
+		packet__cleanup(packet);
 		mosquitto__free(packet);
 		if(mosq->is_dropping == false){
 			mosq->is_dropping = true;
@@ -180,12 +213,19 @@ int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet)
 	if(mosq->wsi){
 		lws_callback_on_writable(mosq->wsi);
 		return MOSQ_ERR_SUCCESS;
-	}else{
-		return packet__write(mosq);
 	}
-#  else
-	return packet__write(mosq);
 #  endif
+	if(mosq->current_out_packet
+#  ifdef WITH_QUIC
+			&& mosq->transport != mosq_t_quic
+#  endif
+			){
+
+		/* The socket is already full and the write will be retried once it
+		 * is writable, this packet is then sent along with the rest. */
+		return MOSQ_ERR_SUCCESS;
+	}
+	return packet__write(mosq);
 #else
 
 	/* Write a single byte to sockpairW (connected to sockpairR) to break out
@@ -223,18 +263,239 @@ int packet__check_oversize(struct mosquitto *mosq, uint32_t remaining_length)
 }
 
 
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+/* Tell the application when sending starts or stops being held back by
+ * QUIC flow control. */
+static void packet__quic_backpressure(struct mosquitto *mosq, bool blocked)
+{
+	if(mosq->quic_backpressure == blocked) return;
+	mosq->quic_backpressure = blocked;
+
+	COMPAT_pthread_mutex_lock(&mosq->callback_mutex);
+	if(mosq->on_quic_backpressure){
+		mosq->in_callback = true;
+		mosq->on_quic_backpressure(mosq, mosq->userdata, blocked);
+		mosq->in_callback = false;
+	}
+	COMPAT_pthread_mutex_unlock(&mosq->callback_mutex);
+}
+
+
+/* Zero copy: msquic sends straight from the packet payloads and frees the
+ * packets once the send completes. Packets queued for the same stream are
+ * handed over together, up to MOSQ_QUIC_SEND_BATCH at a time. Called with
+ * current_out_packet_mutex held, which is released before returning. */
+static int packet__write_quic(struct mosquitto *mosq)
+{
+	struct mosquitto__packet *batch[MOSQ_QUIC_SEND_BATCH];
+	uint8_t commands[MOSQ_QUIC_SEND_BATCH];
+	uint16_t mids[MOSQ_QUIC_SEND_BATCH];
+	struct mosquitto__packet *packet;
+	int count, sent, i;
+	bool blocked;
+	int rc;
+
+	while(mosq->current_out_packet){
+		packet = mosq->current_out_packet;
+		batch[0] = packet;
+		count = 1;
+
+		COMPAT_pthread_mutex_lock(&mosq->out_packet_mutex);
+		while(count < MOSQ_QUIC_SEND_BATCH && mosq->out_packet
+				&& !packet->datagram && !mosq->out_packet->datagram
+				&& mosq->out_packet->lane == packet->lane
+				&& (batch[count-1]->command&0xF0) != CMD_DISCONNECT){
+
+			batch[count++] = mosq->out_packet;
+			mosq->out_packet = mosq->out_packet->next;
+			if(!mosq->out_packet){
+				mosq->out_packet_last = NULL;
+			}
+			mosq->out_packet_count--;
+		}
+		COMPAT_pthread_mutex_unlock(&mosq->out_packet_mutex);
+
+		for(i=0; i<count; i++){
+			commands[i] = batch[i]->command;
+			mids[i] = batch[i]->mid;
+		}
+
+		rc = msquic_send_packets(mosq, batch, count, &sent);
+		blocked = (rc == MOSQ_ERR_ERRNO && errno == EAGAIN);
+
+		/* Whatever msquic did not take goes back on the front of the queue,
+		 * in the same order. */
+		COMPAT_pthread_mutex_lock(&mosq->out_packet_mutex);
+		for(i=count-1; i>sent; i--){
+			batch[i]->next = mosq->out_packet;
+			mosq->out_packet = batch[i];
+			if(!mosq->out_packet_last){
+				mosq->out_packet_last = batch[i];
+			}
+			mosq->out_packet_count++;
+		}
+		if(sent < count){
+			mosq->current_out_packet = batch[sent];
+		}else{
+			mosq->current_out_packet = mosq->out_packet;
+			if(mosq->out_packet){
+				mosq->out_packet = mosq->out_packet->next;
+				if(!mosq->out_packet){
+					mosq->out_packet_last = NULL;
+				}
+				mosq->out_packet_count--;
+			}
+		}
+		COMPAT_pthread_mutex_unlock(&mosq->out_packet_mutex);
+
+		if(sent == 0){
+			COMPAT_pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+			if(blocked){
+				/* The stream is full, the packets stay queued until msquic
+				 * has sent some of what it already has. */
+				packet__quic_backpressure(mosq, true);
+				return MOSQ_ERR_SUCCESS;
+			}
+			return rc;
+		}
+		if(sent == count){
+			packet__quic_backpressure(mosq, false);
+		}
+
+		for(i=0; i<sent; i++){
+			if((commands[i]&0xF6) == CMD_PUBLISH){
+				COMPAT_pthread_mutex_lock(&mosq->callback_mutex);
+				if(mosq->on_publish){
+					/* This is a QoS=0 message */
+					mosq->in_callback = true;
+					mosq->on_publish(mosq, mosq->userdata, mids[i]);
+					mosq->in_callback = false;
+				}
+				if(mosq->on_publish_v5){
+					/* This is a QoS=0 message */
+					mosq->in_callback = true;
+					mosq->on_publish_v5(mosq, mosq->userdata, mids[i], 0, NULL);
+					mosq->in_callback = false;
+				}
+				COMPAT_pthread_mutex_unlock(&mosq->callback_mutex);
+			}else if((commands[i]&0xF0) == CMD_DISCONNECT){
+				/* Always the last of its batch. Releases
+				 * current_out_packet_mutex. */
+				do_client_disconnect(mosq, MOSQ_ERR_SUCCESS, NULL);
+				return MOSQ_ERR_SUCCESS;
+			}
+		}
+
+		COMPAT_pthread_mutex_lock(&mosq->msgtime_mutex);
+		mosq->next_msg_out = mosquitto_time() + mosq->keepalive;
+		COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
+	}
+	COMPAT_pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+	return MOSQ_ERR_SUCCESS;
+}
+#endif
+
+
+#ifndef WIN32
+/* Describe the unsent part of a packet in at most iovmax buffers, returning
+ * how many were used. A packet built on a shared PUBLISH may have its own
+ * command byte and message id, everything else comes from the shared
+ * buffer. */
+static int packet__iov(struct mosquitto__packet *packet, struct iovec *iov, int iovmax)
+{
+	struct iovec seg[4];
+	int segcnt = 0;
+	int iovcnt = 0;
+	int i;
+	size_t skip = packet->pos;
+
+#ifdef WITH_BROKER
+	if(packet->shared && (packet->shared->mid_pos || packet->command != packet->shared->command)){
+		seg[0].iov_base = &packet->command;
+		seg[0].iov_len = 1;
+		if(packet->shared->mid_pos){
+			seg[1].iov_base = &packet->payload[1];
+			seg[1].iov_len = packet->shared->mid_pos - 1;
+			seg[2].iov_base = packet->mid_bytes;
+			seg[2].iov_len = 2;
+			seg[3].iov_base = &packet->payload[packet->shared->mid_pos + 2];
+			seg[3].iov_len = packet->packet_length - packet->shared->mid_pos - 2;
+			segcnt = 4;
+		}else{
+			seg[1].iov_base = &packet->payload[1];
+			seg[1].iov_len = packet->packet_length - 1;
+			segcnt = 2;
+		}
+	}else
+#endif
+	{
+		seg[0].iov_base = packet->payload;
+		seg[0].iov_len = packet->packet_length;
+		segcnt = 1;
+	}
+
+	for(i=0; i<segcnt && iovcnt<iovmax; i++){
+		if(skip >= seg[i].iov_len){
+			skip -= seg[i].iov_len;
+			continue;
+		}
+		iov[iovcnt].iov_base = (uint8_t *)seg[i].iov_base + skip;
+		iov[iovcnt].iov_len = seg[i].iov_len - skip;
+		skip = 0;
+		iovcnt++;
+	}
+	return iovcnt;
+}
+#endif
+
+
+/* Write the remainder of the current packet, along with as many of the
+ * packets queued behind it as fit, in a single call. */
+static ssize_t packet__write_gather(struct mosquitto *mosq, struct mosquitto__packet *packet)
+{
+#ifndef WIN32
+	struct iovec iov[PACKET_WRITE_IOV_MAX];
+	struct mosquitto__packet *next;
+	int iovcnt;
+
+	iovcnt = packet__iov(packet, iov, PACKET_WRITE_IOV_MAX);
+
+	COMPAT_pthread_mutex_lock(&mosq->out_packet_mutex);
+	for(next = mosq->out_packet; next && iovcnt < PACKET_WRITE_IOV_MAX; next = next->next){
+		iovcnt += packet__iov(next, &iov[iovcnt], PACKET_WRITE_IOV_MAX - iovcnt);
+	}
+	COMPAT_pthread_mutex_unlock(&mosq->out_packet_mutex);
+
+	if(iovcnt > 1){
+		return net__writev(mosq, iov, iovcnt);
+	}
+	return net__write(mosq, iov[0].iov_base, iov[0].iov_len);
+#else
+	return net__write(mosq, &(packet->payload[packet->pos]), packet->to_process);
+#endif
+}
+
+
 int packet__write(struct mosquitto *mosq)
 {
 	ssize_t write_length;
+	size_t written = 0;
+	uint32_t len;
 	struct mosquitto__packet *packet;
 	enum mosquitto_client_state state;
+	uint8_t command;
+#ifndef WITH_BROKER
+	uint16_t mid;
+#endif
+#if defined(WITH_QUIC) && defined(WITH_BROKER)
+	bool quic_owned;
+#endif
 
 	if(!mosq) return MOSQ_ERR_INVAL;
-#ifdef WITH_QUIC
-	if(mosq->connection.handle == NULL) return MOSQ_ERR_NO_CONN;
-#endif
 #ifdef WITH_BROKER
 	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
+#else
+	if(!net__transport_is_open(mosq)) return MOSQ_ERR_NO_CONN;
 #endif
 	COMPAT_pthread_mutex_lock(&mosq->current_out_packet_mutex);
 	COMPAT_pthread_mutex_lock(&mosq->out_packet_mutex);
@@ -260,15 +521,51 @@ int packet__write(struct mosquitto *mosq)
 		return MOSQ_ERR_SUCCESS;
 	}
 
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+	if(mosq->transport == mosq_t_quic){
+		return packet__write_quic(mosq);
+	}
+#endif
+
 	while(mosq->current_out_packet){
 		packet = mosq->current_out_packet;
+		command = packet->command;
+#ifndef WITH_BROKER
+		mid = packet->mid;
+#endif
+#if defined(WITH_QUIC) && defined(WITH_BROKER)
+		quic_owned = false;
+#endif
 
 		while(packet->to_process > 0){
-			write_length = net__write(mosq, &(packet->payload[packet->pos]), packet->to_process);
+			if(written > 0){
+				/* Already sent as part of an earlier gathered write. */
+				len = written < packet->to_process ? (uint32_t)written : packet->to_process;
+				packet->to_process -= len;
+				packet->pos += len;
+				written -= len;
+				continue;
+			}
+#if defined(WITH_QUIC) && defined(WITH_BROKER)
+			if(mosq->transport == mosq_t_quic){
+				/* msquic sends straight from the payload and the packet is
+				 * freed once it has finished, see net__quic_write_packet(). */
+				write_length = -1;
+				if(packet->datagram && packet->pos == 0){
+					write_length = net__quic_write_datagram(mosq, packet);
+				}
+				if(write_length < 0){
+					write_length = net__quic_write_packet(mosq, packet);
+				}
+				quic_owned = write_length > 0;
+			}else
+#endif
+			{
+				write_length = packet__write_gather(mosq, packet);
+			}
 			if(write_length > 0){
 				G_BYTES_SENT_INC(write_length);
-				packet->to_process -= (uint32_t)write_length;
-				packet->pos += (uint32_t)write_length;
+				written = (size_t)write_length;
 			}else{
 #ifdef WIN32
 				errno = WSAGetLastError();
@@ -297,30 +594,30 @@ int packet__write(struct mosquitto *mosq)
 		}
 
 		G_MSGS_SENT_INC(1);
-		if(((packet->command)&0xF6) == CMD_PUBLISH){
+		if((command&0xF6) == CMD_PUBLISH){
 			G_PUB_MSGS_SENT_INC(1);
 #ifndef WITH_BROKER
 			COMPAT_pthread_mutex_lock(&mosq->callback_mutex);
 			if(mosq->on_publish){
 				/* This is a QoS=0 message */
 				mosq->in_callback = true;
-				mosq->on_publish(mosq, mosq->userdata, packet->mid);
+				mosq->on_publish(mosq, mosq->userdata, mid);
 				mosq->in_callback = false;
 			}
 			if(mosq->on_publish_v5){
 				/* This is a QoS=0 message */
 				mosq->in_callback = true;
-				mosq->on_publish_v5(mosq, mosq->userdata, packet->mid, 0, NULL);
+				mosq->on_publish_v5(mosq, mosq->userdata, mid, 0, NULL);
 				mosq->in_callback = false;
 			}
 			COMPAT_pthread_mutex_unlock(&mosq->callback_mutex);
-		}else if(((packet->command)&0xF0) == CMD_DISCONNECT){
+		}else if((command&0xF0) == CMD_DISCONNECT){
 			do_client_disconnect(mosq, MOSQ_ERR_SUCCESS, NULL);
 			packet__cleanup(packet);
 			mosquitto__free(packet);
 			return MOSQ_ERR_SUCCESS;
 #endif
-		}else if(((packet->command)&0xF0) == CMD_PUBLISH){
+		}else if((command&0xF0) == CMD_PUBLISH){
 			G_PUB_MSGS_SENT_INC(1);
 		}
 
@@ -336,8 +633,13 @@ int packet__write(struct mosquitto *mosq)
 		}
 		COMPAT_pthread_mutex_unlock(&mosq->out_packet_mutex);
 
-		packet__cleanup(packet);
-		mosquitto__free(packet);
+#if defined(WITH_QUIC) && defined(WITH_BROKER)
+		if(!quic_owned)
+#endif
+		{
+			packet__cleanup(packet);
+			mosquitto__free(packet);
+		}
 
 #ifdef WITH_BROKER
 		mosq->next_msg_out = db.now_s + mosq->keepalive;
@@ -356,25 +658,134 @@ int packet__write(struct mosquitto *mosq)
 	return MOSQ_ERR_SUCCESS;
 }
 
+/* Check the remaining length of the incoming packet once it is fully known,
+ * before any payload is read. */
+static int packet__check_in_length(struct mosquitto *mosq)
+{
+#ifdef WITH_BROKER
+	switch(mosq->in_packet.command & 0xF0){
+		case CMD_CONNECT:
+			if(mosq->in_packet.remaining_length > 100000){ /* Arbitrary limit, make configurable */
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_PUBACK:
+		case CMD_PUBREC:
+		case CMD_PUBREL:
+		case CMD_PUBCOMP:
+		case CMD_UNSUBACK:
+			if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 2){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_PINGREQ:
+		case CMD_PINGRESP:
+			if(mosq->in_packet.remaining_length != 0){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_DISCONNECT:
+			if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 0){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+	}
+
+	if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
+		if(mosq->protocol == mosq_p_mqtt5){
+			send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
+		}
+		return MOSQ_ERR_OVERSIZE_PACKET;
+	}
+#else
+	/* FIXME - client case for incoming message received from broker too large */
+	UNUSED(mosq);
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Handle a fully read incoming packet and reset in_packet ready for the next
+ * one. If borrowed is true, the payload points into a transport owned buffer
+ * and must not be freed here. */
+static int packet__read_complete(struct mosquitto *mosq, bool borrowed)
+{
+	int rc;
+
+	mosq->in_packet.pos = 0;
+#ifdef WITH_BROKER
+	G_MSGS_RECEIVED_INC(1);
+	if(((mosq->in_packet.command)&0xF0) == CMD_PUBLISH){
+		G_PUB_MSGS_RECEIVED_INC(1);
+	}
+#endif
+	rc = handle__packet(mosq);
+
+	/* Free data and reset values */
+	if(borrowed){
+		mosq->in_packet.payload = NULL;
+	}
+	packet__cleanup(&mosq->in_packet);
+
+#ifdef WITH_BROKER
+	keepalive__update(mosq);
+#else
+	COMPAT_pthread_mutex_lock(&mosq->msgtime_mutex);
+	mosq->last_msg_in = mosquitto_time();
+	COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
+#endif
+	return rc;
+}
+
+
+/* Map a failed or empty net__read() onto a return code for packet__read(). */
+static int packet__read_error(ssize_t read_length)
+{
+	if(read_length == 0){
+		return MOSQ_ERR_CONN_LOST; /* EOF */
+	}
+#ifdef WIN32
+	errno = WSAGetLastError();
+#endif
+	if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
+		return MOSQ_ERR_SUCCESS;
+	}
+	switch(errno){
+		case COMPAT_ECONNRESET:
+			return MOSQ_ERR_CONN_LOST;
+		case COMPAT_EINTR:
+			return MOSQ_ERR_SUCCESS;
+		default:
+			return MOSQ_ERR_ERRNO;
+	}
+}
+
+
 int packet__read(struct mosquitto *mosq)
 {
-	uint8_t byte;
+	uint8_t buf[PACKET_READ_SIZE];
 	ssize_t read_length;
-	int rc = 0;
 	enum mosquitto_client_state state;
 
 	if(!mosq){
 		return MOSQ_ERR_INVAL;
 	}
-#ifdef WITH_QUIC
-	if(mosq->connection.handle == NULL){
+#ifdef WITH_BROKER
+	if(mosq->sock == INVALID_SOCKET){
 		return MOSQ_ERR_NO_CONN;
 	}
-#endif
-#ifdef WITH_TCP
-	if(mosq->sock == INVALID_SOCKET){
+#else
+	if(!net__transport_is_open(mosq)){
 		return MOSQ_ERR_NO_CONN;
 	}
+#endif
+#if defined(WITH_QUIC) && defined(WITH_BROKER)
+	if(mosq->transport == mosq_t_quic){
+		return net__quic_read_packets(mosq);
+	}
 #endif
 	state = mosquitto__get_state(mosq);
 	if(state == mosq_cs_connect_pending){
@@ -382,64 +793,148 @@ int packet__read(struct mosquitto *mosq)
 	}
 
 	/* This gets called if pselect() indicates that there is network data
-	 * available - ie. at least one byte.  What we do depends on what data we
-	 * already have.
-	 * If we've not got a command, attempt to read one and save it. This should
-	 * always work because it's only a single byte.
-	 * Then try to read the remaining length. This may fail because it is may
-	 * be more than one byte - will need to save data pending next read if it
-	 * does fail.
-	 * Then try to read the remaining payload, where 'payload' here means the
-	 * combined variable header and actual payload. This is the most likely to
-	 * fail due to longer length, so save current data and current position.
-	 * After all data is read, send to mosquitto__handle_packet() to deal with.
-	 * Finally, free the memory and reset everything to starting conditions.
+	 * available - ie. at least one byte.
+	 * A single read takes as much as fits in buf, and every complete packet
+	 * in it is handled in turn, so a client sending many small packets costs
+	 * one read for all of them rather than three or more reads per packet.
+	 * A packet cut off at the end of buf is kept in in_packet and completed
+	 * by later reads, so nothing has to be kept of buf itself.
+	 * Once the rest of a packet is at least as large as buf, it is read
+	 * straight into its payload instead, without the extra copy.
 	 */
-	if(!mosq->in_packet.command){
-		read_length = net__read(mosq, &byte, 1);
-		if(read_length == 1){
-			mosq->in_packet.command = byte;
+	if(mosq->in_packet.to_process >= PACKET_READ_SIZE){
+		while(mosq->in_packet.to_process > 0){
+			read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
+			if(read_length > 0){
+				G_BYTES_RECEIVED_INC(read_length);
+				mosq->in_packet.to_process -= (uint32_t)read_length;
+				mosq->in_packet.pos += (uint32_t)read_length;
+			}else{
+				if(read_length < 0 && (errno == EAGAIN || errno == COMPAT_EWOULDBLOCK)){
+					/* Update last_msg_in time while a large message is
+					 * still arriving. If a client can't send 1000 bytes in a
+					 * second it probably shouldn't be using a 1 second keep
+					 * alive. */
+#ifdef WITH_BROKER
+					keepalive__update(mosq);
+#else
+					COMPAT_pthread_mutex_lock(&mosq->msgtime_mutex);
+					mosq->last_msg_in = mosquitto_time();
+					COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
+#endif
+				}
+				return packet__read_error(read_length);
+			}
+		}
+		/* All data for this packet is read. */
+		return packet__read_complete(mosq, false);
+	}
+
+	read_length = net__read(mosq, buf, sizeof(buf));
+	if(read_length <= 0){
+		return packet__read_error(read_length);
+	}
+	return packet__read_buffer_real(mosq, buf, (uint32_t)read_length);
+}
+
+
+static bool packet__read_buffer_stop(struct mosquitto *mosq)
+{
+	enum mosquitto_client_state state;
+
+	state = mosquitto__get_state(mosq);
+	return state == mosq_cs_disconnecting
+			|| state == mosq_cs_disconnect_with_will
+			|| state == mosq_cs_disconnected
+			|| state == mosq_cs_disused;
+}
+
+
+/* Feed a buffer read by packet__read(), received from a message based
+ * transport, read by an I/O thread or received through io_uring into the
+ * incoming packet framer.
+ *
+ * Packets that lie entirely within buf are handled in place, with in_packet
+ * borrowing its payload from buf. Only a packet that spans more than one
+ * buffer is copied into an allocated payload, in the same way as packet__read()
+ * does for stream sockets. buf must remain valid until this returns.
+ */
+static int packet__read_buffer_real(struct mosquitto *mosq, uint8_t *buf, uint32_t len)
+{
+	uint32_t pos = 0;
+	uint32_t remaining_length;
+	uint32_t mult;
+	uint32_t hdr;
+	uint32_t avail;
+	uint8_t byte = 0;
+	int rc;
+
+	if(!mosq || (!buf && len > 0)){
+		return MOSQ_ERR_INVAL;
+	}
+
+	while(pos < len){
+		if(packet__read_buffer_stop(mosq)){
+			return MOSQ_ERR_SUCCESS;
+		}
+
+		if(!mosq->in_packet.command){
 #ifdef WITH_BROKER
-			G_BYTES_RECEIVED_INC(1);
 			/* Clients must send CONNECT as their first command. */
-			if(!(mosq->bridge) && state == mosq_cs_new && (byte&0xF0) != CMD_CONNECT){
+			if(!(mosq->bridge) && mosquitto__get_state(mosq) == mosq_cs_new && (buf[pos]&0xF0) != CMD_CONNECT){
 				return MOSQ_ERR_PROTOCOL;
 			}
 #endif
-		}else{
-			if(read_length == 0){
-				return MOSQ_ERR_CONN_LOST; /* EOF */
-			}
-#ifdef WIN32
-			errno = WSAGetLastError();
-#endif
-			if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
-				return MOSQ_ERR_SUCCESS;
-			}else{
-				switch(errno){
-					case COMPAT_ECONNRESET:
-						return MOSQ_ERR_CONN_LOST;
-					case COMPAT_EINTR:
-						return MOSQ_ERR_SUCCESS;
-					default:
-						return MOSQ_ERR_ERRNO;
+			/* Fast path: the whole packet is in this buffer. */
+			remaining_length = 0;
+			mult = 1;
+			hdr = 1;
+			do{
+				if(pos + hdr >= len || hdr > 4){
+					break;
+				}
+				byte = buf[pos+hdr];
+				remaining_length += (byte & 127) * mult;
+				mult *= 128;
+				hdr++;
+			}while((byte & 128) != 0);
+
+			if(hdr > 1 && (buf[pos+hdr-1] & 128) == 0
+					&& len - pos - hdr >= remaining_length){
+
+				mosq->in_packet.command = buf[pos];
+				mosq->in_packet.remaining_length = remaining_length;
+				mosq->in_packet.remaining_count = (int8_t)(hdr - 1);
+				rc = packet__check_in_length(mosq);
+				if(rc) return rc;
+
+				if(remaining_length > 0){
+					mosq->in_packet.payload = &buf[pos+hdr];
 				}
+				G_BYTES_RECEIVED_INC(hdr + remaining_length);
+				pos += hdr + remaining_length;
+
+				rc = packet__read_complete(mosq, true);
+				if(rc) return rc;
+				continue;
+			}else if(hdr > 4 && (buf[pos+hdr-1] & 128) != 0){
+				return MOSQ_ERR_MALFORMED_PACKET;
 			}
+
+			mosq->in_packet.command = buf[pos];
+			pos++;
+			G_BYTES_RECEIVED_INC(1);
 		}
-	}
-	/* remaining_count is the number of bytes that the remaining_length
-	 * parameter occupied in this incoming packet. We don't use it here as such
-	 * (it is used when allocating an outgoing packet), but we must be able to
-	 * determine whether all of the remaining_length parameter has been read.
-	 * remaining_count has three states here:
-	 *   0 means that we haven't read any remaining_length bytes
-	 *   <0 means we have read some remaining_length bytes but haven't finished
-	 *   >0 means we have finished reading the remaining_length bytes.
-	 */
-	if(mosq->in_packet.remaining_count <= 0){
-		do{
-			read_length = net__read(mosq, &byte, 1);
-			if(read_length == 1){
+
+		/* Slow path: accumulate a packet that spans buffers. */
+		if(mosq->in_packet.remaining_count <= 0){
+			do{
+				if(pos == len){
+					return MOSQ_ERR_SUCCESS;
+				}
+				byte = buf[pos];
+				pos++;
+
 				mosq->in_packet.remaining_count--;
 				/* Max 4 bytes length for remaining length as defined by protocol.
 				 * Anything more likely means a broken/malicious client.
@@ -451,138 +946,107 @@ int packet__read(struct mosquitto *mosq)
 				G_BYTES_RECEIVED_INC(1);
 				mosq->in_packet.remaining_length += (byte & 127) * mosq->in_packet.remaining_mult;
 				mosq->in_packet.remaining_mult *= 128;
-			}else{
-				if(read_length == 0){
-					return MOSQ_ERR_CONN_LOST; /* EOF */
-				}
-#ifdef WIN32
-				errno = WSAGetLastError();
-#endif
-				if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
-					return MOSQ_ERR_SUCCESS;
-				}else{
-					switch(errno){
-						case COMPAT_ECONNRESET:
-							return MOSQ_ERR_CONN_LOST;
-						case COMPAT_EINTR:
-							return MOSQ_ERR_SUCCESS;
-						default:
-							return MOSQ_ERR_ERRNO;
-					}
-				}
-			}
-		}while((byte & 128) != 0);
-		/* We have finished reading remaining_length, so make remaining_count
-		 * positive. */
-		mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
-
-#ifdef WITH_BROKER
-		switch(mosq->in_packet.command & 0xF0){
-			case CMD_CONNECT:
-				if(mosq->in_packet.remaining_length > 100000){ /* Arbitrary limit, make configurable */
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
-
-			case CMD_PUBACK:
-			case CMD_PUBREC:
-			case CMD_PUBREL:
-			case CMD_PUBCOMP:
-			case CMD_UNSUBACK:
-				if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 2){
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
+			}while((byte & 128) != 0);
+			mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
 
-			case CMD_PINGREQ:
-			case CMD_PINGRESP:
-				if(mosq->in_packet.remaining_length != 0){
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
+			rc = packet__check_in_length(mosq);
+			if(rc) return rc;
 
-			case CMD_DISCONNECT:
-				if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 0){
-					return MOSQ_ERR_MALFORMED_PACKET;
+			if(mosq->in_packet.remaining_length > 0){
+				mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
+				if(!mosq->in_packet.payload){
+					return MOSQ_ERR_NOMEM;
 				}
-				break;
-		}
-
-		if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
-			if(mosq->protocol == mosq_p_mqtt5){
-				send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
+				mosq->in_packet.to_process = mosq->in_packet.remaining_length;
 			}
-			return MOSQ_ERR_OVERSIZE_PACKET;
 		}
-#else
-		/* FIXME - client case for incoming message received from broker too large */
-#endif
-		if(mosq->in_packet.remaining_length > 0){
-			mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
-			if(!mosq->in_packet.payload){
-				return MOSQ_ERR_NOMEM;
+		if(mosq->in_packet.to_process > 0){
+			avail = len - pos;
+			if(avail > mosq->in_packet.to_process){
+				avail = mosq->in_packet.to_process;
 			}
-			mosq->in_packet.to_process = mosq->in_packet.remaining_length;
-		}
-	}
-	while(mosq->in_packet.to_process>0){
-		read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
-		if(read_length > 0){
-			G_BYTES_RECEIVED_INC(read_length);
-			mosq->in_packet.to_process -= (uint32_t)read_length;
-			mosq->in_packet.pos += (uint32_t)read_length;
-		}else{
-#ifdef WIN32
-			errno = WSAGetLastError();
-#endif
-			if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
-				if(mosq->in_packet.to_process > 1000){
-					/* Update last_msg_in time if more than 1000 bytes left to
-					 * receive. Helps when receiving large messages.
-					 * This is an arbitrary limit, but with some consideration.
-					 * If a client can't send 1000 bytes in a second it
-					 * probably shouldn't be using a 1 second keep alive. */
-#ifdef WITH_BROKER
-					keepalive__update(mosq);
-#else
-					COMPAT_pthread_mutex_lock(&mosq->msgtime_mutex);
-					mosq->last_msg_in = mosquitto_time();
-					COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
-				}
+			memcpy(&mosq->in_packet.payload[mosq->in_packet.pos], &buf[pos], avail);
+			G_BYTES_RECEIVED_INC(avail);
+			mosq->in_packet.pos += avail;
+			mosq->in_packet.to_process -= avail;
+			pos += avail;
+			if(mosq->in_packet.to_process > 0){
 				return MOSQ_ERR_SUCCESS;
-			}else{
-				switch(errno){
-					case COMPAT_ECONNRESET:
-						return MOSQ_ERR_CONN_LOST;
-					case COMPAT_EINTR:
-						return MOSQ_ERR_SUCCESS;
-					default:
-						return MOSQ_ERR_ERRNO;
-				}
 			}
 		}
+
+		/* All data for this packet is read. */
+		rc = packet__read_complete(mosq, false);
+		if(rc) return rc;
 	}
+	return MOSQ_ERR_SUCCESS;
+}
 
-	/* All data for this packet is read. */
-	mosq->in_packet.pos = 0;
-#ifdef WITH_BROKER
-	G_MSGS_RECEIVED_INC(1);
-	if(((mosq->in_packet.command)&0xF0) == CMD_PUBLISH){
-		G_PUB_MSGS_RECEIVED_INC(1);
+
+#if defined(WITH_QUIC) || defined(WITH_IO_THREADS) || defined(WITH_IO_URING)
+/* A transport with several independent streams keeps a partially read packet
+ * per stream. saved holds it for this stream between calls, and is swapped
+ * into in_packet while buf is parsed. saved may be NULL for the one stream
+ * that uses in_packet directly. */
+int packet__read_buffer(struct mosquitto *mosq, struct mosquitto__packet *saved, uint8_t *buf, uint32_t len)
+{
+	struct mosquitto__packet other;
+	int rc;
+
+	if(!mosq) return MOSQ_ERR_INVAL;
+	if(!saved){
+		return packet__read_buffer_real(mosq, buf, len);
 	}
+
+	other = mosq->in_packet;
+	mosq->in_packet = *saved;
+	rc = packet__read_buffer_real(mosq, buf, len);
+	*saved = mosq->in_packet;
+	mosq->in_packet = other;
+
+	return rc;
+}
 #endif
-	rc = handle__packet(mosq);
 
-	/* Free data and reset values */
-	packet__cleanup(&mosq->in_packet);
 
+#ifdef WITH_QUIC
+/* Handle a packet received as an unreliable datagram. Only a single, whole
+ * QoS 0 PUBLISH is accepted, anything else is silently dropped because the
+ * sender cannot rely on a datagram arriving anyway. */
+int packet__read_datagram(struct mosquitto *mosq, uint8_t *buf, uint32_t len)
+{
+	struct mosquitto__packet saved;
+	uint32_t remaining_length = 0;
+	uint32_t mult = 1;
+	uint32_t hdr = 1;
+	uint8_t byte;
+
+	if(!mosq || !buf) return MOSQ_ERR_INVAL;
+
+	if(len < 2 || (buf[0]&0xF6) != CMD_PUBLISH){
+		return MOSQ_ERR_SUCCESS;
+	}
 #ifdef WITH_BROKER
-	keepalive__update(mosq);
-#else
-	COMPAT_pthread_mutex_lock(&mosq->msgtime_mutex);
-	mosq->last_msg_in = mosquitto_time();
-	COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
+	/* A datagram may overtake CONNECT. */
+	if(mosquitto__get_state(mosq) != mosq_cs_active){
+		return MOSQ_ERR_SUCCESS;
+	}
 #endif
-	return rc;
+	do{
+		if(hdr == len || hdr > 4){
+			return MOSQ_ERR_SUCCESS;
+		}
+		byte = buf[hdr];
+		remaining_length += (byte & 127) * mult;
+		mult *= 128;
+		hdr++;
+	}while((byte & 128) != 0);
+	if(len - hdr != remaining_length){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	memset(&saved, 0, sizeof(saved));
+	saved.remaining_mult = 1;
+	return packet__read_buffer(mosq, &saved, buf, len);
 }
+#endif
@@ -26,6 +26,9 @@ void packet__cleanup(struct mosquitto__packet *packet);
 void packet__cleanup_all(struct mosquitto *mosq);
 void packet__cleanup_all_no_locks(struct mosquitto *mosq);
 int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet);
+#ifdef WITH_BROKER
+void packet__shared_release(struct mosquitto__shared_packet *shared);
+#endif
 
 int packet__check_oversize(struct mosquitto *mosq, uint32_t remaining_length);
 
@@ -48,5 +51,11 @@ unsigned int packet__varint_bytes(uint32_t word);
 
 int packet__write(struct mosquitto *mosq);
 int packet__read(struct mosquitto *mosq);
+#if defined(WITH_QUIC) || defined(WITH_IO_THREADS) || defined(WITH_IO_URING)
+int packet__read_buffer(struct mosquitto *mosq, struct mosquitto__packet *saved, uint8_t *buf, uint32_t len);
+#endif
+#ifdef WITH_QUIC
+int packet__read_datagram(struct mosquitto *mosq, uint8_t *buf, uint32_t len);
+#endif
 
 #endif
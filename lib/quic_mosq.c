@@ -1,12 +1,59 @@
 #ifdef WITH_QUIC
+#include <errno.h>
+#include <stdio.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
 #include "logging_mosq.h"
 #include "memory_mosq.h"
+#include "misc_mosq.h"
+#include "net_mosq.h"
 #include "packet_mosq.h"
 #include "quic_mosq.h"
 
 const QUIC_API_TABLE* msquic = NULL;
-HQUIC registration;
-HQUIC configuration;
+#ifndef WITH_BROKER
+/* Registrations and configurations are shared by every client in the process
+ * that asks for the same settings, so that a process can run many clients
+ * without opening a registration each. Registrations are keyed by execution
+ * profile, configurations by registration and settings. Both are reference
+ * counted and closed when the last client using them is destroyed. */
+struct mosq_quic_registration {
+    struct mosq_quic_registration *next;
+    HQUIC handle;
+    QUIC_EXECUTION_PROFILE profile;
+    int refcount;
+};
+
+struct mosq_quic_config {
+    struct mosq_quic_config *next;
+    struct mosq_quic_registration *registration;
+    HQUIC handle;
+    QUIC_SETTINGS settings;
+    int refcount;
+};
+
+static struct mosq_quic_registration *registrations = NULL;
+static struct mosq_quic_config *configs = NULL;
+static pthread_mutex_t configs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Resumption tickets, one per host/port, shared by all clients in the
+ * process. Tickets arrive on msquic threads so the list is locked; the
+ * resumption file is only touched from application threads, under
+ * tickets_file_mutex. */
+struct mosq_quic_ticket {
+    struct mosq_quic_ticket *next;
+    char *host;
+    uint16_t port;
+    uint32_t length;
+    uint8_t *data;
+};
+
+static struct mosq_quic_ticket *tickets = NULL;
+static pthread_mutex_t tickets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tickets_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 int msquic_init(void) 
 {
@@ -28,72 +75,502 @@ void msquic_cleanup(void)
     }
 }
 
-int msquic_config(struct mosquitto *mosq)
+#ifndef WITH_BROKER
+/* Drop a reference with configs_mutex held. Returns true if this was the last
+ * one, in which case reg has been unlinked and the caller must pass it to
+ * registration__close() once configs_mutex has been released. */
+static bool registration__unref_locked(struct mosq_quic_registration *reg)
 {
-    if(msquic == NULL) {
-        return MOSQ_ERR_QUIC;
+    struct mosq_quic_registration **prev;
+
+    reg->refcount--;
+    if (reg->refcount > 0) {
+        return false;
+    }
+    for (prev = &registrations; *prev; prev = &(*prev)->next) {
+        if (*prev == reg) {
+            *prev = reg->next;
+            break;
+        }
     }
+    return true;
+}
 
-    QUIC_STATUS status = QUIC_STATUS_SUCCESS;
+static void registration__close(struct mosq_quic_registration *reg)
+{
+    /* Blocks until every connection in the registration has closed, so must
+     * not be called with configs_mutex held. */
+    msquic->RegistrationClose(reg->handle);
+    mosquitto__free(reg);
+}
+
+static struct mosq_quic_registration *registration__get(struct mosquitto *mosq)
+{
+    struct mosq_quic_registration *reg;
+    QUIC_STATUS status;
 
+    for (reg = registrations; reg; reg = reg->next) {
+        if (reg->profile == mosq->quic_execution_profile) {
+            reg->refcount++;
+            return reg;
+        }
+    }
+
+    reg = mosquitto__calloc(1, sizeof(struct mosq_quic_registration));
+    if (!reg) {
+        return NULL;
+    }
     const QUIC_REGISTRATION_CONFIG regconfig = {
-        "mosquitto", 
+        "mosquitto",
         mosq->quic_execution_profile
     };
-    if (QUIC_FAILED(status = msquic->RegistrationOpen(
-            &regconfig, 
-            &registration))) {
+    if (QUIC_FAILED(status = msquic->RegistrationOpen(&regconfig, &reg->handle))) {
         log__printf(mosq, MOSQ_LOG_ERR, "Error: RegistrationOpen failed, 0x%x!", status);
-        goto Error;
+        mosquitto__free(reg);
+        return NULL;
     }
+    reg->profile = mosq->quic_execution_profile;
+    reg->refcount = 1;
+    reg->next = registrations;
+    registrations = reg;
+    return reg;
+}
 
-    const QUIC_BUFFER alpn = { 
-        sizeof("mqtt") - 1, 
-        (uint8_t*)"mqtt" 
+/* Drop a reference with configs_mutex held. If it was the last one the
+ * configuration is unlinked and returned, and the caller must pass it to
+ * config__close() after releasing configs_mutex. */
+static struct mosq_quic_config *config__unref_locked(struct mosq_quic_config *config)
+{
+    struct mosq_quic_config **prev;
+
+    config->refcount--;
+    if (config->refcount > 0) {
+        return NULL;
+    }
+    for (prev = &configs; *prev; prev = &(*prev)->next) {
+        if (*prev == config) {
+            *prev = config->next;
+            break;
+        }
+    }
+    if (!registration__unref_locked(config->registration)) {
+        config->registration = NULL;
+    }
+    return config;
+}
+
+static void config__close(struct mosq_quic_config *config)
+{
+    if (config == NULL) {
+        return;
+    }
+    msquic->ConfigurationClose(config->handle);
+    if (config->registration) {
+        registration__close(config->registration);
+    }
+    mosquitto__free(config);
+}
+
+static struct mosq_quic_config *config__open(struct mosquitto *mosq, const QUIC_SETTINGS *settings)
+{
+    struct mosq_quic_config *config;
+    QUIC_CREDENTIAL_CONFIG credconfig;
+    QUIC_STATUS status;
+    const QUIC_BUFFER alpn = {
+        sizeof("mqtt") - 1,
+        (uint8_t*)"mqtt"
     };
-    QUIC_SETTINGS settings = {0};
-    settings.IdleTimeoutMs = 0;
-    settings.IsSet.IdleTimeoutMs = 1;
+
+    config = mosquitto__calloc(1, sizeof(struct mosq_quic_config));
+    if (!config) {
+        return NULL;
+    }
+    config->registration = registration__get(mosq);
+    if (!config->registration) {
+        mosquitto__free(config);
+        return NULL;
+    }
+    memcpy(&config->settings, settings, sizeof(QUIC_SETTINGS));
 
     if (QUIC_FAILED(status = msquic->ConfigurationOpen(
-            registration,
+            config->registration->handle,
             &alpn,
             1,
-            &settings,
-            sizeof(settings),
+            &config->settings,
+            sizeof(config->settings),
             NULL,
-            &configuration))) {
+            &config->handle))) {
         log__printf(mosq, MOSQ_LOG_ERR, "Error: ConfigurationOpen failed, 0x%x!", status);
         goto Error;
     }
 
-    QUIC_CREDENTIAL_CONFIG credconfig;
     memset(&credconfig, 0, sizeof(credconfig));
     credconfig.Type = QUIC_CREDENTIAL_TYPE_NONE;
-    credconfig.Flags = QUIC_CREDENTIAL_FLAG_CLIENT | 
+    credconfig.Flags = QUIC_CREDENTIAL_FLAG_CLIENT |
                            QUIC_CREDENTIAL_FLAG_NO_CERTIFICATE_VALIDATION;
-    
+
     if (QUIC_FAILED(status = msquic->ConfigurationLoadCredential(
-            configuration,
+            config->handle,
             &credconfig))) {
         log__printf(mosq, MOSQ_LOG_ERR, "Error: ConfigurationLoadCredential failed, 0x%x!", status);
         goto Error;
     }
+    return config;
+
+Error:
+    if (config->handle != NULL) {
+        msquic->ConfigurationClose(config->handle);
+    }
+    /* Only a registration opened just above can be released here, and it has
+     * no connections yet, so closing it does not block. */
+    if (registration__unref_locked(config->registration)) {
+        registration__close(config->registration);
+    }
+    mosquitto__free(config);
+    return NULL;
+}
+
+/* Attach mosq to the shared configuration matching its settings, opening one
+ * if there is none yet. Replaces any configuration it used before; existing
+ * connections keep a reference of their own inside msquic. */
+int msquic_config(struct mosquitto *mosq)
+{
+    struct mosq_quic_config *config, *old = NULL;
+    const QUIC_SETTINGS *settings = &mosq->quic_settings;
+
+    if(msquic == NULL) {
+        return MOSQ_ERR_QUIC;
+    }
+
+    pthread_mutex_lock(&configs_mutex);
+    for (config = configs; config; config = config->next) {
+        if (config->registration->profile == mosq->quic_execution_profile
+                && !memcmp(&config->settings, settings, sizeof(QUIC_SETTINGS))) {
+            break;
+        }
+    }
+    if (config) {
+        config->refcount++;
+    } else {
+        config = config__open(mosq, settings);
+        if (!config) {
+            pthread_mutex_unlock(&configs_mutex);
+            return MOSQ_ERR_QUIC;
+        }
+        config->refcount = 1;
+        config->next = configs;
+        configs = config;
+    }
+    if (mosq->quic_config) {
+        old = config__unref_locked(mosq->quic_config);
+    }
+    mosq->quic_config = config;
+    pthread_mutex_unlock(&configs_mutex);
+    config__close(old);
 
     return MOSQ_ERR_SUCCESS;
+}
 
-Error:
-    if (msquic != NULL) {
-        if (configuration != NULL) {
-            msquic->ConfigurationClose(configuration);
-            configuration = NULL;
+void msquic_config_release(struct mosquitto *mosq)
+{
+    struct mosq_quic_config *old;
+
+    if (mosq->quic_config == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&configs_mutex);
+    old = config__unref_locked(mosq->quic_config);
+    mosq->quic_config = NULL;
+    pthread_mutex_unlock(&configs_mutex);
+    config__close(old);
+}
+
+static struct mosq_quic_ticket *ticket__find(struct mosq_quic_ticket *list, const char *host, uint16_t port)
+{
+    struct mosq_quic_ticket *ticket;
+
+    for (ticket = list; ticket; ticket = ticket->next) {
+        if (ticket->port == port && !strcmp(ticket->host, host)) {
+            return ticket;
         }
-        if (registration != NULL) {
-            msquic->RegistrationClose(registration);
-            registration = NULL;
+    }
+    return NULL;
+}
+
+/* Takes ownership of data. Must be called with tickets_mutex held if list is
+ * the shared cache. */
+static int ticket__set(struct mosq_quic_ticket **list, const char *host, uint16_t port, uint8_t *data, uint32_t length)
+{
+    struct mosq_quic_ticket *ticket;
+
+    ticket = ticket__find(*list, host, port);
+    if (!ticket) {
+        ticket = mosquitto__calloc(1, sizeof(struct mosq_quic_ticket));
+        if (!ticket) {
+            return MOSQ_ERR_NOMEM;
         }
+        ticket->host = mosquitto__strdup(host);
+        if (!ticket->host) {
+            mosquitto__free(ticket);
+            return MOSQ_ERR_NOMEM;
+        }
+        ticket->port = port;
+        ticket->next = *list;
+        *list = ticket;
     }
-    return MOSQ_ERR_QUIC;
+    mosquitto__free(ticket->data);
+    ticket->data = data;
+    ticket->length = length;
+    return MOSQ_ERR_SUCCESS;
+}
+
+static void ticket__free_all(struct mosq_quic_ticket *list)
+{
+    struct mosq_quic_ticket *next;
+
+    while (list) {
+        next = list->next;
+        mosquitto__free(list->host);
+        mosquitto__free(list->data);
+        mosquitto__free(list);
+        list = next;
+    }
+}
+
+static int hex__value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* The resumption file holds one "host port hex-ticket" line per broker.
+ * Entries it contains are merged into the in memory cache, so a file shared by
+ * several processes keeps tickets for brokers this process never used. The
+ * file is parsed into a private list first so that tickets_mutex is only held
+ * for the merge, never for the file access. */
+static void ticket__load_file(struct mosquitto *mosq, const char *path)
+{
+    FILE *fptr;
+    char *line;
+    char host[256];
+    unsigned int port;
+    int offset;
+    size_t hexlen, i;
+    uint8_t *data;
+    int hi, lo;
+    const size_t line_len = 256 + 8 + 2*8192 + 4;
+    struct mosq_quic_ticket *loaded = NULL, *ticket;
+
+    fptr = mosquitto__fopen(path, "rt", true);
+    if (!fptr) {
+        return;
+    }
+    line = mosquitto__malloc(line_len);
+    if (!line) {
+        fclose(fptr);
+        return;
+    }
+    while (fgets(line, (int)line_len, fptr)) {
+        if (sscanf(line, "%255s %u %n", host, &port, &offset) != 2 || port == 0 || port > UINT16_MAX) {
+            continue;
+        }
+        hexlen = strcspn(&line[offset], "\r\n");
+        if (hexlen == 0 || hexlen % 2) {
+            continue;
+        }
+        data = mosquitto__malloc(hexlen/2);
+        if (!data) {
+            break;
+        }
+        for (i = 0; i < hexlen/2; i++) {
+            hi = hex__value(line[offset + 2*i]);
+            lo = hex__value(line[offset + 2*i + 1]);
+            if (hi < 0 || lo < 0) {
+                break;
+            }
+            data[i] = (uint8_t)((hi<<4) | lo);
+        }
+        if (i != hexlen/2 || ticket__find(loaded, host, (uint16_t)port)
+                || ticket__set(&loaded, host, (uint16_t)port, data, (uint32_t)(hexlen/2))) {
+
+            mosquitto__free(data);
+        }
+    }
+    mosquitto__free(line);
+    fclose(fptr);
+
+    /* Tickets already in memory are newer than anything on disk. */
+    pthread_mutex_lock(&tickets_mutex);
+    for (ticket = loaded; ticket; ticket = ticket->next) {
+        if (!ticket__find(tickets, ticket->host, ticket->port)
+                && !ticket__set(&tickets, ticket->host, ticket->port, ticket->data, ticket->length)) {
+
+            ticket->data = NULL;
+        }
+    }
+    pthread_mutex_unlock(&tickets_mutex);
+    ticket__free_all(loaded);
+    log__printf(mosq, MOSQ_LOG_DEBUG, "Loaded QUIC resumption tickets from %s.", path);
+}
+
+/* Render the cache in the resumption file format. Must be called with
+ * tickets_mutex held. */
+static char *ticket__format(size_t *len)
+{
+    struct mosq_quic_ticket *ticket;
+    char *buf;
+    size_t size = 1, pos = 0;
+    uint32_t i;
+
+    for (ticket = tickets; ticket; ticket = ticket->next) {
+        size += strlen(ticket->host) + strlen(" 65535 \n") + 2*(size_t)ticket->length;
+    }
+    buf = mosquitto__malloc(size);
+    if (!buf) {
+        return NULL;
+    }
+    for (ticket = tickets; ticket; ticket = ticket->next) {
+        pos += (size_t)snprintf(&buf[pos], size-pos, "%s %u ", ticket->host, ticket->port);
+        for (i = 0; i < ticket->length; i++) {
+            pos += (size_t)snprintf(&buf[pos], size-pos, "%02x", ticket->data[i]);
+        }
+        buf[pos++] = '\n';
+    }
+    buf[pos] = '\0';
+    *len = pos;
+    return buf;
+}
+
+static void ticket__save_file(struct mosquitto *mosq, const char *path)
+{
+    FILE *fptr;
+    char *tmp_path;
+    char *buf;
+    size_t len, buflen = 0;
+    bool ok;
+
+    pthread_mutex_lock(&tickets_mutex);
+    buf = ticket__format(&buflen);
+    pthread_mutex_unlock(&tickets_mutex);
+    if (!buf) {
+        return;
+    }
+
+    len = strlen(path) + strlen(".new") + 1;
+    tmp_path = mosquitto__malloc(len);
+    if (!tmp_path) {
+        mosquitto__free(buf);
+        return;
+    }
+    snprintf(tmp_path, len, "%s.new", path);
+
+    fptr = mosquitto__fopen(tmp_path, "wt", true);
+    if (!fptr) {
+        log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Unable to write QUIC resumption file %s: %s.", tmp_path, strerror(errno));
+        mosquitto__free(tmp_path);
+        mosquitto__free(buf);
+        return;
+    }
+    ok = fwrite(buf, 1, buflen, fptr) == buflen;
+    if (fclose(fptr) != 0) {
+        ok = false;
+    }
+    /* Replace the old file in one step so a crash never leaves it half written. */
+    if (!ok || rename(tmp_path, path) != 0) {
+        log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Unable to write QUIC resumption file %s.", path);
+        remove(tmp_path);
+    }
+    mosquitto__free(tmp_path);
+    mosquitto__free(buf);
+}
+
+/* Called from the connection callback when the broker issues a ticket. This
+ * runs on an msquic worker thread, so it only updates the cache; the
+ * resumption file is written later by msquic_tickets_save() on the
+ * application thread. */
+static void ticket__store(struct mosquitto *mosq, const uint8_t *data, uint32_t length)
+{
+    uint8_t *copy;
+
+    if (!mosq->host || length == 0) {
+        return;
+    }
+    copy = mosquitto__malloc(length);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, data, length);
+
+    pthread_mutex_lock(&tickets_mutex);
+    if (ticket__set(&tickets, mosq->host, mosq->port, copy, length)) {
+        mosquitto__free(copy);
+    } else {
+        mosq->quic_ticket_dirty = true;
+    }
+    pthread_mutex_unlock(&tickets_mutex);
+}
+
+/* Write the resumption file if this client has received a ticket since it
+ * was last saved. Called from the network loop and on disconnect, never from
+ * an msquic callback. */
+void msquic_tickets_save(struct mosquitto *mosq)
+{
+    bool dirty;
+
+    pthread_mutex_lock(&tickets_mutex);
+    dirty = mosq->quic_ticket_dirty;
+    mosq->quic_ticket_dirty = false;
+    pthread_mutex_unlock(&tickets_mutex);
+
+    if (!dirty || !mosq->quic_resumption_file) {
+        return;
+    }
+    /* Several clients may share one file, keep their writes in order. */
+    pthread_mutex_lock(&tickets_file_mutex);
+    ticket__load_file(mosq, mosq->quic_resumption_file);
+    ticket__save_file(mosq, mosq->quic_resumption_file);
+    pthread_mutex_unlock(&tickets_file_mutex);
+}
+
+/* Hand any cached ticket for host/port to a connection that has not been
+ * started yet. Returns true if the connection will attempt resumption. */
+static bool ticket__apply(struct mosquitto *mosq, HQUIC handle, const char *host, uint16_t port)
+{
+    struct mosq_quic_ticket *ticket;
+    QUIC_STATUS status;
+    bool applied = false;
+
+    pthread_mutex_lock(&tickets_mutex);
+    ticket = ticket__find(tickets, host, port);
+    pthread_mutex_unlock(&tickets_mutex);
+    if (!ticket && mosq->quic_resumption_file) {
+        pthread_mutex_lock(&tickets_file_mutex);
+        ticket__load_file(mosq, mosq->quic_resumption_file);
+        pthread_mutex_unlock(&tickets_file_mutex);
+    }
+
+    pthread_mutex_lock(&tickets_mutex);
+    ticket = ticket__find(tickets, host, port);
+    if (ticket) {
+        status = msquic->SetParam(handle, QUIC_PARAM_CONN_RESUMPTION_TICKET, ticket->length, ticket->data);
+        if (QUIC_FAILED(status)) {
+            log__printf(mosq, MOSQ_LOG_DEBUG, "Unable to use QUIC resumption ticket for %s:%d, 0x%x.", host, port, status);
+        } else {
+            applied = true;
+        }
+    }
+    pthread_mutex_unlock(&tickets_mutex);
+    return applied;
+}
+
+void msquic_tickets_cleanup(void)
+{
+    pthread_mutex_lock(&tickets_mutex);
+    ticket__free_all(tickets);
+    tickets = NULL;
+    pthread_mutex_unlock(&tickets_mutex);
 }
 
 static void connection_state_transition(
@@ -113,6 +590,54 @@ static void connection_state_transition(
     pthread_mutex_unlock(&connection->state_mutex);
 }
 
+/* Break mosquitto_loop() out of its wait, as packet__queue() does. */
+static void msquic_wake(struct mosquitto *mosq)
+{
+    char sockpair_data = 0;
+
+    if (mosq->sockpairW != INVALID_SOCKET) {
+#ifndef WIN32
+        if (write(mosq->sockpairW, &sockpair_data, 1)) {
+        }
+#else
+        send(mosq->sockpairW, &sockpair_data, 1, 0);
+#endif
+    }
+}
+
+bool msquic_connection_closed(struct mosq_quic_connection *connection)
+{
+    bool closed;
+
+    pthread_mutex_lock(&connection->state_mutex);
+    closed = connection->state == mosq_qs_closed || connection->state == mosq_qs_failed;
+    pthread_mutex_unlock(&connection->state_mutex);
+
+    return closed;
+}
+
+/* True while a send is waiting for msquic to drain a stream. The loop does
+ * not need to retry until SEND_COMPLETE wakes it. */
+bool msquic_send_blocked(struct mosq_quic_connection *connection)
+{
+    bool blocked;
+
+    pthread_mutex_lock(&connection->state_mutex);
+    blocked = connection->send_blocked;
+    pthread_mutex_unlock(&connection->state_mutex);
+
+    return blocked;
+}
+
+/* Called with state_mutex held once a stream has room again. */
+static void stream_unblock(struct mosquitto *mosq)
+{
+    if (mosq->connection.send_blocked) {
+        mosq->connection.send_blocked = false;
+        msquic_wake(mosq);
+    }
+}
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(QUIC_STREAM_CALLBACK)
 QUIC_STATUS
@@ -123,29 +648,70 @@ quic_client_stream_callback(
     _Inout_ QUIC_STREAM_EVENT* event
     )
 {
-    struct mosquitto *mosq = (struct mosquitto *)context;
+    struct mosq_quic_stream *qstream = (struct mosq_quic_stream *)context;
+    struct mosquitto *mosq = qstream->mosq;
+    struct mosquitto__packet *packet;
+    struct mosquitto__packet *next;
+    uint64_t length;
+    uint32_t i;
+    int rc;
+
     switch (event->Type) {
     case QUIC_STREAM_EVENT_SEND_COMPLETE:
-        free(event->SEND_COMPLETE.ClientContext);
+        /* Every client send owns a chain of whole packets, see
+         * msquic_send_packets(). */
+        packet = (struct mosquitto__packet *)event->SEND_COMPLETE.ClientContext;
+        mosquitto__free(packet->quic_buffers);
+        packet->quic_buffers = NULL;
+        length = 0;
+        while (packet) {
+            next = packet->next;
+            length += packet->quic_buffer.Length;
+            packet__cleanup(packet);
+            mosquitto__free(packet);
+            packet = next;
+        }
+        pthread_mutex_lock(&mosq->connection.state_mutex);
+        qstream->send_outstanding -= length;
+        stream_unblock(mosq);
+        pthread_mutex_unlock(&mosq->connection.state_mutex);
+        break;
+    case QUIC_STREAM_EVENT_IDEAL_SEND_BUFFER_SIZE:
+        /* msquic's estimate of the bandwidth-delay product. Keeping no more
+         * than this queued keeps the link busy without building a backlog
+         * in msquic, see msquic_send_packet(). */
+        pthread_mutex_lock(&mosq->connection.state_mutex);
+        qstream->ideal_send_buffer = event->IDEAL_SEND_BUFFER_SIZE.ByteCount;
+        stream_unblock(mosq);
+        pthread_mutex_unlock(&mosq->connection.state_mutex);
         break;
     case QUIC_STREAM_EVENT_RECEIVE:
-        mosq->stream.packet_reader.buffers = event->RECEIVE.Buffers;
-        mosq->stream.packet_reader.buffer_count = event->RECEIVE.BufferCount;
-        mosq->stream.packet_reader.current_buffer = 0;
-        mosq->stream.packet_reader.buffer_pos = 0;
-        mosq->stream.packet_reader.total_length = event->RECEIVE.TotalBufferLength;
-        mosq->stream.packet_reader.consumed_length = 0;
-        mosquitto_loop_read(mosq, 1);
-        if(mosq->stream.packet_reader.consumed_length < mosq->stream.packet_reader.total_length) {
-            msquic->StreamReceiveSetEnabled(stream, TRUE);
-        }
-        event->RECEIVE.TotalBufferLength = mosq->stream.packet_reader.consumed_length;
+        /* Packets are parsed straight out of the msquic receive buffers, so
+         * the whole receive is consumed before returning. */
+        for (i = 0; i < event->RECEIVE.BufferCount; i++) {
+            rc = packet__read_buffer(mosq,
+                    qstream->lane == 0 ? NULL : &qstream->in_packet,
+                    event->RECEIVE.Buffers[i].Buffer,
+                    event->RECEIVE.Buffers[i].Length);
+            if (rc) {
+                log__printf(mosq, MOSQ_LOG_DEBUG, "[strm][%p] Error %d reading packet, closing connection", stream, rc);
+                /* Must not wait for the shutdown from inside a callback. */
+                msquic->ConnectionShutdown(
+                    mosq->connection.handle,
+                    QUIC_CONNECTION_SHUTDOWN_FLAG_NONE,
+                    0);
+                break;
+            }
+        }
         break;
     case QUIC_STREAM_EVENT_PEER_SEND_SHUTDOWN:
         log__printf(mosq, MOSQ_LOG_DEBUG, "[strm][%p] Peer shut down\n", stream);
         break;
     case QUIC_STREAM_EVENT_SHUTDOWN_COMPLETE:
         log__printf(mosq, MOSQ_LOG_DEBUG, "[strm][%p] All done\n", stream);
+        if (qstream->handle == stream) {
+            qstream->handle = NULL;
+        }
         if (!event->SHUTDOWN_COMPLETE.AppCloseInProgress) {
             msquic->StreamClose(stream);
         }
@@ -168,11 +734,20 @@ quic_client_connection_callback(
 {
     struct mosquitto *mosq = (struct mosquitto *)context;
     struct mosq_quic_connection *connection = &mosq->connection;
+    struct mosquitto__packet *packet;
+    QUIC_ADDR_STR address;
+    int rc;
 
     switch (event->Type) {
     case QUIC_CONNECTION_EVENT_CONNECTED:
-        log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Connected", handle);
+        log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Connected%s", handle,
+                event->CONNECTED.SessionResumed ? " (resumed)" : "");
+        pthread_mutex_lock(&connection->state_mutex);
+        connection->early_data = false;
+        pthread_mutex_unlock(&connection->state_mutex);
         connection_state_transition(connection, mosq_qs_connected);
+        /* An asynchronous connect did not wait for this. */
+        msquic_wake(mosq);
         break;
     case QUIC_CONNECTION_EVENT_SHUTDOWN_INITIATED_BY_TRANSPORT:
         if (event->SHUTDOWN_INITIATED_BY_TRANSPORT.Status == QUIC_STATUS_CONNECTION_IDLE) {
@@ -186,16 +761,54 @@ quic_client_connection_callback(
         break;
     case QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE:
         log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] All done", handle);
-        if (!event->SHUTDOWN_COMPLETE.AppCloseInProgress) {
-            msquic->ConnectionClose(handle);
-        }
+        /* The handle is left for msquic_try_close() to close, the loop or
+         * the application may still be about to use it. */
         if (connection->state == mosq_qs_connecting) {
             connection_state_transition(connection, mosq_qs_failed);
         } else if (connection->state == mosq_qs_connected) {
             connection_state_transition(connection, mosq_qs_closed);
         }
+        msquic_wake(mosq);
+        break;
+    case QUIC_CONNECTION_EVENT_LOCAL_ADDRESS_CHANGED:
+        if (QuicAddrToString(event->LOCAL_ADDRESS_CHANGED.Address, &address)) {
+            log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Local address now %s", handle, address.Address);
+        }
+        break;
+    case QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED:
+        if (QuicAddrToString(event->PEER_ADDRESS_CHANGED.Address, &address)) {
+            log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Broker address now %s", handle, address.Address);
+        }
         break;
     case QUIC_CONNECTION_EVENT_RESUMPTION_TICKET_RECEIVED:
+        log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Resumption ticket received (%u bytes)",
+                handle, event->RESUMPTION_TICKET_RECEIVED.ResumptionTicketLength);
+        ticket__store(mosq,
+                event->RESUMPTION_TICKET_RECEIVED.ResumptionTicket,
+                event->RESUMPTION_TICKET_RECEIVED.ResumptionTicketLength);
+        break;
+    case QUIC_CONNECTION_EVENT_DATAGRAM_STATE_CHANGED:
+        pthread_mutex_lock(&connection->state_mutex);
+        connection->datagram_max = event->DATAGRAM_STATE_CHANGED.SendEnabled ?
+                event->DATAGRAM_STATE_CHANGED.MaxSendLength : 0;
+        pthread_mutex_unlock(&connection->state_mutex);
+        break;
+    case QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED:
+        rc = packet__read_datagram(mosq,
+                event->DATAGRAM_RECEIVED.Buffer->Buffer,
+                event->DATAGRAM_RECEIVED.Buffer->Length);
+        if (rc) {
+            log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Error %d reading datagram, closing connection", handle, rc);
+            msquic->ConnectionShutdown(handle, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
+        }
+        break;
+    case QUIC_CONNECTION_EVENT_DATAGRAM_SEND_STATE_CHANGED:
+        /* The packet is the send context, see msquic_send_packet(). */
+        if (QUIC_DATAGRAM_SEND_STATE_IS_FINAL(event->DATAGRAM_SEND_STATE_CHANGED.State)) {
+            packet = (struct mosquitto__packet *)event->DATAGRAM_SEND_STATE_CHANGED.ClientContext;
+            packet__cleanup(packet);
+            mosquitto__free(packet);
+        }
         break;
     default:
         break;
@@ -232,20 +845,103 @@ static int msquic_wait_connection(struct mosq_quic_connection *connection)
     return rc;
 }
 
-int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address)
+static int msquic_wait_close(struct mosq_quic_connection *connection) 
+{
+    int rc;
+
+    pthread_mutex_lock(&connection->state_mutex);
+    
+    while (connection->state == mosq_qs_connecting
+            || connection->state == mosq_qs_connected) {
+        rc = pthread_cond_wait(&connection->state_cond, 
+                              &connection->state_mutex);
+        if (rc) {
+            pthread_mutex_unlock(&connection->state_mutex);
+            return MOSQ_ERR_UNKNOWN;
+        }
+    }
+    
+    rc = (connection->state == mosq_qs_closed || connection->state == mosq_qs_failed) ?
+         MOSQ_ERR_SUCCESS : MOSQ_ERR_UNKNOWN;
+    
+    pthread_mutex_unlock(&connection->state_mutex);
+
+    return rc;
+}
+
+/* Open every lane. Lanes are started in order, so lane n gets stream ID 4*n
+ * and the broker can tell them apart. Lanes other than 0 are started
+ * immediately so the broker knows about them before any PUBLISH arrives. */
+static void stream_priority_apply(struct mosquitto *mosq, struct mosq_quic_stream *qstream)
+{
+    uint16_t priority = qstream->priority;
+    QUIC_STATUS status;
+
+    status = msquic->SetParam(
+        qstream->handle,
+        QUIC_PARAM_STREAM_PRIORITY,
+        sizeof(priority),
+        &priority);
+    if (QUIC_FAILED(status)) {
+        log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Unable to set priority of lane %d, 0x%x!", qstream->lane, status);
+    }
+}
+
+static int msquic_stream_open(struct mosquitto *mosq)
+{
+    QUIC_STATUS status;
+    struct mosq_quic_stream *qstream;
+    uint8_t i;
+
+    for (i = 0; i < mosq->quic_lanes; i++) {
+        qstream = &mosq->streams[i];
+        qstream->ideal_send_buffer = MOSQ_QUIC_IDEAL_SEND_BUFFER;
+        qstream->send_outstanding = 0;
+        if (QUIC_FAILED(status = msquic->StreamOpen(mosq->connection.handle, QUIC_STREAM_OPEN_FLAG_NONE, quic_client_stream_callback, qstream, &qstream->handle))) {
+            log__printf(mosq, MOSQ_LOG_ERR, "StreamOpen failed, 0x%x!", status);
+            qstream->handle = NULL;
+            return MOSQ_ERR_QUIC;
+        }
+        if (qstream->priority != MOSQ_QUIC_PRIORITY_DEFAULT) {
+            stream_priority_apply(mosq, qstream);
+        }
+        if (QUIC_FAILED(status = msquic->StreamStart(qstream->handle, i == 0 ? QUIC_STREAM_START_FLAG_NONE : QUIC_STREAM_START_FLAG_IMMEDIATE))) {
+            log__printf(mosq, MOSQ_LOG_ERR, "StreamStart failed, 0x%x!", status);
+            msquic->StreamClose(qstream->handle);
+            qstream->handle = NULL;
+            return MOSQ_ERR_QUIC;
+        }
+    }
+    return MOSQ_ERR_SUCCESS;
+}
+
+/* Start connecting. When blocking, this waits for the handshake to finish
+ * before opening the streams. Otherwise the streams are opened straight away
+ * and msquic holds anything sent on them until the handshake completes, or
+ * sends it as 0-RTT data when resuming a session, so CONNECT can be queued
+ * immediately. A failed handshake then shows up in mosquitto_loop() as a
+ * lost connection. */
+int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking)
 {
     if(!msquic) {
         log__printf(mosq, MOSQ_LOG_ERR, "Error: msquic is NULL!");
         return MOSQ_ERR_QUIC;
     }
+    /* Picks up any options changed since the last connection. */
+    if (msquic_config(mosq)) {
+        return MOSQ_ERR_QUIC;
+    }
 
     struct mosq_quic_connection *connection = &mosq->connection;
     connection->state = mosq_qs_connecting;
     
     QUIC_STATUS status = QUIC_STATUS_SUCCESS;
+    QUIC_ADDR local_address;
+    bool resuming;
+    int rc;
     
     status = msquic->ConnectionOpen(
-        registration,
+        mosq->quic_config->registration->handle,
         quic_client_connection_callback,
         mosq,
         &connection->handle);
@@ -256,19 +952,47 @@ int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port,
     }
 
     if (bind_address) {
+        memset(&local_address, 0, sizeof(local_address));
+        if (!QuicAddrFromString(bind_address, 0, &local_address)) {
+            log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Invalid local address %s.", bind_address);
+        } else {
+            status = msquic->SetParam(
+                connection->handle,
+                QUIC_PARAM_CONN_LOCAL_ADDRESS,
+                sizeof(local_address),
+                &local_address);
+            if (QUIC_FAILED(status)) {
+                log__printf(mosq, MOSQ_LOG_WARNING,"Warning: Unable to set local address, 0x%x!", status);
+            }
+        }
+    }
+
+    if (mosq->quic_datagram) {
+        BOOLEAN enabled = TRUE;
         status = msquic->SetParam(
             connection->handle,
-            QUIC_PARAM_CONN_LOCAL_ADDRESS,
-            sizeof(bind_address),
-            bind_address);
+            QUIC_PARAM_CONN_DATAGRAM_RECEIVE_ENABLED,
+            sizeof(enabled),
+            &enabled);
         if (QUIC_FAILED(status)) {
-            log__printf(mosq, MOSQ_LOG_WARNING,"Warning: Unable to set local address, 0x%x!", status);
+            log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Unable to enable QUIC datagrams, 0x%x!", status);
         }
     }
 
+    resuming = ticket__apply(mosq, connection->handle, host, port);
+    /* Set before ConnectionStart(), the CONNECTED event may clear it from
+     * the msquic thread at any point after. If the broker rejects early
+     * data, msquic sends it again once the handshake completes. */
+    pthread_mutex_lock(&connection->state_mutex);
+    connection->early_data = resuming && mosq->quic_zero_rtt;
+    connection->send_blocked = false;
+    connection->datagram_max = 0;
+    pthread_mutex_unlock(&connection->state_mutex);
+    mosq->quic_backpressure = false;
+
     status = msquic->ConnectionStart(
         connection->handle,
-        configuration,
+        mosq->quic_config->handle,
         QUIC_ADDRESS_FAMILY_UNSPEC,
         host,
         port);
@@ -278,19 +1002,19 @@ int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port,
         goto Error;
     }
 
-    int rc = msquic_wait_connection(connection);
-    if (!rc)
-    {
-        if (QUIC_FAILED(status = msquic->StreamOpen(connection->handle, QUIC_STREAM_OPEN_FLAG_NONE, quic_client_stream_callback, mosq, &mosq->stream.handle))) {
-            log__printf(mosq, MOSQ_LOG_ERR, "StreamOpen failed, 0x%x!", status);
-        }
-        if (QUIC_FAILED(status = msquic->StreamStart(mosq->stream.handle, QUIC_STREAM_START_FLAG_NONE))) {
-            log__printf(mosq, MOSQ_LOG_ERR, "StreamStart failed, 0x%x!", status);
-            msquic->StreamClose(mosq->stream.handle);
+    if (!blocking || (resuming && mosq->quic_zero_rtt)) {
+        if (msquic_stream_open(mosq)) {
+            goto Error;
         }
+        return MOSQ_ERR_SUCCESS;
     }
-    
-    return rc;
+
+    rc = msquic_wait_connection(connection);
+    if (rc) {
+        msquic_try_close(connection);
+        return rc;
+    }
+    return msquic_stream_open(mosq);
     
 Error:
     if (connection->handle != NULL) {
@@ -300,132 +1024,396 @@ Error:
     return MOSQ_ERR_QUIC;
 }
 
-static int msquic_wait_close(struct mosq_quic_connection *connection) 
+int msquic_try_close(struct mosq_quic_connection *connection)
 {
-    int rc;
+    if(!msquic) {
+        return MOSQ_ERR_QUIC;
+    }
 
-    pthread_mutex_lock(&connection->state_mutex);
-    
-    while (connection->state == mosq_qs_connected) {
-        rc = pthread_cond_wait(&connection->state_cond, 
-                              &connection->state_mutex);
-        if (rc) {
-            pthread_mutex_unlock(&connection->state_mutex);
-            return MOSQ_ERR_UNKNOWN;
+    int rc = MOSQ_ERR_SUCCESS;
+
+    if(connection->handle)
+    {
+        if (!msquic_connection_closed(connection)) {
+            msquic->ConnectionShutdown(
+                connection->handle, 
+                QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 
+                0);
+            rc = msquic_wait_close(connection);
         }
+        msquic->ConnectionClose(connection->handle);
+        connection->handle = NULL;
     }
-    
-    rc = (connection->state == mosq_qs_closed) ? 
-         MOSQ_ERR_SUCCESS : MOSQ_ERR_UNKNOWN;
-    
-    pthread_mutex_unlock(&connection->state_mutex);
-
     return rc;
 }
 
-int msquic_try_close(struct mosq_quic_connection *connection)
+/* Try to send a packet as a QUIC DATAGRAM. The packet is freed once msquic
+ * reports the datagram as acknowledged, lost or cancelled. */
+static bool msquic_send_datagram(struct mosquitto *mosq, struct mosquitto__packet *packet)
 {
-    if(!msquic) {
-        return MOSQ_ERR_QUIC;
+    QUIC_STATUS status;
+    uint16_t datagram_max;
+
+    if (!packet->datagram || packet->pos != 0) {
+        return false;
     }
+    pthread_mutex_lock(&mosq->connection.state_mutex);
+    datagram_max = mosq->connection.datagram_max;
+    pthread_mutex_unlock(&mosq->connection.state_mutex);
 
-    if(connection->handle)
-    {
-        msquic->ConnectionShutdown(
-            connection->handle, 
-            QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 
-            0);
-        return msquic_wait_close(connection);
+    /* Anything that does not fit in one datagram goes on the stream. */
+    if (packet->to_process > datagram_max) {
+        return false;
     }
-    return MOSQ_ERR_SUCCESS;
+    packet->quic_buffer.Buffer = packet->payload;
+    packet->quic_buffer.Length = packet->to_process;
+    status = msquic->DatagramSend(
+        mosq->connection.handle,
+        &packet->quic_buffer,
+        1,
+        QUIC_SEND_FLAG_NONE,
+        packet);
+    return QUIC_SUCCEEDED(status);
 }
 
-ssize_t msquic_send(HQUIC stream, const void *buf, size_t count)
+/* Hand packets to msquic without copying them. Each packet's QUIC_BUFFER
+ * points straight at the unsent part of its payload. All of the packets go
+ * to the stream of the first one in a single StreamSend, so a burst of small
+ * packets is framed together rather than one send at a time. The packets are
+ * chained through next and the first is the send context, so the whole batch
+ * is freed from the SEND_COMPLETE event.
+ *
+ * A stream only takes as much as msquic says it needs to keep the link busy.
+ * *sent is set to the number of packets taken, always a leading run of the
+ * array. The caller must no longer touch those. If none fit, errno is set to
+ * EAGAIN, the same as for a full socket, and the caller keeps the rest until
+ * SEND_COMPLETE makes room. */
+int msquic_send_packets(struct mosquitto *mosq, struct mosquitto__packet **packets, int count, int *sent)
 {
-    if (!stream || !buf) {
-        return -1;
+    QUIC_STATUS status;
+    QUIC_SEND_FLAGS flags = QUIC_SEND_FLAG_NONE;
+    struct mosq_quic_stream *qstream = NULL;
+    struct mosquitto__packet *head = packets[0];
+    QUIC_BUFFER *buffers;
+    uint64_t length = 0;
+    bool early_data;
+    int i, n;
+
+    *sent = 0;
+    if (count == 1 && msquic_send_datagram(mosq, head)) {
+        *sent = 1;
+        return MOSQ_ERR_SUCCESS;
     }
-    if (count == 0) {
-        return 0;
+
+    if (head->lane < mosq->quic_lanes && mosq->streams[head->lane].handle) {
+        qstream = &mosq->streams[head->lane];
+    } else if (mosq->streams[0].handle) {
+        qstream = &mosq->streams[0];
+    } else {
+        return MOSQ_ERR_NO_CONN;
     }
 
-    if (count > UINT32_MAX) {
-        return -1; 
+    pthread_mutex_lock(&mosq->connection.state_mutex);
+    for (n = 0; n < count; n++) {
+        /* An empty stream always takes one packet, however large. */
+        if ((qstream->send_outstanding > 0 || n > 0)
+                && qstream->send_outstanding + length + packets[n]->to_process > qstream->ideal_send_buffer) {
+            break;
+        }
+        length += packets[n]->to_process;
     }
+    if (n < count) {
+        mosq->connection.send_blocked = true;
+    }
+    if (n == 0) {
+        pthread_mutex_unlock(&mosq->connection.state_mutex);
+        errno = EAGAIN;
+        return MOSQ_ERR_ERRNO;
+    }
+    qstream->send_outstanding += length;
+    early_data = mosq->connection.early_data;
+    pthread_mutex_unlock(&mosq->connection.state_mutex);
 
-    const size_t total_size = sizeof(QUIC_BUFFER) + count;
-    uint8_t *mem = (uint8_t *)malloc(total_size);
-    if (!mem) {
-        return -1;
+    for (i = 0; i < n; i++) {
+        packets[i]->quic_buffer.Buffer = &packets[i]->payload[packets[i]->pos];
+        packets[i]->quic_buffer.Length = packets[i]->to_process;
+        packets[i]->next = i + 1 < n ? packets[i + 1] : NULL;
     }
 
-    QUIC_BUFFER *qbuf = (QUIC_BUFFER *)mem;
-    qbuf->Buffer = mem + sizeof(QUIC_BUFFER);
-    qbuf->Length = (uint32_t)count;
+    buffers = &head->quic_buffer;
+    if (n > 1) {
+        /* msquic wants the buffers side by side and keeps using the array
+         * until the send completes. */
+        buffers = mosquitto__calloc((size_t)n, sizeof(QUIC_BUFFER));
+        if (!buffers) {
+            pthread_mutex_lock(&mosq->connection.state_mutex);
+            qstream->send_outstanding -= length;
+            pthread_mutex_unlock(&mosq->connection.state_mutex);
+            return MOSQ_ERR_NOMEM;
+        }
+        for (i = 0; i < n; i++) {
+            buffers[i] = packets[i]->quic_buffer;
+        }
+        head->quic_buffers = buffers;
+    }
 
-    memcpy(qbuf->Buffer, buf, count);
-    
-    QUIC_STATUS status = msquic->StreamSend(
-        stream,
-        qbuf,
-        1,
-        QUIC_SEND_FLAG_NONE,
-        qbuf
-    );
+    if (early_data) {
+        /* Still resuming the session, see msquic_try_connect(). */
+        flags |= QUIC_SEND_FLAG_ALLOW_0_RTT;
+    }
+
+    status = msquic->StreamSend(
+        qstream->handle,
+        buffers,
+        (uint32_t)n,
+        flags,
+        head);
     if (QUIC_FAILED(status)) {
-        free(mem);
-        return -1;
+        pthread_mutex_lock(&mosq->connection.state_mutex);
+        qstream->send_outstanding -= length;
+        pthread_mutex_unlock(&mosq->connection.state_mutex);
+        mosquitto__free(head->quic_buffers);
+        head->quic_buffers = NULL;
+        return MOSQ_ERR_QUIC;
     }
+    *sent = n;
+    return MOSQ_ERR_SUCCESS;
+}
 
-    return (ssize_t)count;
+int msquic_send_packet(struct mosquitto *mosq, struct mosquitto__packet *packet)
+{
+    int sent;
+
+    return msquic_send_packets(mosq, &packet, 1, &sent);
 }
 
+/* Active migration: move the connection to another local address, for
+ * example when the network interface changes. msquic validates the new path
+ * and the same connection carries on, so the MQTT session, subscriptions and
+ * messages in flight are untouched. */
+int msquic_migrate(struct mosquitto *mosq, const char *local_address)
+{
+    struct mosq_quic_connection *connection = &mosq->connection;
+    QUIC_ADDR address;
+    QUIC_STATUS status;
+    bool connected;
 
-ssize_t msquic_recv(struct mosq_quic_packet_reader* reader, void *buf, size_t count)
+    pthread_mutex_lock(&connection->state_mutex);
+    connected = connection->handle != NULL && connection->state == mosq_qs_connected;
+    pthread_mutex_unlock(&connection->state_mutex);
+    if (!connected) {
+        return MOSQ_ERR_NO_CONN;
+    }
+
+    memset(&address, 0, sizeof(address));
+    if (!QuicAddrFromString(local_address, 0, &address)) {
+        return MOSQ_ERR_INVAL;
+    }
+    status = msquic->SetParam(
+        connection->handle,
+        QUIC_PARAM_CONN_LOCAL_ADDRESS,
+        sizeof(address),
+        &address);
+    if (QUIC_FAILED(status)) {
+        log__printf(mosq, MOSQ_LOG_WARNING, "Warning: Unable to migrate to local address %s, 0x%x!", local_address, status);
+        return MOSQ_ERR_QUIC;
+    }
+    log__printf(mosq, MOSQ_LOG_DEBUG, "[conn][%p] Migrating to local address %s", connection->handle, local_address);
+    return MOSQ_ERR_SUCCESS;
+}
+
+int msquic_stats(struct mosquitto *mosq, struct mosquitto_quic_stats *stats)
 {
-    if (!reader || !buf) {
-        return -1;
+    QUIC_STATISTICS_V2 qstats;
+    uint32_t len = sizeof(qstats);
+    QUIC_STATUS status;
+
+    if (mosq->connection.handle == NULL) {
+        return MOSQ_ERR_NO_CONN;
+    }
+    memset(&qstats, 0, sizeof(qstats));
+    status = msquic->GetParam(
+        mosq->connection.handle,
+        QUIC_PARAM_CONN_STATISTICS_V2,
+        &len,
+        &qstats);
+    if (QUIC_FAILED(status)) {
+        return MOSQ_ERR_QUIC;
     }
 
-    if (count == 0) {
+    memset(stats, 0, sizeof(struct mosquitto_quic_stats));
+    stats->rtt = qstats.Rtt;
+    stats->min_rtt = qstats.MinRtt;
+    stats->max_rtt = qstats.MaxRtt;
+    stats->rtt_variance = qstats.RttVariance;
+    stats->congestion_window = qstats.SendCongestionWindow;
+    stats->path_mtu = qstats.SendPathMtu;
+    stats->send_packets = qstats.SendTotalPackets;
+    stats->send_bytes = qstats.SendTotalBytes;
+    stats->send_lost_packets = qstats.SendSuspectedLostPackets;
+    stats->send_spurious_lost_packets = qstats.SendSpuriousLostPackets;
+    stats->congestion_events = qstats.SendCongestionCount;
+    stats->persistent_congestion_events = qstats.SendPersistentCongestionCount;
+    stats->ecn_congestion_events = qstats.SendEcnCongestionCount;
+    stats->recv_packets = qstats.RecvTotalPackets;
+    stats->recv_bytes = qstats.RecvTotalBytes;
+    stats->recv_reordered_packets = qstats.RecvReorderedPackets;
+    stats->recv_dropped_packets = qstats.RecvDroppedPackets;
+    stats->recv_duplicate_packets = qstats.RecvDuplicatePackets;
+    stats->resumed = qstats.ResumptionSucceeded;
+
+    return MOSQ_ERR_SUCCESS;
+}
+
+/* Choose the lane for an outgoing PUBLISH, see MOSQ_OPT_QUIC_LANE_MODE. */
+uint8_t msquic_publish_lane(struct mosquitto *mosq, const char *topic, uint8_t qos)
+{
+    struct mosq_quic_lane_topic *lane_topic;
+    uint8_t free_lanes[MOSQ_QUIC_MAX_LANES];
+    uint8_t free_count = 0;
+    unsigned int reserved = 0;
+    bool match;
+    uint8_t i;
+
+    if (mosq->quic_lanes < 2) {
         return 0;
     }
-    
-    if (reader->consumed_length == reader->total_length) {
+    /* Pinned topics first, so that their lane can be given a priority of
+     * its own without other traffic sharing it. */
+    for (lane_topic = mosq->quic_lane_topics; lane_topic; lane_topic = lane_topic->next) {
+        if (lane_topic->lane >= mosq->quic_lanes) {
+            continue;
+        }
+        if (topic && !mosquitto_topic_matches_sub(lane_topic->pattern, topic, &match) && match) {
+            return lane_topic->lane;
+        }
+        reserved |= 1U << lane_topic->lane;
+    }
+    if (mosq->quic_lane_mode == MOSQ_QUIC_LANE_BY_APP) {
+        return (uint8_t)(mosq->quic_lane % mosq->quic_lanes);
+    }
+    if (reserved == 0) {
+        if (mosq->quic_lane_mode == MOSQ_QUIC_LANE_BY_QOS) {
+            return (uint8_t)(1 + qos % (mosq->quic_lanes - 1));
+        }
+        return msquic_topic_lane(topic, mosq->quic_lanes);
+    }
+
+    for (i = 1; i < mosq->quic_lanes; i++) {
+        if (!(reserved & (1U << i))) {
+            free_lanes[free_count++] = i;
+        }
+    }
+    if (free_count == 0) {
         return 0;
     }
+    if (mosq->quic_lane_mode == MOSQ_QUIC_LANE_BY_QOS) {
+        return free_lanes[qos % free_count];
+    }
+    /* msquic_topic_lane() spreads over lanes 1 to free_count. */
+    i = msquic_topic_lane(topic, (uint8_t)(free_count + 1));
+    return i ? free_lanes[i - 1] : 0;
+}
 
-    
-    const uint64_t total_remaining = reader->total_length - reader->consumed_length;
-    
-    if (count > total_remaining) {
-        count = (size_t)total_remaining;
+int msquic_lane_priority(struct mosquitto *mosq, uint8_t lane, uint16_t priority)
+{
+    struct mosq_quic_stream *qstream = &mosq->streams[lane];
+
+    qstream->priority = priority;
+    if (qstream->handle) {
+        stream_priority_apply(mosq, qstream);
     }
+    return MOSQ_ERR_SUCCESS;
+}
 
-    size_t bytes_read = 0;
-    uint8_t *out_ptr = (uint8_t *)buf;
+int msquic_lane_topic_add(struct mosquitto *mosq, const char *pattern, uint8_t lane)
+{
+    struct mosq_quic_lane_topic *lane_topic, *last;
 
-    while (bytes_read < count && reader->current_buffer < reader->buffer_count)
-    {
-        const QUIC_BUFFER *cur_buf = &reader->buffers[reader->current_buffer];
-        
-        const size_t buffer_remaining = cur_buf->Length - reader->buffer_pos;
-        if (buffer_remaining == 0) {
-            reader->current_buffer++;
-            reader->buffer_pos = 0;
-            continue;
-        }
-        
-        const size_t need = count - bytes_read;
-        size_t to_read = (need < buffer_remaining) ? need : buffer_remaining;
+    lane_topic = mosquitto__calloc(1, sizeof(struct mosq_quic_lane_topic));
+    if (!lane_topic) {
+        return MOSQ_ERR_NOMEM;
+    }
+    lane_topic->pattern = mosquitto__strdup(pattern);
+    if (!lane_topic->pattern) {
+        mosquitto__free(lane_topic);
+        return MOSQ_ERR_NOMEM;
+    }
+    lane_topic->lane = lane;
+
+    /* Kept in the order added, the first match wins. */
+    if (mosq->quic_lane_topics) {
+        for (last = mosq->quic_lane_topics; last->next; last = last->next);
+        last->next = lane_topic;
+    } else {
+        mosq->quic_lane_topics = lane_topic;
+    }
+    return MOSQ_ERR_SUCCESS;
+}
+
+void msquic_lane_topics_clear(struct mosquitto *mosq)
+{
+    struct mosq_quic_lane_topic *lane_topic, *next;
+
+    lane_topic = mosq->quic_lane_topics;
+    while (lane_topic) {
+        next = lane_topic->next;
+        mosquitto__free(lane_topic->pattern);
+        mosquitto__free(lane_topic);
+        lane_topic = next;
+    }
+    mosq->quic_lane_topics = NULL;
+}
 
-        memcpy(out_ptr + bytes_read, cur_buf->Buffer + reader->buffer_pos, to_read);
+/* Copying variant for callers that do not own a packet. */
+ssize_t msquic_send_buffer(struct mosquitto *mosq, const void *buf, size_t count)
+{
+    struct mosquitto__packet *packet;
 
-        bytes_read += to_read;
-        reader->buffer_pos += (uint32_t)to_read;
-        reader->consumed_length += to_read;
+    if (count == 0) {
+        return 0;
+    }
+    if (count > UINT32_MAX) {
+        return -1;
+    }
+
+    packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+    if (!packet) {
+        return -1;
+    }
+    packet->payload = mosquitto__malloc(count);
+    if (!packet->payload) {
+        mosquitto__free(packet);
+        return -1;
     }
+    memcpy(packet->payload, buf, count);
+    packet->packet_length = (uint32_t)count;
+    packet->to_process = (uint32_t)count;
 
-    return (ssize_t)bytes_read;
+    if (msquic_send_packet(mosq, packet)) {
+        packet__cleanup(packet);
+        mosquitto__free(packet);
+        return -1;
+    }
+    return (ssize_t)count;
+}
+#endif
+
+/* Lane for a PUBLISH on topic. Lane 0 is left for control packets, so the
+ * topic is hashed (FNV-1a) over the remaining lanes. */
+uint8_t msquic_topic_lane(const char *topic, uint8_t lanes)
+{
+    uint32_t hash = 2166136261U;
+
+    if (lanes < 2 || topic == NULL) {
+        return 0;
+    }
+    while (*topic) {
+        hash ^= (uint8_t)*topic;
+        hash *= 16777619U;
+        topic++;
+    }
+    return (uint8_t)(1 + hash % (uint32_t)(lanes - 1));
 }
+
 #endif
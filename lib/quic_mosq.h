@@ -10,13 +10,31 @@
 int msquic_init(void);
 void msquic_cleanup(void);
 
+extern const QUIC_API_TABLE *msquic;
+
+#ifndef WITH_BROKER
 int msquic_config(struct mosquitto *mosq);
+void msquic_config_release(struct mosquitto *mosq);
 
-int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address);
+int msquic_try_connect(struct mosquitto *mosq, const char *host, uint16_t port, const char *bind_address, bool blocking);
 int msquic_try_close(struct mosq_quic_connection *connection);
+bool msquic_connection_closed(struct mosq_quic_connection *connection);
+bool msquic_send_blocked(struct mosq_quic_connection *connection);
+int msquic_stats(struct mosquitto *mosq, struct mosquitto_quic_stats *stats);
+int msquic_migrate(struct mosquitto *mosq, const char *local_address);
+
+int msquic_send_packet(struct mosquitto *mosq, struct mosquitto__packet *packet);
+int msquic_send_packets(struct mosquitto *mosq, struct mosquitto__packet **packets, int count, int *sent);
+ssize_t msquic_send_buffer(struct mosquitto *mosq, const void *buf, size_t count);
+void msquic_tickets_save(struct mosquitto *mosq);
+void msquic_tickets_cleanup(void);
+uint8_t msquic_publish_lane(struct mosquitto *mosq, const char *topic, uint8_t qos);
+int msquic_lane_priority(struct mosquitto *mosq, uint8_t lane, uint16_t priority);
+int msquic_lane_topic_add(struct mosquitto *mosq, const char *pattern, uint8_t lane);
+void msquic_lane_topics_clear(struct mosquitto *mosq);
+#endif
 
-ssize_t msquic_send(HQUIC stream, const void *buf, size_t count);
-ssize_t msquic_recv(struct mosq_quic_packet_reader* reader, void *buf, size_t count);
+uint8_t msquic_topic_lane(const char *topic, uint8_t lanes);
 
 #endif
 
@@ -37,6 +37,9 @@ Contributors:
 #include "packet_mosq.h"
 #include "property_mosq.h"
 #include "send_mosq.h"
+#if defined(WITH_QUIC) && !defined(WITH_BROKER)
+#  include "quic_mosq.h"
+#endif
 
 
 int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
@@ -56,13 +59,10 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 
 #if defined(WITH_BROKER) && defined(WITH_WEBSOCKETS)
 	if(mosq->sock == INVALID_SOCKET && !mosq->wsi) return MOSQ_ERR_NO_CONN;
-#else
-#ifdef WITH_QUIC
-	if(mosq->connection.handle == NULL) return MOSQ_ERR_NO_CONN;
-#endif
-#ifdef WITH_TCP
+#elif defined(WITH_BROKER)
 	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
-#endif
+#else
+	if(!net__transport_is_open(mosq)) return MOSQ_ERR_NO_CONN;
 #endif
 
 	if(!mosq->retain_available){
@@ -139,7 +139,7 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 }
 
 
-int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+static int send__publish_packet(struct mosquitto *mosq, struct mosquitto__packet **packet_out, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
 {
 	struct mosquitto__packet *packet = NULL;
 	unsigned int packetlen;
@@ -193,6 +193,22 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 	packet->mid = mid;
 	packet->command = (uint8_t)(CMD_PUBLISH | (uint8_t)((dup&0x1)<<3) | (uint8_t)(qos<<1) | retain);
 	packet->remaining_length = packetlen;
+#ifdef WITH_QUIC
+	if(mosq->transport == mosq_t_quic){
+#  ifdef WITH_BROKER
+		packet->lane = net__quic_publish_lane(mosq, topic);
+		/* Only used if the client enabled datagrams, see net__quic_write_datagram(). */
+		packet->datagram = (qos == 0);
+#  else
+		/* A topic alias must be set up and used on the same lane, and
+		 * must not be lost. */
+		if(!mosquitto_property_read_int16(cmsg_props, MQTT_PROP_TOPIC_ALIAS, NULL, false)){
+			packet->lane = msquic_publish_lane(mosq, topic, qos);
+			packet->datagram = (qos == 0 && mosq->quic_datagram);
+		}
+#  endif
+	}
+#endif
 	rc = packet__alloc(packet);
 	if(rc){
 		mosquitto__free(packet);
@@ -222,5 +238,160 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 		packet__write_bytes(packet, payload, payloadlen);
 	}
 
+	*packet_out = packet;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+{
+	struct mosquitto__packet *packet = NULL;
+	int rc;
+
+	rc = send__publish_packet(mosq, &packet, mid, topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+	if(rc) return rc;
+
+	return packet__queue(mosq, packet);
+}
+
+
+#ifdef WITH_BROKER
+/* Find the encoded copy of a stored message that suits this client, encoding
+ * it if there is none yet. Clients that share an entry differ only in the
+ * message id and dup flag. */
+static int send__publish_shared_get(struct mosquitto *mosq, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, uint32_t expiry_interval, struct mosquitto__shared_packet **shared_out)
+{
+	struct mosquitto__shared_packet *shared, **prev;
+	struct mosquitto__packet *packet = NULL;
+	bool mqtt5 = (mosq->protocol == mosq_p_mqtt5);
+	int rc;
+
+	prev = &stored->shared_packets;
+	for(shared = stored->shared_packets; shared; shared = shared->next){
+		if((shared->command&0x07) == (uint8_t)((qos<<1) | retain) && shared->mqtt5 == mqtt5){
+			if(!mqtt5 || shared->expiry_interval == expiry_interval){
+				*shared_out = shared;
+				return MOSQ_ERR_SUCCESS;
+			}
+			/* The remaining expiry interval has moved on, replace it. */
+			*prev = shared->next;
+			packet__shared_release(shared);
+			break;
+		}
+		prev = &shared->next;
+	}
+
+	rc = send__publish_packet(mosq, &packet, 0, stored->topic, stored->payloadlen, stored->payload, qos, retain, false, NULL, stored->properties, expiry_interval);
+	if(rc) return rc;
+
+	shared = mosquitto__calloc(1, sizeof(struct mosquitto__shared_packet));
+	if(!shared){
+		packet__cleanup(packet);
+		mosquitto__free(packet);
+		return MOSQ_ERR_NOMEM;
+	}
+	shared->payload = packet->payload;
+	shared->packet_length = packet->packet_length;
+	shared->remaining_length = packet->remaining_length;
+	shared->remaining_count = packet->remaining_count;
+	shared->command = packet->command;
+	if(qos > 0){
+		shared->mid_pos = 1U + (uint8_t)packet->remaining_count + 2U + (uint32_t)strlen(stored->topic);
+	}
+	shared->expiry_interval = expiry_interval;
+	shared->mqtt5 = mqtt5;
+	shared->ref_count = 1; /* Held by the message store */
+	mosquitto__free(packet);
+
+	shared->next = stored->shared_packets;
+	stored->shared_packets = shared;
+	*shared_out = shared;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Send a stored message, encoding it only once however many clients it goes
+ * to. Every client's packet refers to the shared encoding, with its own
+ * command byte and message id gathered in around it when they are
+ * written. */
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval)
+{
+	struct mosquitto__shared_packet *shared;
+	struct mosquitto__packet *packet;
+	int rc;
+
+	assert(mosq);
+	assert(stored);
+
+	/* Anything that makes the packet specific to this client, or a transport
+	 * that modifies or takes over the payload, goes the long way round.
+	 * Websockets clients are mosq_t_tcp too, but move the payload in place
+	 * to make room for LWS_PRE. */
+	if(mosq->transport != mosq_t_tcp || cmsg_props
+			|| (mosq->listener && mosq->listener->mount_point)
+#ifdef WITH_WEBSOCKETS
+			|| mosq->wsi
+#endif
+#ifdef WITH_BRIDGE
+			|| mosq->bridge
+#endif
+			){
+
+		return send__publish(mosq, mid, stored->topic, stored->payloadlen, stored->payload, qos, retain, dup, cmsg_props, stored->properties, expiry_interval);
+	}
+
+	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
+
+	if(!mosq->retain_available){
+		retain = false;
+	}
+
+	rc = send__publish_shared_get(mosq, stored, qos, retain, expiry_interval, &shared);
+	if(rc) return rc;
+
+	if(packet__check_oversize(mosq, shared->remaining_length)){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Dropping too large outgoing PUBLISH for %s (%d bytes)", SAFE_PRINT(mosq->id), shared->remaining_length);
+		return MOSQ_ERR_OVERSIZE_PACKET;
+	}
+	log__printf(NULL, MOSQ_LOG_DEBUG, "Sending PUBLISH to %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", SAFE_PRINT(mosq->id), dup, qos, retain, mid, stored->topic, (long)stored->payloadlen);
+	G_PUB_BYTES_SENT_INC(stored->payloadlen);
+
+	packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	if(!packet) return MOSQ_ERR_NOMEM;
+
+	packet->mid = mid;
+	packet->command = (uint8_t)(shared->command | (uint8_t)((dup&0x1)<<3));
+	packet->remaining_length = shared->remaining_length;
+	packet->remaining_count = shared->remaining_count;
+	packet->packet_length = shared->packet_length;
+#ifdef WIN32
+	/* There are no gathered writes, so a packet that differs from the shared
+	 * one needs a copy of its own. */
+	if(shared->mid_pos || packet->command != shared->command){
+		packet->payload = mosquitto__malloc(shared->packet_length);
+		if(!packet->payload){
+			mosquitto__free(packet);
+			return MOSQ_ERR_NOMEM;
+		}
+		memcpy(packet->payload, shared->payload, shared->packet_length);
+		packet->payload[0] = packet->command;
+		if(shared->mid_pos){
+			packet->payload[shared->mid_pos] = MOSQ_MSB(mid);
+			packet->payload[shared->mid_pos+1] = MOSQ_LSB(mid);
+		}
+		return packet__queue(mosq, packet);
+	}
+#endif
+	/* The command byte and message id are written from the packet itself,
+	 * everything else straight from the shared buffer, see packet__iov(). */
+	packet->payload = shared->payload;
+	packet->shared = shared;
+	shared->ref_count++;
+	if(shared->mid_pos){
+		packet->mid_bytes[0] = MOSQ_MSB(mid);
+		packet->mid_bytes[1] = MOSQ_LSB(mid);
+	}
+
 	return packet__queue(mosq, packet);
 }
+#endif
@@ -91,13 +91,12 @@ int mosquitto__check_keepalive(struct mosquitto *mosq)
 	next_msg_out = mosq->next_msg_out;
 	last_msg_in = mosq->last_msg_in;
 	COMPAT_pthread_mutex_unlock(&mosq->msgtime_mutex);
-#ifdef WITH_QUIC
-	if(mosq->keepalive && mosq->connection.handle != NULL &&
-			(now >= next_msg_out || now - last_msg_in >= mosq->keepalive)){
-#endif
-#ifdef WITH_TCP
+#ifdef WITH_BROKER
 	if(mosq->keepalive && mosq->sock != INVALID_SOCKET &&
 			(now >= next_msg_out || now - last_msg_in >= mosq->keepalive)){
+#else
+	if(mosq->keepalive && net__transport_is_open(mosq) &&
+			(now >= next_msg_out || now - last_msg_in >= mosq->keepalive)){
 #endif
 		state = mosquitto__get_state(mosq);
 		if(state == mosq_cs_active && mosq->ping_t == 0){
@@ -114,22 +113,9 @@ int mosquitto__check_keepalive(struct mosquitto *mosq)
 				context__send_will(mosq);
 			}
 #  endif
-#	ifdef WITH_QUIC
-			net__quic_close(mosq);
-#	endif
-
-#	ifdef WITH_TCP
 			net__socket_close(mosq);
-#	endif
 #else
-
-#ifdef WITH_QUIC
-			net__quic_close(mosq);
-#endif
-
-#ifdef WITH_TCP
-			net__socket_close(mosq);
-#endif
+			net__transport_close(mosq);
 			state = mosquitto__get_state(mosq);
 			if(state == mosq_cs_disconnecting){
 				rc = MOSQ_ERR_SUCCESS;
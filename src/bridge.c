@@ -152,6 +152,33 @@ int bridge__new(struct mosquitto__bridge *bridge)
 #endif
 }
 
+#ifdef WITH_QUIC
+/* msquic resolves the address itself and holds CONNECT until the handshake
+ * completes, so a QUIC bridge is connected in a single step. */
+static int bridge__connect_quic(struct mosquitto *context)
+{
+	int rc;
+
+	log__printf(NULL, MOSQ_LOG_NOTICE, "Connecting bridge %s over QUIC (%s:%d)", context->bridge->name, context->bridge->addresses[context->bridge->cur_address].address, context->bridge->addresses[context->bridge->cur_address].port);
+	rc = net__quic_bridge_connect(context,
+			context->bridge->addresses[context->bridge->cur_address].address,
+			context->bridge->addresses[context->bridge->cur_address].port,
+			context->bridge->bind_address);
+	if(rc){
+		return rc;
+	}
+
+	HASH_ADD(hh_sock, db.contexts_by_sock, sock, sizeof(context->sock), context);
+
+	rc = send__connect(context, context->keepalive, context->clean_start, NULL);
+	if(rc){
+		mux__delete(context);
+		net__socket_close(context);
+	}
+	return rc;
+}
+#endif
+
 #if defined(__GLIBC__) && defined(WITH_ADNS)
 int bridge__connect_step1(struct mosquitto *context)
 {
@@ -248,6 +275,17 @@ int bridge__connect_step1(struct mosquitto *context)
 		}
 	}
 
+#ifdef WITH_QUIC
+	if(context->bridge->transport == mosq_t_quic){
+		rc = bridge__connect_quic(context);
+		if(rc == MOSQ_ERR_SUCCESS){
+			/* There is no step 2 to do this. */
+			mux__add_in(context);
+		}
+		return rc;
+	}
+#endif
+
 	log__printf(NULL, MOSQ_LOG_NOTICE, "Connecting bridge (step 1) %s (%s:%d)", context->bridge->name, context->bridge->addresses[context->bridge->cur_address].address, context->bridge->addresses[context->bridge->cur_address].port);
 	rc = net__try_connect_step1(context, context->bridge->addresses[context->bridge->cur_address].address);
 	if(rc > 0 ){
@@ -438,6 +476,12 @@ int bridge__connect(struct mosquitto *context)
 		}
 	}
 
+#ifdef WITH_QUIC
+	if(context->bridge->transport == mosq_t_quic){
+		return bridge__connect_quic(context);
+	}
+#endif
+
 	log__printf(NULL, MOSQ_LOG_NOTICE, "Connecting bridge %s (%s:%d)", context->bridge->name, context->bridge->addresses[context->bridge->cur_address].address, context->bridge->addresses[context->bridge->cur_address].port);
 	rc = net__socket_connect(context,
 			context->bridge->addresses[context->bridge->cur_address].address,
@@ -634,6 +678,9 @@ void bridge__cleanup(struct mosquitto *context)
 		context->ssl_ctx = NULL;
 	}
 #endif
+#ifdef WITH_QUIC
+	net__quic_bridge_cleanup(context->bridge);
+#endif
 }
 
 
@@ -747,8 +794,12 @@ void bridge_check(void)
 			bridge_check_pending(context);
 
 			/* Check for bridges that are not round robin and not currently
-			 * connected to their primary broker. */
+			 * connected to their primary broker. The primary is probed
+			 * with a TCP connection, so this does not apply to QUIC. */
 			if(context->bridge->round_robin == false
+#ifdef WITH_QUIC
+					&& context->bridge->transport != mosq_t_quic
+#endif
 					&& context->bridge->cur_address != 0
 					&& context->bridge->primary_retry
 					&& db.now_s > context->bridge->primary_retry){
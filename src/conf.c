@@ -1125,6 +1125,22 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					}
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_quic_lanes")){
+#if defined(WITH_BRIDGE) && defined(WITH_QUIC)
+					if(reload) continue; /* Bridges not valid for reloading. */
+					if(!cur_bridge){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+					if(conf__parse_int(&token, "bridge_quic_lanes", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 1 || tmp_int > MOSQ_QUIC_MAX_LANES){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: bridge_quic_lanes must be between 1 and %d.", MOSQ_QUIC_MAX_LANES);
+						return MOSQ_ERR_INVAL;
+					}
+					cur_bridge->quic_lanes = (uint8_t)tmp_int;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge and/or QUIC support not available.");
 #endif
 				}else if(!strcmp(token, "bridge_psk")){
 #if defined(WITH_BRIDGE) && defined(FINAL_WITH_TLS_PSK)
@@ -1140,6 +1156,37 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_string(&token, "bridge_psk", &cur_bridge->tls_psk, saveptr)) return MOSQ_ERR_INVAL;
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge and/or TLS-PSK support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_transport")){
+#ifdef WITH_BRIDGE
+					if(reload) continue; /* Bridges not valid for reloading. */
+					if(!cur_bridge){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+					token = strtok_r(NULL, " ", &saveptr);
+					if(token){
+						if(!strcmp(token, "tcp")){
+#ifdef WITH_QUIC
+							cur_bridge->transport = mosq_t_tcp;
+#endif
+						}else if(!strcmp(token, "quic")){
+#ifdef WITH_QUIC
+							cur_bridge->transport = mosq_t_quic;
+#else
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: QUIC support not available.");
+							return MOSQ_ERR_INVAL;
+#endif
+						}else{
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge_transport value (%s).", token);
+							return MOSQ_ERR_INVAL;
+						}
+					}else{
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty bridge_transport value in configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
 				}else if(!strcmp(token, "bridge_tls_version")){
 #if defined(WITH_BRIDGE) && defined(WITH_TLS)
@@ -1279,6 +1326,10 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 						cur_bridge->primary_retry_sock = INVALID_SOCKET;
 						cur_bridge->outgoing_retain = true;
 						cur_bridge->clean_start_local = -1;
+#ifdef WITH_QUIC
+						cur_bridge->transport = mosq_t_tcp;
+						cur_bridge->quic_lanes = 1;
+#endif
 					}else{
 						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty connection value in configuration.");
 						return MOSQ_ERR_INVAL;
@@ -1354,6 +1405,24 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 						mosquitto__free(files);
 						if(rc) return rc; /* This returns if config__read_file() fails above */
 					}
+				}else if(!strcmp(token, "io_threads")){
+					if(reload) continue; /* Listeners not valid for reloading. */
+#ifdef WITH_IO_THREADS
+					if(conf__parse_int(&token, "io_threads", &config->io_threads, saveptr)) return MOSQ_ERR_INVAL;
+					if(config->io_threads < 0 || config->io_threads > 1024){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid io_threads value (%d).", config->io_threads);
+						return MOSQ_ERR_INVAL;
+					}
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: I/O thread support not available.");
+#endif
+				}else if(!strcmp(token, "io_uring")){
+					if(reload) continue; /* The event loop is chosen at startup. */
+#ifdef WITH_IO_URING
+					if(conf__parse_bool(&token, "io_uring", &config->io_uring, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: io_uring support not available.");
+#endif
 				}else if(!strcmp(token, "keepalive_interval")){
 #ifdef WITH_BRIDGE
 					if(reload) continue; /* FIXME */
@@ -1851,6 +1920,13 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 #else
 							log__printf(NULL, MOSQ_LOG_ERR, "Error: Websockets support not available.");
 							return MOSQ_ERR_INVAL;
+#endif
+						}else if(!strcmp(token, "quic")){
+#ifdef WITH_QUIC
+							cur_listener->protocol = mp_quic;
+#else
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: QUIC support not available.");
+							return MOSQ_ERR_INVAL;
 #endif
 						}else{
 							log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid protocol value (%s).", token);
@@ -46,6 +46,7 @@ struct mosquitto *context__init(mosq_sock_t sock)
 #endif
 	mosquitto__set_state(context, mosq_cs_new);
 	context->sock = sock;
+	context->transport = mosq_t_tcp;
 	context->last_msg_in = db.now_s;
 	context->next_msg_out = db.now_s + 60;
 	context->keepalive = 60; /* Default to 60s */
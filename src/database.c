@@ -24,6 +24,7 @@ Contributors:
 
 #include "mosquitto_broker_internal.h"
 #include "memory_mosq.h"
+#include "packet_mosq.h"
 #include "send_mosq.h"
 #include "sys_tree.h"
 #include "time_mosq.h"
@@ -264,6 +265,20 @@ void db__msg_store_add(struct mosquitto_msg_store *store)
 }
 
 
+/* Drop the encoded copies of a message. Packets still queued keep their own
+ * reference. */
+static void db__msg_store_free_shared(struct mosquitto_msg_store *store)
+{
+	struct mosquitto__shared_packet *shared, *next;
+
+	for(shared = store->shared_packets; shared; shared = next){
+		next = shared->next;
+		packet__shared_release(shared);
+	}
+	store->shared_packets = NULL;
+}
+
+
 void db__msg_store_free(struct mosquitto_msg_store *store)
 {
 	int i;
@@ -279,6 +294,7 @@ void db__msg_store_free(struct mosquitto_msg_store *store)
 	mosquitto__free(store->topic);
 	mosquitto_property_free_all(&store->properties);
 	mosquitto__free(store->payload);
+	db__msg_store_free_shared(store);
 	mosquitto__free(store);
 }
 
@@ -325,6 +341,10 @@ void db__msg_store_ref_dec(struct mosquitto_msg_store **store)
 	if((*store)->ref_count == 0){
 		db__msg_store_remove(*store);
 		*store = NULL;
+	}else if((*store)->ref_count == 1 && (*store)->retain){
+		/* Only the retained message tree is left, don't keep the encoded
+		 * copies around for as long as it is retained. */
+		db__msg_store_free_shared(*store);
 	}
 }
 
@@ -1085,15 +1105,12 @@ void db__expire_all_messages(struct mosquitto *context)
 
 static int db__message_write_inflight_out_single(struct mosquitto *context, struct mosquitto_client_msg *msg)
 {
-	mosquitto_property *cmsg_props = NULL, *store_props = NULL;
+	mosquitto_property *cmsg_props = NULL;
 	int rc;
 	uint16_t mid;
 	int retries;
 	int retain;
-	const char *topic;
 	uint8_t qos;
-	uint32_t payloadlen;
-	const void *payload;
 	uint32_t expiry_interval;
 
 	expiry_interval = 0;
@@ -1112,16 +1129,12 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 	mid = msg->mid;
 	retries = msg->dup;
 	retain = msg->retain;
-	topic = msg->store->topic;
 	qos = (uint8_t)msg->qos;
-	payloadlen = msg->store->payloadlen;
-	payload = msg->store->payload;
 	cmsg_props = msg->properties;
-	store_props = msg->store->properties;
 
 	switch(msg->state){
 		case mosq_ms_publish_qos0:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_OVERSIZE_PACKET){
 				db__message_remove_from_inflight(&context->msgs_out, msg);
 			}else{
@@ -1130,7 +1143,7 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 			break;
 
 		case mosq_ms_publish_qos1:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
@@ -1143,7 +1156,7 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 			break;
 
 		case mosq_ms_publish_qos2:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
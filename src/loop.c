@@ -201,8 +201,14 @@ int mosquitto_main_loop(struct mosquitto__listener_sock *listensock, int listens
 		bridge_check();
 #endif
 
+#ifdef WITH_IO_THREADS
+		net__io_flush();
+#endif
 		rc = mux__handle(listensock, listensock_count);
 		if(rc) return rc;
+#ifdef WITH_IO_THREADS
+		net__io_flush();
+#endif
 
 		session_expiry__check();
 		will_delay__check();
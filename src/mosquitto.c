@@ -217,6 +217,12 @@ static int listeners__start_single_mqtt(struct mosquitto__listener *listener)
 	if(net__socket_listen(listener)){
 		return 1;
 	}
+#ifdef WITH_IO_THREADS
+	if(listener->sock_count == 0){
+		/* Handed over to the I/O threads, see listeners__start_io_threads(). */
+		return MOSQ_ERR_SUCCESS;
+	}
+#endif
 	listensock_count += listener->sock_count;
 	listensock_new = mosquitto__realloc(listensock, sizeof(struct mosquitto__listener_sock)*(size_t)listensock_count);
 	if(!listensock_new){
@@ -239,6 +245,40 @@ static int listeners__start_single_mqtt(struct mosquitto__listener *listener)
 }
 
 
+#ifdef WITH_IO_THREADS
+/* Start the I/O threads serving any listeners net__socket_listen() gave
+ * them, and watch each thread's notification descriptor. */
+static int listeners__start_io_threads(void)
+{
+	int i;
+	int count;
+	struct mosquitto__listener_sock *listensock_new;
+
+	count = net__io_thread_count();
+	if(count == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(net__io_start()){
+		return 1;
+	}
+	listensock_count += count;
+	listensock_new = mosquitto__realloc(listensock, sizeof(struct mosquitto__listener_sock)*(size_t)listensock_count);
+	if(!listensock_new){
+		return 1;
+	}
+	listensock = listensock_new;
+
+	for(i=0; i<count; i++){
+		listensock[listensock_index].sock = net__io_thread_sock(i);
+		listensock[listensock_index].listener = NULL;
+		listensock[listensock_index].ident = id_io_thread;
+		listensock_index++;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+#endif
+
+
 #ifdef WITH_WEBSOCKETS
 void listeners__add_websockets(struct lws_context *ws_context, mosq_sock_t fd)
 {
@@ -344,7 +384,11 @@ static int listeners__start(void)
 	listensock_count = 0;
 
 	if(db.config->local_only){
-		if(listeners__start_local_only()){
+		if(listeners__start_local_only()
+#ifdef WITH_IO_THREADS
+				|| listeners__start_io_threads()
+#endif
+				){
 			db__close();
 			if(db.config->pid_file){
 				(void)remove(db.config->pid_file);
@@ -355,7 +399,8 @@ static int listeners__start(void)
 	}
 
 	for(i=0; i<db.config->listener_count; i++){
-		if(db.config->listeners[i].protocol == mp_mqtt){
+		if(db.config->listeners[i].protocol == mp_mqtt
+				|| db.config->listeners[i].protocol == mp_quic){
 			if(listeners__start_single_mqtt(&db.config->listeners[i])){
 				db__close();
 				if(db.config->pid_file){
@@ -373,6 +418,15 @@ static int listeners__start(void)
 #endif
 		}
 	}
+#ifdef WITH_IO_THREADS
+	if(listeners__start_io_threads()){
+		db__close();
+		if(db.config->pid_file){
+			(void)remove(db.config->pid_file);
+		}
+		return 1;
+	}
+#endif
 	if(listensock == NULL){
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to start any listening sockets, exiting.");
 		return 1;
@@ -385,7 +439,15 @@ static void listeners__stop(void)
 {
 	int i;
 
+#ifdef WITH_IO_THREADS
+	net__io_stop();
+#endif
 	for(i=0; i<db.config->listener_count; i++){
+#ifdef WITH_QUIC
+		if(db.config->listeners[i].protocol == mp_quic){
+			net__quic_listener_close(&db.config->listeners[i]);
+		}
+#endif
 #ifdef WITH_WEBSOCKETS
 		if(db.config->listeners[i].ws_context){
 			lws_context_destroy(db.config->listeners[i].ws_context);
@@ -191,6 +191,7 @@ enum struct_ident{
 	id_listener = 1,
 	id_client = 2,
 	id_listener_ws = 3,
+	id_io_thread = 4,
 };
 #endif
 
@@ -232,6 +233,9 @@ struct mosquitto__listener {
 	bool ws_in_init;
 	char *http_dir;
 	struct lws_protocols *ws_protocol;
+#endif
+#ifdef WITH_QUIC
+	struct mosquitto__quic_listener *quic;
 #endif
 	struct mosquitto__security_options security_options;
 #ifdef WITH_UNIX_SOCKETS
@@ -264,6 +268,8 @@ struct mosquitto__config {
 	int cmd_port_count;
 	bool daemon;
 	struct mosquitto__listener default_listener;
+	int io_threads;
+	bool io_uring;
 	struct mosquitto__listener *listeners;
 	int listener_count;
 	bool local_only;
@@ -374,6 +380,7 @@ struct mosquitto_msg_store{
 	char* topic;
 	mosquitto_property *properties;
 	void *payload;
+	struct mosquitto__shared_packet *shared_packets; /* Encoded PUBLISH cache, see send__publish_stored() */
 	time_t message_expiry_time;
 	uint32_t payloadlen;
 	enum mosquitto_msg_origin origin;
@@ -545,6 +552,11 @@ struct mosquitto__bridge{
 	bool attempt_unsubscribe;
 	bool initial_notification_done;
 	bool outgoing_retain;
+#ifdef WITH_QUIC
+	enum mosquitto__transport transport;
+	uint8_t quic_lanes;
+	HQUIC quic_configuration; /* Opened on first connect, see net__quic_bridge_connect(). */
+#endif
 #ifdef WITH_TLS
 	bool tls_insecure;
 	bool tls_ocsp_required;
@@ -614,12 +626,49 @@ int send__auth(struct mosquitto *context, uint8_t reason_code, const void *auth_
 void net__broker_init(void);
 void net__broker_cleanup(void);
 struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock);
+struct mosquitto *net__socket_accept_finish(struct mosquitto__listener *listener, mosq_sock_t new_sock);
 int net__socket_listen(struct mosquitto__listener *listener);
 int net__socket_get_address(mosq_sock_t sock, char *buf, size_t len, uint16_t *remote_address);
 int net__tls_load_verify(struct mosquitto__listener *listener);
 int net__tls_server_ctx(struct mosquitto__listener *listener);
 int net__load_certificates(struct mosquitto__listener *listener);
 
+#ifdef WITH_QUIC
+/* ============================================================
+ * QUIC listener functions
+ * ============================================================ */
+int net__quic_listen(struct mosquitto__listener *listener);
+void net__quic_listener_close(struct mosquitto__listener *listener);
+struct mosquitto *net__quic_accept(struct mosquitto__listener_sock *listensock);
+int net__quic_read_packets(struct mosquitto *context);
+ssize_t net__quic_write_packet(struct mosquitto *context, struct mosquitto__packet *packet);
+ssize_t net__quic_write_datagram(struct mosquitto *context, struct mosquitto__packet *packet);
+uint8_t net__quic_publish_lane(struct mosquitto *context, const char *topic);
+int net__quic_close(struct mosquitto *context);
+void net__quic_broker_cleanup(void);
+#ifdef WITH_BRIDGE
+int net__quic_bridge_connect(struct mosquitto *context, const char *host, uint16_t port, const char *bind_address);
+void net__quic_bridge_cleanup(struct mosquitto__bridge *bridge);
+#endif
+#endif
+
+#ifdef WITH_IO_THREADS
+/* ============================================================
+ * I/O thread functions
+ * ============================================================ */
+bool net__io_listener_eligible(struct mosquitto__listener *listener);
+int net__io_listen(struct mosquitto__listener *listener);
+int net__io_start(void);
+int net__io_thread_count(void);
+mosq_sock_t net__io_thread_sock(int index);
+void net__io_handle(struct mosquitto__listener_sock *listensock);
+ssize_t net__io_write(struct mosquitto *context, const void *buf, size_t count);
+void net__io_flush(void);
+void net__io_close(struct mosquitto *context);
+void net__io_stop(void);
+void net__io_cleanup(void);
+#endif
+
 /* ============================================================
  * Read handling functions
  * ============================================================ */
@@ -749,6 +798,10 @@ int mux__delete(struct mosquitto *context);
 int mux__wait(void);
 int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
 int mux__cleanup(void);
+#ifdef WITH_IO_URING
+ssize_t mux_uring__write(struct mosquitto *context, const void *buf, size_t count);
+void mux_uring__close(struct mosquitto *context);
+#endif
 
 /* ============================================================
  * Listener related functions
@@ -19,8 +19,21 @@ Contributors:
 
 #include "mux.h"
 
+#ifdef WITH_IO_URING
+static bool use_uring = false;
+#endif
+
 int mux__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
+#ifdef WITH_IO_URING
+	if(db.config->io_uring){
+		if(mux_uring__init(listensock, listensock_count) == MOSQ_ERR_SUCCESS){
+			use_uring = true;
+			return MOSQ_ERR_SUCCESS;
+		}
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to use io_uring, falling back to epoll.");
+	}
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__init(listensock, listensock_count);
 #else
@@ -30,6 +43,13 @@ int mux__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 
 int mux__add_out(struct mosquitto *context)
 {
+#ifdef WITH_IO_THREADS
+	/* I/O thread connections are not in the main loop's set at all. */
+	if(context->io) return MOSQ_ERR_SUCCESS;
+#endif
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__add_out(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__add_out(context);
 #else
@@ -40,6 +60,12 @@ int mux__add_out(struct mosquitto *context)
 
 int mux__remove_out(struct mosquitto *context)
 {
+#ifdef WITH_IO_THREADS
+	if(context->io) return MOSQ_ERR_SUCCESS;
+#endif
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__remove_out(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__remove_out(context);
 #else
@@ -50,6 +76,12 @@ int mux__remove_out(struct mosquitto *context)
 
 int mux__add_in(struct mosquitto *context)
 {
+#ifdef WITH_IO_THREADS
+	if(context->io) return MOSQ_ERR_SUCCESS;
+#endif
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__add_in(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__add_in(context);
 #else
@@ -60,6 +92,12 @@ int mux__add_in(struct mosquitto *context)
 
 int mux__delete(struct mosquitto *context)
 {
+#ifdef WITH_IO_THREADS
+	if(context->io) return MOSQ_ERR_SUCCESS;
+#endif
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__delete(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__delete(context);
 #else
@@ -70,6 +108,13 @@ int mux__delete(struct mosquitto *context)
 
 int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
+#ifdef WITH_IO_URING
+	if(use_uring){
+		UNUSED(listensock);
+		UNUSED(listensock_count);
+		return mux_uring__handle();
+	}
+#endif
 #ifdef WITH_EPOLL
 	UNUSED(listensock);
 	UNUSED(listensock_count);
@@ -82,6 +127,12 @@ int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_coun
 
 int mux__cleanup(void)
 {
+#ifdef WITH_IO_URING
+	if(use_uring){
+		use_uring = false;
+		return mux_uring__cleanup();
+	}
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__cleanup();
 #else
@@ -37,4 +37,12 @@ int mux_poll__delete(struct mosquitto *context);
 int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
 int mux_poll__cleanup(void);
 
+int mux_uring__init(struct mosquitto__listener_sock *listensock, int listensock_count);
+int mux_uring__add_out(struct mosquitto *context);
+int mux_uring__remove_out(struct mosquitto *context);
+int mux_uring__add_in(struct mosquitto *context);
+int mux_uring__delete(struct mosquitto *context);
+int mux_uring__handle(void);
+int mux_uring__cleanup(void);
+
 #endif
@@ -213,6 +213,10 @@ int mux_epoll__handle(void)
 						mux__add_in(context);
 					}
 				}
+#ifdef WITH_IO_THREADS
+			}else if(context->ident == id_io_thread){
+				net__io_handle(ep_events[i].data.ptr);
+#endif
 #ifdef WITH_WEBSOCKETS
 			}else if(context->ident == id_listener_ws){
 				/* Nothing needs to happen here, because we always call lws_service in the loop.
@@ -0,0 +1,1113 @@
+/*
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+*/
+
+#include "config.h"
+
+#ifdef WITH_IO_URING
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef WITH_WEBSOCKETS
+#  include <libwebsockets.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mux.h"
+#include "net_mosq.h"
+#include "packet_mosq.h"
+#include "sys_tree.h"
+#include "time_mosq.h"
+#include "util_mosq.h"
+
+#include "uthash.h"
+#include "utlist.h"
+
+/* An io_uring event loop, chosen with the io_uring option.
+ *
+ * Plain TCP and unix socket clients accepted on an MQTT listener are served
+ * entirely through the ring. Listeners use a multishot accept, so one
+ * submission keeps accepting connections. Each client has a multishot recv
+ * that takes its buffers from a ring of provided buffers, and the received
+ * data is parsed in place with packet__read_buffer(), as for QUIC streams
+ * and I/O thread connections. net__write() appends to the client's output
+ * buffer, and the buffers that have something in them are sent with one
+ * send per client at the start of the next mux_uring__handle(), in the same
+ * io_uring_enter() call that waits for completions. A busy loop therefore
+ * makes one system call per pass rather than one or more per client.
+ *
+ * Everything else - TLS clients, which need OpenSSL to do the reading and
+ * writing, websockets clients, outgoing bridges and the other listener
+ * sockets - is served with one-shot poll requests, re-armed after each
+ * event, which behave like the level triggered epoll loop in mux_epoll.c.
+ *
+ * A completion may arrive after its client has been freed, so each client
+ * has a separately allocated mosquitto__uring_conn, which is only freed once
+ * no request refers to it any more. For ring clients the descriptor belongs
+ * to the connection as well, and is closed once what was left to send has
+ * been sent. */
+
+/* Submission queue size; the completion queue is four times larger. */
+#define UR_ENTRIES 4096
+/* Most completions handled per call, so the rest of the main loop still
+ * runs regularly under load. */
+#define UR_MAX_EVENTS 1000
+#define UR_BUF_GROUP 0
+/* Provided receive buffers, the count must be a power of two. They are
+ * handed back as soon as their data has been parsed, so together they only
+ * bound how much received data can wait for the main loop. Keeping that
+ * small, like a socket buffer, lets TCP flow control slow down clients that
+ * send faster than the broker can route. */
+#define UR_BUF_COUNT 256
+#define UR_BUF_SIZE 4096
+#define UR_OUT_MIN 4096
+/* Output buffers that have grown beyond this are released once empty. */
+#define UR_OUT_KEEP 65536
+/* Report EAGAIN to packet__write() once this much is waiting to be sent. */
+#define UR_OUT_MAX (1024*1024)
+
+/* The request type is kept in the low bits of the user_data, the rest is the
+ * connection or listener socket it belongs to. */
+#define UR_OP_MASK 0x7
+enum ur__op{
+	ur_op_ignore = 0,
+	ur_op_poll = 1,
+	ur_op_recv = 2,
+	ur_op_send = 3,
+	ur_op_accept = 4,
+	ur_op_listen_poll = 5,
+};
+
+struct ur__buf{
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct mosquitto__uring_conn{
+	struct mosquitto__uring_conn *prev, *next;
+	struct mosquitto__uring_conn *next_flush;
+	struct mosquitto *context; /* NULL once the client has closed. */
+	struct ur__buf out;
+	struct ur__buf sending;
+	size_t sending_pos;
+	mosq_sock_t sock;
+	int ops; /* Requests in flight that refer to this connection. */
+	uint32_t events; /* Poll events wanted, for poll connections. */
+	bool direct; /* Served by recv/send through the ring. */
+	bool poll_armed;
+	bool recv_armed;
+	bool send_armed;
+	bool flush_queued;
+	bool want_writable;
+	bool failed;
+};
+
+struct ur__sq{
+	unsigned *head;
+	unsigned *tail;
+	unsigned *mask;
+	unsigned entries;
+	unsigned local_tail;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+};
+
+struct ur__cq{
+	unsigned *head;
+	unsigned *tail;
+	unsigned *mask;
+	struct io_uring_cqe *cqes;
+};
+
+static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events);
+
+static sigset_t my_sigblock;
+static int ring_fd = -1;
+static void *ring_map = NULL;
+static size_t ring_map_size = 0;
+static void *cq_map = NULL;
+static size_t cq_map_size = 0;
+static struct ur__sq sq;
+static struct ur__cq cq;
+static struct io_uring_buf_ring *buf_ring = NULL;
+static size_t buf_ring_size = 0;
+static uint8_t *buf_pool = NULL;
+static uint16_t buf_tail = 0;
+static struct mosquitto__uring_conn *conns = NULL;
+static struct mosquitto__uring_conn *flush_list = NULL;
+static struct mosquitto__uring_conn *flush_last = NULL;
+static bool ur_stopped = false;
+
+
+/* ============================================================
+ * Ring handling
+ * ============================================================ */
+
+static bool ur__kernel_supported(void)
+{
+	struct utsname uts;
+	int major;
+
+	/* Multishot recv, the newest feature used here, arrived in 6.0. */
+	if(uname(&uts) || sscanf(uts.release, "%d.", &major) != 1){
+		return false;
+	}
+	return major >= 6;
+}
+
+
+static int ur__enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+/* Makes the queued requests visible to the kernel, and returns how many
+ * there are. */
+static unsigned ur__sq_publish(void)
+{
+	unsigned to_submit;
+
+	to_submit = sq.local_tail - *sq.tail;
+	__atomic_store_n(sq.tail, sq.local_tail, __ATOMIC_RELEASE);
+	return to_submit;
+}
+
+
+static struct io_uring_sqe *ur__get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head;
+
+	if(ring_fd < 0){
+		return NULL;
+	}
+	head = __atomic_load_n(sq.head, __ATOMIC_ACQUIRE);
+	if(sq.local_tail - head >= sq.entries){
+		ur__enter(ur__sq_publish(), 0, 0, NULL, 0);
+		head = __atomic_load_n(sq.head, __ATOMIC_ACQUIRE);
+		if(sq.local_tail - head >= sq.entries){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: io_uring submission queue full.");
+			return NULL;
+		}
+	}
+	sqe = &sq.sqes[sq.local_tail & *sq.mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sq.local_tail++;
+	return sqe;
+}
+
+
+static uint64_t ur__user_data(void *ptr, enum ur__op op)
+{
+	return (uint64_t)(uintptr_t)ptr | (uint64_t)op;
+}
+
+
+static void ur__buf_return(uint16_t bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &buf_ring->bufs[buf_tail & (UR_BUF_COUNT-1)];
+	buf->addr = (uint64_t)(uintptr_t)&buf_pool[(size_t)bid*UR_BUF_SIZE];
+	buf->len = UR_BUF_SIZE;
+	buf->bid = bid;
+	buf_tail++;
+	__atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+
+static int ur__setup(void)
+{
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	size_t sq_size, cq_size;
+	uint8_t *sq_ptr, *cq_ptr;
+	uint16_t i;
+
+	memset(&params, 0, sizeof(struct io_uring_params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = UR_ENTRIES*4;
+	ring_fd = (int)syscall(__NR_io_uring_setup, UR_ENTRIES, &params);
+	if(ring_fd < 0){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error creating io_uring: %s.", strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		if(cq_size > sq_size){
+			sq_size = cq_size;
+		}
+	}
+	ring_map_size = sq_size;
+	ring_map = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring_fd, IORING_OFF_SQ_RING);
+	if(ring_map == MAP_FAILED){
+		ring_map = NULL;
+		log__printf(NULL, MOSQ_LOG_ERR, "Error mapping io_uring: %s.", strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		cq_ptr = ring_map;
+	}else{
+		cq_map_size = cq_size;
+		cq_map = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring_fd, IORING_OFF_CQ_RING);
+		if(cq_map == MAP_FAILED){
+			cq_map = NULL;
+			log__printf(NULL, MOSQ_LOG_ERR, "Error mapping io_uring: %s.", strerror(errno));
+			return MOSQ_ERR_UNKNOWN;
+		}
+		cq_ptr = cq_map;
+	}
+	sq_ptr = ring_map;
+
+	sq.head = (unsigned *)(sq_ptr + params.sq_off.head);
+	sq.tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+	sq.mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+	sq.entries = params.sq_entries;
+	sq.local_tail = *sq.tail;
+	sq.sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+	sq.sqes = mmap(NULL, sq.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring_fd, IORING_OFF_SQES);
+	if(sq.sqes == MAP_FAILED){
+		sq.sqes = NULL;
+		log__printf(NULL, MOSQ_LOG_ERR, "Error mapping io_uring: %s.", strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+	/* Slot i of the submission queue always holds entry i. */
+	for(i=0; i<params.sq_entries; i++){
+		((unsigned *)(sq_ptr + params.sq_off.array))[i] = i;
+	}
+
+	cq.head = (unsigned *)(cq_ptr + params.cq_off.head);
+	cq.tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+	cq.mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+	cq.cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+	buf_ring_size = UR_BUF_COUNT*sizeof(struct io_uring_buf);
+	buf_ring = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buf_ring == MAP_FAILED){
+		buf_ring = NULL;
+		return MOSQ_ERR_NOMEM;
+	}
+	buf_pool = mmap(NULL, (size_t)UR_BUF_COUNT*UR_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buf_pool == MAP_FAILED){
+		buf_pool = NULL;
+		return MOSQ_ERR_NOMEM;
+	}
+	memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+	reg.ring_entries = UR_BUF_COUNT;
+	reg.bgid = UR_BUF_GROUP;
+	if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error registering io_uring buffers: %s.", strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+	for(i=0; i<UR_BUF_COUNT; i++){
+		ur__buf_return(i);
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void ur__teardown(void)
+{
+	if(sq.sqes){
+		munmap(sq.sqes, sq.sqes_size);
+		sq.sqes = NULL;
+	}
+	if(cq_map){
+		munmap(cq_map, cq_map_size);
+		cq_map = NULL;
+	}
+	if(ring_map){
+		munmap(ring_map, ring_map_size);
+		ring_map = NULL;
+	}
+	if(ring_fd >= 0){
+		/* Closing the ring cancels whatever is still in flight. */
+		close(ring_fd);
+		ring_fd = -1;
+	}
+	if(buf_ring){
+		munmap(buf_ring, buf_ring_size);
+		buf_ring = NULL;
+	}
+	if(buf_pool){
+		munmap(buf_pool, (size_t)UR_BUF_COUNT*UR_BUF_SIZE);
+		buf_pool = NULL;
+	}
+}
+
+
+/* ============================================================
+ * Connections
+ * ============================================================ */
+
+static int ur__buf_append(struct ur__buf *buf, const void *data, size_t len)
+{
+	uint8_t *newdata;
+	size_t size;
+
+	if(buf->len + len > buf->size){
+		size = buf->size ? buf->size : UR_OUT_MIN;
+		while(size < buf->len + len){
+			size *= 2;
+		}
+		newdata = mosquitto__realloc(buf->data, size);
+		if(!newdata){
+			return MOSQ_ERR_NOMEM;
+		}
+		buf->data = newdata;
+		buf->size = size;
+	}
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void ur__buf_trim(struct ur__buf *buf)
+{
+	if(buf->len == 0 && buf->size > UR_OUT_KEEP){
+		mosquitto__free(buf->data);
+		buf->data = NULL;
+		buf->size = 0;
+	}
+}
+
+
+static struct mosquitto__uring_conn *ur__conn_new(struct mosquitto *context, bool direct)
+{
+	struct mosquitto__uring_conn *conn;
+
+	conn = mosquitto__calloc(1, sizeof(struct mosquitto__uring_conn));
+	if(!conn){
+		return NULL;
+	}
+	conn->context = context;
+	conn->sock = context->sock;
+	conn->direct = direct;
+	context->uring = conn;
+	context->uring_direct = direct;
+	DL_APPEND(conns, conn);
+	return conn;
+}
+
+
+/* Frees a connection whose client has gone, once nothing refers to it. */
+static void ur__conn_release(struct mosquitto__uring_conn *conn)
+{
+	if(conn->context || conn->ops > 0 || conn->flush_queued){
+		return;
+	}
+	if(conn->direct && conn->sock != INVALID_SOCKET){
+		COMPAT_CLOSE(conn->sock);
+	}
+	DL_DELETE(conns, conn);
+	mosquitto__free(conn->out.data);
+	mosquitto__free(conn->sending.data);
+	mosquitto__free(conn);
+}
+
+
+static void ur__poll_arm(struct mosquitto__uring_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = conn->sock;
+	sqe->poll32_events = conn->events;
+	sqe->user_data = ur__user_data(conn, ur_op_poll);
+	conn->poll_armed = true;
+	conn->ops++;
+}
+
+
+/* Changes the events of an armed poll request, or cancels it if no events
+ * are wanted. If the request has already completed the kernel reports that
+ * to the ignored completion of this one, and the poll completion re-arms
+ * with the current events anyway. */
+static void ur__poll_update(struct mosquitto__uring_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	if(!conn->poll_armed){
+		if(conn->events){
+			ur__poll_arm(conn);
+		}
+		return;
+	}
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = ur__user_data(conn, ur_op_poll);
+	if(conn->events){
+		sqe->len = IORING_POLL_UPDATE_EVENTS;
+		sqe->poll32_events = conn->events;
+	}
+	sqe->user_data = ur__user_data(NULL, ur_op_ignore);
+}
+
+
+static void ur__recv_arm(struct mosquitto__uring_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ur__get_sqe();
+	if(!sqe){
+		conn->failed = true;
+		return;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = UR_BUF_GROUP;
+	sqe->user_data = ur__user_data(conn, ur_op_recv);
+	conn->recv_armed = true;
+	conn->ops++;
+}
+
+
+static void ur__cancel(struct mosquitto__uring_conn *conn, enum ur__op op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = ur__user_data(conn, op);
+	sqe->user_data = ur__user_data(NULL, ur_op_ignore);
+}
+
+
+/* Starts a send of whatever is waiting, if there is no send in flight. */
+static void ur__send(struct mosquitto__uring_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+	struct ur__buf tmp;
+
+	if(conn->send_armed || conn->failed){
+		return;
+	}
+	if(conn->sending_pos >= conn->sending.len){
+		conn->sending.len = 0;
+		conn->sending_pos = 0;
+		ur__buf_trim(&conn->sending);
+		if(conn->out.len == 0){
+			return;
+		}
+		tmp = conn->out;
+		conn->out = conn->sending;
+		conn->sending = tmp;
+	}
+
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->sock;
+	sqe->addr = (uint64_t)(uintptr_t)&conn->sending.data[conn->sending_pos];
+	sqe->len = (uint32_t)(conn->sending.len - conn->sending_pos);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = ur__user_data(conn, ur_op_send);
+	conn->send_armed = true;
+	conn->ops++;
+}
+
+
+static void ur__flush_queue(struct mosquitto__uring_conn *conn)
+{
+	if(conn->flush_queued){
+		return;
+	}
+	conn->flush_queued = true;
+	conn->next_flush = NULL;
+	if(flush_last){
+		flush_last->next_flush = conn;
+	}else{
+		flush_list = conn;
+	}
+	flush_last = conn;
+}
+
+
+static void ur__flush(void)
+{
+	struct mosquitto__uring_conn *conn, *next;
+
+	conn = flush_list;
+	flush_list = NULL;
+	flush_last = NULL;
+	while(conn){
+		next = conn->next_flush;
+		conn->flush_queued = false;
+		ur__send(conn);
+		ur__conn_release(conn);
+		conn = next;
+	}
+}
+
+
+/* ============================================================
+ * Completions
+ * ============================================================ */
+
+static void ur__accept_arm(struct mosquitto__listener_sock *listensock)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listensock->sock;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	sqe->user_data = ur__user_data(listensock, ur_op_accept);
+}
+
+
+static void ur__listen_poll_arm(struct mosquitto__listener_sock *listensock)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ur__get_sqe();
+	if(!sqe) return;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = listensock->sock;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = ur__user_data(listensock, ur_op_listen_poll);
+}
+
+
+static void ur__accepted(struct mosquitto__listener_sock *listensock, mosq_sock_t sock)
+{
+	struct mosquitto *context;
+	bool direct = true;
+
+	G_SOCKET_CONNECTIONS_INC();
+	context = net__socket_accept_finish(listensock->listener, sock);
+	if(!context){
+		return;
+	}
+#ifdef WITH_TLS
+	if(context->ssl){
+		direct = false;
+	}
+#endif
+	if(direct){
+		if(!ur__conn_new(context, true)){
+			do_disconnect(context, MOSQ_ERR_NOMEM);
+			return;
+		}
+		ur__recv_arm(context->uring);
+	}else{
+		mux__add_in(context);
+	}
+}
+
+
+static void ur__handle_accept(struct mosquitto__listener_sock *listensock, struct io_uring_cqe *cqe)
+{
+	struct mosquitto *context;
+
+	if(cqe->res >= 0){
+		ur__accepted(listensock, cqe->res);
+	}else if(cqe->res == -EMFILE || cqe->res == -ENFILE){
+		/* net__socket_accept() knows how to get out of this. */
+		context = net__socket_accept(listensock);
+		if(context){
+			mux__add_in(context);
+		}
+	}else if(cqe->res != -ECANCELED){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error accepting connection: %s.", strerror(-cqe->res));
+	}
+	if(!(cqe->flags & IORING_CQE_F_MORE) && !ur_stopped){
+		ur__accept_arm(listensock);
+	}
+}
+
+
+static void ur__handle_listen_poll(struct mosquitto__listener_sock *listensock, struct io_uring_cqe *cqe)
+{
+	struct mosquitto *context;
+
+	if(cqe->res == -ECANCELED){
+		return;
+	}
+	if(listensock->ident == id_listener){
+		while((context = net__socket_accept(listensock)) != NULL){
+			mux__add_in(context);
+		}
+#ifdef WITH_IO_THREADS
+	}else if(listensock->ident == id_io_thread){
+		net__io_handle(listensock);
+#endif
+#ifdef WITH_WEBSOCKETS
+	}else if(listensock->ident == id_listener_ws){
+		/* Nothing needs to happen here, because we always call lws_service in the loop.
+		 * The important point is we've been woken up for this listener. */
+#endif
+	}
+	ur__listen_poll_arm(listensock);
+}
+
+
+static void ur__handle_poll(struct mosquitto__uring_conn *conn, struct io_uring_cqe *cqe)
+{
+	conn->poll_armed = false;
+	if(conn->context && cqe->res > 0){
+		loop_handle_reads_writes(conn->context, (uint32_t)cqe->res);
+	}
+	conn->ops--;
+	if(conn->context && conn->events && !conn->poll_armed){
+		ur__poll_arm(conn);
+	}
+	ur__conn_release(conn);
+}
+
+
+static void ur__handle_recv(struct mosquitto__uring_conn *conn, struct io_uring_cqe *cqe)
+{
+	struct mosquitto *context = conn->context;
+	uint16_t bid;
+	int rc;
+
+	if(cqe->flags & IORING_CQE_F_BUFFER){
+		bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		if(context && cqe->res > 0){
+			rc = packet__read_buffer(context, NULL,
+					&buf_pool[(size_t)bid*UR_BUF_SIZE], (uint32_t)cqe->res);
+			if(rc){
+				do_disconnect(context, rc);
+			}
+		}
+		ur__buf_return(bid);
+	}else if(context && cqe->res != -ENOBUFS && cqe->res != -ECANCELED){
+		/* End of stream or an error. -ENOBUFS means every provided buffer
+		 * was in use, and the recv is simply made again. */
+		do_disconnect(context, MOSQ_ERR_CONN_LOST);
+	}
+
+	if(!(cqe->flags & IORING_CQE_F_MORE)){
+		conn->recv_armed = false;
+		conn->ops--;
+		if(conn->context && !conn->failed && (cqe->res > 0 || cqe->res == -ENOBUFS)){
+			ur__recv_arm(conn);
+		}
+	}
+	ur__conn_release(conn);
+}
+
+
+static void ur__handle_send(struct mosquitto__uring_conn *conn, struct io_uring_cqe *cqe)
+{
+	struct mosquitto *context;
+	int rc;
+
+	conn->send_armed = false;
+	if(cqe->res > 0){
+		conn->sending_pos += (size_t)cqe->res;
+		ur__send(conn);
+	}else{
+		/* The data still waiting is dropped as the kernel would drop unsent
+		 * data on a reset connection. */
+		conn->failed = true;
+		conn->out.len = 0;
+		conn->sending.len = 0;
+		conn->sending_pos = 0;
+		if(conn->context){
+			do_disconnect(conn->context, MOSQ_ERR_CONN_LOST);
+		}
+	}
+
+	context = conn->context;
+	if(context && conn->want_writable && conn->out.len < UR_OUT_MAX){
+		conn->want_writable = false;
+		rc = packet__write(context);
+		if(rc){
+			do_disconnect(context, rc);
+		}
+	}
+	conn->ops--;
+	ur__conn_release(conn);
+}
+
+
+static void ur__reap(void)
+{
+	struct io_uring_cqe cqe;
+	unsigned head, tail;
+	void *ptr;
+
+	head = *cq.head;
+	tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+	if(tail - head > UR_MAX_EVENTS){
+		tail = head + UR_MAX_EVENTS;
+	}
+	while(head != tail){
+		cqe = cq.cqes[head & *cq.mask];
+		head++;
+		__atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+
+		ptr = (void *)(uintptr_t)(cqe.user_data & ~(uint64_t)UR_OP_MASK);
+		switch(cqe.user_data & UR_OP_MASK){
+			case ur_op_poll:
+				ur__handle_poll(ptr, &cqe);
+				break;
+			case ur_op_recv:
+				ur__handle_recv(ptr, &cqe);
+				break;
+			case ur_op_send:
+				ur__handle_send(ptr, &cqe);
+				break;
+			case ur_op_accept:
+				ur__handle_accept(ptr, &cqe);
+				break;
+			case ur_op_listen_poll:
+				ur__handle_listen_poll(ptr, &cqe);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+
+/* ============================================================
+ * Multiplexer interface
+ * ============================================================ */
+
+int mux_uring__init(struct mosquitto__listener_sock *listensock, int listensock_count)
+{
+	int i;
+
+	sigemptyset(&my_sigblock);
+	sigaddset(&my_sigblock, SIGINT);
+	sigaddset(&my_sigblock, SIGTERM);
+	sigaddset(&my_sigblock, SIGUSR1);
+	sigaddset(&my_sigblock, SIGUSR2);
+	sigaddset(&my_sigblock, SIGHUP);
+
+	if(!ur__kernel_supported()){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: io_uring event loop needs Linux 6.0 or later.");
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+	if(ur__setup()){
+		ur__teardown();
+		return MOSQ_ERR_UNKNOWN;
+	}
+	ur_stopped = false;
+
+	for(i=0; i<listensock_count; i++){
+		if(listensock[i].ident == id_listener && listensock[i].listener
+				&& listensock[i].listener->protocol == mp_mqtt){
+
+			ur__accept_arm(&listensock[i]);
+		}else{
+			ur__listen_poll_arm(&listensock[i]);
+		}
+	}
+	ur__enter(ur__sq_publish(), 0, 0, NULL, 0);
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Using io_uring event loop.");
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__add_out(struct mosquitto *context)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+
+	if(context->uring_direct){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(!conn){
+		conn = ur__conn_new(context, false);
+		if(!conn) return MOSQ_ERR_NOMEM;
+	}
+	if(!(conn->events & POLLOUT)){
+		conn->sock = context->sock;
+		conn->events = POLLIN | POLLOUT;
+		ur__poll_update(conn);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__remove_out(struct mosquitto *context)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+
+	if(context->uring_direct){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(conn && (conn->events & POLLOUT)){
+		conn->events = POLLIN;
+		ur__poll_update(conn);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__add_in(struct mosquitto *context)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+
+	if(context->uring_direct){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(!conn){
+		conn = ur__conn_new(context, false);
+		if(!conn) return MOSQ_ERR_NOMEM;
+	}
+	if(conn->events != POLLIN){
+		conn->sock = context->sock;
+		conn->events = POLLIN;
+		ur__poll_update(conn);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__delete(struct mosquitto *context)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+
+	if(context->uring_direct){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(conn && conn->events){
+		conn->events = 0;
+		ur__poll_update(conn);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__handle(void)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	sigset_t origsig;
+	int rc;
+
+	ur__flush();
+
+	memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	sigprocmask(SIG_SETMASK, &my_sigblock, &origsig);
+	rc = ur__enter(ur__sq_publish(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(struct io_uring_getevents_arg));
+	sigprocmask(SIG_SETMASK, &origsig, NULL);
+
+	db.now_s = mosquitto_time();
+	db.now_real_s = time(NULL);
+
+	if(rc < 0 && errno != EINTR && errno != ETIME && errno != EBUSY){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error in io_uring waiting: %s.", strerror(errno));
+	}
+	ur__reap();
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__cleanup(void)
+{
+	struct mosquitto__uring_conn *conn, *tmp;
+
+	ur_stopped = true;
+	ur__teardown();
+
+	/* Nothing will complete any more, so connections whose clients have
+	 * gone are freed now, and the rest when their client closes. */
+	flush_list = NULL;
+	flush_last = NULL;
+	DL_FOREACH_SAFE(conns, conn, tmp){
+		conn->ops = 0;
+		conn->flush_queued = false;
+		conn->poll_armed = false;
+		conn->recv_armed = false;
+		conn->send_armed = false;
+		ur__conn_release(conn);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Called from net__write() for ring clients. */
+ssize_t mux_uring__write(struct mosquitto *context, const void *buf, size_t count)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+
+	if(conn->failed){
+		/* The disconnect is already on its way. */
+		return (ssize_t)count;
+	}
+	if(conn->out.len >= UR_OUT_MAX){
+		/* ur__handle_send() calls packet__write() again once this has
+		 * drained. */
+		conn->want_writable = true;
+		errno = EAGAIN;
+		return -1;
+	}
+	if(ur__buf_append(&conn->out, buf, count)){
+		errno = ENOMEM;
+		return -1;
+	}
+	if(!ur_stopped){
+		ur__flush_queue(conn);
+	}
+	return (ssize_t)count;
+}
+
+
+/* Called from net__socket_close(). Ring clients keep their descriptor open
+ * until what is left has been sent, the others are closed by the caller. */
+void mux_uring__close(struct mosquitto *context)
+{
+	struct mosquitto__uring_conn *conn = context->uring;
+	struct mosquitto *mosq_found;
+
+	context->uring = NULL;
+	context->uring_direct = false;
+	conn->context = NULL;
+
+	if(conn->direct){
+		if(context->sock != INVALID_SOCKET){
+			HASH_FIND(hh_sock, db.contexts_by_sock, &context->sock, sizeof(context->sock), mosq_found);
+			if(mosq_found){
+				HASH_DELETE(hh_sock, db.contexts_by_sock, mosq_found);
+			}
+			context->sock = INVALID_SOCKET;
+		}
+		if(!ur_stopped){
+			ur__send(conn);
+			if(conn->recv_armed){
+				ur__cancel(conn, ur_op_recv);
+			}
+		}
+	}else if(conn->poll_armed && !ur_stopped){
+		conn->events = 0;
+		ur__poll_update(conn);
+	}
+	ur__conn_release(conn);
+}
+
+
+static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
+{
+	int err;
+	socklen_t len;
+	int rc;
+
+	if(context->sock == INVALID_SOCKET){
+		return;
+	}
+
+#ifdef WITH_WEBSOCKETS
+	if(context->wsi){
+		struct lws_pollfd wspoll;
+		wspoll.fd = context->sock;
+		wspoll.events = (int16_t)context->uring->events;
+		wspoll.revents = (int16_t)events;
+		lws_service_fd(lws_get_context(context->wsi), &wspoll);
+		return;
+	}
+#endif
+
+	if(events & POLLOUT
+#ifdef WITH_TLS
+			|| context->want_write
+			|| (context->ssl && context->state == mosq_cs_new)
+#endif
+			){
+
+		if(context->state == mosq_cs_connect_pending){
+			len = sizeof(int);
+			if(!getsockopt(context->sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len)){
+				if(err == 0){
+					mosquitto__set_state(context, mosq_cs_new);
+#if defined(WITH_ADNS) && defined(WITH_BRIDGE)
+					if(context->bridge){
+						bridge__connect_step3(context);
+					}
+#endif
+				}
+			}else{
+				do_disconnect(context, MOSQ_ERR_CONN_LOST);
+				return;
+			}
+		}
+		rc = packet__write(context);
+		if(rc){
+			do_disconnect(context, rc);
+			return;
+		}
+	}
+
+	if(events & POLLIN
+#ifdef WITH_TLS
+			|| (context->ssl && context->state == mosq_cs_new)
+#endif
+			){
+
+		do{
+			rc = packet__read(context);
+			if(rc){
+				do_disconnect(context, rc);
+				return;
+			}
+		}while(SSL_DATA_PENDING(context));
+	}else{
+		if(events & (POLLERR | POLLHUP)){
+			do_disconnect(context, MOSQ_ERR_CONN_LOST);
+			return;
+		}
+	}
+}
+#endif
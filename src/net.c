@@ -87,6 +87,12 @@ void net__broker_cleanup(void)
 		COMPAT_CLOSE(spare_sock);
 		spare_sock = INVALID_SOCKET;
 	}
+#ifdef WITH_QUIC
+	net__quic_broker_cleanup();
+#endif
+#ifdef WITH_IO_THREADS
+	net__io_cleanup();
+#endif
 	net__cleanup();
 }
 
@@ -111,16 +117,11 @@ static void net__print_error(unsigned int log, const char *format_str)
 struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock)
 {
 	mosq_sock_t new_sock = INVALID_SOCKET;
-	struct mosquitto *new_context;
-#ifdef WITH_TLS
-	BIO *bio;
-	int rc;
-	char ebuf[256];
-	unsigned long e;
-#endif
-#ifdef WITH_WRAP
-	struct request_info wrap_req;
-	char address[1024];
+
+#ifdef WITH_QUIC
+	if(listensock->listener && listensock->listener->protocol == mp_quic){
+		return net__quic_accept(listensock);
+	}
 #endif
 
 	new_sock = accept(listensock->sock, NULL, 0);
@@ -156,6 +157,26 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 		return NULL;
 	}
 
+	return net__socket_accept_finish(listensock->listener, new_sock);
+}
+
+
+/* Set up a context for a newly accepted, non-blocking socket. new_sock is
+ * closed if the connection is refused. */
+struct mosquitto *net__socket_accept_finish(struct mosquitto__listener *listener, mosq_sock_t new_sock)
+{
+	struct mosquitto *new_context;
+#ifdef WITH_TLS
+	BIO *bio;
+	int rc;
+	char ebuf[256];
+	unsigned long e;
+#endif
+#ifdef WITH_WRAP
+	struct request_info wrap_req;
+	char address[1024];
+#endif
+
 #ifdef WITH_WRAP
 	/* Use tcpd / libwrap to determine whether a connection is allowed. */
 	request_init(&wrap_req, RQ_FILE, new_sock, RQ_DAEMON, "mosquitto", 0);
@@ -188,7 +209,7 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 		COMPAT_CLOSE(new_sock);
 		return NULL;
 	}
-	new_context->listener = listensock->listener;
+	new_context->listener = listener;
 	if(!new_context->listener){
 		context__cleanup(new_context, true);
 		return NULL;
@@ -213,6 +234,8 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 		}
 		SSL_set_ex_data(new_context->ssl, tls_ex_index_context, new_context);
 		SSL_set_ex_data(new_context->ssl, tls_ex_index_listener, new_context->listener);
+		/* net__writev() retries with a freshly gathered buffer. */
+		SSL_set_mode(new_context->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 		new_context->want_write = true;
 		bio = BIO_new_socket(new_sock, BIO_NOCLOSE);
 		SSL_set_bio(new_context->ssl, bio, bio);
@@ -758,6 +781,14 @@ static int net__socket_listen_tcp(struct mosquitto__listener *listener)
 		ss_opt = 1;
 		(void)setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ss_opt, sizeof(ss_opt));
 #endif
+#if defined(WITH_IO_THREADS) && defined(SO_REUSEPORT)
+		if(net__io_listener_eligible(listener)){
+			/* Each I/O thread gets a socket bound to the same address,
+			 * see net__io_listen(). */
+			ss_opt = 1;
+			(void)setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &ss_opt, sizeof(ss_opt));
+		}
+#endif
 
 		if(net__socket_nonblock(&sock)){
 			freeaddrinfo(ainfo);
@@ -889,6 +920,13 @@ int net__socket_listen(struct mosquitto__listener *listener)
 
 	if(!listener) return MOSQ_ERR_INVAL;
 
+#ifdef WITH_QUIC
+	if(listener->protocol == mp_quic){
+		/* QUIC listeners carry their own TLS 1.3 stack inside msquic. */
+		return net__quic_listen(listener);
+	}
+#endif
+
 #ifdef WITH_UNIX_SOCKETS
 	if(listener->port == 0 && listener->unix_socket_path != NULL){
 		rc = net__socket_listen_unix(listener);
@@ -937,6 +975,11 @@ int net__socket_listen(struct mosquitto__listener *listener)
 		}
 #  endif /* FINAL_WITH_TLS_PSK */
 #endif /* WITH_TLS */
+#ifdef WITH_IO_THREADS
+		if(net__io_listener_eligible(listener)){
+			return net__io_listen(listener);
+		}
+#endif
 		return 0;
 	}else{
 		return 1;
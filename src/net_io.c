@@ -0,0 +1,1148 @@
+/*
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+*/
+
+#include "config.h"
+
+#ifdef WITH_IO_THREADS
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "net_mosq.h"
+#include "packet_mosq.h"
+#include "sys_tree.h"
+#include "util_mosq.h"
+
+#include "uthash.h"
+
+/* Plain TCP listeners may be served by a pool of I/O threads, set with the
+ * io_threads option. Each thread has its own epoll set and its own
+ * SO_REUSEPORT listening socket for every address of those listeners, so the
+ * kernel spreads new connections over the threads, and a connection stays
+ * with the thread that accepted it. The threads make the accept(), recv()
+ * and send() calls for their connections. Everything else - parsing,
+ * authentication, routing, the subscription tree, persistence - stays on
+ * the main loop, so none of it has to become thread safe.
+ *
+ * This offloads system calls, it does not shard the broker. The threads own
+ * no client state: every context, session and delivery to a subscriber still
+ * belongs to the main loop, and no messages pass directly between threads.
+ * Using more than one core for message processing would need contexts owned
+ * by per-thread event loops, with queues between them for messages that
+ * cross from one thread's clients to another's, and none of that is here.
+ *
+ * The two sides meet much as they do for QUIC. A thread appends what it has
+ * read to the connection under the thread lock, puts the connection on the
+ * thread's ready list and makes an eventfd readable. There is one eventfd
+ * per thread rather than per connection, so a single wakeup of the main loop
+ * hands over every connection that has become ready in the meantime, and the
+ * main loop parses the received data without any system call of its own.
+ * Outgoing data goes the other way: net__write() appends to the
+ * connection's output buffer, and once per pass of the main loop the
+ * connections with something to send are handed to their threads, with one
+ * wakeup per thread.
+ *
+ * context->sock holds the connection's descriptor so that the contexts_by_sock
+ * hash and the checks for a connected client work unchanged, but the main
+ * loop never does I/O on it, and it is only closed by the thread.
+ *
+ * Connections and their buffers cross threads, so they are allocated with
+ * plain malloc/free rather than the (not thread safe) tracked allocator. A
+ * connection is only ever freed by the main loop, once its thread has closed
+ * the descriptor and said so on the ready list. */
+
+#define IO_MAX_EVENTS 256
+#define IO_ACCEPT_BATCH 32
+/* Largest single recv(), the thread's scratch buffer. */
+#define IO_READ_SIZE 65536
+#define IO_BUF_MIN 4096
+/* Buffers that have grown beyond this are released once empty. */
+#define IO_BUF_KEEP 65536
+/* Stop reading from a client with this much data the main loop has not
+ * parsed yet, and let TCP flow control slow it down. */
+#define IO_IN_MAX (1024*1024)
+/* Report EAGAIN to packet__write() once this much is waiting to be sent. */
+#define IO_OUT_MAX (1024*1024)
+
+enum io__kind{
+	io_kind_listen = 1,
+	io_kind_conn = 2,
+};
+
+struct io__buf{
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct io__listen{
+	int kind; /* This *must* be the first element in the struct. */
+	mosq_sock_t sock;
+	struct mosquitto__listener *listener;
+};
+
+struct mosquitto__io_conn{
+	int kind; /* This *must* be the first element in the struct. */
+	mosq_sock_t sock;
+	struct mosquitto__io_thread *thread;
+	struct mosquitto__listener *listener;
+
+	/* Protected by thread->lock. */
+	struct mosquitto__io_conn *next;        /* On the accepted or ready list. */
+	struct mosquitto__io_conn *next_write;  /* On the writes list. */
+	struct io__buf in;                      /* Received, not yet parsed. */
+	struct io__buf out;                     /* Written, not yet sent. */
+	bool ready_queued;
+	bool write_queued;
+	bool eof;               /* Closed by the peer, or an error. */
+	bool want_writable;     /* net__io_write() has refused data... */
+	bool writable;          /* ...and there is room for it again. */
+	bool read_paused;       /* in reached IO_IN_MAX. */
+	bool rearm;             /* The main loop has emptied a paused in. */
+	bool released;          /* The broker no longer references this. */
+	bool thread_done;       /* The thread has closed sock. */
+
+	/* Main loop only. */
+	struct mosquitto *context;
+	struct mosquitto__io_conn *next_main;
+	struct mosquitto__io_conn *next_flush;
+	struct io__buf parse;
+	bool flush_queued;
+	bool main_eof;
+	bool main_writable;
+	bool main_rearm;
+
+	/* I/O thread only. */
+	struct mosquitto__io_conn *next_thread;
+	struct io__buf sending;
+	size_t sending_pos;
+	uint32_t events;        /* As registered with epoll. */
+	bool read_off;
+	bool out_armed;
+	bool failed;
+	bool thread_released;
+	bool thread_rearm;
+};
+
+struct mosquitto__io_thread{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int epollfd;
+	int notify;             /* Wakes the thread. */
+	int notify_main;        /* Wakes the main loop, this is its listensock. */
+	struct io__listen *listens;
+	int listen_count;
+	mosq_sock_t spare_sock;
+	bool started;
+
+	/* Protected by lock. */
+	struct mosquitto__io_conn *accepted;
+	struct mosquitto__io_conn *accepted_last;
+	struct mosquitto__io_conn *ready;
+	struct mosquitto__io_conn *ready_last;
+	struct mosquitto__io_conn *writes;
+	struct mosquitto__io_conn *writes_last;
+	int accept_dropped;
+	bool main_signalled;
+	bool thread_signalled;
+	bool stop;
+
+	/* Main loop only. */
+	struct mosquitto__io_conn *flush;
+	struct mosquitto__io_conn *flush_last;
+
+	uint8_t scratch[IO_READ_SIZE];
+};
+
+static struct mosquitto__io_thread *io_threads = NULL;
+static int io_thread_count = 0;
+static bool io_stopped = false;
+
+
+static void io__signal(int fd)
+{
+	uint64_t one = 1;
+
+	/* A saturated eventfd is already readable. */
+	if(write(fd, &one, sizeof(one)) < 0){
+		return;
+	}
+}
+
+
+static void io__clear(int fd)
+{
+	uint64_t value;
+
+	if(read(fd, &value, sizeof(value)) < 0){
+		return;
+	}
+}
+
+
+static int io__buf_append(struct io__buf *buf, const void *data, size_t len)
+{
+	uint8_t *newdata;
+	size_t size;
+
+	if(buf->len + len > buf->size){
+		size = buf->size ? buf->size : IO_BUF_MIN;
+		while(size < buf->len + len){
+			size *= 2;
+		}
+		newdata = realloc(buf->data, size);
+		if(!newdata){
+			return MOSQ_ERR_NOMEM;
+		}
+		buf->data = newdata;
+		buf->size = size;
+	}
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void io__buf_swap(struct io__buf *a, struct io__buf *b)
+{
+	struct io__buf tmp;
+
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+
+static void io__buf_trim(struct io__buf *buf)
+{
+	if(buf->len == 0 && buf->size > IO_BUF_KEEP){
+		free(buf->data);
+		buf->data = NULL;
+		buf->size = 0;
+	}
+}
+
+
+static void io__conn_free(struct mosquitto__io_conn *conn)
+{
+	free(conn->in.data);
+	free(conn->out.data);
+	free(conn->parse.data);
+	free(conn->sending.data);
+	free(conn);
+}
+
+
+/* ============================================================
+ * I/O thread side
+ * ============================================================ */
+
+/* Called with thread->lock held. */
+static void io__signal_main(struct mosquitto__io_thread *thread)
+{
+	if(!thread->main_signalled){
+		thread->main_signalled = true;
+		io__signal(thread->notify_main);
+	}
+}
+
+
+/* Called with thread->lock held. */
+static void io__ready_push(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	if(conn->ready_queued) return;
+
+	conn->ready_queued = true;
+	conn->next = NULL;
+	if(thread->ready_last){
+		thread->ready_last->next = conn;
+	}else{
+		thread->ready = conn;
+	}
+	thread->ready_last = conn;
+	io__signal_main(thread);
+}
+
+
+static void io__conn_fail(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn);
+
+static void io__conn_events(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	struct epoll_event ev;
+	uint32_t events = 0;
+	int op;
+
+	if(!conn->read_off) events |= EPOLLIN;
+	if(conn->out_armed) events |= EPOLLOUT;
+	if(events == conn->events) return;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = conn;
+	if(events == 0){
+		op = EPOLL_CTL_DEL;
+	}else if(conn->events == 0){
+		op = EPOLL_CTL_ADD;
+	}else{
+		op = EPOLL_CTL_MOD;
+	}
+	if(epoll_ctl(thread->epollfd, op, conn->sock, &ev) == 0 || op == EPOLL_CTL_DEL){
+		conn->events = events;
+	}else if(!conn->failed){
+		io__conn_fail(thread, conn);
+	}
+}
+
+
+/* The connection is unusable. The main loop parses anything that was read
+ * before this and then disconnects the client. */
+static void io__conn_fail(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	pthread_mutex_lock(&thread->lock);
+	conn->eof = true;
+	conn->out.len = 0;
+	io__ready_push(thread, conn);
+	pthread_mutex_unlock(&thread->lock);
+
+	conn->failed = true;
+	conn->read_off = true;
+	conn->out_armed = false;
+	conn->sending.len = 0;
+	conn->sending_pos = 0;
+	io__conn_events(thread, conn);
+}
+
+
+static void io__conn_read(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	ssize_t len;
+	bool pause = false;
+	int rc;
+
+	len = recv(conn->sock, thread->scratch, sizeof(thread->scratch), 0);
+	if(len < 0 && (errno == EAGAIN || errno == COMPAT_EWOULDBLOCK || errno == EINTR)){
+		return;
+	}
+	if(len <= 0){
+		io__conn_fail(thread, conn);
+		return;
+	}
+
+	pthread_mutex_lock(&thread->lock);
+	rc = io__buf_append(&conn->in, thread->scratch, (size_t)len);
+	if(rc == MOSQ_ERR_SUCCESS){
+		if(conn->in.len >= IO_IN_MAX){
+			conn->read_paused = true;
+			pause = true;
+		}
+		io__ready_push(thread, conn);
+	}
+	pthread_mutex_unlock(&thread->lock);
+
+	if(rc){
+		io__conn_fail(thread, conn);
+	}else if(pause){
+		conn->read_off = true;
+		io__conn_events(thread, conn);
+	}
+}
+
+
+/* Send until the socket is full or there is nothing left. Whatever the main
+ * loop has written is taken in one go by swapping buffers, so the lock is
+ * never held across send(). */
+static void io__conn_write(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	ssize_t len;
+
+	if(conn->failed) return;
+
+	while(1){
+		if(conn->sending_pos == conn->sending.len){
+			conn->sending.len = 0;
+			conn->sending_pos = 0;
+			io__buf_trim(&conn->sending);
+
+			pthread_mutex_lock(&thread->lock);
+			io__buf_swap(&conn->out, &conn->sending);
+			if(conn->want_writable){
+				/* There is room in out again, let packet__write() carry on. */
+				conn->want_writable = false;
+				conn->writable = true;
+				io__ready_push(thread, conn);
+			}
+			pthread_mutex_unlock(&thread->lock);
+
+			if(conn->sending.len == 0){
+				break;
+			}
+		}
+		len = send(conn->sock, &conn->sending.data[conn->sending_pos],
+				conn->sending.len - conn->sending_pos, MSG_NOSIGNAL);
+		if(len > 0){
+			conn->sending_pos += (size_t)len;
+		}else if(len < 0 && errno == EINTR){
+			continue;
+		}else if(len < 0 && (errno == EAGAIN || errno == COMPAT_EWOULDBLOCK)){
+			conn->out_armed = true;
+			io__conn_events(thread, conn);
+			return;
+		}else{
+			io__conn_fail(thread, conn);
+			return;
+		}
+	}
+	conn->out_armed = false;
+	io__conn_events(thread, conn);
+}
+
+
+static void io__conn_close(struct mosquitto__io_thread *thread, struct mosquitto__io_conn *conn)
+{
+	struct epoll_event ev;
+
+	/* Best effort at sending what was queued last, typically a CONNACK or
+	 * DISCONNECT carrying a reason code. */
+	io__conn_write(thread, conn);
+	if(conn->events){
+		memset(&ev, 0, sizeof(struct epoll_event));
+		(void)epoll_ctl(thread->epollfd, EPOLL_CTL_DEL, conn->sock, &ev);
+		conn->events = 0;
+	}
+	COMPAT_CLOSE(conn->sock);
+	conn->sock = INVALID_SOCKET;
+
+	pthread_mutex_lock(&thread->lock);
+	conn->thread_done = true;
+	io__ready_push(thread, conn);
+	pthread_mutex_unlock(&thread->lock);
+}
+
+
+static void io__thread_accept(struct mosquitto__io_thread *thread, struct io__listen *listen)
+{
+	struct mosquitto__io_conn *conn;
+	mosq_sock_t sock;
+	int i;
+
+	for(i=0; i<IO_ACCEPT_BATCH; i++){
+		sock = accept4(listen->sock, NULL, NULL, SOCK_NONBLOCK);
+		if(sock == INVALID_SOCKET){
+			if(errno == EMFILE || errno == ENFILE){
+				/* As in net__socket_accept(), sacrifice the spare socket
+				 * so the connection can be accepted and closed, rather
+				 * than left to wake us up forever. */
+				COMPAT_CLOSE(thread->spare_sock);
+				sock = accept(listen->sock, NULL, 0);
+				if(sock != INVALID_SOCKET){
+					COMPAT_CLOSE(sock);
+				}
+				thread->spare_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+				pthread_mutex_lock(&thread->lock);
+				thread->accept_dropped++;
+				io__signal_main(thread);
+				pthread_mutex_unlock(&thread->lock);
+			}
+			return;
+		}
+
+		conn = calloc(1, sizeof(struct mosquitto__io_conn));
+		if(!conn){
+			COMPAT_CLOSE(sock);
+			continue;
+		}
+		conn->kind = io_kind_conn;
+		conn->sock = sock;
+		conn->thread = thread;
+		conn->listener = listen->listener;
+
+		/* The main loop decides whether to keep the connection, and
+		 * hands it back through the writes list if so. */
+		pthread_mutex_lock(&thread->lock);
+		if(thread->accepted_last){
+			thread->accepted_last->next = conn;
+		}else{
+			thread->accepted = conn;
+		}
+		thread->accepted_last = conn;
+		io__signal_main(thread);
+		pthread_mutex_unlock(&thread->lock);
+	}
+}
+
+
+/* Take the connections the main loop has handed over. Returns true if the
+ * thread should exit. */
+static bool io__thread_writes(struct mosquitto__io_thread *thread)
+{
+	struct mosquitto__io_conn *conn, *next;
+	struct mosquitto__io_conn *list = NULL, *last = NULL;
+	bool stop;
+
+	pthread_mutex_lock(&thread->lock);
+	io__clear(thread->notify);
+	thread->thread_signalled = false;
+	for(conn = thread->writes; conn; conn = conn->next_write){
+		conn->write_queued = false;
+		conn->thread_released = conn->released;
+		conn->thread_rearm = conn->rearm;
+		if(conn->rearm){
+			conn->rearm = false;
+			conn->read_paused = false;
+		}
+		conn->next_thread = NULL;
+		if(last){
+			last->next_thread = conn;
+		}else{
+			list = conn;
+		}
+		last = conn;
+	}
+	thread->writes = NULL;
+	thread->writes_last = NULL;
+	stop = thread->stop;
+	pthread_mutex_unlock(&thread->lock);
+
+	for(conn = list; conn; conn = next){
+		next = conn->next_thread;
+		if(conn->thread_released){
+			io__conn_close(thread, conn);
+			continue;
+		}
+		if(conn->thread_rearm && !conn->failed){
+			conn->read_off = false;
+		}
+		/* Also registers a new connection with epoll. */
+		io__conn_write(thread, conn);
+	}
+	return stop;
+}
+
+
+static void *io__thread_main(void *arg)
+{
+	struct mosquitto__io_thread *thread = arg;
+	struct epoll_event events[IO_MAX_EVENTS];
+	struct mosquitto__io_conn *conn;
+	bool notified;
+	int event_count;
+	int i;
+
+	while(1){
+		event_count = epoll_wait(thread->epollfd, events, IO_MAX_EVENTS, -1);
+		notified = false;
+		for(i=0; i<event_count; i++){
+			if(events[i].data.ptr == NULL){
+				notified = true;
+			}else if(*(int *)events[i].data.ptr == io_kind_listen){
+				io__thread_accept(thread, events[i].data.ptr);
+			}else{
+				conn = events[i].data.ptr;
+				if(events[i].events & EPOLLOUT){
+					io__conn_write(thread, conn);
+				}
+				if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+					if(!conn->read_off){
+						io__conn_read(thread, conn);
+					}else if(!conn->failed && (events[i].events & (EPOLLERR | EPOLLHUP))){
+						io__conn_fail(thread, conn);
+					}
+				}
+			}
+		}
+		/* Last, because it closes connections the events above may refer to. */
+		if(notified && io__thread_writes(thread)){
+			break;
+		}
+	}
+	return NULL;
+}
+
+
+/* ============================================================
+ * Main loop side
+ * ============================================================ */
+
+bool net__io_listener_eligible(struct mosquitto__listener *listener)
+{
+#ifdef SO_REUSEPORT
+	if(db.config->io_threads < 1 || listener->protocol != mp_mqtt || listener->port == 0){
+		return false;
+	}
+#  ifdef WITH_TLS
+	/* TLS stays on the main loop, with the SSL objects. */
+	if(listener->certfile || listener->psk_hint){
+		return false;
+	}
+#  endif
+	return true;
+#else
+	UNUSED(listener);
+	return false;
+#endif
+}
+
+
+static int io__threads_init(void)
+{
+	struct mosquitto__io_thread *thread;
+	struct epoll_event ev;
+	int i;
+
+	if(io_threads) return MOSQ_ERR_SUCCESS;
+
+	io_threads = mosquitto__calloc((size_t)db.config->io_threads, sizeof(struct mosquitto__io_thread));
+	if(!io_threads){
+		errno = ENOMEM;
+		return MOSQ_ERR_NOMEM;
+	}
+	io_thread_count = db.config->io_threads;
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		pthread_mutex_init(&thread->lock, NULL);
+		thread->epollfd = -1;
+		thread->notify = -1;
+		thread->notify_main = -1;
+		thread->spare_sock = INVALID_SOCKET;
+	}
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		thread->epollfd = epoll_create1(EPOLL_CLOEXEC);
+		thread->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		thread->notify_main = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(thread->epollfd < 0 || thread->notify < 0 || thread->notify_main < 0){
+			return MOSQ_ERR_ERRNO;
+		}
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if(epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, thread->notify, &ev) == -1){
+			return MOSQ_ERR_ERRNO;
+		}
+		thread->spare_sock = socket(AF_INET, SOCK_STREAM, 0);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int io__listen_add(struct mosquitto__io_thread *thread, struct mosquitto__listener *listener, mosq_sock_t sock)
+{
+	struct io__listen *listens;
+
+	listens = mosquitto__realloc(thread->listens, sizeof(struct io__listen)*(size_t)(thread->listen_count+1));
+	if(!listens){
+		COMPAT_CLOSE(sock);
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return MOSQ_ERR_NOMEM;
+	}
+	thread->listens = listens;
+	listens[thread->listen_count].kind = io_kind_listen;
+	listens[thread->listen_count].sock = sock;
+	listens[thread->listen_count].listener = listener;
+	thread->listen_count++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static mosq_sock_t io__listen_clone(const struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	mosq_sock_t sock;
+	int ss_opt;
+
+	sock = socket(addr->ss_family, SOCK_STREAM, 0);
+	if(sock == INVALID_SOCKET){
+		return INVALID_SOCKET;
+	}
+	ss_opt = 1;
+	(void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &ss_opt, sizeof(ss_opt));
+	ss_opt = 1;
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &ss_opt, sizeof(ss_opt))){
+		COMPAT_CLOSE(sock);
+		return INVALID_SOCKET;
+	}
+#ifdef IPV6_V6ONLY
+	if(addr->ss_family == AF_INET6){
+		ss_opt = 1;
+		(void)setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ss_opt, sizeof(ss_opt));
+	}
+#endif
+	if(net__socket_nonblock(&sock)){
+		return INVALID_SOCKET;
+	}
+	if(bind(sock, (const struct sockaddr *)addr, addrlen) == -1
+			|| listen(sock, 100) == -1){
+
+		COMPAT_CLOSE(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+
+/* Take over the sockets net__socket_listen_tcp() has opened for listener.
+ * The first thread gets those, the others each a socket of their own bound
+ * to the same address. Afterwards the listener has no sockets of its own for
+ * the main loop to watch. */
+int net__io_listen(struct mosquitto__listener *listener)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	mosq_sock_t sock;
+	int i, j;
+
+	if(io__threads_init()){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to create I/O threads: %s.", strerror(errno));
+		return 1;
+	}
+
+	for(i=0; i<listener->sock_count; i++){
+		memset(&addr, 0, sizeof(struct sockaddr_storage));
+		addrlen = sizeof(addr);
+		if(getsockname(listener->socks[i], (struct sockaddr *)&addr, &addrlen)){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: %s", strerror(errno));
+			return 1;
+		}
+		sock = listener->socks[i];
+		listener->socks[i] = INVALID_SOCKET;
+		if(io__listen_add(&io_threads[0], listener, sock)){
+			return 1;
+		}
+		for(j=1; j<io_thread_count; j++){
+			sock = io__listen_clone(&addr, addrlen);
+			if(sock == INVALID_SOCKET){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open I/O thread listen socket on port %d: %s.",
+						listener->port, strerror(errno));
+				return 1;
+			}
+			if(io__listen_add(&io_threads[j], listener, sock)){
+				return 1;
+			}
+		}
+	}
+	log__printf(NULL, MOSQ_LOG_INFO, "Serving port %d from %d I/O threads.", listener->port, io_thread_count);
+
+	mosquitto__free(listener->socks);
+	listener->socks = NULL;
+	listener->sock_count = 0;
+	return 0;
+}
+
+
+int net__io_start(void)
+{
+	struct mosquitto__io_thread *thread;
+	struct epoll_event ev;
+	sigset_t sigs, origsigs;
+	int i, j;
+	int rc = 0;
+
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		/* Registered only now, the listens array may have moved before. */
+		for(j=0; j<thread->listen_count; j++){
+			memset(&ev, 0, sizeof(struct epoll_event));
+			ev.events = EPOLLIN;
+			ev.data.ptr = &thread->listens[j];
+			if(epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, thread->listens[j].sock, &ev) == -1){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll registering: %s", strerror(errno));
+				return 1;
+			}
+		}
+	}
+
+	/* Signals are for the main loop only. */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_SETMASK, &sigs, &origsigs);
+	for(i=0; i<io_thread_count; i++){
+		rc = pthread_create(&io_threads[i].thread, NULL, io__thread_main, &io_threads[i]);
+		if(rc){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to start I/O thread: %s.", strerror(rc));
+			break;
+		}
+		io_threads[i].started = true;
+	}
+	pthread_sigmask(SIG_SETMASK, &origsigs, NULL);
+
+	return rc?1:0;
+}
+
+
+int net__io_thread_count(void)
+{
+	return io_thread_count;
+}
+
+
+mosq_sock_t net__io_thread_sock(int index)
+{
+	if(index < 0 || index >= io_thread_count){
+		return INVALID_SOCKET;
+	}
+	return io_threads[index].notify_main;
+}
+
+
+static void io__flush_queue(struct mosquitto__io_conn *conn)
+{
+	struct mosquitto__io_thread *thread = conn->thread;
+
+	if(conn->flush_queued) return;
+
+	conn->flush_queued = true;
+	conn->next_flush = NULL;
+	if(thread->flush_last){
+		thread->flush_last->next_flush = conn;
+	}else{
+		thread->flush = conn;
+	}
+	thread->flush_last = conn;
+}
+
+
+/* Called with thread->lock held. */
+static void io__flush_thread(struct mosquitto__io_thread *thread)
+{
+	struct mosquitto__io_conn *conn, *next;
+
+	for(conn = thread->flush; conn; conn = next){
+		next = conn->next_flush;
+		conn->flush_queued = false;
+		if(!conn->write_queued){
+			conn->write_queued = true;
+			conn->next_write = NULL;
+			if(thread->writes_last){
+				thread->writes_last->next_write = conn;
+			}else{
+				thread->writes = conn;
+			}
+			thread->writes_last = conn;
+		}
+	}
+	thread->flush = NULL;
+	thread->flush_last = NULL;
+	if(!thread->thread_signalled){
+		thread->thread_signalled = true;
+		io__signal(thread->notify);
+	}
+}
+
+
+/* Hand everything written since the last call to the I/O threads. */
+void net__io_flush(void)
+{
+	struct mosquitto__io_thread *thread;
+	int i;
+
+	if(io_stopped) return;
+
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		if(thread->flush){
+			pthread_mutex_lock(&thread->lock);
+			io__flush_thread(thread);
+			pthread_mutex_unlock(&thread->lock);
+		}
+	}
+}
+
+
+static void io__accepted(struct mosquitto__io_conn *accepted)
+{
+	struct mosquitto__io_conn *conn;
+	struct mosquitto *context;
+
+	while(accepted){
+		conn = accepted;
+		accepted = conn->next;
+		conn->next = NULL;
+
+		G_SOCKET_CONNECTIONS_INC();
+		context = net__socket_accept_finish(conn->listener, conn->sock);
+		if(!context){
+			/* The descriptor has been closed, the thread never used it. */
+			io__conn_free(conn);
+			continue;
+		}
+		context->io = conn;
+		conn->context = context;
+		/* The thread starts reading once it is handed the connection. */
+		io__flush_queue(conn);
+	}
+}
+
+
+void net__io_handle(struct mosquitto__listener_sock *listensock)
+{
+	struct mosquitto__io_thread *thread = NULL;
+	struct mosquitto__io_conn *conn, *next;
+	struct mosquitto__io_conn *accepted;
+	struct mosquitto__io_conn *list = NULL, *last = NULL;
+	struct mosquitto *context;
+	int dropped;
+	int rc;
+	int i;
+
+	for(i=0; i<io_thread_count; i++){
+		if(io_threads[i].notify_main == listensock->sock){
+			thread = &io_threads[i];
+			break;
+		}
+	}
+	if(!thread) return;
+
+	pthread_mutex_lock(&thread->lock);
+	/* Clearing the notification under the lock means anything the thread
+	 * queues after this wakes us up again. */
+	io__clear(thread->notify_main);
+	thread->main_signalled = false;
+	accepted = thread->accepted;
+	thread->accepted = NULL;
+	thread->accepted_last = NULL;
+	dropped = thread->accept_dropped;
+	thread->accept_dropped = 0;
+	for(conn = thread->ready; conn; conn = next){
+		next = conn->next;
+		conn->ready_queued = false;
+		if(conn->released){
+			if(conn->thread_done){
+				io__conn_free(conn);
+			}
+			continue;
+		}
+		/* parse is always empty here, swap it for the received data. */
+		io__buf_swap(&conn->in, &conn->parse);
+		conn->main_rearm = conn->read_paused && !conn->rearm;
+		if(conn->main_rearm){
+			conn->rearm = true;
+		}
+		conn->main_eof = conn->eof;
+		conn->main_writable = conn->writable;
+		conn->writable = false;
+
+		conn->next_main = NULL;
+		if(last){
+			last->next_main = conn;
+		}else{
+			list = conn;
+		}
+		last = conn;
+	}
+	thread->ready = NULL;
+	thread->ready_last = NULL;
+	pthread_mutex_unlock(&thread->lock);
+
+	if(dropped){
+		log__printf(NULL, MOSQ_LOG_WARNING,
+				"Unable to accept new connection, system socket count has been exceeded. Try increasing \"ulimit -n\" or equivalent.");
+	}
+	io__accepted(accepted);
+
+	for(conn = list; conn; conn = conn->next_main){
+		context = conn->context;
+		if(!context){
+			/* Closed by a packet handled earlier in this list. */
+			conn->parse.len = 0;
+			continue;
+		}
+		if(conn->main_rearm){
+			io__flush_queue(conn);
+		}
+		if(conn->main_writable){
+			rc = packet__write(context);
+			if(rc){
+				conn->parse.len = 0;
+				do_disconnect(context, rc);
+				continue;
+			}
+		}
+		if(conn->parse.len){
+			rc = packet__read_buffer(context, NULL, conn->parse.data, (uint32_t)conn->parse.len);
+			conn->parse.len = 0;
+			io__buf_trim(&conn->parse);
+			if(rc){
+				do_disconnect(context, rc);
+				continue;
+			}
+		}
+		if(conn->main_eof && context->io == conn){
+			do_disconnect(context, MOSQ_ERR_CONN_LOST);
+		}
+	}
+}
+
+
+ssize_t net__io_write(struct mosquitto *context, const void *buf, size_t count)
+{
+	struct mosquitto__io_conn *conn = context->io;
+	struct mosquitto__io_thread *thread = conn->thread;
+	int rc;
+
+	pthread_mutex_lock(&thread->lock);
+	if(conn->eof){
+		/* The disconnect is already queued for the main loop. Failing here
+		 * would leave every message routed to this client in the meantime on
+		 * its inflight list, so the data is dropped as the kernel would drop
+		 * unsent data on a reset connection. */
+		pthread_mutex_unlock(&thread->lock);
+		return (ssize_t)count;
+	}
+	if(conn->out.len >= IO_OUT_MAX){
+		/* The thread pushes the connection onto the ready list with
+		 * writable set once it has taken this data. */
+		conn->want_writable = true;
+		pthread_mutex_unlock(&thread->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	rc = io__buf_append(&conn->out, buf, count);
+	pthread_mutex_unlock(&thread->lock);
+
+	if(rc){
+		errno = ENOMEM;
+		return -1;
+	}
+	io__flush_queue(conn);
+	return (ssize_t)count;
+}
+
+
+/* Called from net__socket_close(). The thread closes the descriptor once it
+ * has sent what is left, and the connection is freed when it says so. */
+void net__io_close(struct mosquitto *context)
+{
+	struct mosquitto__io_conn *conn = context->io;
+	struct mosquitto__io_thread *thread = conn->thread;
+	struct mosquitto *mosq_found;
+
+	if(context->sock != INVALID_SOCKET){
+		HASH_FIND(hh_sock, db.contexts_by_sock, &context->sock, sizeof(context->sock), mosq_found);
+		if(mosq_found){
+			HASH_DELETE(hh_sock, db.contexts_by_sock, mosq_found);
+		}
+		context->sock = INVALID_SOCKET;
+	}
+	context->io = NULL;
+	conn->context = NULL;
+
+	if(io_stopped){
+		COMPAT_CLOSE(conn->sock);
+		io__conn_free(conn);
+		return;
+	}
+
+	pthread_mutex_lock(&thread->lock);
+	conn->released = true;
+	pthread_mutex_unlock(&thread->lock);
+	io__flush_queue(conn);
+}
+
+
+/* Stop the threads, after they have sent anything still queued. Connections
+ * that the broker still references are closed by net__io_close(). */
+void net__io_stop(void)
+{
+	struct mosquitto__io_thread *thread;
+	struct mosquitto__io_conn *conn, *next;
+	int i, j;
+
+	if(!io_threads || io_stopped) return;
+
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		pthread_mutex_lock(&thread->lock);
+		io__flush_thread(thread);
+		thread->stop = true;
+		pthread_mutex_unlock(&thread->lock);
+	}
+	for(i=0; i<io_thread_count; i++){
+		if(io_threads[i].started){
+			pthread_join(io_threads[i].thread, NULL);
+			io_threads[i].started = false;
+		}
+	}
+	io_stopped = true;
+
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		for(conn = thread->accepted; conn; conn = next){
+			next = conn->next;
+			COMPAT_CLOSE(conn->sock);
+			io__conn_free(conn);
+		}
+		thread->accepted = NULL;
+		thread->accepted_last = NULL;
+
+		for(conn = thread->ready; conn; conn = next){
+			next = conn->next;
+			conn->ready_queued = false;
+			if(conn->released && conn->thread_done){
+				io__conn_free(conn);
+			}
+		}
+		thread->ready = NULL;
+		thread->ready_last = NULL;
+
+		for(conn = thread->writes; conn; conn = next){
+			next = conn->next_write;
+			conn->write_queued = false;
+			if(conn->released && !conn->thread_done){
+				COMPAT_CLOSE(conn->sock);
+				io__conn_free(conn);
+			}
+		}
+		thread->writes = NULL;
+		thread->writes_last = NULL;
+
+		for(j=0; j<thread->listen_count; j++){
+			COMPAT_CLOSE(thread->listens[j].sock);
+		}
+		mosquitto__free(thread->listens);
+		thread->listens = NULL;
+		thread->listen_count = 0;
+	}
+}
+
+
+void net__io_cleanup(void)
+{
+	struct mosquitto__io_thread *thread;
+	int i;
+
+	if(!io_threads) return;
+
+	net__io_stop();
+	for(i=0; i<io_thread_count; i++){
+		thread = &io_threads[i];
+		/* notify_main is a listensock, closed with the others. */
+		if(thread->epollfd >= 0) COMPAT_CLOSE(thread->epollfd);
+		if(thread->notify >= 0) COMPAT_CLOSE(thread->notify);
+		if(thread->spare_sock != INVALID_SOCKET) COMPAT_CLOSE(thread->spare_sock);
+		pthread_mutex_destroy(&thread->lock);
+	}
+	mosquitto__free(io_threads);
+	io_threads = NULL;
+	io_thread_count = 0;
+}
+
+#endif
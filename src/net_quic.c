@@ -0,0 +1,1347 @@
+/*
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+*/
+
+#include "config.h"
+
+#ifdef WITH_QUIC
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/eventfd.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "net_mosq.h"
+#include "packet_mosq.h"
+#include "quic_mosq.h"
+#include "sys_tree.h"
+#include "util_mosq.h"
+
+#include "uthash.h"
+
+/* msquic delivers all connection and stream events on its own worker threads,
+ * whereas the broker does all of its work on the main loop thread. The two
+ * sides meet through the structures below: the msquic callbacks record what
+ * happened under a lock and then wake the main loop by making a notification
+ * descriptor readable. That descriptor is what the mux sees, as the listening
+ * socket for a listener and as context->sock for a client, so epoll/poll,
+ * keepalive handling and the contexts_by_sock hash all work unchanged.
+ *
+ * Received data is parsed directly out of msquic's buffers: the RECEIVE event
+ * returns QUIC_STATUS_PENDING and the buffers stay valid until the main loop
+ * calls StreamReceiveComplete(). The lock is not held while parsing, instead
+ * `reading` makes the msquic callbacks leave the streams and connection for
+ * the main loop to close and free once it has finished.
+ *
+ * A client may open up to MOSQ_QUIC_MAX_LANES bidirectional streams, or
+ * lanes. Lane n is the stream with ID 4*n, lane 0 carries the control
+ * packets and its end is the end of the connection. Each lane keeps its own
+ * partially read packet, and outgoing PUBLISH packets are spread over the
+ * lanes by topic.
+ *
+ * Clients that enable QUIC datagrams may send QoS 0 PUBLISH packets as
+ * datagrams, which are only valid during the callback. They are copied onto
+ * a short queue for the main loop, and dropped if it is full; the sender
+ * expects some to be lost anyway. QoS 0 messages are sent back to such
+ * clients as datagrams where they fit.
+ *
+ * Outgoing packets are handed to msquic whole and sent straight from their
+ * payload. msquic reports that it has finished with one on its own thread,
+ * but packets use the tracked allocator, so they are passed back to be freed
+ * on the main loop thread.
+ *
+ * Bridges connect out over QUIC using the same structures. Such a connection
+ * has no listener and is known to the main loop from the start, and its
+ * lanes are opened by the broker rather than the peer.
+ *
+ * Connections may be freed from an msquic thread, so they are allocated with
+ * plain malloc/free rather than the (not thread safe) tracked allocator. */
+
+struct mosquitto__quic_stream{
+	struct mosquitto__quic_conn *conn;
+	HQUIC handle;
+	HQUIC closing;          /* Shut down while being read, close afterwards. */
+	const QUIC_BUFFER *buffers;
+	uint32_t buffer_count;
+	uint64_t total_length;
+	struct mosquitto__packet in_packet; /* Partial packet, lanes other than 0. */
+	bool receive_pending;   /* buffers are held and not yet completed. */
+	uint8_t lane;
+};
+
+/* Received datagrams kept until the main loop reads them, and an upper limit
+ * on how many. */
+#define QUIC_DATAGRAM_QUEUE_MAX 64
+
+struct mosquitto__quic_datagram{
+	struct mosquitto__quic_datagram *next;
+	uint32_t length;
+	uint8_t data[];
+};
+
+struct mosquitto__quic_conn{
+	HQUIC handle;
+	struct mosquitto__quic_stream streams[MOSQ_QUIC_MAX_LANES];
+	struct mosquitto__quic_listener *qlistener;
+	struct mosquitto__quic_conn *next;
+	pthread_mutex_t lock;
+	mosq_sock_t notify_r;
+	mosq_sock_t notify_w;
+	struct mosquitto__quic_datagram *datagrams;
+	struct mosquitto__quic_datagram *datagrams_last;
+	int datagram_count;
+	char address[INET6_ADDRSTRLEN];
+	uint16_t remote_port;
+	uint16_t datagram_max;  /* Largest datagram the client accepts, or 0. */
+	uint8_t lane_count;     /* One more than the highest lane opened. */
+	bool queued;            /* Handed to the listener accept queue. */
+	bool peer_closed;       /* Peer finished or aborted lane 0. */
+	bool shutdown_complete; /* msquic has finished with the connection. */
+	bool broker_closed;     /* The broker no longer references this. */
+	bool reading;           /* Main loop is parsing received buffers. */
+	bool free_deferred;     /* Free once reading has finished. */
+	bool address_changed;   /* The client migrated, see address. */
+	struct mosquitto__quic_stream rejected; /* Context for refused streams. */
+};
+
+struct mosquitto__quic_listener{
+	HQUIC handle;
+	HQUIC configuration;
+	struct mosquitto__quic_listener *next;
+	pthread_mutex_t lock;
+	struct mosquitto__quic_conn *pending;
+	struct mosquitto__quic_conn *pending_last;
+	mosq_sock_t notify_r;
+	mosq_sock_t notify_w;
+	bool closed;
+};
+
+static HQUIC quic_registration = NULL;
+static struct mosquitto__quic_listener *quic_listeners = NULL;
+
+/* Packets msquic has finished sending, freed by quic__sent_free(). */
+static pthread_mutex_t quic_sent_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mosquitto__packet *quic_sent = NULL;
+
+
+static int quic__notify_open(mosq_sock_t *notify_r, mosq_sock_t *notify_w)
+{
+#ifdef __linux__
+	int fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(fd < 0){
+		return MOSQ_ERR_ERRNO;
+	}
+	*notify_r = fd;
+	*notify_w = fd;
+#else
+	int fds[2];
+
+	if(pipe(fds)){
+		return MOSQ_ERR_ERRNO;
+	}
+	if(fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1
+			|| fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1){
+
+		close(fds[0]);
+		close(fds[1]);
+		return MOSQ_ERR_ERRNO;
+	}
+	*notify_r = fds[0];
+	*notify_w = fds[1];
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void quic__notify_signal(mosq_sock_t notify_w)
+{
+#ifdef __linux__
+	uint64_t one = 1;
+#else
+	uint8_t one = 1;
+#endif
+
+	if(notify_w != INVALID_SOCKET){
+		/* A full pipe or saturated eventfd is already readable. */
+		if(write(notify_w, &one, sizeof(one)) < 0){
+			return;
+		}
+	}
+}
+
+
+static void quic__notify_clear(mosq_sock_t notify_r)
+{
+#ifdef __linux__
+	uint64_t value;
+
+	if(read(notify_r, &value, sizeof(value)) < 0){
+		return;
+	}
+#else
+	uint8_t buf[64];
+
+	while(read(notify_r, buf, sizeof(buf)) > 0){
+	}
+#endif
+}
+
+
+static void quic__notify_close(mosq_sock_t *notify_r, mosq_sock_t *notify_w)
+{
+	if(*notify_w != INVALID_SOCKET && *notify_w != *notify_r){
+		COMPAT_CLOSE(*notify_w);
+	}
+	if(*notify_r != INVALID_SOCKET){
+		COMPAT_CLOSE(*notify_r);
+	}
+	*notify_r = INVALID_SOCKET;
+	*notify_w = INVALID_SOCKET;
+}
+
+
+static void quic__addr_to_string(const QUIC_ADDR *addr, char *buf, size_t len, uint16_t *remote_port)
+{
+	buf[0] = '\0';
+	*remote_port = 0;
+	if(addr == NULL) return;
+
+	if(QuicAddrGetFamily(addr) == QUIC_ADDRESS_FAMILY_INET6){
+		inet_ntop(AF_INET6, &addr->Ipv6.sin6_addr, buf, (socklen_t)len);
+	}else{
+		inet_ntop(AF_INET, &addr->Ipv4.sin_addr, buf, (socklen_t)len);
+	}
+	*remote_port = QuicAddrGetPort(addr);
+}
+
+
+static bool quic__receive_pending(struct mosquitto__quic_conn *conn)
+{
+	int i;
+
+	if(conn->datagrams){
+		return true;
+	}
+	for(i=0; i<conn->lane_count; i++){
+		if(conn->streams[i].receive_pending){
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/* Called with conn->lock held. */
+static void quic__address_update(struct mosquitto *context, struct mosquitto__quic_conn *conn)
+{
+	char *address;
+
+	if(context->address && !strcmp(context->address, conn->address)
+			&& context->remote_port == conn->remote_port){
+		return;
+	}
+	address = mosquitto__strdup(conn->address);
+	if(!address){
+		return;
+	}
+	log__printf(NULL, MOSQ_LOG_NOTICE, "Client %s migrated from %s:%d to %s:%d.",
+			context->id?context->id:"<unknown>",
+			context->address?context->address:"<unknown>", context->remote_port,
+			address, conn->remote_port);
+	mosquitto__free(context->address);
+	context->address = address;
+	context->remote_port = conn->remote_port;
+}
+
+
+/* Called from msquic threads once a packet is no longer needed. */
+static void quic__sent_add(struct mosquitto__packet *packet)
+{
+	pthread_mutex_lock(&quic_sent_lock);
+	packet->next = quic_sent;
+	quic_sent = packet;
+	pthread_mutex_unlock(&quic_sent_lock);
+}
+
+
+static void quic__sent_free(void)
+{
+	struct mosquitto__packet *packet, *next;
+
+	pthread_mutex_lock(&quic_sent_lock);
+	packet = quic_sent;
+	quic_sent = NULL;
+	pthread_mutex_unlock(&quic_sent_lock);
+
+	while(packet){
+		next = packet->next;
+		packet__cleanup(packet);
+		mosquitto__free(packet);
+		packet = next;
+	}
+}
+
+
+static void quic__datagrams_free(struct mosquitto__quic_datagram *datagram)
+{
+	struct mosquitto__quic_datagram *next;
+
+	while(datagram){
+		next = datagram->next;
+		free(datagram);
+		datagram = next;
+	}
+}
+
+
+static void quic__conn_free(struct mosquitto__quic_conn *conn, bool app_close_in_progress)
+{
+	if(!app_close_in_progress){
+		msquic->ConnectionClose(conn->handle);
+	}
+	quic__datagrams_free(conn->datagrams);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+
+/* Drop the broker's interest in a connection. If msquic has already finished
+ * with it, it is freed immediately, otherwise it is shut down and freed when
+ * the SHUTDOWN_COMPLETE event arrives. notify_r is only closed here if it was
+ * never handed to a context; otherwise net__socket_close() owns it. */
+static void quic__conn_release(struct mosquitto__quic_conn *conn, bool close_notify_r)
+{
+	struct mosquitto__quic_stream *qstream;
+	bool free_now;
+	int i;
+
+	pthread_mutex_lock(&conn->lock);
+	conn->broker_closed = true;
+	for(i=0; i<conn->lane_count && !conn->reading; i++){
+		qstream = &conn->streams[i];
+		if(qstream->receive_pending){
+			qstream->receive_pending = false;
+			msquic->StreamReceiveComplete(qstream->handle, qstream->total_length);
+		}
+	}
+	if(close_notify_r){
+		quic__notify_close(&conn->notify_r, &conn->notify_w);
+	}else{
+		if(conn->notify_w != conn->notify_r && conn->notify_w != INVALID_SOCKET){
+			COMPAT_CLOSE(conn->notify_w);
+		}
+		conn->notify_r = INVALID_SOCKET;
+		conn->notify_w = INVALID_SOCKET;
+	}
+	free_now = conn->shutdown_complete;
+	if(!free_now){
+		msquic->ConnectionShutdown(conn->handle, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
+	}else if(conn->reading){
+		/* Called from a packet handler, net__quic_read_packets() frees it. */
+		conn->free_deferred = true;
+		free_now = false;
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	if(free_now){
+		quic__conn_free(conn, false);
+	}
+}
+
+
+static QUIC_STATUS QUIC_API quic__stream_callback(HQUIC stream, void *context, QUIC_STREAM_EVENT *event)
+{
+	struct mosquitto__quic_stream *qstream = context;
+	struct mosquitto__quic_conn *conn = qstream->conn;
+	QUIC_STATUS status = QUIC_STATUS_SUCCESS;
+
+	switch(event->Type){
+		case QUIC_STREAM_EVENT_SEND_COMPLETE:
+			quic__sent_add(event->SEND_COMPLETE.ClientContext);
+			break;
+
+		case QUIC_STREAM_EVENT_RECEIVE:
+			if(event->RECEIVE.TotalBufferLength == 0){
+				break;
+			}
+			pthread_mutex_lock(&conn->lock);
+			if(stream == qstream->handle && !conn->broker_closed){
+				/* Keep hold of msquic's buffers until the main loop has
+				 * parsed them, see net__quic_read_packets(). */
+				qstream->buffers = event->RECEIVE.Buffers;
+				qstream->buffer_count = event->RECEIVE.BufferCount;
+				qstream->total_length = event->RECEIVE.TotalBufferLength;
+				qstream->receive_pending = true;
+				quic__notify_signal(conn->notify_w);
+				status = QUIC_STATUS_PENDING;
+			}
+			pthread_mutex_unlock(&conn->lock);
+			break;
+
+		case QUIC_STREAM_EVENT_PEER_SEND_SHUTDOWN:
+		case QUIC_STREAM_EVENT_PEER_SEND_ABORTED:
+			if(qstream->lane == 0){
+				pthread_mutex_lock(&conn->lock);
+				if(stream == qstream->handle){
+					conn->peer_closed = true;
+					quic__notify_signal(conn->notify_w);
+				}
+				pthread_mutex_unlock(&conn->lock);
+			}
+			break;
+
+		case QUIC_STREAM_EVENT_SHUTDOWN_COMPLETE:
+			pthread_mutex_lock(&conn->lock);
+			if(stream == qstream->handle){
+				qstream->handle = NULL;
+				qstream->receive_pending = false;
+				if(qstream->lane == 0){
+					conn->peer_closed = true;
+				}
+				quic__notify_signal(conn->notify_w);
+				if(conn->reading && !event->SHUTDOWN_COMPLETE.AppCloseInProgress){
+					/* Closing the stream would release the buffers that are
+					 * being parsed. */
+					qstream->closing = stream;
+					stream = NULL;
+				}
+			}
+			pthread_mutex_unlock(&conn->lock);
+			if(stream && !event->SHUTDOWN_COMPLETE.AppCloseInProgress){
+				msquic->StreamClose(stream);
+			}
+			break;
+
+		default:
+			break;
+	}
+	return status;
+}
+
+
+static QUIC_STATUS QUIC_API quic__connection_callback(HQUIC handle, void *context, QUIC_CONNECTION_EVENT *event)
+{
+	struct mosquitto__quic_conn *conn = context;
+	struct mosquitto__quic_listener *qlistener = conn->qlistener;
+	struct mosquitto__quic_datagram *datagram;
+	const QUIC_BUFFER *buffer;
+	HQUIC stream;
+	uint64_t stream_id, lane;
+	uint32_t id_len;
+	bool free_now;
+	int i;
+
+	switch(event->Type){
+		case QUIC_CONNECTION_EVENT_CONNECTED:
+			if(!qlistener){
+				/* A bridge, the main loop has had it from the start and
+				 * msquic now sends the queued CONNECT. */
+				break;
+			}
+			/* Handshake done, hand the connection to the main loop. */
+			pthread_mutex_lock(&qlistener->lock);
+			if(!qlistener->closed){
+				conn->queued = true;
+				if(qlistener->pending_last){
+					qlistener->pending_last->next = conn;
+				}else{
+					qlistener->pending = conn;
+				}
+				qlistener->pending_last = conn;
+				quic__notify_signal(qlistener->notify_w);
+			}
+			pthread_mutex_unlock(&qlistener->lock);
+			if(!conn->queued){
+				msquic->ConnectionShutdown(handle, QUIC_CONNECTION_SHUTDOWN_FLAG_NONE, 0);
+			}else{
+				msquic->ConnectionSendResumptionTicket(handle, QUIC_SEND_RESUMPTION_FLAG_NONE, 0, NULL);
+			}
+			break;
+
+		case QUIC_CONNECTION_EVENT_PEER_STREAM_STARTED:
+			stream = event->PEER_STREAM_STARTED.Stream;
+			id_len = sizeof(stream_id);
+			if(QUIC_FAILED(msquic->GetParam(stream, QUIC_PARAM_STREAM_ID, &id_len, &stream_id))){
+				stream_id = UINT64_MAX;
+			}
+			/* Client initiated bidirectional streams have IDs 0, 4, 8, ... */
+			lane = (stream_id & 0x3) == 0 ? stream_id >> 2 : UINT64_MAX;
+			pthread_mutex_lock(&conn->lock);
+			if(lane < MOSQ_QUIC_MAX_LANES
+					&& conn->streams[lane].handle == NULL
+					&& !conn->peer_closed){
+
+				conn->streams[lane].handle = stream;
+				if(conn->lane_count <= lane){
+					conn->lane_count = (uint8_t)(lane + 1);
+				}
+				msquic->SetCallbackHandler(stream, (void *)quic__stream_callback, &conn->streams[lane]);
+			}else{
+				msquic->SetCallbackHandler(stream, (void *)quic__stream_callback, &conn->rejected);
+				msquic->StreamShutdown(stream, QUIC_STREAM_SHUTDOWN_FLAG_ABORT, 0);
+			}
+			pthread_mutex_unlock(&conn->lock);
+			break;
+
+		case QUIC_CONNECTION_EVENT_PEER_ADDRESS_CHANGED:
+			/* msquic has validated the new path, after the client moved
+			 * to another network or a NAT rebinding. The connection, and
+			 * with it the session, carries on. */
+			if(!qlistener) break;
+			pthread_mutex_lock(&conn->lock);
+			quic__addr_to_string(event->PEER_ADDRESS_CHANGED.Address,
+					conn->address, sizeof(conn->address), &conn->remote_port);
+			if(conn->queued){
+				conn->address_changed = true;
+				quic__notify_signal(conn->notify_w);
+			}
+			pthread_mutex_unlock(&conn->lock);
+			break;
+
+		case QUIC_CONNECTION_EVENT_DATAGRAM_STATE_CHANGED:
+			pthread_mutex_lock(&conn->lock);
+			conn->datagram_max = event->DATAGRAM_STATE_CHANGED.SendEnabled ?
+					event->DATAGRAM_STATE_CHANGED.MaxSendLength : 0;
+			pthread_mutex_unlock(&conn->lock);
+			break;
+
+		case QUIC_CONNECTION_EVENT_DATAGRAM_RECEIVED:
+			buffer = event->DATAGRAM_RECEIVED.Buffer;
+			pthread_mutex_lock(&conn->lock);
+			if(!conn->broker_closed && conn->datagram_count < QUIC_DATAGRAM_QUEUE_MAX){
+				datagram = malloc(sizeof(struct mosquitto__quic_datagram) + buffer->Length);
+				if(datagram){
+					datagram->next = NULL;
+					datagram->length = buffer->Length;
+					memcpy(datagram->data, buffer->Buffer, buffer->Length);
+					if(conn->datagrams_last){
+						conn->datagrams_last->next = datagram;
+					}else{
+						conn->datagrams = datagram;
+					}
+					conn->datagrams_last = datagram;
+					conn->datagram_count++;
+					quic__notify_signal(conn->notify_w);
+				}
+			}
+			pthread_mutex_unlock(&conn->lock);
+			break;
+
+		case QUIC_CONNECTION_EVENT_DATAGRAM_SEND_STATE_CHANGED:
+			if(QUIC_DATAGRAM_SEND_STATE_IS_FINAL(event->DATAGRAM_SEND_STATE_CHANGED.State)){
+				quic__sent_add(event->DATAGRAM_SEND_STATE_CHANGED.ClientContext);
+			}
+			break;
+
+		case QUIC_CONNECTION_EVENT_SHUTDOWN_COMPLETE:
+			pthread_mutex_lock(&conn->lock);
+			conn->shutdown_complete = true;
+			for(i=0; i<MOSQ_QUIC_MAX_LANES; i++){
+				conn->streams[i].receive_pending = false;
+			}
+			/* Until it is queued nobody else knows about the connection. */
+			free_now = conn->broker_closed || !conn->queued;
+			if(!free_now){
+				quic__notify_signal(conn->notify_w);
+			}else if(conn->reading){
+				conn->free_deferred = true;
+				free_now = false;
+			}
+			pthread_mutex_unlock(&conn->lock);
+			if(free_now){
+				quic__conn_free(conn, event->SHUTDOWN_COMPLETE.AppCloseInProgress);
+			}
+			break;
+
+		default:
+			break;
+	}
+	return QUIC_STATUS_SUCCESS;
+}
+
+
+static QUIC_STATUS QUIC_API quic__listener_callback(HQUIC handle, void *context, QUIC_LISTENER_EVENT *event)
+{
+	struct mosquitto__quic_listener *qlistener = context;
+	struct mosquitto__quic_conn *conn;
+	QUIC_STATUS status;
+	int i;
+
+	UNUSED(handle);
+
+	if(event->Type != QUIC_LISTENER_EVENT_NEW_CONNECTION){
+		return QUIC_STATUS_SUCCESS;
+	}
+
+	conn = calloc(1, sizeof(struct mosquitto__quic_conn));
+	if(!conn){
+		return QUIC_STATUS_OUT_OF_MEMORY;
+	}
+	conn->handle = event->NEW_CONNECTION.Connection;
+	conn->qlistener = qlistener;
+	for(i=0; i<MOSQ_QUIC_MAX_LANES; i++){
+		conn->streams[i].conn = conn;
+		conn->streams[i].lane = (uint8_t)i;
+		conn->streams[i].in_packet.remaining_mult = 1;
+	}
+	conn->rejected.conn = conn;
+	conn->rejected.lane = UINT8_MAX;
+	conn->notify_r = INVALID_SOCKET;
+	conn->notify_w = INVALID_SOCKET;
+	pthread_mutex_init(&conn->lock, NULL);
+	quic__addr_to_string(event->NEW_CONNECTION.Info->RemoteAddress,
+			conn->address, sizeof(conn->address), &conn->remote_port);
+
+	status = msquic->ConnectionSetConfiguration(conn->handle, qlistener->configuration);
+	if(QUIC_FAILED(status)){
+		/* Returning a failure makes msquic reject and close the connection. */
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+		return status;
+	}
+	msquic->SetCallbackHandler(conn->handle, (void *)quic__connection_callback, conn);
+
+	return QUIC_STATUS_SUCCESS;
+}
+
+
+static int quic__registration_open(void)
+{
+	QUIC_STATUS status;
+	const QUIC_REGISTRATION_CONFIG regconfig = {
+		"mosquitto",
+		QUIC_EXECUTION_PROFILE_LOW_LATENCY
+	};
+
+	if(quic_registration) return MOSQ_ERR_SUCCESS;
+	if(msquic == NULL) return MOSQ_ERR_QUIC;
+
+	status = msquic->RegistrationOpen(&regconfig, &quic_registration);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC registration, 0x%x.", status);
+		quic_registration = NULL;
+		return MOSQ_ERR_QUIC;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int quic__configuration_open(struct mosquitto__listener *listener, struct mosquitto__quic_listener *qlistener)
+{
+	QUIC_STATUS status;
+	QUIC_SETTINGS settings;
+	QUIC_CREDENTIAL_CONFIG credconfig;
+	QUIC_CERTIFICATE_FILE certfile;
+	const QUIC_BUFFER alpn = { sizeof("mqtt") - 1, (uint8_t *)"mqtt" };
+
+#ifdef WITH_TLS
+	if(listener->certfile == NULL || listener->keyfile == NULL){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: QUIC listener on port %d requires certfile and keyfile.", listener->port);
+		return MOSQ_ERR_INVAL;
+	}
+#else
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: QUIC listener on port %d requires TLS support to load its certificate.", listener->port);
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+
+	memset(&settings, 0, sizeof(settings));
+	/* Idle clients are handled by the MQTT keepalive, as for TCP. */
+	settings.IdleTimeoutMs = 0;
+	settings.IsSet.IdleTimeoutMs = 1;
+	settings.PeerBidiStreamCount = MOSQ_QUIC_MAX_LANES;
+	settings.IsSet.PeerBidiStreamCount = 1;
+	/* Let reconnecting clients resume, and send CONNECT as 0-RTT data. */
+	settings.ServerResumptionLevel = QUIC_SERVER_RESUME_AND_ZERORTT;
+	settings.IsSet.ServerResumptionLevel = 1;
+	/* Accept QoS 0 publishes as datagrams from clients that want that. */
+	settings.DatagramReceiveEnabled = 1;
+	settings.IsSet.DatagramReceiveEnabled = 1;
+
+	status = msquic->ConfigurationOpen(quic_registration, &alpn, 1,
+			&settings, sizeof(settings), NULL, &qlistener->configuration);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC configuration, 0x%x.", status);
+		return MOSQ_ERR_QUIC;
+	}
+
+#ifdef WITH_TLS
+	memset(&credconfig, 0, sizeof(credconfig));
+	memset(&certfile, 0, sizeof(certfile));
+	certfile.CertificateFile = listener->certfile;
+	certfile.PrivateKeyFile = listener->keyfile;
+	credconfig.Type = QUIC_CREDENTIAL_TYPE_CERTIFICATE_FILE;
+	credconfig.Flags = QUIC_CREDENTIAL_FLAG_NONE;
+	credconfig.CertificateFile = &certfile;
+	if(listener->require_certificate){
+		credconfig.Flags |= QUIC_CREDENTIAL_FLAG_REQUIRE_CLIENT_AUTHENTICATION;
+	}
+	if(listener->cafile){
+		credconfig.Flags |= QUIC_CREDENTIAL_FLAG_SET_CA_CERTIFICATE_FILE;
+		credconfig.CaCertificateFile = listener->cafile;
+	}
+
+	status = msquic->ConfigurationLoadCredential(qlistener->configuration, &credconfig);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to load QUIC certificate for listener on port %d, 0x%x.",
+				listener->port, status);
+		return MOSQ_ERR_TLS;
+	}
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void quic__listener_close_handles(struct mosquitto__quic_listener *qlistener)
+{
+	if(qlistener->handle){
+		msquic->ListenerClose(qlistener->handle);
+		qlistener->handle = NULL;
+	}
+	if(qlistener->configuration){
+		msquic->ConfigurationClose(qlistener->configuration);
+		qlistener->configuration = NULL;
+	}
+}
+
+
+static void quic__listener_free(struct mosquitto__quic_listener *qlistener)
+{
+	quic__listener_close_handles(qlistener);
+	quic__notify_close(&qlistener->notify_r, &qlistener->notify_w);
+	pthread_mutex_destroy(&qlistener->lock);
+	mosquitto__free(qlistener);
+}
+
+
+int net__quic_listen(struct mosquitto__listener *listener)
+{
+	struct mosquitto__quic_listener *qlistener;
+	QUIC_STATUS status;
+	QUIC_ADDR address;
+	const QUIC_BUFFER alpn = { sizeof("mqtt") - 1, (uint8_t *)"mqtt" };
+
+	if(quic__registration_open()){
+		return 1;
+	}
+
+	qlistener = mosquitto__calloc(1, sizeof(struct mosquitto__quic_listener));
+	if(!qlistener){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return 1;
+	}
+	pthread_mutex_init(&qlistener->lock, NULL);
+	qlistener->notify_r = INVALID_SOCKET;
+	qlistener->notify_w = INVALID_SOCKET;
+
+	if(quic__notify_open(&qlistener->notify_r, &qlistener->notify_w)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to create QUIC listener notification: %s.", strerror(errno));
+		quic__listener_free(qlistener);
+		return 1;
+	}
+
+	if(quic__configuration_open(listener, qlistener)){
+		quic__listener_free(qlistener);
+		return 1;
+	}
+
+	status = msquic->ListenerOpen(quic_registration, quic__listener_callback, qlistener, &qlistener->handle);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC listener, 0x%x.", status);
+		qlistener->handle = NULL;
+		quic__listener_free(qlistener);
+		return 1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	if(listener->host){
+		if(!QuicAddrFromString(listener->host, listener->port, &address)){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid QUIC listener address \"%s\".", listener->host);
+			quic__listener_free(qlistener);
+			return 1;
+		}
+	}else{
+		QuicAddrSetFamily(&address, QUIC_ADDRESS_FAMILY_UNSPEC);
+		QuicAddrSetPort(&address, listener->port);
+	}
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Opening QUIC listen socket on port %d.", listener->port);
+	status = msquic->ListenerStart(qlistener->handle, &alpn, 1, &address);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to start QUIC listener on port %d, 0x%x.", listener->port, status);
+		quic__listener_free(qlistener);
+		return 1;
+	}
+
+	listener->socks = mosquitto__malloc(sizeof(mosq_sock_t));
+	if(!listener->socks){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		quic__listener_free(qlistener);
+		return 1;
+	}
+	listener->socks[0] = qlistener->notify_r;
+	listener->sock_count = 1;
+	listener->quic = qlistener;
+
+	qlistener->next = quic_listeners;
+	quic_listeners = qlistener;
+
+	return 0;
+}
+
+
+void net__quic_listener_close(struct mosquitto__listener *listener)
+{
+	struct mosquitto__quic_listener *qlistener;
+	struct mosquitto__quic_conn *conn, *next;
+
+	qlistener = listener->quic;
+	if(!qlistener) return;
+
+	/* Blocks until no more listener callbacks can run. */
+	if(qlistener->handle){
+		msquic->ListenerClose(qlistener->handle);
+		qlistener->handle = NULL;
+	}
+
+	pthread_mutex_lock(&qlistener->lock);
+	qlistener->closed = true;
+	conn = qlistener->pending;
+	qlistener->pending = NULL;
+	qlistener->pending_last = NULL;
+	pthread_mutex_unlock(&qlistener->lock);
+
+	while(conn){
+		next = conn->next;
+		quic__conn_release(conn, true);
+		conn = next;
+	}
+
+	/* The notification descriptor is the listensock, closed by the caller.
+	 * The structure itself must outlive any connections that still point at
+	 * it, so it is freed in net__quic_broker_cleanup(). */
+	if(qlistener->notify_w != qlistener->notify_r && qlistener->notify_w != INVALID_SOCKET){
+		COMPAT_CLOSE(qlistener->notify_w);
+	}
+	qlistener->notify_r = INVALID_SOCKET;
+	qlistener->notify_w = INVALID_SOCKET;
+	listener->quic = NULL;
+}
+
+
+struct mosquitto *net__quic_accept(struct mosquitto__listener_sock *listensock)
+{
+	struct mosquitto__quic_listener *qlistener = listensock->listener->quic;
+	struct mosquitto__quic_conn *conn;
+	struct mosquitto *new_context;
+	bool usable;
+
+	if(!qlistener) return NULL;
+
+	while(1){
+		pthread_mutex_lock(&qlistener->lock);
+		conn = qlistener->pending;
+		if(conn){
+			qlistener->pending = conn->next;
+			if(qlistener->pending == NULL){
+				qlistener->pending_last = NULL;
+			}
+			conn->next = NULL;
+		}else{
+			quic__notify_clear(qlistener->notify_r);
+		}
+		pthread_mutex_unlock(&qlistener->lock);
+
+		if(!conn) return NULL;
+
+		pthread_mutex_lock(&conn->lock);
+		usable = !conn->shutdown_complete
+				&& quic__notify_open(&conn->notify_r, &conn->notify_w) == MOSQ_ERR_SUCCESS;
+		if(usable && (quic__receive_pending(conn) || conn->peer_closed)){
+			quic__notify_signal(conn->notify_w);
+		}
+		pthread_mutex_unlock(&conn->lock);
+
+		if(usable) break;
+		quic__conn_release(conn, true);
+	}
+
+	G_SOCKET_CONNECTIONS_INC();
+
+	new_context = context__init(INVALID_SOCKET);
+	if(!new_context){
+		quic__conn_release(conn, true);
+		return NULL;
+	}
+	new_context->sock = conn->notify_r;
+	new_context->transport = mosq_t_quic;
+	new_context->quic = conn;
+	new_context->remote_port = conn->remote_port;
+	new_context->address = mosquitto__strdup(conn->address);
+	if(!new_context->address){
+		context__cleanup(new_context, true);
+		return NULL;
+	}
+	HASH_ADD(hh_sock, db.contexts_by_sock, sock, sizeof(new_context->sock), new_context);
+
+	new_context->listener = listensock->listener;
+	new_context->listener->client_count++;
+
+	if(new_context->listener->max_connections > 0 && new_context->listener->client_count > new_context->listener->max_connections){
+		if(db.config->connection_messages == true){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "Client connection from %s denied: max_connections exceeded.", new_context->address);
+		}
+		context__cleanup(new_context, true);
+		return NULL;
+	}
+
+	if(db.config->connection_messages == true){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "New QUIC connection from %s:%d on port %d.",
+				new_context->address, new_context->remote_port, new_context->listener->port);
+	}
+
+	return new_context;
+}
+
+
+/* Parse all MQTT packets from the data msquic has delivered for this
+ * connection, without copying it out of the receive buffers first. */
+int net__quic_read_packets(struct mosquitto *context)
+{
+	struct mosquitto__quic_conn *conn = context->quic;
+	struct mosquitto__quic_stream *qstream;
+	struct mosquitto__quic_datagram *datagrams, *datagram;
+	bool pending[MOSQ_QUIC_MAX_LANES];
+	HQUIC closing[MOSQ_QUIC_MAX_LANES];
+	uint8_t lane_count;
+	uint8_t lane;
+	uint32_t i;
+	bool free_now;
+	bool eof;
+	bool stop = false;
+	int rc = MOSQ_ERR_SUCCESS;
+
+	if(!conn){
+		return MOSQ_ERR_NO_CONN;
+	}
+	quic__sent_free();
+
+	pthread_mutex_lock(&conn->lock);
+	/* Clearing the notification under the lock means a RECEIVE or shutdown
+	 * racing with us will make it readable again. */
+	quic__notify_clear(conn->notify_r);
+	if(conn->address_changed){
+		conn->address_changed = false;
+		quic__address_update(context, conn);
+	}
+	if(!quic__receive_pending(conn)){
+		eof = conn->peer_closed || conn->shutdown_complete;
+		pthread_mutex_unlock(&conn->lock);
+		return eof?MOSQ_ERR_CONN_LOST:MOSQ_ERR_SUCCESS;
+	}
+	/* Buffers are not touched by msquic while they are pending, and the
+	 * stream callbacks defer closing any stream while reading is set. */
+	lane_count = conn->lane_count;
+	for(lane=0; lane<lane_count; lane++){
+		pending[lane] = conn->streams[lane].receive_pending;
+	}
+	datagrams = conn->datagrams;
+	conn->datagrams = NULL;
+	conn->datagrams_last = NULL;
+	conn->datagram_count = 0;
+	conn->reading = true;
+	pthread_mutex_unlock(&conn->lock);
+
+	for(lane=0; lane<lane_count && !stop; lane++){
+		if(!pending[lane]) continue;
+		qstream = &conn->streams[lane];
+		for(i=0; i<qstream->buffer_count; i++){
+			rc = packet__read_buffer(context, lane == 0 ? NULL : &qstream->in_packet,
+					qstream->buffers[i].Buffer, qstream->buffers[i].Length);
+			if(rc || context->quic != conn){
+				/* Error, or the handler closed the connection. */
+				stop = true;
+				break;
+			}
+		}
+	}
+	/* Datagrams after the streams, so that a CONNECT sent alongside them
+	 * is handled first. */
+	for(datagram=datagrams; datagram && !stop; datagram=datagram->next){
+		rc = packet__read_datagram(context, datagram->data, datagram->length);
+		if(rc || context->quic != conn){
+			stop = true;
+		}
+	}
+	quic__datagrams_free(datagrams);
+
+	pthread_mutex_lock(&conn->lock);
+	conn->reading = false;
+	for(lane=0; lane<lane_count; lane++){
+		qstream = &conn->streams[lane];
+		if(pending[lane] && qstream->receive_pending){
+			/* Everything handed over by the last RECEIVE event has been
+			 * parsed, let msquic reuse the buffers and deliver more. */
+			qstream->receive_pending = false;
+			msquic->StreamReceiveComplete(qstream->handle, qstream->total_length);
+		}
+		closing[lane] = qstream->closing;
+		qstream->closing = NULL;
+	}
+	eof = conn->peer_closed || conn->shutdown_complete;
+	free_now = conn->free_deferred;
+	pthread_mutex_unlock(&conn->lock);
+
+	for(lane=0; lane<lane_count; lane++){
+		if(closing[lane]){
+			msquic->StreamClose(closing[lane]);
+		}
+	}
+	if(free_now){
+		quic__conn_free(conn, false);
+		return rc;
+	}
+	if(rc == MOSQ_ERR_SUCCESS && context->quic == conn && eof){
+		rc = MOSQ_ERR_CONN_LOST;
+	}
+	return rc;
+}
+
+
+uint8_t net__quic_publish_lane(struct mosquitto *context, const char *topic)
+{
+	struct mosquitto__quic_conn *conn = context->quic;
+	uint8_t lane_count;
+
+	if(!conn) return 0;
+
+	pthread_mutex_lock(&conn->lock);
+	lane_count = conn->lane_count;
+	pthread_mutex_unlock(&conn->lock);
+
+	return msquic_topic_lane(topic, lane_count);
+}
+
+
+/* Send a whole packet as a datagram. Returns -1 if the client has not
+ * enabled datagrams or the packet does not fit, and it must go on a stream.
+ * Otherwise msquic owns the packet until DATAGRAM_SEND_STATE_CHANGED reports
+ * a final state. */
+ssize_t net__quic_write_datagram(struct mosquitto *context, struct mosquitto__packet *packet)
+{
+	struct mosquitto__quic_conn *conn = context->quic;
+	QUIC_STATUS status;
+	ssize_t len = -1;
+
+	if(!conn) return -1;
+
+	pthread_mutex_lock(&conn->lock);
+	if(packet->to_process > 0 && packet->to_process <= conn->datagram_max && !conn->shutdown_complete){
+		packet->quic_buffer.Buffer = packet->payload;
+		packet->quic_buffer.Length = packet->to_process;
+		status = msquic->DatagramSend(conn->handle, &packet->quic_buffer, 1, QUIC_SEND_FLAG_NONE, packet);
+		if(QUIC_SUCCEEDED(status)){
+			len = (ssize_t)packet->to_process;
+		}
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	return len;
+}
+
+
+/* Send the rest of a packet on its lane. On success msquic owns the packet
+ * until SEND_COMPLETE, when it is passed to quic__sent_free(). */
+ssize_t net__quic_write_packet(struct mosquitto *context, struct mosquitto__packet *packet)
+{
+	struct mosquitto__quic_conn *conn = context->quic;
+	HQUIC stream = NULL;
+	QUIC_STATUS status;
+	ssize_t len;
+
+	if(!conn){
+		errno = ENOTCONN;
+		return -1;
+	}
+	quic__sent_free();
+
+	pthread_mutex_lock(&conn->lock);
+	if(packet->lane < MOSQ_QUIC_MAX_LANES){
+		stream = conn->streams[packet->lane].handle;
+	}
+	if(stream == NULL){
+		/* The lane has gone, fall back to the control stream. */
+		stream = conn->streams[0].handle;
+	}
+	if(stream == NULL || conn->shutdown_complete){
+		errno = ENOTCONN;
+		len = -1;
+	}else{
+		packet->quic_buffer.Buffer = &packet->payload[packet->pos];
+		packet->quic_buffer.Length = packet->to_process;
+		status = msquic->StreamSend(stream, &packet->quic_buffer, 1, QUIC_SEND_FLAG_NONE, packet);
+		if(QUIC_SUCCEEDED(status)){
+			len = (ssize_t)packet->to_process;
+		}else{
+			errno = ENOMEM;
+			len = -1;
+		}
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	return len;
+}
+
+
+int net__quic_close(struct mosquitto *context)
+{
+	struct mosquitto__quic_conn *conn = context->quic;
+	int i;
+
+	if(!conn) return MOSQ_ERR_SUCCESS;
+
+	context->quic = NULL;
+	quic__sent_free();
+	/* Partial packets use the tracked allocator, so free them here on the
+	 * main thread rather than wherever the connection ends up freed. */
+	for(i=1; i<MOSQ_QUIC_MAX_LANES; i++){
+		packet__cleanup(&conn->streams[i].in_packet);
+	}
+	quic__conn_release(conn, false);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+#ifdef WITH_BRIDGE
+static int quic__bridge_configuration_open(struct mosquitto__bridge *bridge)
+{
+	QUIC_STATUS status;
+	QUIC_SETTINGS settings;
+	QUIC_CREDENTIAL_CONFIG credconfig;
+#ifdef WITH_TLS
+	QUIC_CERTIFICATE_FILE certfile;
+#endif
+	const QUIC_BUFFER alpn = { sizeof("mqtt") - 1, (uint8_t *)"mqtt" };
+
+	memset(&settings, 0, sizeof(settings));
+	/* The bridge keepalive looks after idle links, as for TCP. */
+	settings.IdleTimeoutMs = 0;
+	settings.IsSet.IdleTimeoutMs = 1;
+	settings.DatagramReceiveEnabled = 1;
+	settings.IsSet.DatagramReceiveEnabled = 1;
+
+	status = msquic->ConfigurationOpen(quic_registration, &alpn, 1,
+			&settings, sizeof(settings), NULL, &bridge->quic_configuration);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC configuration for bridge %s, 0x%x.",
+				bridge->name, status);
+		bridge->quic_configuration = NULL;
+		return MOSQ_ERR_QUIC;
+	}
+
+	memset(&credconfig, 0, sizeof(credconfig));
+	credconfig.Type = QUIC_CREDENTIAL_TYPE_NONE;
+	credconfig.Flags = QUIC_CREDENTIAL_FLAG_CLIENT;
+#ifdef WITH_TLS
+	if(bridge->tls_certfile && bridge->tls_keyfile){
+		memset(&certfile, 0, sizeof(certfile));
+		certfile.CertificateFile = bridge->tls_certfile;
+		certfile.PrivateKeyFile = bridge->tls_keyfile;
+		credconfig.Type = QUIC_CREDENTIAL_TYPE_CERTIFICATE_FILE;
+		credconfig.CertificateFile = &certfile;
+	}
+	if(bridge->tls_cafile){
+		credconfig.Flags |= QUIC_CREDENTIAL_FLAG_SET_CA_CERTIFICATE_FILE;
+		credconfig.CaCertificateFile = bridge->tls_cafile;
+	}
+	if(bridge->tls_insecure){
+		credconfig.Flags |= QUIC_CREDENTIAL_FLAG_NO_CERTIFICATE_VALIDATION;
+	}
+#endif
+
+	status = msquic->ConfigurationLoadCredential(bridge->quic_configuration, &credconfig);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to load QUIC credentials for bridge %s, 0x%x.",
+				bridge->name, status);
+		msquic->ConfigurationClose(bridge->quic_configuration);
+		bridge->quic_configuration = NULL;
+		return MOSQ_ERR_TLS;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Start a bridge connection. This does not wait for the handshake: the lanes
+ * are opened straight away and msquic holds anything sent on them until it
+ * completes, so CONNECT can be queued immediately. A failed handshake shows
+ * up in net__quic_read_packets() as a lost connection. */
+int net__quic_bridge_connect(struct mosquitto *context, const char *host, uint16_t port, const char *bind_address)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+	struct mosquitto__quic_conn *conn;
+	struct mosquitto__quic_stream *qstream;
+	QUIC_STATUS status;
+	QUIC_ADDR address;
+	uint8_t i;
+
+#ifdef FINAL_WITH_TLS_PSK
+	if(bridge->tls_psk){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Bridge %s cannot use bridge_psk over QUIC.", bridge->name);
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+#endif
+	if(quic__registration_open()){
+		return MOSQ_ERR_QUIC;
+	}
+	if(!bridge->quic_configuration && quic__bridge_configuration_open(bridge)){
+		return MOSQ_ERR_QUIC;
+	}
+
+	conn = calloc(1, sizeof(struct mosquitto__quic_conn));
+	if(!conn){
+		return MOSQ_ERR_NOMEM;
+	}
+	for(i=0; i<MOSQ_QUIC_MAX_LANES; i++){
+		conn->streams[i].conn = conn;
+		conn->streams[i].lane = i;
+		conn->streams[i].in_packet.remaining_mult = 1;
+	}
+	conn->rejected.conn = conn;
+	conn->rejected.lane = UINT8_MAX;
+	conn->notify_r = INVALID_SOCKET;
+	conn->notify_w = INVALID_SOCKET;
+	/* The main loop owns it from the start, see the CONNECTED event. */
+	conn->queued = true;
+	pthread_mutex_init(&conn->lock, NULL);
+
+	if(quic__notify_open(&conn->notify_r, &conn->notify_w)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to create QUIC notification for bridge %s: %s.",
+				bridge->name, strerror(errno));
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+		return MOSQ_ERR_ERRNO;
+	}
+
+	status = msquic->ConnectionOpen(quic_registration, quic__connection_callback, conn, &conn->handle);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC connection for bridge %s, 0x%x.",
+				bridge->name, status);
+		quic__notify_close(&conn->notify_r, &conn->notify_w);
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+		return MOSQ_ERR_QUIC;
+	}
+
+	if(bind_address){
+		memset(&address, 0, sizeof(address));
+		if(!QuicAddrFromString(bind_address, 0, &address)
+				|| QUIC_FAILED(msquic->SetParam(conn->handle, QUIC_PARAM_CONN_LOCAL_ADDRESS, sizeof(address), &address))){
+
+			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to bind bridge %s to %s.", bridge->name, bind_address);
+		}
+	}
+
+	/* Lanes are started in order, so lane n gets stream ID 4*n and the
+	 * remote broker can tell them apart. */
+	for(i=0; i<bridge->quic_lanes; i++){
+		qstream = &conn->streams[i];
+		status = msquic->StreamOpen(conn->handle, QUIC_STREAM_OPEN_FLAG_NONE,
+				quic__stream_callback, qstream, &qstream->handle);
+		if(QUIC_SUCCEEDED(status)){
+			status = msquic->StreamStart(qstream->handle,
+					i == 0 ? QUIC_STREAM_START_FLAG_NONE : QUIC_STREAM_START_FLAG_IMMEDIATE);
+			if(QUIC_FAILED(status)){
+				msquic->StreamClose(qstream->handle);
+			}
+		}
+		if(QUIC_FAILED(status)){
+			qstream->handle = NULL;
+			if(i == 0){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open QUIC stream for bridge %s, 0x%x.",
+						bridge->name, status);
+				quic__notify_close(&conn->notify_r, &conn->notify_w);
+				quic__conn_free(conn, false);
+				return MOSQ_ERR_QUIC;
+			}
+			break;
+		}
+		conn->lane_count = (uint8_t)(i + 1);
+	}
+
+	strncpy(conn->address, host, sizeof(conn->address)-1);
+	conn->remote_port = port;
+
+	status = msquic->ConnectionStart(conn->handle, bridge->quic_configuration,
+			QUIC_ADDRESS_FAMILY_UNSPEC, host, port);
+	if(QUIC_FAILED(status)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to start QUIC connection for bridge %s, 0x%x.",
+				bridge->name, status);
+		quic__notify_close(&conn->notify_r, &conn->notify_w);
+		quic__conn_free(conn, false);
+		return MOSQ_ERR_QUIC;
+	}
+
+	context->sock = conn->notify_r;
+	context->transport = mosq_t_quic;
+	context->quic = conn;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void net__quic_bridge_cleanup(struct mosquitto__bridge *bridge)
+{
+	if(bridge->quic_configuration){
+		msquic->ConfigurationClose(bridge->quic_configuration);
+		bridge->quic_configuration = NULL;
+	}
+}
+#endif
+
+
+void net__quic_broker_cleanup(void)
+{
+	struct mosquitto__quic_listener *qlistener, *next;
+
+	if(quic_registration){
+		/* Any connection still open is closed from its SHUTDOWN_COMPLETE
+		 * event, and RegistrationClose() waits for all of them. */
+		msquic->RegistrationShutdown(quic_registration, QUIC_CONNECTION_SHUTDOWN_FLAG_SILENT, 0);
+		for(qlistener = quic_listeners; qlistener; qlistener = qlistener->next){
+			quic__listener_close_handles(qlistener);
+		}
+		msquic->RegistrationClose(quic_registration);
+		quic_registration = NULL;
+	}
+	/* Every send has completed by now. */
+	quic__sent_free();
+
+	qlistener = quic_listeners;
+	while(qlistener){
+		next = qlistener->next;
+		quic__listener_free(qlistener);
+		qlistener = next;
+	}
+	quic_listeners = NULL;
+}
+
+#endif
@@ -39,6 +39,9 @@ void print_col(struct mosquitto *client)
 		case mp_websockets:
 			printf("%s", ANSI_MAGENTA);
 			break;
+		case mp_quic:
+			printf("%s", ANSI_BLUE);
+			break;
 		default:
 			break;
 	}
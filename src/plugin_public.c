@@ -93,7 +93,13 @@ int mosquitto_client_protocol(const struct mosquitto *client)
 	if(client && client->wsi){
 		return mp_websockets;
 	}else
-#else
+#endif
+#ifdef WITH_QUIC
+	if(client && client->transport == mosq_t_quic){
+		return mp_quic;
+	}else
+#endif
+#if !defined(WITH_WEBSOCKETS) && !defined(WITH_QUIC)
 	UNUSED(client);
 #endif
 	{
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+
+# Exercise the io_threads handoff between the I/O threads and the main loop:
+# fan out to clients spread over both threads, a subscriber that stops
+# reading until far more than IO_OUT_MAX is waiting for it, a burst of
+# incoming data large enough to pause reading at IO_IN_MAX, and clients that
+# go away while data is still waiting in the handoff buffers.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("io_threads 2\n")
+        f.write("max_queued_messages 0\n")
+        f.write("max_queued_bytes 0\n")
+
+def recv_exact(sock, count):
+    data = b""
+    while len(data) < count:
+        chunk = sock.recv(count - len(data))
+        if len(chunk) == 0:
+            raise mosq_test.TestError("connection closed")
+        data += chunk
+    return data
+
+def read_packet(sock):
+    hdr = recv_exact(sock, 1)
+    rl = 0
+    multiplier = 1
+    while True:
+        byte = recv_exact(sock, 1)
+        hdr += byte
+        rl += (byte[0] & 127)*multiplier
+        multiplier *= 128
+        if byte[0] & 128 == 0:
+            break
+    return hdr + recv_exact(sock, rl)
+
+def expect_publish(sock, topic, payload, proto_ver):
+    packet = read_packet(sock)
+    expected = mosq_test.gen_publish(topic, qos=0, payload=payload, proto_ver=proto_ver)
+    if packet != expected:
+        raise mosq_test.TestError("publish %s mismatch" % (topic))
+
+def connect(client_id, proto_ver, port, rcvbuf=0, clean_session=True, session_present=0):
+    if not clean_session and proto_ver == 5:
+        # Keep the session across the takeover.
+        connect_packet = mosq_test.gen_connect(client_id, clean_session=False, proto_ver=proto_ver, session_expiry=60)
+    else:
+        connect_packet = mosq_test.gen_connect(client_id, clean_session=clean_session, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(flags=session_present, rc=0, proto_ver=proto_ver)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    if rcvbuf:
+        # Set before connecting so the window stays small.
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+    sock.settimeout(30)
+    sock.connect(("localhost", port))
+    mosq_test.do_send_receive(sock, connect_packet, connack_packet, "connack %s" % (client_id))
+    return sock
+
+def subscribe(sock, topic, proto_ver):
+    subscribe_packet = mosq_test.gen_subscribe(1, topic, 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(1, 0, proto_ver=proto_ver)
+    mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+def payload_for(i, size):
+    prefix = "%06d" % (i)
+    return prefix + "x"*(size - len(prefix))
+
+def do_fan_out(port, proto_ver):
+    subs = []
+    for i in range(0, 8):
+        sock = connect("io-fan-%d" % (i), proto_ver, port)
+        subscribe(sock, "io/fan", proto_ver)
+        subs.append(sock)
+
+    pub = connect("io-fan-pub", proto_ver, port)
+    # All publishes go out in one send so they reach the broker in as few
+    # reads as possible.
+    data = b""
+    for i in range(0, 200):
+        data += mosq_test.gen_publish("io/fan", qos=0, payload=payload_for(i, 100), proto_ver=proto_ver)
+    pub.sendall(data)
+
+    for sock in subs:
+        for i in range(0, 200):
+            expect_publish(sock, "io/fan", payload_for(i, 100), proto_ver)
+        sock.close()
+    pub.close()
+
+def do_slow_reader(port, proto_ver):
+    count = 400
+    size = 20000
+
+    slow = connect("io-slow", proto_ver, port, rcvbuf=4096)
+    subscribe(slow, "io/slow", proto_ver)
+    pub = connect("io-slow-pub", proto_ver, port)
+
+    # 8MB for a client that is not reading fills the socket and then
+    # IO_OUT_MAX, so packet__write() sees EAGAIN repeatedly.
+    data = b""
+    for i in range(0, count):
+        data += mosq_test.gen_publish("io/slow", qos=0, payload=payload_for(i, size), proto_ver=proto_ver)
+    pub.sendall(data)
+
+    # The main loop must still serve everyone else.
+    time.sleep(0.5)
+    mosq_test.do_ping(pub)
+
+    for i in range(0, count):
+        expect_publish(slow, "io/slow", payload_for(i, size), proto_ver)
+    mosq_test.do_ping(slow)
+    slow.close()
+    pub.close()
+
+def do_incoming_burst(port, proto_ver):
+    count = 300
+    size = 30000
+
+    sub = connect("io-burst", proto_ver, port)
+    subscribe(sub, "io/burst", proto_ver)
+    pub = connect("io-burst-pub", proto_ver, port)
+
+    # Several times IO_IN_MAX arriving at once, while the main loop is also
+    # writing it all out again, so the I/O thread stops reading from pub and
+    # has to be rearmed.
+    data = b""
+    for i in range(0, count):
+        data += mosq_test.gen_publish("io/burst", qos=0, payload=payload_for(i, size), proto_ver=proto_ver)
+    pub.sendall(data)
+
+    for i in range(0, count):
+        expect_publish(sub, "io/burst", payload_for(i, size), proto_ver)
+    mosq_test.do_ping(pub)
+    sub.close()
+    pub.close()
+
+def do_close_pending(port, proto_ver):
+    size = 20000
+
+    # A stalled subscriber with several MB waiting for it is taken over.
+    slow = connect("io-takeover", proto_ver, port, rcvbuf=4096, clean_session=False)
+    subscribe(slow, "io/takeover", proto_ver)
+    pub = connect("io-takeover-pub", proto_ver, port)
+    data = b""
+    for i in range(0, 300):
+        data += mosq_test.gen_publish("io/takeover", qos=0, payload=payload_for(i, size), proto_ver=proto_ver)
+    pub.sendall(data)
+    time.sleep(0.5)
+
+    new = connect("io-takeover", proto_ver, port, clean_session=False, session_present=1)
+    pub.send(mosq_test.gen_publish("io/takeover", qos=0, payload="marker", proto_ver=proto_ver))
+    # Anything queued before the takeover may or may not follow, but the
+    # stream must stay intact up to the marker.
+    while True:
+        packet = read_packet(new)
+        if packet == mosq_test.gen_publish("io/takeover", qos=0, payload="marker", proto_ver=proto_ver):
+            break
+        if packet[0] & 0xF0 != 0x30:
+            raise mosq_test.TestError("unexpected packet after takeover")
+    slow.close()
+
+    # A subscriber that vanishes with data still queued for it.
+    gone = connect("io-gone", proto_ver, port, rcvbuf=4096)
+    subscribe(gone, "io/gone", proto_ver)
+    data = b""
+    for i in range(0, 300):
+        data += mosq_test.gen_publish("io/gone", qos=0, payload=payload_for(i, size), proto_ver=proto_ver)
+    pub.sendall(data)
+    time.sleep(0.2)
+    gone.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack('ii', 1, 0))
+    gone.close()
+
+    # A publisher that vanishes with data the main loop has not parsed yet.
+    burst = connect("io-burst-gone", proto_ver, port)
+    data = b""
+    for i in range(0, 100):
+        data += mosq_test.gen_publish("io/takeover", qos=0, payload=payload_for(i, size), proto_ver=proto_ver)
+    burst.sendall(data)
+    burst.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack('ii', 1, 0))
+    burst.close()
+
+    mosq_test.do_ping(pub)
+    new.close()
+    pub.close()
+
+    # And the broker still accepts new clients afterwards.
+    sock = connect("io-after", proto_ver, port)
+    mosq_test.do_ping(sock)
+    sock.close()
+
+def do_test(proto_ver):
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    # Far too much traffic for a -v log through a pipe nobody reads until
+    # the end.
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port, nolog=True)
+
+    try:
+        do_fan_out(port, proto_ver)
+        do_slow_reader(port, proto_ver)
+        do_incoming_burst(port, proto_ver)
+        do_close_pending(port, proto_ver)
+        rc = 0
+    except mosq_test.TestError as e:
+        print(e.message)
+    except Exception as e:
+        print(e)
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        if rc:
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
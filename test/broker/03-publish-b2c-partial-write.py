@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+
+# packet__write() gathers many queued packets into one sendmsg(). Check that a
+# subscriber that stops reading, so that the broker hits EAGAIN part way
+# through a gathered write, still receives an intact byte stream once it
+# starts reading again. Payload sizes vary so that partial writes end at
+# arbitrary points within and between packets. QoS 1 packets are written
+# from the shared encoding with their own message id gathered in, so they
+# are split at more points again.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_queued_messages 0\n")
+        f.write("max_queued_bytes 0\n")
+        f.write("max_inflight_messages 0\n")
+
+def payload_for(i):
+    size = 1 + (i*7919) % 3000
+    prefix = "%06d" % (i)
+    return (prefix + "x"*size)[0:size]
+
+def do_test(proto_ver, qos):
+    rc = 1
+    count = 3000
+
+    if proto_ver == 5:
+        # Let every QoS 1 message to the subscriber be in flight at once.
+        props = mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_RECEIVE_MAXIMUM, 65535)
+        connect_packet = mosq_test.gen_connect("partial-write", proto_ver=proto_ver, properties=props)
+        # No receive maximum with max_inflight_messages 0.
+        props = mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_TOPIC_ALIAS_MAXIMUM, 10)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver, properties=props, property_helper=False)
+    else:
+        connect_packet = mosq_test.gen_connect("partial-write", proto_ver=proto_ver)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+    helper_connect_packet = mosq_test.gen_connect("partial-write-helper", proto_ver=proto_ver)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "partial/write", qos, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(1, qos, proto_ver=proto_ver)
+
+    # The broker numbers its messages to the subscriber from 1 as well, so
+    # the subscriber receives exactly what the helper sends.
+    publishes = []
+    pubacks = b""
+    for i in range(0, count):
+        mid = i+1 if qos > 0 else 0
+        publishes.append(mosq_test.gen_publish("partial/write", qos=qos, mid=mid, payload=payload_for(i), proto_ver=proto_ver))
+        if qos > 0:
+            pubacks += mosq_test.gen_puback(mid, proto_ver=proto_ver)
+    expected = b"".join(publishes)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    # Far too much traffic for a -v log through a pipe nobody reads until
+    # the end.
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port, nolog=True)
+
+    try:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        # A small window, set before connecting, so the broker's socket fills
+        # quickly.
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        sock.settimeout(30)
+        sock.connect(("localhost", port))
+        mosq_test.do_send_receive(sock, connect_packet, connack_packet, "connack")
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        helper = mosq_test.do_client_connect(helper_connect_packet, connack_packet, port=port, connack_error="helper connack")
+        # Send in batches so the broker queues several packets per pass.
+        for i in range(0, count, 100):
+            helper.sendall(b"".join(publishes[i:i+100]))
+        if qos > 0:
+            acks = b""
+            while len(acks) < len(pubacks):
+                data = helper.recv(len(pubacks) - len(acks))
+                if len(data) == 0:
+                    raise mosq_test.TestError("helper connection closed")
+                acks += data
+            if acks != pubacks:
+                raise mosq_test.TestError("helper pubacks mismatch")
+        mosq_test.do_ping(helper)
+        time.sleep(0.5)
+
+        # Read in odd sized pieces, pausing now and then so that the broker
+        # keeps running into a full socket.
+        received = bytearray()
+        reads = 0
+        while len(received) < len(expected):
+            data = sock.recv(997)
+            if len(data) == 0:
+                raise mosq_test.TestError("connection closed")
+            received.extend(data)
+            reads += 1
+            if reads % 500 == 0:
+                time.sleep(0.1)
+
+        if received != expected:
+            for i in range(0, len(expected)):
+                if received[i] != expected[i]:
+                    raise mosq_test.TestError("stream differs at byte %d of %d" % (i, len(expected)))
+        mosq_test.do_ping(sock)
+
+        sock.close()
+        helper.close()
+        rc = 0
+    except mosq_test.TestError as e:
+        print(e.message)
+    except Exception as e:
+        print(e)
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        if rc:
+            print("proto_ver=%d qos=%d" % (proto_ver, qos))
+            exit(rc)
+
+
+do_test(proto_ver=4, qos=0)
+do_test(proto_ver=5, qos=0)
+do_test(proto_ver=4, qos=1)
+do_test(proto_ver=5, qos=1)
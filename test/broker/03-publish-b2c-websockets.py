@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+
+# Stored messages are encoded once and shared between TCP subscribers, but
+# websockets subscribers move the payload in place to make room for the
+# libwebsockets header. Check that websockets and TCP subscribers to the same
+# topic, at QoS 0 and 1, all receive intact packets.
+
+from mosq_test_helper import *
+import base64
+
+def write_config(filename, port, ws_port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("\n")
+        f.write("listener %d\n" % (ws_port))
+        f.write("protocol websockets\n")
+        f.write("allow_anonymous true\n")
+
+def recv_exact(sock, count):
+    data = b""
+    while len(data) < count:
+        chunk = sock.recv(count - len(data))
+        if len(chunk) == 0:
+            raise mosq_test.TestError("connection closed")
+        data += chunk
+    return data
+
+def parse_packet(data):
+    # Return (packet, rest) for the first MQTT packet in data, or (None, data)
+    # if it is not complete yet.
+    rl = 0
+    multiplier = 1
+    i = 1
+    while True:
+        if i >= len(data):
+            return (None, data)
+        rl += (data[i] & 127)*multiplier
+        multiplier *= 128
+        i += 1
+        if data[i-1] & 128 == 0:
+            break
+    if len(data) < i + rl:
+        return (None, data)
+    return (data[0:i+rl], data[i+rl:])
+
+class TcpClient:
+    def __init__(self, client_id, port, proto_ver):
+        connect_packet = mosq_test.gen_connect(client_id, proto_ver=proto_ver)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+        self.sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port, connack_error="connack %s" % (client_id))
+        self.buf = b""
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def recv_packet(self):
+        while True:
+            (packet, self.buf) = parse_packet(self.buf)
+            if packet is not None:
+                return packet
+            data = self.sock.recv(4096)
+            if len(data) == 0:
+                raise mosq_test.TestError("connection closed")
+            self.buf += data
+
+    def close(self):
+        self.sock.close()
+
+class WsClient(TcpClient):
+    def __init__(self, client_id, port, proto_ver):
+        self.sock = socket.create_connection(("localhost", port), timeout=10)
+        self.buf = b""
+        self.frames = b""
+        key = base64.b64encode(os.urandom(16)).decode('utf-8')
+        request = "GET /mqtt HTTP/1.1\r\n" \
+            + "Host: localhost:%d\r\n" % (port) \
+            + "Upgrade: websocket\r\n" \
+            + "Connection: Upgrade\r\n" \
+            + "Sec-WebSocket-Key: %s\r\n" % (key) \
+            + "Sec-WebSocket-Protocol: mqtt\r\n" \
+            + "Sec-WebSocket-Version: 13\r\n\r\n"
+        self.sock.sendall(request.encode('utf-8'))
+        response = b""
+        while b"\r\n\r\n" not in response:
+            data = self.sock.recv(1024)
+            if len(data) == 0:
+                raise mosq_test.TestError("websockets handshake closed")
+            response += data
+        (header, self.frames) = response.split(b"\r\n\r\n", 1)
+        if not header.startswith(b"HTTP/1.1 101"):
+            raise mosq_test.TestError("websockets handshake failed")
+
+        connect_packet = mosq_test.gen_connect(client_id, proto_ver=proto_ver)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+        self.send(connect_packet)
+        if self.recv_packet() != connack_packet:
+            raise mosq_test.TestError("connack %s" % (client_id))
+
+    def send(self, data):
+        # Client frames must be masked.
+        mask = os.urandom(4)
+        if len(data) < 126:
+            header = struct.pack("!BB", 0x82, 0x80 | len(data))
+        elif len(data) < 65536:
+            header = struct.pack("!BBH", 0x82, 0x80 | 126, len(data))
+        else:
+            header = struct.pack("!BBQ", 0x82, 0x80 | 127, len(data))
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(data))
+        self.sock.sendall(header + mask + masked)
+
+    def read_frame(self):
+        while len(self.frames) < 2:
+            self.frames += recv_exact(self.sock, 1)
+        opcode = self.frames[0] & 0x0F
+        length = self.frames[1] & 0x7F
+        if self.frames[1] & 0x80:
+            raise mosq_test.TestError("masked frame from server")
+        hdr = 2
+        if length == 126:
+            hdr = 4
+        elif length == 127:
+            hdr = 10
+        if len(self.frames) < hdr:
+            self.frames += recv_exact(self.sock, hdr - len(self.frames))
+        if length == 126:
+            length = struct.unpack("!H", self.frames[2:4])[0]
+        elif length == 127:
+            length = struct.unpack("!Q", self.frames[2:10])[0]
+        if len(self.frames) < hdr + length:
+            self.frames += recv_exact(self.sock, hdr + length - len(self.frames))
+        payload = self.frames[hdr:hdr+length]
+        self.frames = self.frames[hdr+length:]
+        if opcode == 0x8:
+            raise mosq_test.TestError("websockets close")
+        if opcode in (0x0, 0x2):
+            return payload
+        # Ignore pings and anything else that is not data.
+        return b""
+
+    def recv_packet(self):
+        while True:
+            (packet, self.buf) = parse_packet(self.buf)
+            if packet is not None:
+                return packet
+            self.buf += self.read_frame()
+
+def subscribe(client, topic, qos, proto_ver):
+    subscribe_packet = mosq_test.gen_subscribe(1, topic, qos, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(1, qos, proto_ver=proto_ver)
+    client.send(subscribe_packet)
+    if client.recv_packet() != suback_packet:
+        raise mosq_test.TestError("suback")
+
+def payload_for(i):
+    size = 1 + (i*7919) % 5000
+    prefix = "%06d" % (i)
+    return (prefix + "x"*size)[0:size]
+
+def do_test(proto_ver):
+    rc = 1
+    count = 50
+
+    (port, ws_port) = mosq_test.get_port(2)
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, ws_port)
+    # Too much traffic for a -v log through a pipe nobody reads until the
+    # end.
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port, nolog=True)
+
+    try:
+        # Websockets subscribers either side of the TCP ones, and two of each
+        # kind, so a websockets client that changed a shared buffer would
+        # corrupt what every later subscriber receives.
+        subs = {0: [], 1: []}
+        for qos in (0, 1):
+            for name in ("ws-a", "tcp-a", "ws-b", "tcp-b"):
+                client_id = "b2c-websockets-%s-%d" % (name, qos)
+                if name.startswith("ws"):
+                    client = WsClient(client_id, ws_port, proto_ver)
+                else:
+                    client = TcpClient(client_id, port, proto_ver)
+                subscribe(client, "b2c/websockets", qos, proto_ver)
+                subs[qos].append(client)
+
+        pub = TcpClient("b2c-websockets-pub", port, proto_ver)
+        for i in range(0, count):
+            publish_packet = mosq_test.gen_publish("b2c/websockets", qos=1, mid=i+1, payload=payload_for(i), proto_ver=proto_ver)
+            pub.send(publish_packet)
+            if pub.recv_packet() != mosq_test.gen_puback(i+1, proto_ver=proto_ver):
+                raise mosq_test.TestError("puback %d" % (i+1))
+
+        for client in subs[0]:
+            for i in range(0, count):
+                expected = mosq_test.gen_publish("b2c/websockets", qos=0, payload=payload_for(i), proto_ver=proto_ver)
+                if client.recv_packet() != expected:
+                    raise mosq_test.TestError("QoS 0 publish %d mismatch" % (i))
+
+        for client in subs[1]:
+            for i in range(0, count):
+                expected = mosq_test.gen_publish("b2c/websockets", qos=1, mid=i+1, payload=payload_for(i), proto_ver=proto_ver)
+                if client.recv_packet() != expected:
+                    raise mosq_test.TestError("QoS 1 publish %d mismatch" % (i))
+                client.send(mosq_test.gen_puback(i+1, proto_ver=proto_ver))
+
+        for qos in (0, 1):
+            for client in subs[qos]:
+                client.send(mosq_test.gen_pingreq())
+                if client.recv_packet() != mosq_test.gen_pingresp():
+                    raise mosq_test.TestError("pingresp")
+                client.close()
+        pub.close()
+        rc = 0
+    except mosq_test.TestError as e:
+        print(e.message)
+    except Exception as e:
+        print(e)
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        if rc:
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+
+# packet__read() takes up to 4096 bytes per read and frames every packet in
+# them, carrying a partial packet over to the next read. Check that packets
+# are framed correctly however they are split across reads:
+# - many small packets arriving in one segment
+# - a remaining length varint split between two reads
+# - payloads either side of the 4096 byte direct read threshold, starting at
+#   the beginning of a read or part way through one
+# - an oversize or malformed packet after valid ones in the same buffer
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_packet_size 200000\n")
+
+def recv_exact(sock, count):
+    data = b""
+    while len(data) < count:
+        chunk = sock.recv(count - len(data))
+        if len(chunk) == 0:
+            raise mosq_test.TestError("connection closed")
+        data += chunk
+    return data
+
+def read_packet(sock):
+    hdr = recv_exact(sock, 1)
+    rl = 0
+    multiplier = 1
+    while True:
+        byte = recv_exact(sock, 1)
+        hdr += byte
+        rl += (byte[0] & 127)*multiplier
+        multiplier *= 128
+        if byte[0] & 128 == 0:
+            break
+    return hdr + recv_exact(sock, rl)
+
+def expect(sock, packet, name):
+    if read_packet(sock) != packet:
+        raise mosq_test.TestError("%s mismatch" % (name))
+
+def expect_closed(sock, proto_ver):
+    try:
+        data = sock.recv(100)
+        if proto_ver == 5 and len(data) > 0 and data[0] == 0xE0:
+            # A v5 client may be sent a DISCONNECT with the reason first.
+            data = sock.recv(100)
+        if len(data) != 0:
+            raise mosq_test.TestError("connection not closed")
+    except ConnectionResetError:
+        pass
+
+def connect(client_id, proto_ver, port):
+    connect_packet = mosq_test.gen_connect(client_id, proto_ver=proto_ver)
+    if proto_ver == 5:
+        props = mqtt5_props.gen_uint32_prop(mqtt5_props.PROP_MAXIMUM_PACKET_SIZE, 200000)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver, properties=props)
+    else:
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port, connack_error="connack %s" % (client_id))
+    # Each send() should leave as one segment, whatever its size.
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return sock
+
+def subscribe(sock, proto_ver):
+    subscribe_packet = mosq_test.gen_subscribe(1, "framing/#", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(1, 1, proto_ver=proto_ver)
+    mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+def payload_for(i, size):
+    prefix = "%06d" % (i)
+    return (prefix + "x"*size)[0:size]
+
+def do_small_packets(sub, pub, proto_ver):
+    publishes = []
+    data = b""
+    for i in range(0, 100):
+        packet = mosq_test.gen_publish("framing/small", qos=0, payload=payload_for(i, 10), proto_ver=proto_ver)
+        publishes.append(packet)
+        data += packet
+    for i in range(0, 20):
+        packet = mosq_test.gen_publish("framing/small", qos=1, mid=i+1, payload=payload_for(i, 10), proto_ver=proto_ver)
+        data += packet
+    data += mosq_test.gen_pingreq()
+    pub.send(data)
+
+    for i in range(0, 20):
+        expect(pub, mosq_test.gen_puback(i+1, proto_ver=proto_ver), "puback %d" % (i+1))
+    expect(pub, mosq_test.gen_pingresp(), "pingresp")
+    for packet in publishes:
+        expect(sub, packet, "small publish")
+    for i in range(0, 20):
+        packet = read_packet(sub)
+        mid = struct.unpack("!H", packet[2+2+len("framing/small"):2+2+len("framing/small")+2])[0]
+        sub.send(mosq_test.gen_puback(mid, proto_ver=proto_ver))
+
+def do_split(sub, pub, proto_ver, size, splits):
+    packet = mosq_test.gen_publish("framing/split", qos=0, payload=payload_for(size, size), proto_ver=proto_ver)
+    prev = 0
+    for split in splits + [len(packet)]:
+        pub.send(packet[prev:split])
+        prev = split
+        # Make sure the broker sees each piece in a read of its own.
+        time.sleep(0.05)
+    expect(sub, packet, "split publish %d %s" % (size, str(splits)))
+
+def do_split_varint(sub, pub, proto_ver):
+    # Two byte remaining length, split after the command byte and after the
+    # first length byte.
+    do_split(sub, pub, proto_ver, 300, [1])
+    do_split(sub, pub, proto_ver, 300, [2])
+    # Three byte remaining length, split between each length byte.
+    do_split(sub, pub, proto_ver, 20000, [2, 3])
+    # A split varint behind a complete packet in the same read.
+    small = mosq_test.gen_publish("framing/split", qos=0, payload="small", proto_ver=proto_ver)
+    packet = mosq_test.gen_publish("framing/split", qos=0, payload=payload_for(0, 20000), proto_ver=proto_ver)
+    pub.send(small + packet[0:2])
+    time.sleep(0.05)
+    pub.send(packet[2:])
+    expect(sub, small, "small before split")
+    expect(sub, packet, "split after small")
+
+def do_threshold(sub, pub, proto_ver):
+    small = mosq_test.gen_publish("framing/threshold", qos=0, payload="small", proto_ver=proto_ver)
+    for size in [4000, 4080, 4090, 4096, 4100, 8191, 8192, 8200, 12288, 100000]:
+        packet = mosq_test.gen_publish("framing/threshold", qos=0, payload=payload_for(size, size), proto_ver=proto_ver)
+        # At the start of a read.
+        pub.send(packet)
+        expect(sub, packet, "threshold %d" % (size))
+        # Part way through a read, with another packet after it.
+        pub.send(small + packet + small)
+        expect(sub, small, "threshold %d before" % (size))
+        expect(sub, packet, "threshold %d middle" % (size))
+        expect(sub, small, "threshold %d after" % (size))
+        # Cut off right at the end of the first read.
+        pub.send(small*100 + packet)
+        for i in range(0, 100):
+            expect(sub, small, "threshold %d lead" % (size))
+        expect(sub, packet, "threshold %d cut" % (size))
+
+def do_bad_after_valid(port, proto_ver):
+    sub = connect("framing-bad-sub", proto_ver, port)
+    subscribe(sub, proto_ver)
+
+    valid = []
+    for i in range(0, 3):
+        valid.append(mosq_test.gen_publish("framing/bad", qos=0, payload=payload_for(i, 10), proto_ver=proto_ver))
+
+    # Oversize: only the header is needed to reject it.
+    pub = connect("framing-oversize", proto_ver, port)
+    oversize = mosq_test.gen_publish("framing/bad", qos=0, payload=payload_for(0, 300000), proto_ver=proto_ver)
+    pub.send(b"".join(valid) + oversize[0:1000])
+    for packet in valid:
+        expect(sub, packet, "valid before oversize")
+    if proto_ver == 5:
+        expect(pub, mosq_test.gen_disconnect(reason_code=mqtt5_rc.MQTT_RC_PACKET_TOO_LARGE, proto_ver=5), "disconnect")
+    expect_closed(pub, proto_ver)
+    pub.close()
+
+    # Malformed: a remaining length longer than four bytes.
+    pub = connect("framing-malformed", proto_ver, port)
+    pub.send(b"".join(valid) + b"\x30\xff\xff\xff\xff\x7f" + valid[0])
+    for packet in valid:
+        expect(sub, packet, "valid before malformed")
+    expect_closed(pub, proto_ver)
+    pub.close()
+
+    # Malformed: a wildcard in a PUBLISH topic, with a valid packet after it
+    # that must not be handled.
+    pub = connect("framing-wildcard", proto_ver, port)
+    bad = mosq_test.gen_publish("framing/+", qos=0, payload="bad", proto_ver=proto_ver)
+    pub.send(b"".join(valid) + bad + valid[0])
+    for packet in valid:
+        expect(sub, packet, "valid before wildcard")
+    expect_closed(pub, proto_ver)
+    pub.close()
+
+    # Nothing else reached the subscriber.
+    mosq_test.do_ping(sub)
+    sub.close()
+
+def do_test(proto_ver):
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port, nolog=True)
+
+    try:
+        sub = connect("framing-sub", proto_ver, port)
+        subscribe(sub, proto_ver)
+        pub = connect("framing-pub", proto_ver, port)
+
+        do_small_packets(sub, pub, proto_ver)
+        do_split_varint(sub, pub, proto_ver)
+        do_threshold(sub, pub, proto_ver)
+        mosq_test.do_ping(pub)
+        mosq_test.do_ping(sub)
+        sub.close()
+        pub.close()
+
+        do_bad_after_valid(port, proto_ver)
+        rc = 0
+    except mosq_test.TestError as e:
+        print(e.message)
+    except Exception as e:
+        print(e)
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        if rc:
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
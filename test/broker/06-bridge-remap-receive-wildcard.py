@@ -75,7 +75,11 @@ def do_test(proto_ver):
             bridge.send(bytes.fromhex("320c00062b2b2b2b2b2b00040033"))
             #bridge.send(bytes.fromhex("320c00062b2b2b2b2b2b00040033"))
             #bridge.send(bytes.fromhex("320c00062b2b2b2b2b2b00040033"))
-            mosq_test.do_ping(bridge)
+            bridge.send(mosq_test.gen_pingreq())
+            if len(bridge.recv(10)) == 0:
+                # The bridge read the PINGREQ in the same read as the bad
+                # PUBLISH, so it closed with nothing unread and no reset.
+                rc = 0
         except ConnectionResetError:
             #expected behaviour
             rc = 0
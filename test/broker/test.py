@@ -21,6 +21,7 @@ tests = [
 
     (1, './02-shared-qos0-v5.py'),
     (1, './02-subhier-crash.py'),
+    (1, './02-subpub-io-threads.py'),
     (1, './02-subpub-qos0-long-topic.py'),
     (1, './02-subpub-qos0-oversize-payload.py'),
     (1, './02-subpub-qos0-queued-bytes.py'),
@@ -51,9 +52,12 @@ tests = [
     (1, './03-pattern-matching.py'),
     (1, './03-publish-b2c-disconnect-qos1.py'),
     (1, './03-publish-b2c-disconnect-qos2.py'),
+    (1, './03-publish-b2c-partial-write.py'),
     (1, './03-publish-b2c-qos1-len.py'),
     (1, './03-publish-b2c-qos2-len.py'),
+    (2, './03-publish-b2c-websockets.py'),
     (1, './03-publish-c2b-disconnect-qos2.py'),
+    (1, './03-publish-c2b-framing.py'),
     (1, './03-publish-c2b-qos2-len.py'),
     (1, './03-publish-dollar-v5.py'),
     (1, './03-publish-dollar.py'),
@@ -6,6 +6,7 @@
 #include <memory_mosq.h>
 #include <mosquitto_broker_internal.h>
 #include <net_mosq.h>
+#include <packet_mosq.h>
 #include <send_mosq.h>
 #include <time_mosq.h>
 
@@ -41,6 +42,20 @@ int net__socket_close(struct mosquitto *mosq)
 	return MOSQ_ERR_SUCCESS;
 }
 
+int net__transport_close(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+bool net__transport_is_open(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+
+	return true;
+}
+
 int send__pingreq(struct mosquitto *mosq)
 {
 	UNUSED(mosq);
@@ -86,6 +101,25 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 	return MOSQ_ERR_SUCCESS;
 }
 
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(stored);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(dup);
+	UNUSED(cmsg_props);
+	UNUSED(expiry_interval);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+void packet__shared_release(struct mosquitto__shared_packet *shared)
+{
+	UNUSED(shared);
+}
+
 int send__pubcomp(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties)
 {
 	UNUSED(mosq);
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#define WITH_BROKER
+
+#include <logging_mosq.h>
+#include <memory_mosq.h>
+#include <mosquitto_broker_internal.h>
+#include <net_mosq.h>
+#include <packet_mosq.h>
+#include <send_mosq.h>
+#include <time_mosq.h>
+#include <util_mosq.h>
+
+/* Everything "sent" by net__write()/net__writev() ends up here, unless
+ * wire_blocked is set, in which case they fail with EAGAIN as a full socket
+ * would. If wire_max is set, writes are cut short there. */
+uint8_t wire[10000];
+size_t wire_len = 0;
+size_t wire_max = 0;
+bool wire_blocked = false;
+
+int log__printf(struct mosquitto *mosq, unsigned int priority, const char *fmt, ...)
+{
+	UNUSED(mosq);
+	UNUSED(priority);
+	UNUSED(fmt);
+
+	return 0;
+}
+
+time_t mosquitto_time(void)
+{
+	return 123;
+}
+
+enum mosquitto_client_state mosquitto__get_state(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+
+	return mosq_cs_active;
+}
+
+ssize_t net__read(struct mosquitto *mosq, void *buf, size_t count)
+{
+	UNUSED(mosq);
+	UNUSED(buf);
+	UNUSED(count);
+
+	errno = EAGAIN;
+	return -1;
+}
+
+ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
+{
+	size_t space = sizeof(wire) - wire_len;
+
+	UNUSED(mosq);
+
+	if(wire_max && wire_max - wire_len < space){
+		space = wire_max - wire_len;
+	}
+	if(wire_blocked || space == 0){
+		errno = EAGAIN;
+		return -1;
+	}
+	if(count > space){
+		count = space;
+	}
+	memcpy(&wire[wire_len], buf, count);
+	wire_len += count;
+	return (ssize_t)count;
+}
+
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0, rc;
+	int i;
+
+	for(i=0; i<iovcnt; i++){
+		rc = net__write(mosq, iov[i].iov_base, iov[i].iov_len);
+		if(rc < 0){
+			return total > 0 ? total : -1;
+		}
+		total += rc;
+		if((size_t)rc < iov[i].iov_len){
+			break;
+		}
+	}
+	return total;
+}
+
+int mux__add_out(struct mosquitto *context)
+{
+	UNUSED(context);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int mux__remove_out(struct mosquitto *context)
+{
+	UNUSED(context);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int keepalive__update(struct mosquitto *context)
+{
+	UNUSED(context);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int handle__packet(struct mosquitto *context)
+{
+	UNUSED(context);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__disconnect(struct mosquitto *mosq, uint8_t reason_code, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(reason_code);
+	UNUSED(properties);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pubrec(struct mosquitto *mosq, uint16_t mid, uint8_t reason_code, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(reason_code);
+	UNUSED(properties);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pubrel(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(properties);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_pub_topic_check(const char *str)
+{
+	UNUSED(str);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int persist__restore(void)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+int retain__init(void)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+void retain__clean(struct mosquitto__retainhier **retainhier)
+{
+	UNUSED(retainhier);
+}
+
+struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent, struct mosquitto__subhier **sibling, const char *topic, uint16_t len)
+{
+	UNUSED(parent);
+	UNUSED(sibling);
+	UNUSED(topic);
+	UNUSED(len);
+
+	return NULL;
+}
+
+int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store **stored)
+{
+	UNUSED(source_id);
+	UNUSED(topic);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(stored);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+void util__decrement_receive_quota(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+}
+
+void util__decrement_send_quota(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+}
+
+void util__increment_receive_quota(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+}
+
+void util__increment_send_quota(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+}
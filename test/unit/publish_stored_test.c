@@ -0,0 +1,458 @@
+/* Tests for send__publish_stored() and the encoded PUBLISH packets it keeps
+ * on each stored message. */
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#define WITH_BROKER
+#define WITH_PERSISTENCE
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mqtt_protocol.h"
+#include "packet_mosq.h"
+#include "send_mosq.h"
+
+struct mosquitto_db db;
+static struct mosquitto__config config;
+
+/* See publish_stored_stubs.c */
+extern uint8_t wire[];
+extern size_t wire_len;
+extern size_t wire_max;
+extern bool wire_blocked;
+
+#define TOPIC "stored/topic"
+#define PAYLOAD "payload"
+
+static void client_init(struct mosquitto *context, int protocol)
+{
+	memset(context, 0, sizeof(struct mosquitto));
+	/* Never used, net__write() is stubbed. */
+	context->sock = 1;
+	context->transport = mosq_t_tcp;
+	context->protocol = protocol;
+	context->retain_available = true;
+}
+
+static struct mosquitto_msg_store *store_new(bool retain)
+{
+	struct mosquitto_msg_store *stored;
+
+	memset(&db, 0, sizeof(struct mosquitto_db));
+	memset(&config, 0, sizeof(struct mosquitto__config));
+	db.config = &config;
+	wire_len = 0;
+	wire_max = 0;
+	wire_blocked = false;
+
+	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	if(!stored) return NULL;
+	stored->topic = mosquitto__strdup(TOPIC);
+	stored->payload = mosquitto__strdup(PAYLOAD);
+	stored->payloadlen = (uint32_t)strlen(PAYLOAD);
+	stored->retain = retain;
+	db__msg_store_add(stored);
+	db.msg_store_count++;
+	db.msg_store_bytes += stored->payloadlen;
+	stored->ref_count = 1;
+	return stored;
+}
+
+/* Build the PUBLISH a client should receive, independently of the code under
+ * test. Everything here is short enough for a one byte remaining length. */
+static size_t expected_publish(uint8_t *buf, uint8_t qos, bool retain, bool dup, uint16_t mid, bool mqtt5, uint32_t expiry_interval)
+{
+	size_t len = 0;
+	size_t topic_len = strlen(TOPIC);
+
+	buf[len++] = (uint8_t)(CMD_PUBLISH | (dup<<3) | (qos<<1) | retain);
+	buf[len++] = 0; /* Remaining length, filled in below */
+	buf[len++] = 0;
+	buf[len++] = (uint8_t)topic_len;
+	memcpy(&buf[len], TOPIC, topic_len);
+	len += topic_len;
+	if(qos > 0){
+		buf[len++] = MOSQ_MSB(mid);
+		buf[len++] = MOSQ_LSB(mid);
+	}
+	if(mqtt5){
+		if(expiry_interval > 0){
+			buf[len++] = 5;
+			buf[len++] = MQTT_PROP_MESSAGE_EXPIRY_INTERVAL;
+			buf[len++] = (uint8_t)((expiry_interval>>24) & 0xFF);
+			buf[len++] = (uint8_t)((expiry_interval>>16) & 0xFF);
+			buf[len++] = (uint8_t)((expiry_interval>>8) & 0xFF);
+			buf[len++] = (uint8_t)(expiry_interval & 0xFF);
+		}else{
+			buf[len++] = 0;
+		}
+	}
+	memcpy(&buf[len], PAYLOAD, strlen(PAYLOAD));
+	len += strlen(PAYLOAD);
+	buf[1] = (uint8_t)(len - 2);
+	return len;
+}
+
+/* Send what is queued for context and check it is exactly one PUBLISH with
+ * the given properties. */
+static void check_wire(struct mosquitto *context, uint8_t qos, bool retain, bool dup, uint16_t mid, uint32_t expiry_interval)
+{
+	uint8_t expected[100];
+	size_t expected_len;
+	int rc;
+
+	expected_len = expected_publish(expected, qos, retain, dup, mid, context->protocol == mosq_p_mqtt5, expiry_interval);
+
+	wire_len = 0;
+	wire_blocked = false;
+	rc = packet__write(context);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	CU_ASSERT_PTR_NULL(context->current_out_packet);
+	CU_ASSERT_EQUAL(wire_len, expected_len);
+	if(wire_len == expected_len){
+		CU_ASSERT_EQUAL(memcmp(wire, expected, expected_len), 0);
+	}
+}
+
+static int shared_count(struct mosquitto_msg_store *stored)
+{
+	struct mosquitto__shared_packet *shared;
+	int count = 0;
+
+	for(shared = stored->shared_packets; shared; shared = shared->next){
+		count++;
+	}
+	return count;
+}
+
+
+/* QoS 0 clients on the same protocol share one encoded packet. */
+static void TEST_qos0_shared(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context1, context2;
+	int rc;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context1, mosq_p_mqtt311);
+	client_init(&context2, mosq_p_mqtt311);
+
+	/* Keep the packets queued so they can be inspected. */
+	wire_blocked = true;
+	rc = send__publish_stored(&context1, 0, stored, 0, false, false, NULL, 0);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	rc = send__publish_stored(&context2, 0, stored, 0, false, false, NULL, 0);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+
+	CU_ASSERT_EQUAL(shared_count(stored), 1);
+	CU_ASSERT_PTR_NOT_NULL(context1.current_out_packet);
+	CU_ASSERT_PTR_NOT_NULL(context2.current_out_packet);
+	if(stored->shared_packets && context1.current_out_packet && context2.current_out_packet){
+		CU_ASSERT_PTR_EQUAL(context1.current_out_packet->payload, stored->shared_packets->payload);
+		CU_ASSERT_PTR_EQUAL(context2.current_out_packet->payload, stored->shared_packets->payload);
+		CU_ASSERT_EQUAL(stored->shared_packets->ref_count, 3);
+	}
+
+	check_wire(&context1, 0, false, false, 0, 0);
+	check_wire(&context2, 0, false, false, 0, 0);
+	if(stored->shared_packets){
+		CU_ASSERT_EQUAL(stored->shared_packets->ref_count, 1);
+	}
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+	CU_ASSERT_EQUAL(db.msg_store_count, 0);
+}
+
+
+/* QoS 0, 1 and 2 clients each get their own encoding. QoS 1 and 2 clients
+ * share it too, with their own message id written in its place. */
+static void TEST_qos_levels(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context0, context1a, context1b, context2;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context0, mosq_p_mqtt311);
+	client_init(&context1a, mosq_p_mqtt311);
+	client_init(&context1b, mosq_p_mqtt311);
+	client_init(&context2, mosq_p_mqtt311);
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context0, 0, stored, 0, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context1a, 1, stored, 1, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context1b, 0x1234, stored, 1, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context2, 0xFFFF, stored, 2, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+
+	CU_ASSERT_EQUAL(shared_count(stored), 3);
+	if(context1a.current_out_packet && context1b.current_out_packet){
+		CU_ASSERT_PTR_NOT_NULL(context1a.current_out_packet->shared);
+		CU_ASSERT_PTR_EQUAL(context1a.current_out_packet->shared, context1b.current_out_packet->shared);
+		CU_ASSERT_PTR_EQUAL(context1a.current_out_packet->payload, context1b.current_out_packet->payload);
+		if(context1a.current_out_packet->shared){
+			CU_ASSERT_EQUAL(context1a.current_out_packet->shared->ref_count, 3);
+		}
+	}
+
+	check_wire(&context0, 0, false, false, 0, 0);
+	check_wire(&context1a, 1, false, false, 1, 0);
+	check_wire(&context1b, 1, false, false, 0x1234, 0);
+	check_wire(&context2, 2, false, false, 0xFFFF, 0);
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+}
+
+
+/* MQTT v3.1 and v3.1.1 PUBLISH packets are identical, v5 ones are not. */
+static void TEST_protocol_versions(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context31, context311, context5;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context31, mosq_p_mqtt31);
+	client_init(&context311, mosq_p_mqtt311);
+	client_init(&context5, mosq_p_mqtt5);
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context31, 0, stored, 0, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context311, 0, stored, 0, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context5, 0, stored, 0, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+
+	CU_ASSERT_EQUAL(shared_count(stored), 2);
+	if(context31.current_out_packet && context311.current_out_packet && context5.current_out_packet){
+		CU_ASSERT_PTR_EQUAL(context31.current_out_packet->payload, context311.current_out_packet->payload);
+		CU_ASSERT_PTR_NOT_EQUAL(context31.current_out_packet->payload, context5.current_out_packet->payload);
+	}
+
+	check_wire(&context31, 0, false, false, 0, 0);
+	check_wire(&context311, 0, false, false, 0, 0);
+	check_wire(&context5, 0, false, false, 0, 0);
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+}
+
+
+/* The remaining expiry interval is part of a v5 encoding, so a new value
+ * replaces the cached packet, without disturbing clients still sending the
+ * old one. v3 clients don't see the interval at all. */
+static void TEST_expiry_interval(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context5a, context5b, context5c, context3a, context3b;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context5a, mosq_p_mqtt5);
+	client_init(&context5b, mosq_p_mqtt5);
+	client_init(&context5c, mosq_p_mqtt5);
+	client_init(&context3a, mosq_p_mqtt311);
+	client_init(&context3b, mosq_p_mqtt311);
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context5a, 0, stored, 0, false, false, NULL, 100), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context5b, 0, stored, 0, false, false, NULL, 90), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(shared_count(stored), 1);
+	if(stored->shared_packets){
+		CU_ASSERT_EQUAL(stored->shared_packets->expiry_interval, 90);
+	}
+	CU_ASSERT_EQUAL(send__publish_stored(&context5c, 0, stored, 0, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(shared_count(stored), 1);
+
+	CU_ASSERT_EQUAL(send__publish_stored(&context3a, 0, stored, 0, false, false, NULL, 100), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context3b, 0, stored, 0, false, false, NULL, 90), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(shared_count(stored), 2);
+	if(context3a.current_out_packet && context3b.current_out_packet){
+		CU_ASSERT_PTR_EQUAL(context3a.current_out_packet->payload, context3b.current_out_packet->payload);
+	}
+
+	check_wire(&context5a, 0, false, false, 0, 100);
+	check_wire(&context5b, 0, false, false, 0, 90);
+	check_wire(&context5c, 0, false, false, 0, 0);
+	check_wire(&context3a, 0, false, false, 0, 0);
+	check_wire(&context3b, 0, false, false, 0, 0);
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+}
+
+
+/* The dup flag and retain flag are set per client, and never leak into the
+ * cached packet. */
+static void TEST_dup_retain(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context1, context2, context3, context4;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context1, mosq_p_mqtt311);
+	client_init(&context2, mosq_p_mqtt311);
+	client_init(&context3, mosq_p_mqtt5);
+	client_init(&context4, mosq_p_mqtt5);
+	context4.retain_available = false;
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context1, 5, stored, 1, false, true, NULL, 0), MOSQ_ERR_SUCCESS);
+	check_wire(&context1, 1, false, true, 5, 0);
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context2, 6, stored, 1, false, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	check_wire(&context2, 1, false, false, 6, 0);
+	if(stored->shared_packets){
+		CU_ASSERT_EQUAL(stored->shared_packets->command, CMD_PUBLISH | 2);
+	}
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context3, 7, stored, 2, true, true, NULL, 0), MOSQ_ERR_SUCCESS);
+	check_wire(&context3, 2, true, true, 7, 0);
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context4, 8, stored, 2, true, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	check_wire(&context4, 2, false, false, 8, 0);
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+}
+
+
+/* A packet built on a shared PUBLISH is written from several buffers, and
+ * must come out intact however the writes are split between them. */
+static void TEST_partial_write(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context;
+	uint8_t expected[200];
+	size_t expected_len, len;
+	int i;
+
+	stored = store_new(false);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	client_init(&context, mosq_p_mqtt5);
+
+	/* A QoS 2 packet with its own command byte and message id, then a QoS 0
+	 * packet sent unchanged, both queued so they are gathered together. */
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context, 0x0102, stored, 2, false, true, NULL, 60), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(send__publish_stored(&context, 0, stored, 0, false, false, NULL, 60), MOSQ_ERR_SUCCESS);
+	expected_len = expected_publish(expected, 2, false, true, 0x0102, true, 60);
+	len = expected_publish(&expected[expected_len], 0, false, false, 0, true, 60);
+	expected_len += len;
+
+	/* One byte at a time. */
+	wire_len = 0;
+	wire_blocked = false;
+	for(i=0; i<(int)expected_len && context.current_out_packet; i++){
+		wire_max = wire_len + 1;
+		CU_ASSERT_EQUAL(packet__write(&context), MOSQ_ERR_SUCCESS);
+	}
+	wire_max = 0;
+	CU_ASSERT_PTR_NULL(context.current_out_packet);
+	CU_ASSERT_EQUAL(wire_len, expected_len);
+	if(wire_len == expected_len){
+		CU_ASSERT_EQUAL(memcmp(wire, expected, expected_len), 0);
+	}
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+}
+
+
+/* Once only the retained message tree holds a message its encoded packets are
+ * released, but a client still sending one keeps it alive. */
+static void TEST_retained_drop(void)
+{
+	struct mosquitto_msg_store *stored;
+	struct mosquitto context1, context2;
+
+	stored = store_new(true);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	db__msg_store_ref_inc(stored); /* Held by context1 */
+	client_init(&context1, mosq_p_mqtt311);
+	client_init(&context2, mosq_p_mqtt5);
+
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context1, 0, stored, 0, true, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(shared_count(stored), 1);
+
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	if(!stored) return;
+	CU_ASSERT_EQUAL(stored->ref_count, 1);
+	CU_ASSERT_PTR_NULL(stored->shared_packets);
+	check_wire(&context1, 0, true, false, 0, 0);
+
+	/* A later subscriber to the retained message encodes it afresh. */
+	db__msg_store_ref_inc(stored);
+	wire_blocked = true;
+	CU_ASSERT_EQUAL(send__publish_stored(&context2, 0, stored, 0, true, false, NULL, 0), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(shared_count(stored), 1);
+
+	/* Retained message replaced, and the client message is done, while the
+	 * packet is still queued. */
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NOT_NULL(stored);
+	db__msg_store_ref_dec(&stored);
+	CU_ASSERT_PTR_NULL(stored);
+	CU_ASSERT_EQUAL(db.msg_store_count, 0);
+	check_wire(&context2, 0, true, false, 0, 0);
+}
+
+
+/* ========================================================================
+ * TEST SUITE SETUP
+ * ======================================================================== */
+
+int main(int argc, char *argv[])
+{
+	CU_pSuite test_suite = NULL;
+	unsigned int fails;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	if(CU_initialize_registry() != CUE_SUCCESS){
+		printf("Error initializing CUnit registry.\n");
+		return 1;
+	}
+
+	test_suite = CU_add_suite("Publish stored", NULL, NULL);
+	if(!test_suite){
+		printf("Error adding CUnit Publish stored test suite.\n");
+		CU_cleanup_registry();
+		return 1;
+	}
+
+	if(0
+			|| !CU_add_test(test_suite, "QoS 0 shared", TEST_qos0_shared)
+			|| !CU_add_test(test_suite, "QoS levels", TEST_qos_levels)
+			|| !CU_add_test(test_suite, "Protocol versions", TEST_protocol_versions)
+			|| !CU_add_test(test_suite, "Expiry interval", TEST_expiry_interval)
+			|| !CU_add_test(test_suite, "Dup and retain", TEST_dup_retain)
+			|| !CU_add_test(test_suite, "Partial write", TEST_partial_write)
+			|| !CU_add_test(test_suite, "Retained drop", TEST_retained_drop)
+			){
+
+		printf("Error adding Publish stored CUnit tests.\n");
+		CU_cleanup_registry();
+		return 1;
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	fails = CU_get_number_of_failures();
+	CU_cleanup_registry();
+
+	return (int)fails;
+}
@@ -29,6 +29,20 @@ int net__socket_close(struct mosquitto_db *db, struct mosquitto *mosq)
 	return MOSQ_ERR_SUCCESS;
 }
 
+int net__transport_close(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+bool net__transport_is_open(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+
+	return true;
+}
+
 int send__pingreq(struct mosquitto *mosq)
 {
 	UNUSED(mosq);